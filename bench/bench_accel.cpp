@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "accel.h"
+#include "cpu.h"
+#include "memory.h"
+}
+
+// A byte-loop memcpy of state.range(0) bytes, called once per iteration,
+// run by the guest or serviced on the host. Reported as bytes per second.
+static void BM_Memcpy(benchmark::State &state, bool host)
+{
+	static const u32 code[] = {
+		0x0FC000EF, // jal ra, memcpy (0x100)
+		0x00100073, // ebreak
+	};
+	static const u32 memcpy_loop[] = {
+		0x00050293, // mv t0, a0
+		0x00060E63, // beqz a2, 2f
+		0x0005C303, // 1: lbu t1, 0(a1)
+		0x00628023, // sb t1, 0(t0)
+		0x00158593, // addi a1, a1, 1
+		0x00128293, // addi t0, t0, 1
+		0xFFF60613, // addi a2, a2, -1
+		0xFE0616E3, // bnez a2, 1b
+		0x00008067, // 2: ret
+	};
+	struct cpu *c = cpu_create(MEM_SIZE);
+	struct accel *a = host ? accel_create() : NULL;
+	u32 n = state.range(0);
+
+	for (size_t i = 0; i < sizeof(code) / 4; ++i)
+		mem_store32(c->memory, 4 + i * 4, code[i]);
+	for (size_t i = 0; i < sizeof(memcpy_loop) / 4; ++i)
+		mem_store32(c->memory, 0x100 + i * 4, memcpy_loop[i]);
+	if (a) {
+		accel_add(a, 0x100, ACCEL_MEMCPY);
+		c->accel = a;
+	}
+
+	for (auto _ : state) {
+		c->pc = 4;
+		c->state = CPU_STATE_RUNNING;
+		c->registers[10] = 0x8000;
+		c->registers[11] = 0x2000;
+		c->registers[12] = n;
+		cpu_run(c);
+	}
+	if (c->stop != CPU_STOP_BREAKPOINT)
+		state.SkipWithError("memcpy did not return");
+	state.SetBytesProcessed(state.iterations() * n);
+	cpu_destroy(c);
+	accel_destroy(a);
+}
+BENCHMARK_CAPTURE(BM_Memcpy, guest, false)->Arg(64)->Arg(4096);
+BENCHMARK_CAPTURE(BM_Memcpy, host, true)->Arg(64)->Arg(4096);
@@ -0,0 +1,134 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "instr.h"
+#include "insn.h"
+#include "rvc.h"
+}
+
+// The opcode/funct3 switch decoder that instr_decode used before the
+// shared decode table, kept here as the baseline.
+static inline u32 get_bits(u32 x, int hi, int lo)
+{
+	return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+// noinline: instr_decode is an out-of-line call too
+__attribute__((noinline)) static void legacy_decode(Instruction *instr,
+						    u32 raw)
+{
+	instr->raw = raw;
+	instr->size = 4;
+	if (RVC_IS_COMPRESSED(raw)) {
+		instr->raw = raw & 0xFFFF;
+		instr->size = 2;
+		raw = rvc_expand(raw & 0xFFFF);
+	}
+
+	instr->opcode = get_bits(raw, 6, 0);
+	instr->rd = get_bits(raw, 11, 7);
+	instr->funct3 = get_bits(raw, 14, 12);
+	instr->rs1 = get_bits(raw, 19, 15);
+	instr->rs2 = get_bits(raw, 24, 20);
+	instr->funct7 = get_bits(raw, 31, 25);
+	instr->imm = 0;
+
+	switch (instr->opcode) {
+	case 0x13:
+		if (instr->funct3 == 0x1 || instr->funct3 == 0x5)
+			instr->imm = (s32)get_bits(raw, 24, 20);
+		else
+			instr->imm = sign_extend(get_bits(raw, 31, 20), 12);
+		break;
+	case 0x03:
+	case 0x67:
+	case 0x73:
+		instr->imm = sign_extend(get_bits(raw, 31, 20), 12);
+		break;
+	case 0x23:
+		instr->imm = sign_extend((get_bits(raw, 31, 25) << 5) |
+						 get_bits(raw, 11, 7),
+					 12);
+		break;
+	case 0x63:
+		instr->imm = sign_extend((get_bits(raw, 31, 31) << 12) |
+						 (get_bits(raw, 7, 7) << 11) |
+						 (get_bits(raw, 30, 25) << 5) |
+						 (get_bits(raw, 11, 8) << 1),
+					 13);
+		break;
+	case 0x37:
+	case 0x17:
+		instr->imm = (s32)(raw & 0xFFFFF000);
+		break;
+	case 0x6F:
+		instr->imm = sign_extend((get_bits(raw, 31, 31) << 20) |
+						 (get_bits(raw, 19, 12) << 12) |
+						 (get_bits(raw, 20, 20) << 11) |
+						 (get_bits(raw, 30, 21) << 1),
+					 21);
+		break;
+	}
+}
+
+// A reproducible stream covering every table entry with random operands
+static const std::vector<u32> &instruction_stream()
+{
+	static std::vector<u32> stream;
+
+	if (stream.empty()) {
+		std::mt19937 rng(42);
+
+		for (int i = 0; i < 4096; ++i) {
+			const struct insn_info *e =
+				&insn_info[1 + rng() % (INSN_COUNT - 1)];
+
+			stream.push_back(e->match | (rng() & ~e->mask));
+		}
+	}
+	return stream;
+}
+
+static void BM_DecodeLegacySwitch(benchmark::State &state)
+{
+	const std::vector<u32> &stream = instruction_stream();
+	Instruction instr;
+
+	for (auto _ : state) {
+		for (u32 raw : stream) {
+			legacy_decode(&instr, raw);
+			benchmark::DoNotOptimize(instr);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_DecodeLegacySwitch);
+
+static void BM_DecodeTable(benchmark::State &state)
+{
+	const std::vector<u32> &stream = instruction_stream();
+	Instruction instr;
+
+	for (auto _ : state) {
+		for (u32 raw : stream) {
+			instr_decode(&instr, raw);
+			benchmark::DoNotOptimize(instr);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_DecodeTable);
+
+static void BM_InsnLookup(benchmark::State &state)
+{
+	const std::vector<u32> &stream = instruction_stream();
+
+	for (auto _ : state) {
+		for (u32 raw : stream)
+			benchmark::DoNotOptimize(insn_lookup(raw));
+	}
+	state.SetItemsProcessed(state.iterations() * stream.size());
+}
+BENCHMARK(BM_InsnLookup);
@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "disassembler.h"
+#include "insn.h"
+}
+
+// A 4 MiB image of random table entries, a third of them compressed
+static const std::vector<u8> &code_image()
+{
+	static std::vector<u8> image;
+
+	if (image.empty()) {
+		std::mt19937 rng(42);
+
+		while (image.size() < (4u << 20)) {
+			u32 raw;
+			int size = 4;
+
+			if (rng() % 3 == 0) {
+				raw = (rng() & 0xFFFC) | rng() % 3;
+				size = 2;
+			} else {
+				const struct insn_info *e =
+					&insn_info[1 + rng() % (INSN_COUNT - 1)];
+
+				raw = e->match | (rng() & ~e->mask);
+			}
+			for (int i = 0; i < size; ++i)
+				image.push_back(raw >> (8 * i));
+		}
+	}
+	return image;
+}
+
+// What a dump loop did before disassemble_range: one snprintf'd line per
+// instruction on top of disassemble()
+static void BM_DisasmPerInsn(benchmark::State &state)
+{
+	const std::vector<u8> &image = code_image();
+	std::vector<char> out(disassemble_range_bound(image.size(), NULL));
+
+	for (auto _ : state) {
+		char *p = out.data();
+
+		for (u32 off = 0; off + 4 <= image.size();) {
+			const u8 *b = &image[off];
+			u32 raw = b[0] | b[1] << 8 | b[2] << 16 | (u32)b[3] << 24;
+			bool rvc = (raw & 3) != 3;
+			char text[DISASM_INSN_MAX];
+
+			disassemble(raw, text, sizeof(text));
+			p += snprintf(p, DISASM_LINE_MAX, "%08x:  %0*x%s  %s\n",
+				      off, rvc ? 4 : 8, rvc ? raw & 0xFFFF : raw,
+				      rvc ? "    " : "", text);
+			off += rvc ? 2 : 4;
+		}
+		benchmark::DoNotOptimize(p);
+	}
+	state.SetBytesProcessed(state.iterations() * image.size());
+}
+BENCHMARK(BM_DisasmPerInsn)->Unit(benchmark::kMillisecond);
+
+static void BM_DisasmRange(benchmark::State &state)
+{
+	const std::vector<u8> &image = code_image();
+	std::vector<char> arena(disassemble_range_bound(image.size(), NULL));
+
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(disassemble_range(
+			image.data(), 0, image.size(), NULL, arena.data(),
+			arena.size(), state.range(0)));
+	}
+	state.SetBytesProcessed(state.iterations() * image.size());
+}
+BENCHMARK(BM_DisasmRange)
+	->Arg(1)
+	->Arg(std::thread::hardware_concurrency())
+	->Unit(benchmark::kMillisecond)
+	->UseRealTime();
@@ -0,0 +1,40 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "cpu.h"
+#include "instr.h"
+#include "memory.h"
+}
+
+// One pre-decoded instruction executed over and over, so the numbers are
+// the handler cost alone. pc is never advanced: branches and jumps only
+// set next_pc.
+static void BM_Exec(benchmark::State &state, u32 raw)
+{
+	struct cpu *c = cpu_create(MEM_SIZE);
+	Instruction instr;
+
+	instr_decode(&instr, raw);
+	c->registers[10] = 0x1000; // a0: address for loads, stores and AMOs
+	c->registers[11] = 7; // a1
+	c->pc = 0x100;
+	for (auto _ : state) {
+		for (int i = 0; i < 1000; ++i) {
+			c->next_pc = c->pc + instr.size;
+			instr_exec_decoded(c, &instr);
+		}
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * 1000);
+	cpu_destroy(c);
+}
+BENCHMARK_CAPTURE(BM_Exec, alu_add, 0x00B50633u); // add a2, a0, a1
+BENCHMARK_CAPTURE(BM_Exec, muldiv_mul, 0x02B50633u); // mul a2, a0, a1
+BENCHMARK_CAPTURE(BM_Exec, muldiv_divu, 0x02B55633u); // divu a2, a0, a1
+BENCHMARK_CAPTURE(BM_Exec, load_lw, 0x00052603u); // lw a2, 0(a0)
+BENCHMARK_CAPTURE(BM_Exec, store_sw, 0x00B52023u); // sw a1, 0(a0)
+BENCHMARK_CAPTURE(BM_Exec, branch_taken, 0x00A50863u); // beq a0, a0, 16
+BENCHMARK_CAPTURE(BM_Exec, branch_not_taken, 0x00A51863u); // bne a0, a0, 16
+BENCHMARK_CAPTURE(BM_Exec, jump_jal, 0x0100006Fu); // j 16
+BENCHMARK_CAPTURE(BM_Exec, amo_amoadd, 0x00B5262Fu); // amoadd.w a2, a1, (a0)
+BENCHMARK_CAPTURE(BM_Exec, system_csrr, 0x34002673u); // csrr a2, mscratch
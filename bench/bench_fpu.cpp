@@ -0,0 +1,45 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+#include "fpu.h"
+}
+
+// 1000 rounds of fmadd.s and fadd.s with dynamic rounding, with frm at
+// round-to-nearest-even (plain host arithmetic), round-towards-zero (a
+// host mode switch per op) or RMM (a tie check per op). Reported as FP
+// operations per second.
+static void BM_FpuMadd(benchmark::State &state, u32 frm)
+{
+	static const u32 code[] = {
+		0x3E800313, // addi t1, zero, 1000
+		0x50C5F543, // 1: fmadd.s fa0, fa1, fa2, fa0
+		0x00B6F6D3, // fadd.s fa3, fa3, fa1
+		0xFFF30313, // addi t1, t1, -1
+		0xFE031AE3, // bnez t1, 1b
+		0x00100073, // ebreak
+	};
+	struct cpu *c = cpu_create(MEM_SIZE);
+
+	for (size_t i = 0; i < sizeof(code) / 4; ++i)
+		mem_store32(c->memory, i * 4, code[i]);
+	c->fpu.frm = frm;
+	c->fpu.f[11] = F32_BOX | 0x3F800347; // fa1 = 1.0001
+	c->fpu.f[12] = F32_BOX | 0x3F000000; // fa2 = 0.5
+
+	for (auto _ : state) {
+		c->fpu.f[10] = F32_BOX; // fa0 = 0
+		c->fpu.f[13] = F32_BOX; // fa3 = 0
+		c->pc = 0;
+		c->state = CPU_STATE_RUNNING;
+		cpu_run(c);
+	}
+	if (c->stop != CPU_STOP_BREAKPOINT)
+		state.SkipWithError("loop did not finish");
+	state.SetItemsProcessed(state.iterations() * 1000 * 2);
+	cpu_destroy(c);
+}
+BENCHMARK_CAPTURE(BM_FpuMadd, rne, FRM_RNE);
+BENCHMARK_CAPTURE(BM_FpuMadd, rtz, FRM_RTZ);
+BENCHMARK_CAPTURE(BM_FpuMadd, rmm, FRM_RMM);
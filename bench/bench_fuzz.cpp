@@ -0,0 +1,48 @@
+#include <benchmark/benchmark.h>
+#include <cstring>
+
+extern "C" {
+#include "cpu.h"
+#include "fuzz.h"
+#include "memory.h"
+}
+
+// A small checksum parser: sums the test case into a scratch table, so
+// every run dirties a page and restores it. Reported as runs per second.
+static void BM_FuzzExec(benchmark::State &state)
+{
+	static const u32 parser[] = {
+		0x00000613, // addi a2, zero, 0
+		0x00058E63, // loop: beqz a1, done
+		0x00054283, // lbu t0, 0(a0)
+		0x00560633, // add a2, a2, t0
+		0x70C02023, // sw a2, 0x700(zero)
+		0x00150513, // addi a0, a0, 1
+		0xFFF58593, // addi a1, a1, -1
+		0xFE0594E3, // bnez a1, loop
+		0x00000513, // done: addi a0, zero, 0
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	};
+	struct fuzz_config cfg = { 0x8000, 4096, 100000 };
+	struct cpu *c = cpu_create(MEM_SIZE);
+	struct fuzz *f;
+	u8 input[64];
+
+	for (size_t i = 0; i < sizeof(parser) / 4; ++i)
+		mem_store32(c->memory, i * 4, parser[i]);
+	f = fuzz_create(c, &cfg);
+	for (size_t i = 0; i < sizeof(input); ++i)
+		input[i] = i * 7;
+
+	for (auto _ : state) {
+		input[0]++;
+		if (fuzz_run(f, input, sizeof(input)) != FUZZ_OK)
+			state.SkipWithError("parser did not exit");
+	}
+	state.counters["execs"] = benchmark::Counter(
+		state.iterations(), benchmark::Counter::kIsRate);
+	fuzz_destroy(f);
+	cpu_destroy(c);
+}
+BENCHMARK(BM_FuzzExec);
@@ -0,0 +1,66 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+}
+
+// Word-aligned addresses spread over the default memory size
+static const std::vector<u32> &random_addresses()
+{
+	static std::vector<u32> addrs;
+
+	if (addrs.empty()) {
+		std::mt19937 rng(42);
+
+		for (int i = 0; i < 4096; ++i)
+			addrs.push_back(rng() % (MEM_SIZE / 4) * 4);
+	}
+	return addrs;
+}
+
+static void BM_MemLoad32(benchmark::State &state)
+{
+	u8 *mem = memory_create(MEM_SIZE);
+	const std::vector<u32> &addrs = random_addresses();
+
+	for (auto _ : state) {
+		u32 sum = 0;
+
+		for (u32 addr : addrs)
+			sum += mem_load32(mem, addr);
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * addrs.size());
+	memory_destroy(mem);
+}
+BENCHMARK(BM_MemLoad32);
+
+static void BM_MemStore32(benchmark::State &state)
+{
+	u8 *mem = memory_create(MEM_SIZE);
+	const std::vector<u32> &addrs = random_addresses();
+
+	for (auto _ : state) {
+		for (u32 addr : addrs)
+			mem_store32(mem, addr, addr);
+		benchmark::ClobberMemory();
+	}
+	state.SetItemsProcessed(state.iterations() * addrs.size());
+	memory_destroy(mem);
+}
+BENCHMARK(BM_MemStore32);
+
+// Dominated by clearing guest memory, so scale with its size
+static void BM_CpuReset(benchmark::State &state)
+{
+	struct cpu *c = cpu_create(state.range(0));
+
+	for (auto _ : state)
+		cpu_reset(c);
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+	cpu_destroy(c);
+}
+BENCHMARK(BM_CpuReset)->Arg(MEM_SIZE)->Arg(1 << 20);
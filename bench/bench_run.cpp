@@ -0,0 +1,43 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+}
+
+// 100 register increments and a jump back, run forever
+static struct cpu *spin_cpu()
+{
+	struct cpu *c = cpu_create(MEM_SIZE);
+
+	for (u32 i = 0; i < 100; ++i)
+		mem_store32(c->memory, i * 4, 0x00128293); // addi t0, t0, 1
+	mem_store32(c->memory, 400, 0xE71FF06F); // jal zero, -400
+	return c;
+}
+
+// The TUI path: one cpu_step, with its register snapshot, per instruction
+static void BM_StepLoop(benchmark::State &state)
+{
+	struct cpu *c = spin_cpu();
+
+	for (auto _ : state) {
+		for (int i = 0; i < 10000; ++i)
+			cpu_step(c);
+	}
+	state.SetItemsProcessed(state.iterations() * 10000);
+	cpu_destroy(c);
+}
+BENCHMARK(BM_StepLoop);
+
+// Budgeted slices the size a scheduler would hand out
+static void BM_RunFor(benchmark::State &state)
+{
+	struct cpu *c = spin_cpu();
+
+	for (auto _ : state)
+		cpu_run_for(c, 10000, NULL);
+	state.SetItemsProcessed(state.iterations() * 10000);
+	cpu_destroy(c);
+}
+BENCHMARK(BM_RunFor);
@@ -0,0 +1,58 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+extern "C" {
+#include "cpu.h"
+#include "server.h"
+}
+
+// Round trip of a small job on a local server: the echo program from
+// test_server.cpp, sent by hash so every job after the first is pooled
+static void BM_ServerJob(benchmark::State &state)
+{
+	static const u32 echo[] = {
+		0x00000513, 0x000025B7, 0x01000613, 0x03F00893, 0x00000073,
+		0x00050413, 0x000024B7, 0x00848933, 0x01248C63, 0x0004C503,
+		0x00100893, 0x00000073, 0x00148493, 0xFEDFF06F, 0x00040513,
+		0x05D00893, 0x00000073,
+	};
+	std::string path =
+		"/tmp/rv32i-bench-" + std::to_string(getpid()) + ".sock";
+	struct server_config cfg = {};
+	struct server_job job = {};
+	struct server_reply reply;
+	static char output[OUTPUT_BUFFER_SIZE];
+	struct server *s;
+	int fd;
+
+	cfg.path = path.c_str();
+	cfg.mem_size = MEM_SIZE;
+	s = server_create(&cfg);
+	if (!s) {
+		state.SkipWithError("cannot create the server");
+		return;
+	}
+	std::thread thread(server_run, s);
+	fd = server_connect(path.c_str());
+	job.image = echo;
+	job.image_len = sizeof(echo);
+	job.input = "benchmark";
+	job.input_len = 9;
+	job.by_hash = true;
+
+	for (auto _ : state) {
+		if (fd < 0 || !server_submit(fd, &job, &reply, output) ||
+		    reply.exit_code != 9) {
+			state.SkipWithError("job failed");
+			break;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+	server_stop(s);
+	thread.join();
+	server_destroy(s);
+}
+BENCHMARK(BM_ServerJob)->UseRealTime();
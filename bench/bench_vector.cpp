@@ -0,0 +1,38 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+}
+
+// 1000 rounds of vmacc.vv and vadd.vv over 32 words (e32, LMUL 8), on the
+// host kernels or one element at a time. Reported as elements per second.
+static void BM_VectorMacc(benchmark::State &state, bool reference)
+{
+	static const u32 code[] = {
+		0x0D3072D7, // vsetvli t0, zero, e32, m8, ta, ma
+		0x3E800313, // addi t1, zero, 1000
+		0xB7882457, // 1: vmacc.vv v8, v16, v24
+		0x030C0857, // vadd.vv v16, v16, v24
+		0xFFF30313, // addi t1, t1, -1
+		0xFE031AE3, // bnez t1, 1b
+		0x00100073, // ebreak
+	};
+	struct cpu *c = cpu_create(MEM_SIZE);
+
+	for (size_t i = 0; i < sizeof(code) / 4; ++i)
+		mem_store32(c->memory, i * 4, code[i]);
+	c->vec.reference = reference;
+
+	for (auto _ : state) {
+		c->pc = 0;
+		c->state = CPU_STATE_RUNNING;
+		cpu_run(c);
+	}
+	if (c->stop != CPU_STOP_BREAKPOINT)
+		state.SkipWithError("loop did not finish");
+	state.SetItemsProcessed(state.iterations() * 1000 * 2 * 32);
+	cpu_destroy(c);
+}
+BENCHMARK_CAPTURE(BM_VectorMacc, host, false);
+BENCHMARK_CAPTURE(BM_VectorMacc, reference, true);
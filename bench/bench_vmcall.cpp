@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+
+extern "C" {
+#include "rv32i.h"
+}
+
+// Round trip of a host-to-guest call into a three-instruction function
+static void BM_VmcallRoundTrip(benchmark::State &state)
+{
+	struct cpu *c = cpu_create(MEM_SIZE);
+	const u32 args[] = { 1, 2, 3 };
+	u32 ret;
+
+	mem_store32(c->memory, 0x100, 0x00B50533); // add a0, a0, a1
+	mem_store32(c->memory, 0x104, 0x00C50533); // add a0, a0, a2
+	mem_store32(c->memory, 0x108, 0x00008067); // ret
+	for (auto _ : state) {
+		vmcall(c, 0x100, args, 3, 1000, &ret);
+		benchmark::DoNotOptimize(ret);
+	}
+	state.SetItemsProcessed(state.iterations());
+	cpu_destroy(c);
+}
+BENCHMARK(BM_VmcallRoundTrip);
@@ -0,0 +1,171 @@
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstring>
+#include <glob.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+#include "trace.h"
+}
+
+// Small guest programs, each run from reset to exit per iteration
+struct workload {
+	std::vector<u32> code;
+	u32 a0; // expected result, ~0u if not checked
+};
+
+// 100000 rounds of add/xor/shift/sub
+static const struct workload alu = { {
+	0x000182B7, // lui t0, 0x18
+	0x6A028293, // addi t0, t0, 0x6A0 # 100000
+	0x00550533, // loop: add a0, a0, t0
+	0x00A5C5B3, // xor a1, a1, a0
+	0x00359613, // slli a2, a1, 3
+	0x40C50533, // sub a0, a0, a2
+	0xFFF28293, // addi t0, t0, -1
+	0xFE0296E3, // bnez t0, loop
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+}, ~0u };
+
+// Copy 4 KiB word pairs at a time, 64 times
+static const struct workload copy = { {
+	0x04000393, // addi t2, zero, 64
+	0x00001537, // pass: lui a0, 0x1 # src
+	0x000025B7, // lui a1, 0x2 # dst
+	0x00002637, // lui a2, 0x2 # src end
+	0x00052283, // copy: lw t0, 0(a0)
+	0x00452303, // lw t1, 4(a0)
+	0x0055A023, // sw t0, 0(a1)
+	0x0065A223, // sw t1, 4(a1)
+	0x00850513, // addi a0, a0, 8
+	0x00858593, // addi a1, a1, 8
+	0xFEC564E3, // bltu a0, a2, copy
+	0xFFF38393, // addi t2, t2, -1
+	0xFC039AE3, // bnez t2, pass
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+}, 0x2000 };
+
+// 100000 rounds of mul/divu/remu
+static const struct workload muldiv = { {
+	0x000182B7, // lui t0, 0x18
+	0x6A028293, // addi t0, t0, 0x6A0 # 100000
+	0x00700313, // addi t1, zero, 7
+	0x025285B3, // loop: mul a1, t0, t0
+	0x0265D633, // divu a2, a1, t1
+	0x0265F6B3, // remu a3, a1, t1
+	0x00C50533, // add a0, a0, a2
+	0x00D50533, // add a0, a0, a3
+	0xFFF28293, // addi t0, t0, -1
+	0xFE0294E3, // bnez t0, loop
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+}, ~0u };
+
+// Naive recursive fib(20): calls, returns and stack traffic
+static const struct workload fib = { {
+	0x00010137, // lui sp, 0x10
+	0x01400513, // addi a0, zero, 20
+	0x00C000EF, // jal ra, fib
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+	0x00200293, // fib: addi t0, zero, 2
+	0x02554C63, // blt a0, t0, leaf
+	0xFF410113, // addi sp, sp, -12
+	0x00112023, // sw ra, 0(sp)
+	0x00A12223, // sw a0, 4(sp)
+	0xFFF50513, // addi a0, a0, -1
+	0xFE9FF0EF, // jal ra, fib
+	0x00A12423, // sw a0, 8(sp)
+	0x00412503, // lw a0, 4(sp)
+	0xFFE50513, // addi a0, a0, -2
+	0xFD9FF0EF, // jal ra, fib
+	0x00812283, // lw t0, 8(sp)
+	0x00550533, // add a0, a0, t0
+	0x00012083, // lw ra, 0(sp)
+	0x00C10113, // addi sp, sp, 12
+	0x00008067, // leaf: ret
+}, 6765 };
+
+// Whole-program throughput, reported as guest MIPS; the traced variant
+// keeps its trace cache warm across iterations
+static void BM_Workload(benchmark::State &state, const struct workload *w,
+			bool traced)
+{
+	struct cpu *c = cpu_create(MEM_SIZE);
+	struct trace_cache *tc = traced ? trace_cache_create() : NULL;
+	u64 insns = 0;
+
+	c->traces = tc;
+	for (auto _ : state) {
+		cpu_reset(c);
+		for (size_t i = 0; i < w->code.size(); ++i)
+			mem_store32(c->memory, i * 4, w->code[i]);
+		cpu_run(c);
+		insns += c->insn_count;
+	}
+	if (c->stop != CPU_STOP_HALT || (w->a0 != ~0u && c->registers[10] != w->a0))
+		state.SkipWithError("workload did not exit with the expected result");
+	state.SetItemsProcessed(insns);
+	state.counters["MIPS"] = benchmark::Counter(
+		insns / 1e6, benchmark::Counter::kIsRate);
+	cpu_destroy(c);
+	trace_cache_destroy(tc);
+}
+BENCHMARK_CAPTURE(BM_Workload, alu, &alu, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, copy, &copy, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, muldiv, &muldiv, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, fib, &fib, false)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, alu_traced, &alu, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, copy_traced, &copy, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, muldiv_traced, &muldiv, true)->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(BM_Workload, fib_traced, &fib, true)->Unit(benchmark::kMillisecond);
+
+// The assembled corpus from `make workloads`, if it has been built
+static void BM_Corpus(benchmark::State &state, std::vector<u8> image)
+{
+	struct cpu *c = cpu_create(MEM_SIZE);
+	u64 insns = 0;
+
+	for (auto _ : state) {
+		cpu_reset(c);
+		memcpy(c->memory, image.data(), image.size());
+		cpu_run(c);
+		insns += c->insn_count;
+	}
+	if (c->stop != CPU_STOP_HALT)
+		state.SkipWithError("workload did not exit");
+	state.SetItemsProcessed(insns);
+	state.counters["MIPS"] = benchmark::Counter(
+		insns / 1e6, benchmark::Counter::kIsRate);
+	cpu_destroy(c);
+}
+
+static int register_corpus()
+{
+	glob_t g;
+
+	if (glob("build/workloads/*.bin", 0, NULL, &g))
+		return 0;
+	for (size_t i = 0; i < g.gl_pathc; ++i) {
+		std::string path = g.gl_pathv[i];
+		std::string name = path.substr(16, path.size() - 20);
+		std::vector<u8> image(MEM_SIZE);
+		FILE *fp = fopen(path.c_str(), "rb");
+
+		if (!fp)
+			continue;
+		image.resize(fread(image.data(), 1, image.size(), fp));
+		fclose(fp);
+		benchmark::RegisterBenchmark(("BM_Corpus/" + name).c_str(),
+					     BM_Corpus, image)
+			->Unit(benchmark::kMillisecond);
+	}
+	globfree(&g);
+	return 0;
+}
+static int corpus_registered = register_corpus();
@@ -0,0 +1,75 @@
+#ifndef RV32I_ACCEL_H
+#define RV32I_ACCEL_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+struct symtab;
+
+/*
+ * Host implementations of guest string routines. When control reaches a
+ * registered entry point, the routine's effect on guest memory is applied
+ * with the host's memcpy/memmove/memset/memchr, a0 gets the return value
+ * and execution continues at ra, as after the guest's own `ret`.
+ *
+ * Anything the host could get different from the guest code runs the
+ * guest code instead: an operand that is unmapped, crosses into physical
+ * pages that are not adjacent, or whose page table entry still needs its
+ * accessed/dirty bit set, and memcpy with overlapping operands. Faults
+ * and undefined behaviour are therefore exactly the guest's own. Only the
+ * routine's scratch registers differ; the ABI lets them hold anything.
+ *
+ * insn_count is charged as if a plain byte loop had run, so MIPS figures
+ * stay comparable; a call that does not fit the cpu_run_for() budget runs
+ * in the guest. The entry point must be reached by a call, not by a loop
+ * branching back to it.
+ */
+#define ACCEL_MAX_ROUTINES 16
+#define ACCEL_CALL_INSNS 2 // the length check and the return
+
+enum accel_kind {
+	ACCEL_MEMCPY,
+	ACCEL_MEMMOVE,
+	ACCEL_MEMSET,
+	ACCEL_STRLEN,
+	ACCEL_NKINDS,
+};
+
+struct accel_stats {
+	u64 calls[ACCEL_NKINDS]; // serviced by the host
+	u64 bytes[ACCEL_NKINDS];
+	u64 declined; // left to the guest code
+};
+
+struct accel {
+	struct accel_routine {
+		u32 addr;
+		enum accel_kind kind;
+	} routines[ACCEL_MAX_ROUTINES];
+	u32 nroutines;
+	struct accel_stats stats;
+};
+
+/* Attach to a CPU through c->accel; create returns NULL when out of memory */
+struct accel *accel_create(void);
+void accel_destroy(struct accel *a);
+
+/* Service calls to @addr as @kind; false when the table is full */
+bool accel_add(struct accel *a, u32 addr, enum accel_kind kind);
+
+/* Register every routine found by name in @syms, returning how many */
+u32 accel_add_symbols(struct accel *a, const struct symtab *syms);
+
+/* "memcpy", "memmove", "memset" or "strlen" */
+bool accel_kind_parse(const char *name, enum accel_kind *kind);
+
+/*
+ * If pc is a registered entry point, run the routine on the host and
+ * return true. At most @budget instructions are charged.
+ */
+bool accel_call(struct accel *a, struct cpu *c, u64 budget);
+
+void accel_print_stats(const struct accel *a, FILE *out);
+
+#endif /* RV32I_ACCEL_H */
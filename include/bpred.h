@@ -0,0 +1,101 @@
+#ifndef RV32I_BPRED_H
+#define RV32I_BPRED_H
+
+#include "type.h"
+#include <stdio.h>
+
+#define TAGE_TABLES 4
+
+enum bpred_kind {
+	BPRED_BIMODAL,
+	BPRED_GSHARE,
+	BPRED_TAGE,
+};
+
+struct bpred_config {
+	enum bpred_kind kind;
+	u32 table_bits; // log2 of the direction table size
+	u32 history_bits; // global history used by gshare
+	u32 btb_bits; // log2 of the BTB size
+	u32 ras_depth; // return-address stack entries
+};
+
+/* What a control transfer looks like to the front end */
+enum branch_type {
+	BRANCH_COND, // BEQ..BGEU
+	BRANCH_JUMP, // JAL without link
+	BRANCH_CALL, // JAL/JALR that pushes the RAS
+	BRANCH_RET, // JALR that pops the RAS
+	BRANCH_INDIRECT, // any other JALR
+};
+
+/* Per static branch statistics, keyed by pc */
+struct bpred_site {
+	u32 pc;
+	u32 type; // enum branch_type
+	u64 executed;
+	u64 taken;
+	u64 mispredicts;
+};
+
+struct tage_entry {
+	u16 tag;
+	s8 ctr; // 3-bit signed: taken when >= 0
+	u8 useful;
+};
+
+struct bpred_stats {
+	u64 cond;
+	u64 cond_mispredicts;
+	u64 jumps; // unconditional transfers of any kind
+	u64 target_mispredicts; // indirect/return targets predicted wrong
+	u64 btb_lookups;
+	u64 btb_misses;
+	u64 ras_pushes;
+	u64 ras_pops;
+	u64 ras_mispredicts;
+	u64 sites_dropped; // executions of new sites with no memory to record
+};
+
+struct bpred {
+	struct bpred_config cfg;
+
+	u8 *counters; // 2-bit counters (bimodal, gshare, TAGE base)
+	u64 ghr; // global history, newest outcome in bit 0
+
+	struct tage_entry *tage[TAGE_TABLES];
+	u32 tage_bits;
+
+	struct btb_entry {
+		u32 pc;
+		u32 target;
+	} *btb;
+
+	u32 *ras;
+	u32 ras_top; // number of valid entries (saturates at depth)
+	u32 ras_next; // circular write position
+
+	struct bpred_site *sites; // open-addressed hash table
+	u32 sites_cap;
+	u32 nsites;
+
+	struct bpred_stats stats;
+};
+
+bool bpred_config_parse(const char *spec, struct bpred_config *cfg);
+struct bpred *bpred_create(const struct bpred_config *cfg);
+void bpred_destroy(struct bpred *bp);
+
+/* Feed one executed conditional branch */
+void bpred_branch(struct bpred *bp, u32 pc, u32 target, bool taken);
+
+/* Feed one executed JAL (indirect = false) or JALR (indirect = true) */
+void bpred_jump(struct bpred *bp, u32 pc, u32 target, u32 rd, u32 rs1,
+		bool indirect, u32 link);
+
+const struct bpred_site *bpred_site_find(const struct bpred *bp, u32 pc);
+
+/* Totals plus the @top branches with the most mispredictions */
+void bpred_print_stats(const struct bpred *bp, u32 top, FILE *out);
+
+#endif /* RV32I_BPRED_H */
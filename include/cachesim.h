@@ -0,0 +1,109 @@
+#ifndef RV32I_CACHESIM_H
+#define RV32I_CACHESIM_H
+
+#include "type.h"
+#include "tlb.h"
+#include <stdio.h>
+
+struct cpu;
+
+#define CACHESIM_MAX_RANGES 16
+
+enum cache_policy {
+	CACHE_LRU,
+	CACHE_FIFO,
+	CACHE_RANDOM,
+};
+
+/* Geometry of one cache level, e.g. parsed from "32k:4:64:lru" */
+struct cache_config {
+	u32 size; // total capacity in bytes
+	u32 ways; // associativity
+	u32 line_size; // bytes per line, a power of two
+	enum cache_policy policy;
+};
+
+struct cache_line {
+	u32 tag;
+	bool valid;
+	bool dirty;
+	u64 stamp; // last use (LRU) or fill time (FIFO)
+};
+
+struct cache {
+	const char *name;
+	u32 sets;
+	u32 ways;
+	u32 line_shift;
+	enum cache_policy policy;
+	struct cache_line *lines; // sets * ways
+	struct cache *next; // next level, or NULL for memory
+	u64 tick;
+	u32 rng;
+
+	u64 accesses;
+	u64 misses;
+	u64 writebacks;
+};
+
+/* Accesses and misses attributed to instructions whose pc is in [start, end) */
+struct cache_range {
+	u32 start;
+	u32 end;
+	u64 fetches;
+	u64 fetch_misses;
+	u64 data_accesses;
+	u64 data_misses;
+};
+
+struct cachesim {
+	struct cache l1i;
+	struct cache l1d;
+	struct cache l2;
+	bool has_l2;
+
+	struct cache_range ranges[CACHESIM_MAX_RANGES];
+	u32 nranges;
+};
+
+/* Events exposed through mhpmcounter3.. / hpmcounter3.. */
+enum cache_event {
+	CACHE_EV_NONE,
+	CACHE_EV_L1I_MISS,
+	CACHE_EV_L1D_MISS,
+	CACHE_EV_L2_MISS,
+	CACHE_EV_L1I_ACCESS,
+	CACHE_EV_L1D_ACCESS,
+	CACHE_EV_L2_ACCESS,
+	CACHE_EV_COUNT,
+};
+
+bool cache_config_parse(const char *spec, struct cache_config *cfg);
+
+/* @l2 may be NULL for a two-level (L1 + memory) hierarchy */
+struct cachesim *cachesim_create(const struct cache_config *l1i,
+				 const struct cache_config *l1d,
+				 const struct cache_config *l2);
+void cachesim_destroy(struct cachesim *sim);
+bool cachesim_add_range(struct cachesim *sim, u32 start, u32 end);
+
+/*
+ * Attach the model to a CPU (NULL detaches). While attached, every memory
+ * access takes the MMU slow path so it can be fed to the model.
+ */
+void cachesim_attach(struct cpu *c, struct cachesim *sim);
+
+/*
+ * One access of @size bytes at @paddr by the instruction at @pc. Every line
+ * it touches is charged; the pc's range sees one access, a miss if any line
+ * missed.
+ */
+void cachesim_access(struct cachesim *sim, u32 pc, u32 paddr, u32 size,
+		     enum mmu_access acc);
+/* The same for an access split across pages: @size2 more bytes at @paddr2 */
+void cachesim_access_split(struct cachesim *sim, u32 pc, u32 paddr, u32 size,
+			   u32 paddr2, u32 size2, enum mmu_access acc);
+u64 cachesim_event(const struct cachesim *sim, enum cache_event ev);
+void cachesim_print_stats(const struct cachesim *sim, FILE *out);
+
+#endif /* RV32I_CACHESIM_H */
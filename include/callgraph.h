@@ -0,0 +1,111 @@
+#ifndef RV32I_CALLGRAPH_H
+#define RV32I_CALLGRAPH_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+struct symtab;
+
+/*
+ * Function-level call-graph profiler. JAL and JALR are classified by the
+ * link-register hints of the unprivileged spec (rd/rs1 = x1/x5): a jump
+ * that links is a call, `jalr x0, 0(ra)` a return. Calls push a shadow
+ * stack; a return pops back to the frame whose return address it jumps
+ * to, so longjmp and skipped returns do not derail it, and a return to
+ * an address no frame expects is taken as a plain jump.
+ *
+ * Nothing is counted per instruction: at every call and return the
+ * instructions stepped since the previous one (insn_count, so traps
+ * included) are charged to the function on top of the stack. Functions
+ * are the symbols containing the call targets, or the targets themselves
+ * without a symbol.
+ */
+#define CALLGRAPH_NONE (~0u)
+#define CALLGRAPH_MAX_DEPTH 65536 // deeper calls are charged to their caller
+
+struct callgraph_fn {
+	u32 addr; // symbol start, or the call target without a symbol
+	const char *name; // NULL: shown as the address
+	u64 self; // instructions stepped in it
+	u64 inclusive; // with its callees, counted once across recursion
+	u64 calls;
+	u32 active; // frames on the shadow stack
+};
+
+/* Calls from one site in one function to another function */
+struct callgraph_edge {
+	u32 caller; // function indices
+	u32 callee;
+	u32 site; // pc of the call
+	u64 calls;
+	u64 inclusive;
+};
+
+struct callgraph_frame {
+	u32 fn;
+	u32 edge; // CALLGRAPH_NONE for the root
+	u32 ret; // where its return goes
+	u64 entry; // insn_count after the call
+};
+
+struct callgraph_stats {
+	u64 calls;
+	u64 returns;
+	u64 unmatched; // returns to no frame's return address
+	u64 dropped; // calls past CALLGRAPH_MAX_DEPTH or out of memory
+	u32 max_depth;
+};
+
+struct callgraph {
+	const struct symtab *syms; // may be NULL
+
+	struct callgraph_fn *fns;
+	u32 nfns;
+	u32 fns_cap;
+	struct callgraph_edge *edges;
+	u32 nedges;
+	u32 edges_cap;
+	// Open-addressed indices into fns (by addr) and edges; values are
+	// index + 1 so zero means empty
+	u32 *fn_slots;
+	u32 fn_slots_cap;
+	u32 *edge_slots;
+	u32 edge_slots_cap;
+
+	struct callgraph_frame *stack;
+	u32 depth;
+	u32 stack_cap;
+	u64 charged; // insn_count up to which costs are assigned
+
+	struct callgraph_stats stats;
+};
+
+/* @syms (may be NULL) must outlive the profiler; NULL when out of memory */
+struct callgraph *callgraph_create(const struct symtab *syms);
+void callgraph_destroy(struct callgraph *cg);
+
+/*
+ * Start profiling @c at its current pc and instruction count, with the
+ * function there as the root. Attach through c->callgraph afterwards.
+ */
+bool callgraph_start(struct callgraph *cg, const struct cpu *c);
+
+/* Feed one executed JAL (indirect = false) or JALR at c->pc */
+void callgraph_jump(struct callgraph *cg, const struct cpu *c, u32 target,
+		    u32 rd, u32 rs1, bool indirect, u32 link);
+
+/* Charge what ran since the last call or return and close every frame */
+void callgraph_stop(struct callgraph *cg, const struct cpu *c);
+
+/*
+ * Write the profile in callgrind format, for KCachegrind or
+ * callgrind_annotate, naming @cmd as the profiled command
+ */
+bool callgraph_write_callgrind(const struct callgraph *cg, FILE *out,
+			       const char *cmd);
+
+/* Totals plus the @top functions with the most inclusive instructions */
+void callgraph_print_stats(const struct callgraph *cg, u32 top, FILE *out);
+
+#endif /* RV32I_CALLGRAPH_H */
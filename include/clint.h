@@ -0,0 +1,49 @@
+#ifndef RV32I_CLINT_H
+#define RV32I_CLINT_H
+
+#include "type.h"
+
+struct cpu;
+
+/*
+ * Core-local interruptor: the machine timer and software interrupt of
+ * hart 0 at the SiFive/QEMU "virt" addresses. Only aligned 32-bit
+ * accesses are supported; anything else is an access fault.
+ *
+ * Time is virtual: mtime advances by one per retired instruction, so a
+ * run is as deterministic as the guest code. Waiting (WFI, idle loops)
+ * moves time forward instead of sleeping on the host.
+ */
+#define CLINT_BASE 0x02000000u
+#define CLINT_SIZE 0x00010000u
+#define CLINT_MSIP 0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME 0xBFF8
+#define CLINT_NEVER (~0ull) // mtimecmp at reset: no timer interrupt
+
+struct clint_stats {
+	u64 wfis; // WFI instructions executed
+	u64 ticks_skipped; // mtime advanced without running instructions
+};
+
+struct clint {
+	u64 mtime_offset; // mtime = insn_count + mtime_offset
+	u64 mtimecmp;
+	u32 msip;
+	struct clint_stats stats;
+};
+
+void clint_reset(struct cpu *c);
+u64 clint_mtime(const struct cpu *c);
+
+/* Move mtime forward by @ticks without running anything */
+void clint_skip(struct cpu *c, u64 ticks);
+
+/* Register access at offset @off; false for an access fault */
+bool clint_load(struct cpu *c, u32 off, int size, u32 *val);
+bool clint_store(struct cpu *c, u32 off, int size, u32 val);
+
+/* Refresh MTIP and MSIP in mip from the device state */
+void clint_update_mip(struct cpu *c);
+
+#endif /* RV32I_CLINT_H */
@@ -12,6 +12,9 @@ typedef struct {
 	u32 rs2; // Source register 2
 	u32 funct7; // 7-bit function code
 	s32 imm; // immediate value
+	u32 raw; // original encoding (low 16 bits for compressed)
+	u32 size; // instruction length in bytes: 2 (RVC) or 4
+	u32 id; // enum insn_id, from the shared decode table
 } Instruction;
 
 // Memory
@@ -2,12 +2,42 @@
 #define RV32I_CPU_H
 
 #include "type.h"
+#include "common.h"
+#include "csr.h"
+#include "tlb.h"
+#include "clint.h"
+#include "vector.h"
+#include "fpu.h"
+#ifdef CONFIG_INSN_MIX
+#include "insn_mix.h"
+#endif
 
 /* RISC-V RV32I constants */
 #define XLEN 32 /* Register width */
 #define NREGS 32 /* Number of Integer Register */
 #define MEM_SIZE 65536 /* Default memmory size: 64KB */
 #define OUTPUT_BUFFER_SIZE 1024 /* Size for our console buffer */
+#define DECODE_CACHE_BITS 10 /* Decoded instructions cached by pc */
+#define DECODE_CACHE_SIZE (1u << DECODE_CACHE_BITS)
+#define CPU_MAX_HOST_SYSCALLS 32
+
+struct cachesim;
+struct bpred;
+struct replay;
+struct perfmap;
+struct fuzz;
+struct trace_cache;
+struct accel;
+struct idle;
+struct callgraph;
+
+struct cpu;
+
+/*
+ * A host implementation of a guest syscall (number in a7, arguments in
+ * a0-a6). It returns its result in a0 and may halt the CPU.
+ */
+typedef void (*syscall_fn)(struct cpu *c, void *opaque);
 
 /* CPU state */
 
@@ -17,25 +47,185 @@ enum cpu_state {
 
 };
 
+/* Why the CPU stopped, or why cpu_run_for() returned */
+enum cpu_stop {
+	CPU_STOP_BUDGET, // the instruction budget ran out, still running
+	CPU_STOP_HALT, // exit(), an unhandled trap or a replay divergence
+	CPU_STOP_BREAKPOINT, // EBREAK or break_pc, pc left on it
+	CPU_STOP_SYSCALL, // ECALL with no handler, pc left on it
+	CPU_STOP_IDLE, // waiting with no interrupt that could wake it
+};
+
+#define CPU_NO_TRAP 0xFFFFFFFFu
+#define CPU_NO_BREAK 0xFFFFFFFFu // odd, so never a pc
+#define CPU_NO_BLOCK 1u // odd too: no interpreter block is running
+
+/* Longest straight-line run between budget checks in cpu_run_for() */
+#define CPU_BLOCK_MAX 64
+
 struct cpu {
 	u32 registers[NREGS]; // 32 general-purpose registers
 	u32 prev_registers[NREGS]; // Store previous register values
 	u32 pc; // program counter
+	u32 next_pc; // pc of the next instruction, set while executing
 	u32 reservation_set;
 	u32 reservation_address;
 	u8 *memory; // system memory
+	u32 mem_size; // size of system memory in bytes
 	enum cpu_state state; // state field
+	enum cpu_stop stop; // why the CPU halted
+	u32 resume_pc; // where cpu_resume() continues after a stop
+	// Instructions stepped since reset, traps included. Blocks add their
+	// length when they end, so inside one only cpu_insn_count() is exact.
+	u64 insn_count;
+	u32 block_pc; // start of the running block, or CPU_NO_BLOCK
+	u32 block_counted; // of its instructions already in insn_count
+	u32 exit_code; // a0 of the guest's exit(), 0 until then
+	u32 trap_cause; // of the unhandled trap that halted it, or CPU_NO_TRAP
+	u32 trap_tval;
+	u32 break_pc; // cpu_run_for() stops before running it, or CPU_NO_BREAK
+
+	// Privileged state
+	u32 priv; // current privilege level (PRV_M/PRV_S/PRV_U)
+	struct csr_state csr;
+	struct clint clint;
+
+	// Vector registers and vl/vtype
+	struct vector_state vec;
+
+	// FP registers and fcsr
+	struct fpu_state fpu;
+
+	// Software TLB for Sv32 address translation
+	struct tlb_entry tlb[MMU_NACCESS][TLB_SIZE];
+	struct mmu_stats mmu_stats;
+
+	// Optional cache model fed by the MMU slow path, NULL when off
+	struct cachesim *cachesim;
+
+	// Optional branch predictor model fed by branches and jumps
+	struct bpred *bpred;
+
+	// Optional record/replay log of nondeterministic syscall inputs
+	struct replay *replay;
+
+	// Optional host profiler trampolines, NULL when off
+	struct perfmap *perfmap;
+
+	// Optional fuzzer: edge coverage and dirty page tracking, NULL when off
+	struct fuzz *fuzz;
+
+	// Optional optimizing tier for hot code, NULL when off
+	struct trace_cache *traces;
+
+	// Optional host implementations of guest string routines, NULL when off
+	struct accel *accel;
+
+	// Optional spin loop detector, NULL when off
+	struct idle *idle;
+
+	// Optional call-graph profiler fed by calls and returns, NULL when off
+	struct callgraph *callgraph;
+
+	// Set while a trace runs: device accesses then leave the trace,
+	// setting trace_device_exit, so the interpreter performs them
+	bool in_trace;
+	bool trace_device_exit;
+
+	// Host syscall handlers, consulted before the built-in ones
+	struct host_syscall {
+		u32 num;
+		syscall_fn fn;
+		void *opaque;
+	} host_syscalls[CPU_MAX_HOST_SYSCALLS];
+	u32 nhost_syscalls;
+
+#ifdef CONFIG_INSN_MIX
+	struct insn_mix mix; // retired instruction mix since reset
+#endif
+
+	// Decoded (and RVC-expanded) instructions, validated against the
+	// raw encoding on every fetch so stale entries are never executed.
+	struct decode_entry {
+		u32 pc;
+		Instruction instr;
+	} decode_cache[DECODE_CACHE_SIZE];
 
 	// Console output buffer
 	char output_buffer[OUTPUT_BUFFER_SIZE];
 	u32 output_buffer_pos;
 };
 
-/* CPU interface */
+/* CPU interface; cpu_create() returns NULL when out of memory */
 struct cpu *cpu_create(u32 mem_size);
 void cpu_destroy(struct cpu *c);
 void cpu_reset(struct cpu *c);
 void cpu_step(struct cpu *c);
 void cpu_run(struct cpu *c);
 
+/*
+ * Run at most @max_insns instructions. The budget is charged per
+ * straight-line block, not per instruction, yet never overrun. @retired
+ * (may be NULL) receives the exact count executed, traps included.
+ */
+enum cpu_stop cpu_run_for(struct cpu *c, u64 max_insns, u64 *retired);
+
+/*
+ * Run straight-line instructions until control leaves the line or @max
+ * (at least 1) have run: cpu_run_for()'s unit of work.
+ */
+void cpu_exec_block(struct cpu *c, u32 max);
+
+/*
+ * Instructions stepped before the one at pc: insn_count plus, inside a
+ * block, those of it already run, counted from the decode cache on demand
+ */
+u64 cpu_insn_count(const struct cpu *c);
+
+/*
+ * Continue after a breakpoint or syscall stop past the EBREAK/ECALL; a
+ * host servicing the syscall sets a0 first. No effect after a halt.
+ */
+void cpu_resume(struct cpu *c);
+
+/* Stop at the current instruction for @why */
+void cpu_halt(struct cpu *c, enum cpu_stop why);
+
+/*
+ * Raise a synchronous exception for the current instruction. With no
+ * handler installed the CPU halts on it instead, with the cause and tval
+ * in trap_cause and trap_tval.
+ */
+void cpu_trap(struct cpu *c, u32 cause, u32 tval);
+
+/*
+ * Take the highest priority pending and enabled interrupt, if any, before
+ * the instruction at pc. cpu_run_for() checks between blocks. With no
+ * handler installed the CPU halts, like cpu_trap().
+ */
+bool cpu_interrupt(struct cpu *c);
+
+/*
+ * WFI: fall through if an interrupt is pending, otherwise skip time to the
+ * timer deadline, or stop with CPU_STOP_IDLE when nothing could wake the
+ * hart. cpu_resume() then continues after the WFI.
+ */
+void cpu_wfi(struct cpu *c, u32 size);
+
+/*
+ * Raise or lower external interrupt lines (MIP_MEIP, MIP_SEIP). Under
+ * record/replay mip only changes at the next block boundary, see replay.h.
+ */
+void cpu_set_irq(struct cpu *c, u32 bits, bool level);
+
+/*
+ * Route syscall @num to @fn, replacing any earlier handler or built-in;
+ * a NULL @fn removes the registration. False if the table is full.
+ */
+bool cpu_register_syscall(struct cpu *c, u32 num, syscall_fn fn,
+			  void *opaque);
+
+/* Switch privilege level, flushing the TLB when translation is on */
+void cpu_set_priv(struct cpu *c, u32 priv);
+
 #endif /* RV32I_CPU_H */
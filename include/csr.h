@@ -0,0 +1,156 @@
+#ifndef RV32I_CSR_H
+#define RV32I_CSR_H
+
+#include "type.h"
+
+struct cpu;
+
+/* Privilege levels */
+#define PRV_U 0
+#define PRV_S 1
+#define PRV_M 3
+
+/* CSR addresses */
+#define CSR_FFLAGS 0x001
+#define CSR_FRM 0x002
+#define CSR_FCSR 0x003
+#define CSR_VSTART 0x008
+#define CSR_VXSAT 0x009
+#define CSR_VXRM 0x00A
+#define CSR_VCSR 0x00F
+#define CSR_VL 0xC20
+#define CSR_VTYPE 0xC21
+#define CSR_VLENB 0xC22
+#define CSR_SSTATUS 0x100
+#define CSR_SIE 0x104
+#define CSR_STVEC 0x105
+#define CSR_SCOUNTEREN 0x106
+#define CSR_SSCRATCH 0x140
+#define CSR_SEPC 0x141
+#define CSR_SCAUSE 0x142
+#define CSR_STVAL 0x143
+#define CSR_SIP 0x144
+#define CSR_SATP 0x180
+
+#define CSR_MSTATUS 0x300
+#define CSR_MISA 0x301
+#define CSR_MEDELEG 0x302
+#define CSR_MIDELEG 0x303
+#define CSR_MIE 0x304
+#define CSR_MTVEC 0x305
+#define CSR_MCOUNTEREN 0x306
+#define CSR_MSCRATCH 0x340
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_MIP 0x344
+#define CSR_MHARTID 0xF14
+
+/* Zicntr: cycle, time and instret, each in two 32-bit halves */
+#define CSR_MCYCLE 0xB00
+#define CSR_MINSTRET 0xB02
+#define CSR_MCYCLEH 0xB80
+#define CSR_MINSTRETH 0xB82
+#define CSR_CYCLE 0xC00
+#define CSR_TIME 0xC01
+#define CSR_INSTRET 0xC02
+#define CSR_CYCLEH 0xC80
+#define CSR_TIMEH 0xC81
+#define CSR_INSTRETH 0xC82
+
+/* Hardware performance monitor: counters 3..31 and their upper halves */
+#define CSR_MHPMEVENT3 0x323
+#define CSR_MHPMEVENT31 0x33F
+#define CSR_MHPMCOUNTER3 0xB03
+#define CSR_MHPMCOUNTER3H 0xB83
+#define CSR_HPMCOUNTER3 0xC03
+#define CSR_HPMCOUNTER3H 0xC83
+
+/* mstatus fields */
+#define MSTATUS_SIE (1u << 1)
+#define MSTATUS_MIE (1u << 3)
+#define MSTATUS_SPIE (1u << 5)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_SPP (1u << 8)
+#define MSTATUS_VS (3u << 9) // vector state: off, initial, clean, dirty
+#define MSTATUS_MPP (3u << 11)
+#define MSTATUS_FS (3u << 13) // FP state, same encoding as VS
+#define MSTATUS_MPRV (1u << 17)
+#define MSTATUS_SUM (1u << 18)
+#define MSTATUS_MXR (1u << 19)
+#define MSTATUS_TW (1u << 21)
+#define MSTATUS_SD (1u << 31) // read-only: some extension state is dirty
+
+#define MSTATUS_VS_OFF (0u << 9)
+#define MSTATUS_VS_INITIAL (1u << 9)
+#define MSTATUS_VS_DIRTY (3u << 9)
+#define MSTATUS_FS_OFF (0u << 13)
+#define MSTATUS_FS_INITIAL (1u << 13)
+#define MSTATUS_FS_DIRTY (3u << 13)
+
+#define SSTATUS_MASK                                                  \
+	(MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_VS |      \
+	 MSTATUS_FS | MSTATUS_SUM | MSTATUS_MXR)
+
+/* mip/mie bits: supervisor and machine software, timer, external */
+#define MIP_SSIP (1u << 1)
+#define MIP_MSIP (1u << 3)
+#define MIP_STIP (1u << 5)
+#define MIP_MTIP (1u << 7)
+#define MIP_SEIP (1u << 9)
+#define MIP_MEIP (1u << 11)
+#define MIP_ALL 0xAAAu
+
+/* satp fields (Sv32) */
+#define SATP_MODE (1u << 31)
+#define SATP_PPN 0x003FFFFFu
+
+/* Exception causes */
+#define CAUSE_INSN_ACCESS 1
+#define CAUSE_ILLEGAL_INSN 2
+#define CAUSE_BREAKPOINT 3
+#define CAUSE_LOAD_MISALIGNED 4
+#define CAUSE_LOAD_ACCESS 5
+#define CAUSE_STORE_MISALIGNED 6
+#define CAUSE_STORE_ACCESS 7
+#define CAUSE_ECALL_U 8
+#define CAUSE_ECALL_S 9
+#define CAUSE_ECALL_M 11
+#define CAUSE_INSN_PAGE_FAULT 12
+#define CAUSE_LOAD_PAGE_FAULT 13
+#define CAUSE_STORE_PAGE_FAULT 15
+#define CAUSE_INTERRUPT (1u << 31) // set in mcause/scause for interrupts
+
+/* Control and status registers */
+struct csr_state {
+	u32 mstatus;
+	u32 medeleg;
+	u32 mideleg;
+	u32 mie;
+	u32 mip;
+	u32 mtvec;
+	u32 mscratch;
+	u32 mepc;
+	u32 mcause;
+	u32 mtval;
+	u32 stvec;
+	u32 sscratch;
+	u32 sepc;
+	u32 scause;
+	u32 stval;
+	u32 satp;
+	u32 mcounteren;
+	u32 scounteren;
+	// mcycle and minstret are cpu_insn_count() plus these, so nothing is
+	// counted per instruction; cpu_trap() takes one off minstret
+	u64 mcycle_offset;
+	u64 minstret_offset;
+};
+
+void csr_reset(struct cpu *c);
+
+/* Return false if the CSR does not exist or is not accessible */
+bool csr_read(struct cpu *c, u32 addr, u32 *val);
+bool csr_write(struct cpu *c, u32 addr, u32 val);
+
+#endif /* RV32I_CSR_H */
@@ -4,6 +4,29 @@
 #include "type.h"
 #include <stddef.h>
 
+struct symtab;
+
+/* Longest text of one instruction, NUL included */
+#define DISASM_INSN_MAX 64
+/* Longest line of disassemble_range() output without symbols */
+#define DISASM_LINE_MAX (DISASM_INSN_MAX + 32)
+#define DISASM_MAX_THREADS 64
+
 void disassemble(u32 raw_instr, char *buffer, size_t size);
+const char *reg_abi_name(u32 reg_idx);
+
+/*
+ * Linear-sweep @len bytes of @image, loaded at @base, into @arena as
+ * "address:  encoding  text" lines. With @syms, every symbol gets a header
+ * line and branch and jump targets are named. Large images are split
+ * across up to @threads threads; the output does not depend on the count.
+ *
+ * Returns the length of the NUL-terminated text, or 0 if @arena_size is
+ * below disassemble_range_bound().
+ */
+size_t disassemble_range(const u8 *image, u32 base, u32 len,
+			 const struct symtab *syms, char *arena,
+			 size_t arena_size, unsigned threads);
+size_t disassemble_range_bound(u32 len, const struct symtab *syms);
 
 #endif /* RV32I_DISASSEMBLER_H */
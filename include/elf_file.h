@@ -0,0 +1,54 @@
+#ifndef RV32I_ELF_FILE_H
+#define RV32I_ELF_FILE_H
+
+#include "type.h"
+#include <stddef.h>
+
+struct symbol {
+	u32 addr;
+	u32 size;
+	const char *name;
+};
+
+/* Symbols sorted by address, names owned by the table */
+struct symtab {
+	struct symbol *syms;
+	u32 count;
+	u32 max_name_len;
+	char *strings;
+};
+
+/* Where elf_load() put a program */
+struct elf_image {
+	u32 base; // lowest load address, placed at guest address 0
+	u32 entry; // entry point, relative to base
+	u32 size; // bytes from base to the end of the last segment
+};
+
+/*
+ * Copy the PT_LOAD segments of a little-endian RV32 executable into @mem,
+ * moved down by the lowest load address so that images linked high (the
+ * riscv-tests use 0x80000000) run in low memory; pc-relative code does not
+ * notice. The zero-filled tail of each segment is cleared. Returns false if
+ * the file is not such an ELF or does not fit in @mem_size bytes.
+ */
+bool elf_load(const char *path, u8 *mem, u32 mem_size, struct elf_image *img);
+
+/*
+ * Read the function and object symbols of a little-endian RV32 ELF file.
+ * Returns false if the file cannot be read or is not such an ELF; a valid
+ * file without a symbol table yields an empty table.
+ */
+bool elf_read_symbols(const char *path, struct symtab *tab);
+void symtab_free(struct symtab *tab);
+
+/* Build a table from (addr, size, name) triples, mainly for tests */
+bool symtab_init(struct symtab *tab, const struct symbol *syms, u32 count);
+
+/* The symbol containing @addr, or the nearest one below it; NULL if none */
+const struct symbol *symtab_find(const struct symtab *tab, u32 addr);
+
+/* Index of the first symbol at or above @addr (count if none) */
+u32 symtab_lower_bound(const struct symtab *tab, u32 addr);
+
+#endif /* RV32I_ELF_FILE_H */
@@ -0,0 +1,87 @@
+#ifndef RV32I_FPU_H
+#define RV32I_FPU_H
+
+#include "type.h"
+#include "common.h"
+
+struct cpu;
+
+/*
+ * F and D extensions on the host FPU. Arithmetic runs as plain host float
+ * and double operations while the rounding mode is round-to-nearest-even,
+ * the host's own. RTZ, RDN and RUP switch the host rounding mode around
+ * the one operation; RMM corrects the nearest-even result on a tie.
+ *
+ * Exception flags are not computed per instruction: the host FPU raises
+ * the same IEEE flags as the guest would, and they stay in the host's
+ * sticky status until fflags is read or another CPU runs FP code on the
+ * same thread. Only the cases the host gets wrong for RISC-V (saturating
+ * conversions, min/max, compares) set fflags directly.
+ */
+#define NFREGS 32
+
+/* Rounding modes, in an instruction's rm field and in frm */
+#define FRM_RNE 0
+#define FRM_RTZ 1
+#define FRM_RDN 2
+#define FRM_RUP 3
+#define FRM_RMM 4
+#define FRM_DYN 7 // rm only: use frm
+
+/* fflags */
+#define FFLAG_NX (1u << 0)
+#define FFLAG_UF (1u << 1)
+#define FFLAG_OF (1u << 2)
+#define FFLAG_DZ (1u << 3)
+#define FFLAG_NV (1u << 4)
+
+/* A single in a 64-bit register is NaN-boxed: upper 32 bits all ones */
+#define F32_BOX 0xFFFFFFFF00000000ull
+#define F32_QNAN 0x7FC00000u
+#define F64_QNAN 0x7FF8000000000000ull
+
+struct fpu_state {
+	u64 f[NFREGS];
+	u32 frm;
+	u32 fflags; // without those still pending in the host FPU
+};
+
+/* Zeroed registers, round-to-nearest-even and no flags */
+void fpu_reset(struct cpu *c);
+
+/*
+ * Fold the host flags raised by @c's instructions into its fflags and give
+ * up the host FPU, so that host code run next cannot add to them. Done
+ * before every return to the host and host syscall handler.
+ */
+void fpu_sync(struct cpu *c);
+
+/* Forget @c as the owner of the host flags, before it is freed */
+void fpu_release(struct cpu *c);
+
+/* fflags, frm and fcsr; false if not accessible */
+bool fpu_csr_read(struct cpu *c, u32 addr, u32 *val);
+bool fpu_csr_write(struct cpu *c, u32 addr, u32 val);
+
+/*
+ * Handlers for the F and D entries of INSN_LIST, bound by name like the
+ * scalar ones in instr.c.
+ */
+#define FPU_HANDLERS(X)                                                      \
+	X(flw) X(fsw) X(fld) X(fsd)                                          \
+	X(fmadd_s) X(fmsub_s) X(fnmsub_s) X(fnmadd_s)                        \
+	X(fadd_s) X(fsub_s) X(fmul_s) X(fdiv_s) X(fsqrt_s)                   \
+	X(fsgnj_s) X(fsgnjn_s) X(fsgnjx_s) X(fmin_s) X(fmax_s)               \
+	X(fcvt_w_s) X(fcvt_wu_s) X(fmv_x_w) X(feq_s) X(flt_s) X(fle_s)       \
+	X(fclass_s) X(fcvt_s_w) X(fcvt_s_wu) X(fmv_w_x)                      \
+	X(fmadd_d) X(fmsub_d) X(fnmsub_d) X(fnmadd_d)                        \
+	X(fadd_d) X(fsub_d) X(fmul_d) X(fdiv_d) X(fsqrt_d)                   \
+	X(fsgnj_d) X(fsgnjn_d) X(fsgnjx_d) X(fmin_d) X(fmax_d)               \
+	X(fcvt_s_d) X(fcvt_d_s) X(feq_d) X(flt_d) X(fle_d) X(fclass_d)       \
+	X(fcvt_w_d) X(fcvt_wu_d) X(fcvt_d_w) X(fcvt_d_wu)
+
+#define X(name) void exec_##name(struct cpu *c, const Instruction *instr);
+FPU_HANDLERS(X)
+#undef X
+
+#endif /* RV32I_FPU_H */
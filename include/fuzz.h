@@ -0,0 +1,102 @@
+#ifndef RV32I_FUZZ_H
+#define RV32I_FUZZ_H
+
+#include "type.h"
+#include "cpu.h"
+
+/*
+ * In-process coverage-guided fuzzing. Branches and jumps record edges
+ * into an AFL-style hit-count bitmap, the test case goes into guest
+ * memory and/or comes back from read(0, ...), and between runs only the
+ * pages the guest wrote are copied back from a snapshot. Store TLB
+ * entries are what notices the writes: the snapshot flushes the TLB, so
+ * the first store to each page takes the slow path, which marks it.
+ */
+#define FUZZ_MAP_SIZE 65536 // AFL's MAP_SIZE
+#define FUZZ_PAGE_SHIFT 12
+
+struct fuzz_config {
+	u32 input_addr; // test case copied here, a0 = addr, a1 = length
+	u32 input_max; // 0: input only through read(0, ...)
+	u64 max_insns; // budget per run, a hang beyond it is a timeout
+};
+
+enum fuzz_result {
+	FUZZ_OK, // the guest called exit()
+	FUZZ_CRASH, // unhandled trap, EBREAK or unknown syscall
+	FUZZ_TIMEOUT, // the budget ran out
+};
+
+struct fuzz {
+	struct fuzz_config cfg;
+	struct cpu *cpu;
+	u8 *map; // FUZZ_MAP_SIZE hit counts
+	bool shm; // map is AFL's shared memory segment
+	u32 prev_loc; // previous edge target, hashed and shifted
+
+	// Snapshot of the guest, restored before every run
+	u8 *memory;
+	struct {
+		u32 registers[NREGS];
+		u32 pc;
+		u32 priv;
+		struct csr_state csr;
+		struct clint clint;
+		struct vector_state vec;
+		struct fpu_state fpu;
+		u32 reservation_set;
+		u32 reservation_address;
+		u32 output_buffer_pos;
+	} regs;
+	u8 *dirty; // one flag per guest page
+	u32 *dirty_pages;
+	u32 ndirty;
+
+	// The current test case, for read(0, ...)
+	const u8 *input;
+	u32 input_len;
+	u32 input_pos;
+	bool exited;
+
+	u64 execs;
+};
+
+/*
+ * Snapshot @c as it is now and attach the fuzzer to it. The bitmap is
+ * AFL's shared memory when __AFL_SHM_ID is set, private otherwise.
+ * Returns NULL when out of memory or the input region does not fit.
+ */
+struct fuzz *fuzz_create(struct cpu *c, const struct fuzz_config *cfg);
+void fuzz_destroy(struct fuzz *f);
+
+/* Restore the snapshot, deliver @data and run the guest once */
+enum fuzz_result fuzz_run(struct fuzz *f, const u8 *data, u32 len);
+
+/*
+ * Serve afl-fuzz as its fork server without forking: each test case is
+ * read from stdin and run in this process. Returns false at once when
+ * not started by afl-fuzz, otherwise when it hangs up.
+ */
+bool fuzz_afl_loop(struct fuzz *f);
+
+// Hooks for the executor and the MMU
+
+static inline void fuzz_edge(struct fuzz *f, u32 to)
+{
+	u32 cur = (to * 0x9E3779B1u) >> 16;
+
+	f->map[(cur ^ f->prev_loc) & (FUZZ_MAP_SIZE - 1)]++;
+	f->prev_loc = cur >> 1;
+}
+
+static inline void fuzz_mark_dirty(struct fuzz *f, u32 paddr)
+{
+	u32 page = paddr >> FUZZ_PAGE_SHIFT;
+
+	if (!f->dirty[page]) {
+		f->dirty[page] = 1;
+		f->dirty_pages[f->ndirty++] = page;
+	}
+}
+
+#endif /* RV32I_FUZZ_H */
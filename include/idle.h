@@ -0,0 +1,56 @@
+#ifndef RV32I_IDLE_H
+#define RV32I_IDLE_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+
+/*
+ * Spin loop detection. A loop of at most IDLE_MAX_INSNS instructions that
+ * stores nothing, touches no CSR other than reading the time, cycle and
+ * instret counters, and carries no register from one iteration to the
+ * next does the same thing every time round: only an interrupt can get it
+ * out (a spin), or a branch on a value loaded from mtime or read from one
+ * of those counters (a poll). Such loops are not run but skipped, whole iterations at
+ * a time, up to the iteration where a branch on mtime changes direction
+ * or the timer interrupt is due; insn_count, and so mtime, advance as if
+ * they had run. A loop nothing can end stops the CPU with CPU_STOP_IDLE.
+ *
+ * Every iteration left out would have looked exactly like the ones run,
+ * so the result is the same as running the loop, only sooner. Cache and
+ * branch predictor models see every access, so with those on nothing is
+ * skipped.
+ */
+#define IDLE_MAX_INSNS 16
+#define IDLE_CACHE_BITS 8
+#define IDLE_CACHE_SIZE (1u << IDLE_CACHE_BITS)
+
+struct idle_stats {
+	u64 spins; // loops skipped that wait for an interrupt
+	u64 polls; // loops skipped that wait for mtime
+	u64 skipped; // instructions not run
+	u64 stops; // loops nothing could end
+};
+
+struct idle {
+	// Loop heads found not to be spin loops, by pc; odd means empty.
+	// Code rewritten into a spin loop later is only missed, not broken.
+	u32 busy[IDLE_CACHE_SIZE];
+	struct idle_stats stats;
+};
+
+/* Attach to a CPU through c->idle; create returns NULL when out of memory */
+struct idle *idle_create(void);
+void idle_destroy(struct idle *d);
+
+/*
+ * Called when a block has branched back to its own start at pc: skip
+ * iterations of the loop there, charging at most @budget instructions,
+ * if it is one that can be skipped.
+ */
+void idle_loop(struct idle *d, struct cpu *c, u64 budget);
+
+void idle_print_stats(const struct idle *d, const struct cpu *c, FILE *out);
+
+#endif /* RV32I_IDLE_H */
@@ -0,0 +1,436 @@
+#ifndef RV32I_INSN_H
+#define RV32I_INSN_H
+
+#include "type.h"
+
+/*
+ * Operand layouts. The format picks how the immediate is decoded and how
+ * the disassembler prints the operands.
+ */
+enum insn_format {
+	FMT_NONE, // no operands: ecall, fence, mret
+	FMT_R, // rd, rs1, rs2
+	FMT_I, // rd, rs1, imm
+	FMT_SHIFT, // rd, rs1, shamt
+	FMT_LOAD, // rd, imm(rs1), also JALR
+	FMT_S, // rs2, imm(rs1)
+	FMT_B, // rs1, rs2, offset
+	FMT_U, // rd, imm[31:12]
+	FMT_J, // rd, offset
+	FMT_CSR, // rd, csr, rs1
+	FMT_CSRI, // rd, csr, uimm
+	FMT_LR, // rd, (rs1)
+	FMT_AMO, // rd, rs2, (rs1)
+	FMT_FENCE_VMA, // rs1, rs2
+	FMT_UNARY, // rd, rs1
+	FMT_VSETVLI, // rd, rs1, vtypei
+	FMT_VSETIVLI, // rd, uimm, vtypei
+	FMT_VMEM, // vd, (rs1), vm
+	FMT_VMEM_STRIDED, // vd, (rs1), rs2, vm
+	FMT_VV, // vd, vs2, vs1, vm
+	FMT_VX, // vd, vs2, rs1, vm
+	FMT_VI, // vd, vs2, simm5, vm
+	FMT_VI_U, // vd, vs2, uimm5, vm
+	FMT_VMAC_VV, // vd, vs1, vs2, vm
+	FMT_VMAC_VX, // vd, rs1, vs2, vm
+	FMT_VMV_V, // vd, vs1
+	FMT_VMV_X, // vd, rs1
+	FMT_VMV_I, // vd, simm5
+	FMT_VMERGE_VV, // vd, vs2, vs1, v0
+	FMT_VMERGE_VX, // vd, vs2, rs1, v0
+	FMT_VMERGE_VI, // vd, vs2, simm5, v0
+	FMT_VMV_XS, // rd, vs2
+	FMT_FLOAD, // fd, imm(rs1)
+	FMT_FSTORE, // fs2, imm(rs1)
+	FMT_FR4, // fd, fs1, fs2, fs3, rm
+	FMT_FR_RM, // fd, fs1, fs2, rm
+	FMT_FR, // fd, fs1, fs2
+	FMT_FR1_RM, // fd, fs1, rm
+	FMT_FR1, // fd, fs1
+	FMT_FCMP, // rd, fs1, fs2
+	FMT_F2X_RM, // rd, fs1, rm
+	FMT_F2X, // rd, fs1
+	FMT_X2F_RM, // fd, rs1, rm
+	FMT_X2F, // fd, rs1
+	FMT_COUNT,
+};
+
+/* Fixed-bit masks shared by most entries below */
+#define MASK_OPCODE 0x0000007f
+#define MASK_FUNCT3 0x0000707f
+#define MASK_FUNCT7 0xfe00707f
+// AMOs match on funct5 only: aq/rl are hints and the width field is not
+// checked, since RV32 has nothing but .W to confuse it with.
+#define MASK_AMO 0xf800007f
+#define MASK_LR 0xf9f0007f
+// Zbb unary ops: rs2 is part of the opcode
+#define MASK_UNARY 0xfff0707f
+// Vector ops: funct6 and funct3 fixed, vm free
+#define MASK_FUNCT6 0xfc00707f
+// Unit-stride vector loads and stores: nf, mew, mop and lumop fixed
+#define MASK_VMEM 0xfdf0707f
+// vmv.x.s: vs1 is part of the opcode
+#define MASK_VS1 0xfe0ff07f
+// Fused multiply-adds: fmt fixed, rs3 and rm free
+#define MASK_FR4 0x0600007f
+// FP ops that round: funct7 fixed, rm free
+#define MASK_FRM 0xfe00007f
+// FP square roots and conversions: rs2 is part of the opcode, rm free
+#define MASK_FRM_UNARY 0xfff0007f
+#define MASK_EXACT 0xffffffff
+
+/*
+ * Every supported 32-bit instruction: X(ID, handler, mnemonic, format,
+ * match, mask). An encoding is the instruction when (raw & mask) == match.
+ * Compressed instructions expand to these encodings before lookup. The
+ * executor binds exec_<handler>, the disassembler prints the mnemonic.
+ */
+#define INSN_LIST(X)                                                          \
+	X(LUI, lui, "lui", FMT_U, 0x00000037, MASK_OPCODE)                     \
+	X(AUIPC, auipc, "auipc", FMT_U, 0x00000017, MASK_OPCODE)               \
+	X(JAL, jal, "jal", FMT_J, 0x0000006f, MASK_OPCODE)                     \
+	X(JALR, jalr, "jalr", FMT_LOAD, 0x00000067, MASK_FUNCT3)               \
+	X(BEQ, beq, "beq", FMT_B, 0x00000063, MASK_FUNCT3)                     \
+	X(BNE, bne, "bne", FMT_B, 0x00001063, MASK_FUNCT3)                     \
+	X(BLT, blt, "blt", FMT_B, 0x00004063, MASK_FUNCT3)                     \
+	X(BGE, bge, "bge", FMT_B, 0x00005063, MASK_FUNCT3)                     \
+	X(BLTU, bltu, "bltu", FMT_B, 0x00006063, MASK_FUNCT3)                  \
+	X(BGEU, bgeu, "bgeu", FMT_B, 0x00007063, MASK_FUNCT3)                  \
+	X(LB, lb, "lb", FMT_LOAD, 0x00000003, MASK_FUNCT3)                     \
+	X(LH, lh, "lh", FMT_LOAD, 0x00001003, MASK_FUNCT3)                     \
+	X(LW, lw, "lw", FMT_LOAD, 0x00002003, MASK_FUNCT3)                     \
+	X(LBU, lbu, "lbu", FMT_LOAD, 0x00004003, MASK_FUNCT3)                  \
+	X(LHU, lhu, "lhu", FMT_LOAD, 0x00005003, MASK_FUNCT3)                  \
+	X(SB, sb, "sb", FMT_S, 0x00000023, MASK_FUNCT3)                        \
+	X(SH, sh, "sh", FMT_S, 0x00001023, MASK_FUNCT3)                        \
+	X(SW, sw, "sw", FMT_S, 0x00002023, MASK_FUNCT3)                        \
+	X(ADDI, addi, "addi", FMT_I, 0x00000013, MASK_FUNCT3)                  \
+	X(SLTI, slti, "slti", FMT_I, 0x00002013, MASK_FUNCT3)                  \
+	X(SLTIU, sltiu, "sltiu", FMT_I, 0x00003013, MASK_FUNCT3)               \
+	X(XORI, xori, "xori", FMT_I, 0x00004013, MASK_FUNCT3)                  \
+	X(ORI, ori, "ori", FMT_I, 0x00006013, MASK_FUNCT3)                     \
+	X(ANDI, andi, "andi", FMT_I, 0x00007013, MASK_FUNCT3)                  \
+	X(SLLI, slli, "slli", FMT_SHIFT, 0x00001013, MASK_FUNCT7)              \
+	X(SRLI, srli, "srli", FMT_SHIFT, 0x00005013, MASK_FUNCT7)              \
+	X(SRAI, srai, "srai", FMT_SHIFT, 0x40005013, MASK_FUNCT7)              \
+	X(ADD, add, "add", FMT_R, 0x00000033, MASK_FUNCT7)                     \
+	X(SUB, sub, "sub", FMT_R, 0x40000033, MASK_FUNCT7)                     \
+	X(SLL, sll, "sll", FMT_R, 0x00001033, MASK_FUNCT7)                     \
+	X(SLT, slt, "slt", FMT_R, 0x00002033, MASK_FUNCT7)                     \
+	X(SLTU, sltu, "sltu", FMT_R, 0x00003033, MASK_FUNCT7)                  \
+	X(XOR, xor, "xor", FMT_R, 0x00004033, MASK_FUNCT7)                     \
+	X(SRL, srl, "srl", FMT_R, 0x00005033, MASK_FUNCT7)                     \
+	X(SRA, sra, "sra", FMT_R, 0x40005033, MASK_FUNCT7)                     \
+	X(OR, or, "or", FMT_R, 0x00006033, MASK_FUNCT7)                        \
+	X(AND, and, "and", FMT_R, 0x00007033, MASK_FUNCT7)                     \
+	X(FENCE, fence, "fence", FMT_NONE, 0x0000000f, MASK_FUNCT3)            \
+	X(FENCE_I, fence, "fence.i", FMT_NONE, 0x0000100f, MASK_FUNCT3)        \
+	X(ECALL, ecall, "ecall", FMT_NONE, 0x00000073, MASK_EXACT)             \
+	X(EBREAK, ebreak, "ebreak", FMT_NONE, 0x00100073, MASK_EXACT)          \
+	X(SRET, sret, "sret", FMT_NONE, 0x10200073, MASK_EXACT)                \
+	X(MRET, mret, "mret", FMT_NONE, 0x30200073, MASK_EXACT)                \
+	X(WFI, wfi, "wfi", FMT_NONE, 0x10500073, MASK_EXACT)                   \
+	X(SFENCE_VMA, sfence_vma, "sfence.vma", FMT_FENCE_VMA, 0x12000073,     \
+	  0xfe007fff)                                                          \
+	X(CSRRW, csr, "csrrw", FMT_CSR, 0x00001073, MASK_FUNCT3)               \
+	X(CSRRS, csr, "csrrs", FMT_CSR, 0x00002073, MASK_FUNCT3)               \
+	X(CSRRC, csr, "csrrc", FMT_CSR, 0x00003073, MASK_FUNCT3)               \
+	X(CSRRWI, csr, "csrrwi", FMT_CSRI, 0x00005073, MASK_FUNCT3)            \
+	X(CSRRSI, csr, "csrrsi", FMT_CSRI, 0x00006073, MASK_FUNCT3)            \
+	X(CSRRCI, csr, "csrrci", FMT_CSRI, 0x00007073, MASK_FUNCT3)            \
+	X(MUL, mul, "mul", FMT_R, 0x02000033, MASK_FUNCT7)                     \
+	X(MULH, mulh, "mulh", FMT_R, 0x02001033, MASK_FUNCT7)                  \
+	X(MULHSU, mulhsu, "mulhsu", FMT_R, 0x02002033, MASK_FUNCT7)            \
+	X(MULHU, mulhu, "mulhu", FMT_R, 0x02003033, MASK_FUNCT7)               \
+	X(DIV, div, "div", FMT_R, 0x02004033, MASK_FUNCT7)                     \
+	X(DIVU, divu, "divu", FMT_R, 0x02005033, MASK_FUNCT7)                  \
+	X(REM, rem, "rem", FMT_R, 0x02006033, MASK_FUNCT7)                     \
+	X(REMU, remu, "remu", FMT_R, 0x02007033, MASK_FUNCT7)                  \
+	X(LR_W, lr_w, "lr.w", FMT_LR, 0x1000002f, MASK_LR)                     \
+	X(SC_W, sc_w, "sc.w", FMT_AMO, 0x1800002f, MASK_AMO)                   \
+	X(AMOSWAP_W, amoswap_w, "amoswap.w", FMT_AMO, 0x0800002f, MASK_AMO)    \
+	X(AMOADD_W, amoadd_w, "amoadd.w", FMT_AMO, 0x0000002f, MASK_AMO)       \
+	X(AMOXOR_W, amoxor_w, "amoxor.w", FMT_AMO, 0x2000002f, MASK_AMO)       \
+	X(AMOAND_W, amoand_w, "amoand.w", FMT_AMO, 0x6000002f, MASK_AMO)       \
+	X(AMOOR_W, amoor_w, "amoor.w", FMT_AMO, 0x4000002f, MASK_AMO)          \
+	X(AMOMIN_W, amomin_w, "amomin.w", FMT_AMO, 0x8000002f, MASK_AMO)       \
+	X(AMOMAX_W, amomax_w, "amomax.w", FMT_AMO, 0xa000002f, MASK_AMO)       \
+	X(AMOMINU_W, amominu_w, "amominu.w", FMT_AMO, 0xc000002f, MASK_AMO)    \
+	X(AMOMAXU_W, amomaxu_w, "amomaxu.w", FMT_AMO, 0xe000002f, MASK_AMO)    \
+	X(SH1ADD, sh1add, "sh1add", FMT_R, 0x20002033, MASK_FUNCT7)            \
+	X(SH2ADD, sh2add, "sh2add", FMT_R, 0x20004033, MASK_FUNCT7)            \
+	X(SH3ADD, sh3add, "sh3add", FMT_R, 0x20006033, MASK_FUNCT7)            \
+	X(ANDN, andn, "andn", FMT_R, 0x40007033, MASK_FUNCT7)                  \
+	X(ORN, orn, "orn", FMT_R, 0x40006033, MASK_FUNCT7)                     \
+	X(XNOR, xnor, "xnor", FMT_R, 0x40004033, MASK_FUNCT7)                  \
+	X(CLZ, clz, "clz", FMT_UNARY, 0x60001013, MASK_UNARY)                  \
+	X(CTZ, ctz, "ctz", FMT_UNARY, 0x60101013, MASK_UNARY)                  \
+	X(CPOP, cpop, "cpop", FMT_UNARY, 0x60201013, MASK_UNARY)               \
+	X(SEXT_B, sext_b, "sext.b", FMT_UNARY, 0x60401013, MASK_UNARY)         \
+	X(SEXT_H, sext_h, "sext.h", FMT_UNARY, 0x60501013, MASK_UNARY)         \
+	X(ZEXT_H, zext_h, "zext.h", FMT_UNARY, 0x08004033, MASK_UNARY)         \
+	X(MIN, min, "min", FMT_R, 0x0a004033, MASK_FUNCT7)                     \
+	X(MINU, minu, "minu", FMT_R, 0x0a005033, MASK_FUNCT7)                  \
+	X(MAX, max, "max", FMT_R, 0x0a006033, MASK_FUNCT7)                     \
+	X(MAXU, maxu, "maxu", FMT_R, 0x0a007033, MASK_FUNCT7)                  \
+	X(ROL, rol, "rol", FMT_R, 0x60001033, MASK_FUNCT7)                     \
+	X(ROR, ror, "ror", FMT_R, 0x60005033, MASK_FUNCT7)                     \
+	X(RORI, rori, "rori", FMT_SHIFT, 0x60005013, MASK_FUNCT7)              \
+	X(ORC_B, orc_b, "orc.b", FMT_UNARY, 0x28705013, MASK_UNARY)            \
+	X(REV8, rev8, "rev8", FMT_UNARY, 0x69805013, MASK_UNARY)               \
+	X(BCLR, bclr, "bclr", FMT_R, 0x48001033, MASK_FUNCT7)                  \
+	X(BCLRI, bclri, "bclri", FMT_SHIFT, 0x48001013, MASK_FUNCT7)           \
+	X(BEXT, bext, "bext", FMT_R, 0x48005033, MASK_FUNCT7)                  \
+	X(BEXTI, bexti, "bexti", FMT_SHIFT, 0x48005013, MASK_FUNCT7)           \
+	X(BINV, binv, "binv", FMT_R, 0x68001033, MASK_FUNCT7)                  \
+	X(BINVI, binvi, "binvi", FMT_SHIFT, 0x68001013, MASK_FUNCT7)           \
+	X(BSET, bset, "bset", FMT_R, 0x28001033, MASK_FUNCT7)                  \
+	X(BSETI, bseti, "bseti", FMT_SHIFT, 0x28001013, MASK_FUNCT7)           \
+	X(VSETVLI, vsetvl, "vsetvli", FMT_VSETVLI, 0x00007057, 0x8000707f)     \
+	X(VSETIVLI, vsetvl, "vsetivli", FMT_VSETIVLI, 0xc0007057, 0xc000707f)  \
+	X(VSETVL, vsetvl, "vsetvl", FMT_R, 0x80007057, MASK_FUNCT7)            \
+	X(VLE8_V, vload, "vle8.v", FMT_VMEM, 0x00000007, MASK_VMEM)            \
+	X(VLE16_V, vload, "vle16.v", FMT_VMEM, 0x00005007, MASK_VMEM)          \
+	X(VLE32_V, vload, "vle32.v", FMT_VMEM, 0x00006007, MASK_VMEM)          \
+	X(VLSE8_V, vload, "vlse8.v", FMT_VMEM_STRIDED, 0x08000007, MASK_FUNCT6) \
+	X(VLSE16_V, vload, "vlse16.v", FMT_VMEM_STRIDED, 0x08005007, MASK_FUNCT6) \
+	X(VLSE32_V, vload, "vlse32.v", FMT_VMEM_STRIDED, 0x08006007, MASK_FUNCT6) \
+	X(VLM_V, vload, "vlm.v", FMT_VMEM, 0x02b00007, MASK_UNARY)             \
+	X(VSE8_V, vstore, "vse8.v", FMT_VMEM, 0x00000027, MASK_VMEM)           \
+	X(VSE16_V, vstore, "vse16.v", FMT_VMEM, 0x00005027, MASK_VMEM)         \
+	X(VSE32_V, vstore, "vse32.v", FMT_VMEM, 0x00006027, MASK_VMEM)         \
+	X(VSSE8_V, vstore, "vsse8.v", FMT_VMEM_STRIDED, 0x08000027, MASK_FUNCT6) \
+	X(VSSE16_V, vstore, "vsse16.v", FMT_VMEM_STRIDED, 0x08005027, MASK_FUNCT6) \
+	X(VSSE32_V, vstore, "vsse32.v", FMT_VMEM_STRIDED, 0x08006027, MASK_FUNCT6) \
+	X(VSM_V, vstore, "vsm.v", FMT_VMEM, 0x02b00027, MASK_UNARY)            \
+	X(VADD_VV, velem, "vadd.vv", FMT_VV, 0x00000057, MASK_FUNCT6)          \
+	X(VADD_VX, velem, "vadd.vx", FMT_VX, 0x00004057, MASK_FUNCT6)          \
+	X(VADD_VI, velem, "vadd.vi", FMT_VI, 0x00003057, MASK_FUNCT6)          \
+	X(VSUB_VV, velem, "vsub.vv", FMT_VV, 0x08000057, MASK_FUNCT6)          \
+	X(VSUB_VX, velem, "vsub.vx", FMT_VX, 0x08004057, MASK_FUNCT6)          \
+	X(VRSUB_VX, velem, "vrsub.vx", FMT_VX, 0x0c004057, MASK_FUNCT6)        \
+	X(VRSUB_VI, velem, "vrsub.vi", FMT_VI, 0x0c003057, MASK_FUNCT6)        \
+	X(VMINU_VV, velem, "vminu.vv", FMT_VV, 0x10000057, MASK_FUNCT6)        \
+	X(VMINU_VX, velem, "vminu.vx", FMT_VX, 0x10004057, MASK_FUNCT6)        \
+	X(VMIN_VV, velem, "vmin.vv", FMT_VV, 0x14000057, MASK_FUNCT6)          \
+	X(VMIN_VX, velem, "vmin.vx", FMT_VX, 0x14004057, MASK_FUNCT6)          \
+	X(VMAXU_VV, velem, "vmaxu.vv", FMT_VV, 0x18000057, MASK_FUNCT6)        \
+	X(VMAXU_VX, velem, "vmaxu.vx", FMT_VX, 0x18004057, MASK_FUNCT6)        \
+	X(VMAX_VV, velem, "vmax.vv", FMT_VV, 0x1c000057, MASK_FUNCT6)          \
+	X(VMAX_VX, velem, "vmax.vx", FMT_VX, 0x1c004057, MASK_FUNCT6)          \
+	X(VAND_VV, velem, "vand.vv", FMT_VV, 0x24000057, MASK_FUNCT6)          \
+	X(VAND_VX, velem, "vand.vx", FMT_VX, 0x24004057, MASK_FUNCT6)          \
+	X(VAND_VI, velem, "vand.vi", FMT_VI, 0x24003057, MASK_FUNCT6)          \
+	X(VOR_VV, velem, "vor.vv", FMT_VV, 0x28000057, MASK_FUNCT6)            \
+	X(VOR_VX, velem, "vor.vx", FMT_VX, 0x28004057, MASK_FUNCT6)            \
+	X(VOR_VI, velem, "vor.vi", FMT_VI, 0x28003057, MASK_FUNCT6)            \
+	X(VXOR_VV, velem, "vxor.vv", FMT_VV, 0x2c000057, MASK_FUNCT6)          \
+	X(VXOR_VX, velem, "vxor.vx", FMT_VX, 0x2c004057, MASK_FUNCT6)          \
+	X(VXOR_VI, velem, "vxor.vi", FMT_VI, 0x2c003057, MASK_FUNCT6)          \
+	X(VMV_V_V, vmerge, "vmv.v.v", FMT_VMV_V, 0x5e000057, MASK_UNARY)       \
+	X(VMV_V_X, vmerge, "vmv.v.x", FMT_VMV_X, 0x5e004057, MASK_UNARY)       \
+	X(VMV_V_I, vmerge, "vmv.v.i", FMT_VMV_I, 0x5e003057, MASK_UNARY)       \
+	X(VMERGE_VVM, vmerge, "vmerge.vvm", FMT_VMERGE_VV, 0x5c000057, MASK_FUNCT7) \
+	X(VMERGE_VXM, vmerge, "vmerge.vxm", FMT_VMERGE_VX, 0x5c004057, MASK_FUNCT7) \
+	X(VMERGE_VIM, vmerge, "vmerge.vim", FMT_VMERGE_VI, 0x5c003057, MASK_FUNCT7) \
+	X(VMSEQ_VV, vcmp, "vmseq.vv", FMT_VV, 0x60000057, MASK_FUNCT6)         \
+	X(VMSEQ_VX, vcmp, "vmseq.vx", FMT_VX, 0x60004057, MASK_FUNCT6)         \
+	X(VMSEQ_VI, vcmp, "vmseq.vi", FMT_VI, 0x60003057, MASK_FUNCT6)         \
+	X(VMSNE_VV, vcmp, "vmsne.vv", FMT_VV, 0x64000057, MASK_FUNCT6)         \
+	X(VMSNE_VX, vcmp, "vmsne.vx", FMT_VX, 0x64004057, MASK_FUNCT6)         \
+	X(VMSNE_VI, vcmp, "vmsne.vi", FMT_VI, 0x64003057, MASK_FUNCT6)         \
+	X(VMSLTU_VV, vcmp, "vmsltu.vv", FMT_VV, 0x68000057, MASK_FUNCT6)       \
+	X(VMSLTU_VX, vcmp, "vmsltu.vx", FMT_VX, 0x68004057, MASK_FUNCT6)       \
+	X(VMSLT_VV, vcmp, "vmslt.vv", FMT_VV, 0x6c000057, MASK_FUNCT6)         \
+	X(VMSLT_VX, vcmp, "vmslt.vx", FMT_VX, 0x6c004057, MASK_FUNCT6)         \
+	X(VMSLEU_VV, vcmp, "vmsleu.vv", FMT_VV, 0x70000057, MASK_FUNCT6)       \
+	X(VMSLEU_VX, vcmp, "vmsleu.vx", FMT_VX, 0x70004057, MASK_FUNCT6)       \
+	X(VMSLEU_VI, vcmp, "vmsleu.vi", FMT_VI, 0x70003057, MASK_FUNCT6)       \
+	X(VMSLE_VV, vcmp, "vmsle.vv", FMT_VV, 0x74000057, MASK_FUNCT6)         \
+	X(VMSLE_VX, vcmp, "vmsle.vx", FMT_VX, 0x74004057, MASK_FUNCT6)         \
+	X(VMSLE_VI, vcmp, "vmsle.vi", FMT_VI, 0x74003057, MASK_FUNCT6)         \
+	X(VMSGTU_VX, vcmp, "vmsgtu.vx", FMT_VX, 0x78004057, MASK_FUNCT6)       \
+	X(VMSGTU_VI, vcmp, "vmsgtu.vi", FMT_VI, 0x78003057, MASK_FUNCT6)       \
+	X(VMSGT_VX, vcmp, "vmsgt.vx", FMT_VX, 0x7c004057, MASK_FUNCT6)         \
+	X(VMSGT_VI, vcmp, "vmsgt.vi", FMT_VI, 0x7c003057, MASK_FUNCT6)         \
+	X(VSADDU_VV, velem, "vsaddu.vv", FMT_VV, 0x80000057, MASK_FUNCT6)      \
+	X(VSADDU_VX, velem, "vsaddu.vx", FMT_VX, 0x80004057, MASK_FUNCT6)      \
+	X(VSADDU_VI, velem, "vsaddu.vi", FMT_VI, 0x80003057, MASK_FUNCT6)      \
+	X(VSADD_VV, velem, "vsadd.vv", FMT_VV, 0x84000057, MASK_FUNCT6)        \
+	X(VSADD_VX, velem, "vsadd.vx", FMT_VX, 0x84004057, MASK_FUNCT6)        \
+	X(VSADD_VI, velem, "vsadd.vi", FMT_VI, 0x84003057, MASK_FUNCT6)        \
+	X(VSSUBU_VV, velem, "vssubu.vv", FMT_VV, 0x88000057, MASK_FUNCT6)      \
+	X(VSSUBU_VX, velem, "vssubu.vx", FMT_VX, 0x88004057, MASK_FUNCT6)      \
+	X(VSSUB_VV, velem, "vssub.vv", FMT_VV, 0x8c000057, MASK_FUNCT6)        \
+	X(VSSUB_VX, velem, "vssub.vx", FMT_VX, 0x8c004057, MASK_FUNCT6)        \
+	X(VSLL_VV, velem, "vsll.vv", FMT_VV, 0x94000057, MASK_FUNCT6)          \
+	X(VSLL_VX, velem, "vsll.vx", FMT_VX, 0x94004057, MASK_FUNCT6)          \
+	X(VSLL_VI, velem, "vsll.vi", FMT_VI_U, 0x94003057, MASK_FUNCT6)        \
+	X(VSRL_VV, velem, "vsrl.vv", FMT_VV, 0xa0000057, MASK_FUNCT6)          \
+	X(VSRL_VX, velem, "vsrl.vx", FMT_VX, 0xa0004057, MASK_FUNCT6)          \
+	X(VSRL_VI, velem, "vsrl.vi", FMT_VI_U, 0xa0003057, MASK_FUNCT6)        \
+	X(VSRA_VV, velem, "vsra.vv", FMT_VV, 0xa4000057, MASK_FUNCT6)          \
+	X(VSRA_VX, velem, "vsra.vx", FMT_VX, 0xa4004057, MASK_FUNCT6)          \
+	X(VSRA_VI, velem, "vsra.vi", FMT_VI_U, 0xa4003057, MASK_FUNCT6)        \
+	X(VREDSUM_VS, vred, "vredsum.vs", FMT_VV, 0x00002057, MASK_FUNCT6)     \
+	X(VREDAND_VS, vred, "vredand.vs", FMT_VV, 0x04002057, MASK_FUNCT6)     \
+	X(VREDOR_VS, vred, "vredor.vs", FMT_VV, 0x08002057, MASK_FUNCT6)       \
+	X(VREDXOR_VS, vred, "vredxor.vs", FMT_VV, 0x0c002057, MASK_FUNCT6)     \
+	X(VREDMINU_VS, vred, "vredminu.vs", FMT_VV, 0x10002057, MASK_FUNCT6)   \
+	X(VREDMIN_VS, vred, "vredmin.vs", FMT_VV, 0x14002057, MASK_FUNCT6)     \
+	X(VREDMAXU_VS, vred, "vredmaxu.vs", FMT_VV, 0x18002057, MASK_FUNCT6)   \
+	X(VREDMAX_VS, vred, "vredmax.vs", FMT_VV, 0x1c002057, MASK_FUNCT6)     \
+	X(VMV_X_S, vmv_x_s, "vmv.x.s", FMT_VMV_XS, 0x42002057, MASK_VS1)       \
+	X(VMV_S_X, vmv_s_x, "vmv.s.x", FMT_VMV_X, 0x42006057, MASK_UNARY)      \
+	X(VDIVU_VV, velem, "vdivu.vv", FMT_VV, 0x80002057, MASK_FUNCT6)        \
+	X(VDIVU_VX, velem, "vdivu.vx", FMT_VX, 0x80006057, MASK_FUNCT6)        \
+	X(VDIV_VV, velem, "vdiv.vv", FMT_VV, 0x84002057, MASK_FUNCT6)          \
+	X(VDIV_VX, velem, "vdiv.vx", FMT_VX, 0x84006057, MASK_FUNCT6)          \
+	X(VREMU_VV, velem, "vremu.vv", FMT_VV, 0x88002057, MASK_FUNCT6)        \
+	X(VREMU_VX, velem, "vremu.vx", FMT_VX, 0x88006057, MASK_FUNCT6)        \
+	X(VREM_VV, velem, "vrem.vv", FMT_VV, 0x8c002057, MASK_FUNCT6)          \
+	X(VREM_VX, velem, "vrem.vx", FMT_VX, 0x8c006057, MASK_FUNCT6)          \
+	X(VMULHU_VV, velem, "vmulhu.vv", FMT_VV, 0x90002057, MASK_FUNCT6)      \
+	X(VMULHU_VX, velem, "vmulhu.vx", FMT_VX, 0x90006057, MASK_FUNCT6)      \
+	X(VMUL_VV, velem, "vmul.vv", FMT_VV, 0x94002057, MASK_FUNCT6)          \
+	X(VMUL_VX, velem, "vmul.vx", FMT_VX, 0x94006057, MASK_FUNCT6)          \
+	X(VMULHSU_VV, velem, "vmulhsu.vv", FMT_VV, 0x98002057, MASK_FUNCT6)    \
+	X(VMULHSU_VX, velem, "vmulhsu.vx", FMT_VX, 0x98006057, MASK_FUNCT6)    \
+	X(VMULH_VV, velem, "vmulh.vv", FMT_VV, 0x9c002057, MASK_FUNCT6)        \
+	X(VMULH_VX, velem, "vmulh.vx", FMT_VX, 0x9c006057, MASK_FUNCT6)        \
+	X(VMADD_VV, velem, "vmadd.vv", FMT_VMAC_VV, 0xa4002057, MASK_FUNCT6)   \
+	X(VMADD_VX, velem, "vmadd.vx", FMT_VMAC_VX, 0xa4006057, MASK_FUNCT6)   \
+	X(VNMSUB_VV, velem, "vnmsub.vv", FMT_VMAC_VV, 0xac002057, MASK_FUNCT6) \
+	X(VNMSUB_VX, velem, "vnmsub.vx", FMT_VMAC_VX, 0xac006057, MASK_FUNCT6) \
+	X(VMACC_VV, velem, "vmacc.vv", FMT_VMAC_VV, 0xb4002057, MASK_FUNCT6)   \
+	X(VMACC_VX, velem, "vmacc.vx", FMT_VMAC_VX, 0xb4006057, MASK_FUNCT6)   \
+	X(VNMSAC_VV, velem, "vnmsac.vv", FMT_VMAC_VV, 0xbc002057, MASK_FUNCT6) \
+	X(VNMSAC_VX, velem, "vnmsac.vx", FMT_VMAC_VX, 0xbc006057, MASK_FUNCT6) \
+	X(FLW, flw, "flw", FMT_FLOAD, 0x00002007, MASK_FUNCT3)                 \
+	X(FSW, fsw, "fsw", FMT_FSTORE, 0x00002027, MASK_FUNCT3)                \
+	X(FLD, fld, "fld", FMT_FLOAD, 0x00003007, MASK_FUNCT3)                 \
+	X(FSD, fsd, "fsd", FMT_FSTORE, 0x00003027, MASK_FUNCT3)                \
+	X(FMADD_S, fmadd_s, "fmadd.s", FMT_FR4, 0x00000043, MASK_FR4)          \
+	X(FMSUB_S, fmsub_s, "fmsub.s", FMT_FR4, 0x00000047, MASK_FR4)          \
+	X(FNMSUB_S, fnmsub_s, "fnmsub.s", FMT_FR4, 0x0000004b, MASK_FR4)       \
+	X(FNMADD_S, fnmadd_s, "fnmadd.s", FMT_FR4, 0x0000004f, MASK_FR4)       \
+	X(FADD_S, fadd_s, "fadd.s", FMT_FR_RM, 0x00000053, MASK_FRM)           \
+	X(FSUB_S, fsub_s, "fsub.s", FMT_FR_RM, 0x08000053, MASK_FRM)           \
+	X(FMUL_S, fmul_s, "fmul.s", FMT_FR_RM, 0x10000053, MASK_FRM)           \
+	X(FDIV_S, fdiv_s, "fdiv.s", FMT_FR_RM, 0x18000053, MASK_FRM)           \
+	X(FSQRT_S, fsqrt_s, "fsqrt.s", FMT_FR1_RM, 0x58000053, MASK_FRM_UNARY) \
+	X(FSGNJ_S, fsgnj_s, "fsgnj.s", FMT_FR, 0x20000053, MASK_FUNCT7)        \
+	X(FSGNJN_S, fsgnjn_s, "fsgnjn.s", FMT_FR, 0x20001053, MASK_FUNCT7)     \
+	X(FSGNJX_S, fsgnjx_s, "fsgnjx.s", FMT_FR, 0x20002053, MASK_FUNCT7)     \
+	X(FMIN_S, fmin_s, "fmin.s", FMT_FR, 0x28000053, MASK_FUNCT7)           \
+	X(FMAX_S, fmax_s, "fmax.s", FMT_FR, 0x28001053, MASK_FUNCT7)           \
+	X(FCVT_W_S, fcvt_w_s, "fcvt.w.s", FMT_F2X_RM, 0xc0000053, MASK_FRM_UNARY) \
+	X(FCVT_WU_S, fcvt_wu_s, "fcvt.wu.s", FMT_F2X_RM, 0xc0100053, MASK_FRM_UNARY) \
+	X(FMV_X_W, fmv_x_w, "fmv.x.w", FMT_F2X, 0xe0000053, MASK_UNARY)        \
+	X(FEQ_S, feq_s, "feq.s", FMT_FCMP, 0xa0002053, MASK_FUNCT7)            \
+	X(FLT_S, flt_s, "flt.s", FMT_FCMP, 0xa0001053, MASK_FUNCT7)            \
+	X(FLE_S, fle_s, "fle.s", FMT_FCMP, 0xa0000053, MASK_FUNCT7)            \
+	X(FCLASS_S, fclass_s, "fclass.s", FMT_F2X, 0xe0001053, MASK_UNARY)     \
+	X(FCVT_S_W, fcvt_s_w, "fcvt.s.w", FMT_X2F_RM, 0xd0000053, MASK_FRM_UNARY) \
+	X(FCVT_S_WU, fcvt_s_wu, "fcvt.s.wu", FMT_X2F_RM, 0xd0100053, MASK_FRM_UNARY) \
+	X(FMV_W_X, fmv_w_x, "fmv.w.x", FMT_X2F, 0xf0000053, MASK_UNARY)        \
+	X(FMADD_D, fmadd_d, "fmadd.d", FMT_FR4, 0x02000043, MASK_FR4)          \
+	X(FMSUB_D, fmsub_d, "fmsub.d", FMT_FR4, 0x02000047, MASK_FR4)          \
+	X(FNMSUB_D, fnmsub_d, "fnmsub.d", FMT_FR4, 0x0200004b, MASK_FR4)       \
+	X(FNMADD_D, fnmadd_d, "fnmadd.d", FMT_FR4, 0x0200004f, MASK_FR4)       \
+	X(FADD_D, fadd_d, "fadd.d", FMT_FR_RM, 0x02000053, MASK_FRM)           \
+	X(FSUB_D, fsub_d, "fsub.d", FMT_FR_RM, 0x0a000053, MASK_FRM)           \
+	X(FMUL_D, fmul_d, "fmul.d", FMT_FR_RM, 0x12000053, MASK_FRM)           \
+	X(FDIV_D, fdiv_d, "fdiv.d", FMT_FR_RM, 0x1a000053, MASK_FRM)           \
+	X(FSQRT_D, fsqrt_d, "fsqrt.d", FMT_FR1_RM, 0x5a000053, MASK_FRM_UNARY) \
+	X(FSGNJ_D, fsgnj_d, "fsgnj.d", FMT_FR, 0x22000053, MASK_FUNCT7)        \
+	X(FSGNJN_D, fsgnjn_d, "fsgnjn.d", FMT_FR, 0x22001053, MASK_FUNCT7)     \
+	X(FSGNJX_D, fsgnjx_d, "fsgnjx.d", FMT_FR, 0x22002053, MASK_FUNCT7)     \
+	X(FMIN_D, fmin_d, "fmin.d", FMT_FR, 0x2a000053, MASK_FUNCT7)           \
+	X(FMAX_D, fmax_d, "fmax.d", FMT_FR, 0x2a001053, MASK_FUNCT7)           \
+	X(FCVT_W_D, fcvt_w_d, "fcvt.w.d", FMT_F2X_RM, 0xc2000053, MASK_FRM_UNARY) \
+	X(FCVT_WU_D, fcvt_wu_d, "fcvt.wu.d", FMT_F2X_RM, 0xc2100053, MASK_FRM_UNARY) \
+	X(FEQ_D, feq_d, "feq.d", FMT_FCMP, 0xa2002053, MASK_FUNCT7)            \
+	X(FLT_D, flt_d, "flt.d", FMT_FCMP, 0xa2001053, MASK_FUNCT7)            \
+	X(FLE_D, fle_d, "fle.d", FMT_FCMP, 0xa2000053, MASK_FUNCT7)            \
+	X(FCLASS_D, fclass_d, "fclass.d", FMT_F2X, 0xe2001053, MASK_UNARY)     \
+	X(FCVT_D_W, fcvt_d_w, "fcvt.d.w", FMT_X2F, 0xd2000053, MASK_FRM_UNARY) \
+	X(FCVT_D_WU, fcvt_d_wu, "fcvt.d.wu", FMT_X2F, 0xd2100053, MASK_FRM_UNARY) \
+	X(FCVT_S_D, fcvt_s_d, "fcvt.s.d", FMT_FR1_RM, 0x40100053, MASK_FRM_UNARY) \
+	X(FCVT_D_S, fcvt_d_s, "fcvt.d.s", FMT_FR1, 0x42000053, MASK_FRM_UNARY)
+
+enum insn_id {
+	INSN_ILLEGAL, // no entry matched; executing it traps
+#define X(id, handler, name, fmt, match, mask) INSN_##id,
+	INSN_LIST(X)
+#undef X
+	INSN_COUNT,
+};
+
+struct insn_info {
+	const char *name;
+	enum insn_format format;
+	u32 match;
+	u32 mask;
+};
+
+extern const struct insn_info insn_info[INSN_COUNT];
+
+/*
+ * The decode table is indexed directly by opcode[6:2], funct3 and funct7
+ * and gives the ID and format in one load. It is filled from INSN_LIST on
+ * first use, once even when several threads decode at the same time:
+ * insn_table_ready is only set, with release ordering, after the table is
+ * complete, and insn_table_init() waits for a fill in progress.
+ */
+#define INSN_KEY_BITS 15
+#define INSN_ALTS_MAX 64
+#define INSN_ALT_SCAN 0xFF // alt lists full: check every entry
+
+struct insn_slot {
+	u16 id; // enum insn_id
+	u8 format; // enum insn_format
+	u8 alt; // index in insn_alts of the later entries sharing the key
+};
+
+extern struct insn_slot insn_table[1u << INSN_KEY_BITS];
+// INSN_ILLEGAL-terminated lists of entry IDs; insn_alts[0] is the empty one
+extern u16 insn_alts[INSN_ALTS_MAX];
+extern bool insn_table_ready;
+
+void insn_table_init(void);
+struct insn_slot insn_scan(u32 raw, struct insn_slot slot);
+
+static inline u32 insn_key(u32 raw)
+{
+	return ((raw >> 2) & 0x1f) | ((raw >> 7) & 0xe0) |
+	       ((raw >> 17) & 0x7f00);
+}
+
+/*
+ * Map a 32-bit encoding to its table slot. The slot is confirmed against
+ * the entry's full mask, which only fails for the few encodings that
+ * share a key and also depend on rs2: the SYSTEM ones (EBREAK, SRET, MRET,
+ * WFI), the Zbb unary ops after CLZ, vlm.v/vsm.v, which share theirs
+ * with the unmasked byte loads and stores, and the unsigned FP
+ * conversions, which share theirs with the signed ones. Those fall back
+ * to the slot's short list of the other entries with the key.
+ */
+static inline struct insn_slot insn_decode_slot(u32 raw)
+{
+	struct insn_slot slot;
+
+	if (!__atomic_load_n(&insn_table_ready, __ATOMIC_ACQUIRE))
+		insn_table_init();
+	slot = insn_table[insn_key(raw)];
+	if ((raw & insn_info[slot.id].mask) != insn_info[slot.id].match)
+		return insn_scan(raw, slot);
+	return slot;
+}
+
+static inline enum insn_id insn_lookup(u32 raw)
+{
+	return (enum insn_id)insn_decode_slot(raw).id;
+}
+
+#endif /* RV32I_INSN_H */
@@ -0,0 +1,43 @@
+#ifndef RV32I_INSN_MIX_H
+#define RV32I_INSN_MIX_H
+
+#include <stdio.h>
+
+#include "type.h"
+#include "insn.h"
+
+/* Coarse instruction classes, derived from the decode table entries */
+enum insn_class {
+	INSN_CLASS_ALU,
+	INSN_CLASS_MULDIV,
+	INSN_CLASS_LOAD,
+	INSN_CLASS_STORE,
+	INSN_CLASS_BRANCH,
+	INSN_CLASS_JUMP,
+	INSN_CLASS_AMO, // LR/SC included
+	INSN_CLASS_FP, // F/D arithmetic, conversions and moves; not loads/stores
+	INSN_CLASS_VECTOR, // OP-V, vsetvl included; not loads/stores
+	INSN_CLASS_SYSTEM, // fences, CSRs, ECALL/EBREAK, xRET
+	INSN_CLASS_COUNT,
+};
+
+enum insn_class insn_class(enum insn_id id);
+const char *insn_class_name(enum insn_class cls);
+
+#ifdef CONFIG_INSN_MIX
+/*
+ * Retired instruction counts, built in with `make INSN_MIX=1`. An
+ * instruction that traps is not retired and only bumps @traps, as does a
+ * fetch that faults.
+ */
+struct insn_mix {
+	u64 count[INSN_COUNT]; // by instruction ID, RVC counted as expanded
+	u64 compressed;
+	u64 branch_taken;
+	u64 traps;
+};
+
+void insn_mix_dump_json(const struct insn_mix *m, FILE *out);
+#endif
+
+#endif /* RV32I_INSN_MIX_H */
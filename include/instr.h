@@ -3,6 +3,7 @@
 
 #include "type.h"
 #include "cpu.h"
+#include "common.h"
 
 /* Instruction field extractors (for 32-bit instr) */
 #define OPCODE(i) ((i) & 0x7f)
@@ -19,7 +20,61 @@ static inline s32 sign_extend(u32 val, int bits)
 	return (val ^ m) - m;
 }
 
-/* Instruction executor */
+// Division never traps: x/0 is all ones, x%0 is x, and the signed
+// overflow case INT_MIN / -1 gives INT_MIN with remainder 0.
+static inline u32 div_signed(u32 a, u32 b)
+{
+	if (b == 0)
+		return 0xFFFFFFFF;
+	if (a == 0x80000000 && b == 0xFFFFFFFF)
+		return a;
+	return (u32)((s32)a / (s32)b);
+}
+
+static inline u32 rem_signed(u32 a, u32 b)
+{
+	if (b == 0)
+		return a;
+	if (a == 0x80000000 && b == 0xFFFFFFFF)
+		return 0;
+	return (u32)((s32)a % (s32)b);
+}
+
+// Zbb helpers. The builtins are undefined for 0, which counts as 32 bits.
+static inline u32 clz32(u32 a)
+{
+	return a ? (u32)__builtin_clz(a) : 32;
+}
+
+static inline u32 ctz32(u32 a)
+{
+	return a ? (u32)__builtin_ctz(a) : 32;
+}
+
+static inline u32 rol32(u32 a, u32 n)
+{
+	return (a << (n & 0x1F)) | (a >> (-n & 0x1F));
+}
+
+static inline u32 ror32(u32 a, u32 n)
+{
+	return (a >> (n & 0x1F)) | (a << (-n & 0x1F));
+}
+
+// Each non-zero byte becomes 0xFF: bit 7 of a byte is set by its own
+// top bit or by the carry out of the low seven
+static inline u32 orc_b(u32 a)
+{
+	u32 top = (((a & 0x7F7F7F7F) + 0x7F7F7F7F) | a) & 0x80808080;
+
+	return (top >> 7) * 0xFF;
+}
+
+/* Instruction decoder */
+void instr_decode(Instruction *instr, u32 raw);
+
+/* Instruction executor: sets c->next_pc, the caller commits it to c->pc */
 void instr_exec(struct cpu *c, u32 instr);
+void instr_exec_decoded(struct cpu *c, const Instruction *instr);
 
 #endif /* RV32I_INSTR_H */
@@ -4,7 +4,7 @@
 
 #include "type.h"
 
-/* Memory allocation */
+/* Memory allocation, NULL on failure */
 u8 *memory_create(u32 size);
 void memory_destroy(u8 *mem);
 
@@ -0,0 +1,165 @@
+#ifndef RV32I_MMU_H
+#define RV32I_MMU_H
+
+#include "type.h"
+#include "cpu.h"
+#include "memory.h"
+#include <stdio.h>
+
+/* Sv32 page geometry */
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1u << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+
+/* Page table entry bits */
+#define PTE_V (1u << 0)
+#define PTE_R (1u << 1)
+#define PTE_W (1u << 2)
+#define PTE_X (1u << 3)
+#define PTE_U (1u << 4)
+#define PTE_G (1u << 5)
+#define PTE_A (1u << 6)
+#define PTE_D (1u << 7)
+
+void mmu_flush(struct cpu *c);
+void mmu_flush_page(struct cpu *c, u32 vaddr);
+
+/*
+ * Slow paths: refill the TLB or raise a trap and return NULL / false.
+ * Loads and stores also reach devices (the CLINT) past the end of RAM;
+ * other accesses there fault.
+ */
+u8 *mmu_translate_slow(struct cpu *c, u32 vaddr, enum mmu_access acc);
+/* The upper half of a 32-bit instruction whose lower half @lo ends a page */
+u8 *mmu_fetch_split(struct cpu *c, u32 vaddr, const u8 *lo);
+bool mmu_load_slow(struct cpu *c, u32 vaddr, u32 *val, int size);
+bool mmu_store_slow(struct cpu *c, u32 vaddr, u32 val, int size);
+
+/*
+ * Translate without touching guest state: no trap, no TLB fill, no
+ * accessed/dirty update. NULL if the access would fault or needs a PTE
+ * update first.
+ */
+u8 *mmu_peek(struct cpu *c, u32 vaddr, enum mmu_access acc);
+
+void mmu_print_stats(struct cpu *c, FILE *out);
+
+/* The host pointer on a TLB hit, otherwise NULL */
+static inline u8 *mmu_tlb_lookup(struct cpu *c, u32 vaddr, enum mmu_access acc)
+{
+	u32 vpn = vaddr >> PAGE_SHIFT;
+	struct tlb_entry *e = &c->tlb[acc][vpn & (TLB_SIZE - 1)];
+
+	if (e->vpn == vpn) {
+		c->mmu_stats.hits[acc]++;
+		return (u8 *)(e->addend + vaddr);
+	}
+	return NULL;
+}
+
+/* Fast paths: return the host pointer, or NULL after raising a trap */
+static inline u8 *mmu_translate(struct cpu *c, u32 vaddr, enum mmu_access acc)
+{
+	u8 *p = mmu_tlb_lookup(c, vaddr, acc);
+
+	return p ? p : mmu_translate_slow(c, vaddr, acc);
+}
+
+// True if an access of @size bytes at @vaddr stays within one page
+static inline bool mmu_in_page(u32 vaddr, int size)
+{
+	return (vaddr & PAGE_MASK) <= PAGE_SIZE - size;
+}
+
+// Fetch one instruction: 16 bits if compressed, otherwise 32
+static inline bool mmu_fetch_insn(struct cpu *c, u32 vaddr, u32 *raw)
+{
+	u8 *p = mmu_translate(c, vaddr, MMU_FETCH);
+	u8 *hi;
+	u32 lo;
+
+	if (!p)
+		return false;
+	lo = mem_load16(p, 0);
+	if ((lo & 0x3) != 0x3) {
+		*raw = lo;
+		return true;
+	}
+
+	// The upper half of a 32-bit instruction may sit on the next page
+	if (mmu_in_page(vaddr, 4)) {
+		hi = p + 2;
+	} else {
+		hi = mmu_fetch_split(c, vaddr, p);
+		if (!hi)
+			return false;
+	}
+	*raw = lo | ((u32)mem_load16(hi, 0) << 16);
+	return true;
+}
+
+static inline bool mmu_load8(struct cpu *c, u32 vaddr, u32 *val)
+{
+	u8 *p = mmu_tlb_lookup(c, vaddr, MMU_LOAD);
+
+	if (!p)
+		return mmu_load_slow(c, vaddr, val, 1);
+	*val = mem_load8(p, 0);
+	return true;
+}
+
+static inline bool mmu_load16(struct cpu *c, u32 vaddr, u32 *val)
+{
+	u8 *p;
+
+	if (!mmu_in_page(vaddr, 2) ||
+	    !(p = mmu_tlb_lookup(c, vaddr, MMU_LOAD)))
+		return mmu_load_slow(c, vaddr, val, 2);
+	*val = mem_load16(p, 0);
+	return true;
+}
+
+static inline bool mmu_load32(struct cpu *c, u32 vaddr, u32 *val)
+{
+	u8 *p;
+
+	if (!mmu_in_page(vaddr, 4) ||
+	    !(p = mmu_tlb_lookup(c, vaddr, MMU_LOAD)))
+		return mmu_load_slow(c, vaddr, val, 4);
+	*val = mem_load32(p, 0);
+	return true;
+}
+
+static inline bool mmu_store8(struct cpu *c, u32 vaddr, u32 val)
+{
+	u8 *p = mmu_tlb_lookup(c, vaddr, MMU_STORE);
+
+	if (!p)
+		return mmu_store_slow(c, vaddr, val, 1);
+	mem_store8(p, 0, (u8)val);
+	return true;
+}
+
+static inline bool mmu_store16(struct cpu *c, u32 vaddr, u32 val)
+{
+	u8 *p;
+
+	if (!mmu_in_page(vaddr, 2) ||
+	    !(p = mmu_tlb_lookup(c, vaddr, MMU_STORE)))
+		return mmu_store_slow(c, vaddr, val, 2);
+	mem_store16(p, 0, (u16)val);
+	return true;
+}
+
+static inline bool mmu_store32(struct cpu *c, u32 vaddr, u32 val)
+{
+	u8 *p;
+
+	if (!mmu_in_page(vaddr, 4) ||
+	    !(p = mmu_tlb_lookup(c, vaddr, MMU_STORE)))
+		return mmu_store_slow(c, vaddr, val, 4);
+	mem_store32(p, 0, val);
+	return true;
+}
+
+#endif /* RV32I_MMU_H */
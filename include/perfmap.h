@@ -0,0 +1,58 @@
+#ifndef RV32I_PERFMAP_H
+#define RV32I_PERFMAP_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+struct symtab;
+
+/*
+ * Guest attribution for host profilers. The emulator generates no code,
+ * so every perf sample lands in the interpreter. Instead, each guest
+ * function (or, without symbols, each block) gets a tiny trampoline in
+ * executable memory that calls the interpreter for its blocks. In a
+ * frame-pointer call chain (`perf record -g`) the trampoline is the
+ * interpreter's caller, and its name comes from /tmp/perf-<pid>.map or a
+ * jitdump: "rv32i:<symbol>@<pc>" or "rv32i:<pc>".
+ */
+#define PERFMAP_SLOT 32 // bytes per trampoline
+#define PERFMAP_MAX_TRAMPOLINES 32768
+#define PERFMAP_CACHE_BITS 10 // block pcs cached direct-mapped
+
+enum {
+	PERFMAP_MAP = 1, // write <dir>/perf-<pid>.map
+	PERFMAP_JITDUMP = 2, // write <dir>/jit-<pid>.dump for `perf inject --jit`
+};
+
+struct perfmap {
+	const struct symtab *syms; // may be NULL
+	u8 *code; // trampolines, PERFMAP_SLOT bytes each
+	u32 ntramps;
+	// Trampoline by key (symbol address or block pc), open addressing;
+	// values are slot + 1 so zero means empty
+	u32 *keys;
+	u32 *slots;
+	struct {
+		u32 pc;
+		u32 slot;
+	} cache[1u << PERFMAP_CACHE_BITS];
+	FILE *map;
+	FILE *jitdump;
+	void *jitdump_marker; // the mapping perf record looks for
+	u64 code_index;
+};
+
+/*
+ * Start attributing: @syms (may be NULL) must outlive the perfmap and @dir
+ * NULL means /tmp, the only place perf looks. Returns NULL if a file
+ * cannot be created or the host architecture has no trampoline template.
+ */
+struct perfmap *perfmap_create(const struct symtab *syms, const char *dir,
+			       unsigned flags);
+void perfmap_destroy(struct perfmap *pm);
+
+/* Run cpu_exec_block() through the trampoline for the current pc */
+void perfmap_exec_block(struct perfmap *pm, struct cpu *c, u32 max);
+
+#endif /* RV32I_PERFMAP_H */
@@ -0,0 +1,97 @@
+#ifndef RV32I_REPLAY_H
+#define RV32I_REPLAY_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+
+/*
+ * Record/replay of the nondeterministic inputs the syscall handler hands
+ * to the guest, and of the external interrupt lines the host drives with
+ * cpu_set_irq(). Every event is stamped with the instruction count it was
+ * delivered at, so a replay notices as soon as the guest goes a different
+ * way instead of silently feeding it the wrong data. While recording, line
+ * changes are held until the next block boundary and take effect and are
+ * logged there, even when made by a syscall handler in mid-block; a replay
+ * ends its blocks at the next logged one to raise it at the same point.
+ *
+ * Log format: the magic, then per event a type byte, the instruction
+ * count delta as a LEB128 varint, the zigzag-encoded result, the payload
+ * length and the payload bytes.
+ */
+#define REPLAY_MAGIC "RV32RPL1"
+
+enum replay_mode {
+	REPLAY_RECORD,
+	REPLAY_REPLAY,
+};
+
+enum replay_event {
+	REPLAY_EV_READ = 1, // read(): result and the bytes read
+	REPLAY_EV_CLOCK, // clock_gettime(): seconds and nanoseconds
+	REPLAY_EV_IRQ, // result: mip.MEIP and SEIP, no payload
+};
+
+struct replay {
+	enum replay_mode mode;
+	FILE *fp;
+	u64 last_count; // instruction count of the previous event
+	u64 events;
+	bool diverged;
+	// Set with diverged, for the caller to report: the first mismatch
+	const char *why;
+	enum replay_event diverged_event;
+	u64 diverged_at; // instruction count
+
+	// Replay: the header of the next event, read ahead to find the next
+	// interrupt line change
+	bool peeked;
+	int next_type;
+	u64 next_count;
+	u64 next_ret; // zigzag-encoded
+	u64 next_len;
+
+	// Record: lines raised and lowered since the last boundary
+	u32 irq_set;
+	u32 irq_clear;
+};
+
+/* NULL if @path cannot be opened or is not a replay log */
+struct replay *replay_open(const char *path, enum replay_mode mode);
+/* False if the log could not be written completely */
+bool replay_close(struct replay *r);
+
+/*
+ * Called before a syscall produces an input. When replaying, returns true
+ * with the recorded result in @ret and at most @max payload bytes in @data,
+ * or halts the CPU if the log does not match. Otherwise returns false and
+ * the caller produces the input itself, then hands it to replay_log().
+ */
+bool replay_fetch(struct cpu *c, enum replay_event ev, s32 *ret, void *data,
+		  u32 max);
+/* "read", "clock" or "irq" */
+const char *replay_event_name(enum replay_event ev);
+
+/* Append an input to the log when recording */
+void replay_log(struct cpu *c, enum replay_event ev, s32 ret,
+		const void *data, u32 len);
+
+/*
+ * Called by cpu_set_irq() instead of changing mip: held for the next
+ * boundary when recording, ignored when replaying, as the log drives the
+ * lines then.
+ */
+void replay_irq(struct cpu *c, u32 bits, bool level);
+
+/*
+ * At a block boundary: apply and log the held line changes, or raise
+ * those logged for this instruction count; halts the CPU if the log does
+ * not match.
+ */
+void replay_irq_sync(struct cpu *c);
+
+/* @left capped at the instructions until the next logged line change */
+u64 replay_irq_limit(struct cpu *c, u64 left);
+
+#endif /* RV32I_REPLAY_H */
@@ -0,0 +1,14 @@
+#ifndef RV32I_RV32I_H
+#define RV32I_RV32I_H
+
+/*
+ * Public interface of librv32i. Nothing in the library exits the process:
+ * constructors return NULL and operations report failure to the caller.
+ */
+#include "type.h"
+#include "cpu.h"
+#include "memory.h"
+#include "mmu.h"
+#include "vmcall.h"
+
+#endif /* RV32I_RV32I_H */
@@ -0,0 +1,15 @@
+#ifndef RV32I_RVC_H
+#define RV32I_RVC_H
+
+#include "type.h"
+
+/* A 16-bit parcel is compressed unless its low two bits are 0b11 */
+#define RVC_IS_COMPRESSED(i) (((i) & 0x3) != 0x3)
+
+/*
+ * Expand a 16-bit RV32C instruction into the equivalent 32-bit encoding.
+ * Returns 0 (an illegal instruction) for reserved or unsupported encodings.
+ */
+u32 rvc_expand(u16 raw);
+
+#endif /* RV32I_RVC_H */
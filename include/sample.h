@@ -0,0 +1,79 @@
+#ifndef RV32I_SAMPLE_H
+#define RV32I_SAMPLE_H
+
+#include "type.h"
+#include <stdio.h>
+
+struct cpu;
+struct cachesim;
+struct bpred;
+
+/*
+ * Sampled simulation: run with the detailed models detached (the TLB fast
+ * path) and attach them only for short windows. The first window starts
+ * after @start instructions and a new one every @interval instructions
+ * (0: a single window). Each window runs @warmup unmeasured instructions
+ * to refill cache and predictor state, then measures @window instructions.
+ */
+struct sample_config {
+	u64 start;
+	u64 interval;
+	u64 window;
+	u64 warmup;
+};
+
+/* Counters measured per window */
+enum sample_event {
+	SAMPLE_EV_INSNS,
+	SAMPLE_EV_L1I_ACCESS,
+	SAMPLE_EV_L1I_MISS,
+	SAMPLE_EV_L1D_ACCESS,
+	SAMPLE_EV_L1D_MISS,
+	SAMPLE_EV_L2_ACCESS,
+	SAMPLE_EV_L2_MISS,
+	SAMPLE_EV_BRANCH,
+	SAMPLE_EV_BRANCH_MISS,
+	SAMPLE_EV_JUMP,
+	SAMPLE_EV_TARGET_MISS,
+	SAMPLE_EV_COUNT,
+};
+
+struct sample_window {
+	u64 begin; // instruction count at the first measured instruction
+	u64 ev[SAMPLE_EV_COUNT];
+};
+
+struct sampler {
+	struct sample_config cfg;
+	struct cachesim *sim; // either model may be NULL
+	struct bpred *bp;
+
+	struct sample_window *windows;
+	u32 nwindows;
+	u32 cap;
+	u64 total_insns; // of the whole run, detailed or not
+};
+
+/* Parse "start:interval:window[:warmup]", counts accepting k/m/g suffixes */
+bool sample_config_parse(const char *spec, struct sample_config *cfg);
+
+struct sampler *sample_create(const struct sample_config *cfg,
+			      struct cachesim *sim, struct bpred *bp);
+void sample_destroy(struct sampler *s);
+
+/* Run @c until it halts, attaching the models only inside windows */
+void sample_run(struct sampler *s, struct cpu *c);
+
+/*
+ * Whole-program estimate of @ev: every window stands for the instructions
+ * from its start up to the next window's start (the first one also for
+ * everything before it), weighted by that share of the run. @ci receives
+ * the half-width of a 95% confidence interval, or 0 with one window.
+ * Returns false when no window was measured.
+ */
+bool sample_estimate(const struct sampler *s, enum sample_event ev,
+		     double *total, double *ci);
+
+void sample_print_stats(const struct sampler *s, FILE *out);
+
+#endif /* RV32I_SAMPLE_H */
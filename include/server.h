@@ -0,0 +1,103 @@
+#ifndef RV32I_SERVER_H
+#define RV32I_SERVER_H
+
+#include "type.h"
+#include "cpu.h"
+
+/*
+ * Job server on a Unix socket. A job is a raw image, console input and an
+ * instruction budget; the reply carries how the run stopped, the exit
+ * code, the console output and the instruction count and time.
+ *
+ * The server keeps a pool of CPUs keyed by a hash of the image they hold.
+ * A finished instance is reset and reloaded right after its reply, so the
+ * next job for the same image starts at once; only an image not in the
+ * pool evicts the least recently used instance. A client may send just
+ * the hash and the image only when the server does not have it.
+ *
+ * The wire format is the structs below in host byte order (the socket is
+ * local), each followed by its variable-length payload. A connection may
+ * carry any number of jobs, one at a time. Requests are read as they
+ * arrive, so a client that stalls halfway holds up no other; one that does
+ * not take its reply within a second is dropped.
+ */
+#define SERVER_MAGIC 0x4A564352u // "RCVJ"
+#define SERVER_INPUT_MAX (1u << 20)
+#define SERVER_MAX_CLIENTS 16
+#define SERVER_POOL_DEFAULT 8
+#define SERVER_BUDGET_DEFAULT 100000000ull
+
+#define SERVER_BY_HASH 1u // no image bytes: use the image with this hash
+
+enum server_status {
+	SERVER_OK,
+	SERVER_BAD_REQUEST, // bad magic, flags or sizes
+	SERVER_UNKNOWN_IMAGE, // by hash, and not in the pool
+	SERVER_NO_MEMORY,
+};
+
+/* Followed by image_len image bytes, then input_len input bytes */
+struct server_request {
+	u32 magic;
+	u32 flags;
+	u64 image_hash;
+	u32 image_len;
+	u32 input_len;
+	u64 budget; // instructions, 0 for the server's default
+};
+
+/* Followed by output_len bytes of console output */
+struct server_reply {
+	u32 magic;
+	u32 status; // enum server_status; nothing else is set unless OK
+	u32 stop; // enum cpu_stop
+	u32 exit_code;
+	u64 insns;
+	u64 run_ns; // time spent running the guest
+	u32 output_len; // at most OUTPUT_BUFFER_SIZE - 1
+	u32 pool_hit; // 1 if an instance already held the image
+};
+
+struct server_config {
+	const char *path; // socket to create; an old one is replaced
+	u32 pool_size; // instances kept, 0 for SERVER_POOL_DEFAULT
+	u32 mem_size; // guest memory per instance
+	u64 budget; // for jobs that ask for 0, 0 for the default
+	bool traces; // give each instance a trace cache
+	bool idle; // and a spin loop detector
+};
+
+struct server;
+
+/* Bind and listen; NULL with errno set on failure */
+struct server *server_create(const struct server_config *cfg);
+void server_destroy(struct server *s);
+
+/* Serve until server_stop(), which is safe from a signal handler */
+void server_run(struct server *s);
+void server_stop(struct server *s);
+
+/* FNV-1a, as used for request image_hash */
+u64 server_hash(const void *data, u32 len);
+
+/* Client side */
+struct server_job {
+	const void *image;
+	u32 image_len;
+	const void *input;
+	u32 input_len;
+	u64 budget;
+	bool by_hash; // try the hash first, send the image if needed
+};
+
+/* Connect to the socket at @path; -1 with errno set on failure */
+int server_connect(const char *path);
+
+/*
+ * Run @job on the server at @fd and wait for the reply. @output receives
+ * the console output, NUL-terminated. False if the connection failed.
+ */
+bool server_submit(int fd, const struct server_job *job,
+		   struct server_reply *reply, char output[OUTPUT_BUFFER_SIZE]);
+
+#endif /* RV32I_SERVER_H */
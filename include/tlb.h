@@ -0,0 +1,42 @@
+#ifndef RV32I_TLB_H
+#define RV32I_TLB_H
+
+#include "type.h"
+#include <stdint.h>
+
+/* Direct-mapped software TLB, one table per access type */
+#define TLB_BITS 8
+#define TLB_SIZE (1u << TLB_BITS)
+#define TLB_INVALID 0xFFFFFFFFu /* never a valid 20-bit VPN */
+#define TLB_VPN_MASK 0x000FFFFFu
+/*
+ * Set in an entry's tag to make the fast-path compare fail while keeping
+ * the translation cached; the slow path then sees every access.
+ */
+#define TLB_SLOW_PATH 0x80000000u
+
+enum mmu_access {
+	MMU_FETCH,
+	MMU_LOAD,
+	MMU_STORE,
+	MMU_NACCESS,
+};
+
+/*
+ * A TLB entry caches the translation of one virtual page for one access
+ * type. Its presence in the fetch/load/store table means the permission
+ * check already passed; host address = addend + vaddr.
+ */
+struct tlb_entry {
+	u32 vpn;
+	uintptr_t addend;
+};
+
+struct mmu_stats {
+	u64 hits[MMU_NACCESS];
+	u64 misses[MMU_NACCESS];
+	u64 walks;
+	u64 flushes;
+};
+
+#endif /* RV32I_TLB_H */
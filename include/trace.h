@@ -0,0 +1,257 @@
+#ifndef RV32I_TRACE_H
+#define RV32I_TRACE_H
+
+#include "type.h"
+#include "cpu.h"
+#include "instr.h"
+#include <stdio.h>
+
+/*
+ * Optimizing tier for hot straight-line code. After TRACE_HOT entries a
+ * run of guest instructions starting at one pc, continuing through
+ * not-taken branches and ending at a jump, is lifted into a small SSA IR.
+ * Constants are propagated and folded (lui/addi pairs become one value),
+ * repeated loads of an address reuse the first result, and register
+ * writes only reach the register file when the trace leaves. Operations
+ * nothing needs are dropped. The result runs in a compact interpreter.
+ *
+ * Guest state is exact at every exit. Each load, store and branch carries
+ * the registers written before it, which are stored only if that
+ * instruction faults or branches away. Traces are checked against the
+ * guest code bytes on entry, so modified code is translated again.
+ */
+#define TRACE_CACHE_BITS 10
+#define TRACE_CACHE_SIZE (1u << TRACE_CACHE_BITS)
+#define TRACE_HOT 16 // entries before a pc is translated
+#define TRACE_MAX_INSNS CPU_BLOCK_MAX
+#define TRACE_MAX_OPS (TRACE_MAX_INSNS * 4)
+
+/* IR operations; the ALU ones are evaluated by trace_eval() */
+enum trace_kind {
+	IR_CONST, // imm
+	IR_GET, // guest register a at trace entry
+	IR_ADD,
+	IR_SUB,
+	IR_SLL,
+	IR_SLT,
+	IR_SLTU,
+	IR_XOR,
+	IR_SRL,
+	IR_SRA,
+	IR_OR,
+	IR_AND,
+	IR_MUL,
+	IR_MULH,
+	IR_MULHSU,
+	IR_MULHU,
+	IR_DIV,
+	IR_DIVU,
+	IR_REM,
+	IR_REMU,
+	IR_SH1ADD,
+	IR_SH2ADD,
+	IR_SH3ADD,
+	IR_ANDN,
+	IR_ORN,
+	IR_XNOR,
+	IR_MIN,
+	IR_MINU,
+	IR_MAX,
+	IR_MAXU,
+	IR_ROL,
+	IR_ROR,
+	IR_BCLR,
+	IR_BEXT,
+	IR_BINV,
+	IR_BSET,
+	IR_CLZ, // unary: b is a constant 0
+	IR_CTZ,
+	IR_CPOP,
+	IR_SEXT_B,
+	IR_SEXT_H,
+	IR_ZEXT_H,
+	IR_ORC_B,
+	IR_REV8,
+	IR_LB, // loads and stores access a + imm, b is the stored value
+	IR_LH,
+	IR_LW,
+	IR_LBU,
+	IR_LHU,
+	IR_SB,
+	IR_SH,
+	IR_SW,
+	IR_BEQ, // leave through exit when a ? b holds
+	IR_BNE,
+	IR_BLT,
+	IR_BGE,
+	IR_BLTU,
+	IR_BGEU,
+	IR_JUMP, // leave through exit, at its pc
+	IR_JALR, // leave through exit, at a & ~1
+};
+
+struct trace_op {
+	u8 kind; // enum trace_kind
+	u16 a, b; // operand values: the results of earlier ops
+	u16 exit; // loads, stores, branches and jumps
+	u32 imm;
+};
+
+/* Where a trace leaves, and the registers it must write back first */
+struct trace_exit {
+	u32 pc; // branch target, or the pc of the load/store
+	u16 ninsns; // guest instructions retired when leaving here
+	u16 first, count; // range of writebacks
+};
+
+struct trace_writeback {
+	u8 reg;
+	u16 val;
+};
+
+struct trace {
+	u32 pc;
+	u32 ninsns; // guest instructions on the full path
+	u32 nops, nexits, nwb;
+	struct trace_op *ops;
+	struct trace_exit *exits;
+	struct trace_writeback *wb;
+	u32 bytes;
+	u8 code[]; // the guest code the trace was made from
+};
+
+struct trace_stats {
+	u64 translated; // traces made
+	u64 runs; // trace entries
+	u64 insns; // guest instructions lifted
+	u64 ops; // IR ops left after optimization
+	u64 folded; // ops replaced by a constant or an operand
+	u64 dead; // ops removed because no one used them
+	u64 loads_reused; // loads answered from an earlier load or store
+	u64 writes_elided; // register writes never stored back
+	u64 device_exits; // traces dropped for touching a device register
+};
+
+struct trace_cache {
+	struct trace_entry {
+		u32 pc;
+		u32 hits;
+		struct trace *t;
+	} entries[TRACE_CACHE_SIZE];
+	struct trace_stats stats;
+};
+
+/* Attach to a CPU through c->traces; create returns NULL when out of memory */
+struct trace_cache *trace_cache_create(void);
+void trace_cache_destroy(struct trace_cache *tc);
+
+/*
+ * cpu_exec_block() with traces: run a trace of at most @max instructions
+ * at pc if there is one, otherwise interpret. Predictor, fuzzer and
+ * instruction mix hooks need every instruction, so with any of those on
+ * this only interprets. A trace that reaches a device register leaves in
+ * front of the access and is not made again.
+ */
+void trace_exec_block(struct trace_cache *tc, struct cpu *c, u32 max);
+
+/* Lift the code at @pc (host copy at @code, @len bytes up to the end of its page) */
+struct trace *trace_translate(struct trace_cache *tc, u32 pc, const u8 *code,
+			      u32 len);
+void trace_free(struct trace *t);
+
+/* The value of an ALU op, for folding and for running */
+static inline u32 trace_eval(enum trace_kind kind, u32 a, u32 b)
+{
+	switch (kind) {
+	case IR_ADD:
+		return a + b;
+	case IR_SUB:
+		return a - b;
+	case IR_SLL:
+		return a << (b & 0x1F);
+	case IR_SLT:
+		return (s32)a < (s32)b;
+	case IR_SLTU:
+		return a < b;
+	case IR_XOR:
+		return a ^ b;
+	case IR_SRL:
+		return a >> (b & 0x1F);
+	case IR_SRA:
+		return (s32)a >> (b & 0x1F);
+	case IR_OR:
+		return a | b;
+	case IR_AND:
+		return a & b;
+	case IR_MUL:
+		return a * b;
+	case IR_MULH:
+		return (u32)(((s64)(s32)a * (s64)(s32)b) >> 32);
+	case IR_MULHSU:
+		return (u32)(((s64)(s32)a * (s64)b) >> 32);
+	case IR_MULHU:
+		return (u32)(((u64)a * b) >> 32);
+	case IR_DIV:
+		return div_signed(a, b);
+	case IR_DIVU:
+		return b ? a / b : 0xFFFFFFFF;
+	case IR_REM:
+		return rem_signed(a, b);
+	case IR_REMU:
+		return b ? a % b : a;
+	case IR_SH1ADD:
+		return (a << 1) + b;
+	case IR_SH2ADD:
+		return (a << 2) + b;
+	case IR_SH3ADD:
+		return (a << 3) + b;
+	case IR_ANDN:
+		return a & ~b;
+	case IR_ORN:
+		return a | ~b;
+	case IR_XNOR:
+		return ~(a ^ b);
+	case IR_MIN:
+		return (s32)a < (s32)b ? a : b;
+	case IR_MINU:
+		return a < b ? a : b;
+	case IR_MAX:
+		return (s32)a > (s32)b ? a : b;
+	case IR_MAXU:
+		return a > b ? a : b;
+	case IR_ROL:
+		return rol32(a, b);
+	case IR_ROR:
+		return ror32(a, b);
+	case IR_BCLR:
+		return a & ~(1u << (b & 0x1F));
+	case IR_BEXT:
+		return (a >> (b & 0x1F)) & 1;
+	case IR_BINV:
+		return a ^ (1u << (b & 0x1F));
+	case IR_BSET:
+		return a | (1u << (b & 0x1F));
+	case IR_CLZ:
+		return clz32(a);
+	case IR_CTZ:
+		return ctz32(a);
+	case IR_CPOP:
+		return __builtin_popcount(a);
+	case IR_SEXT_B:
+		return (s32)(s8)a;
+	case IR_SEXT_H:
+		return (s32)(s16)a;
+	case IR_ZEXT_H:
+		return a & 0xFFFF;
+	case IR_ORC_B:
+		return orc_b(a);
+	case IR_REV8:
+		return __builtin_bswap32(a);
+	default:
+		return 0;
+	}
+}
+
+void trace_print_stats(const struct trace_cache *tc, FILE *out);
+
+#endif /* RV32I_TRACE_H */
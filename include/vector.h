@@ -0,0 +1,63 @@
+#ifndef RV32I_VECTOR_H
+#define RV32I_VECTOR_H
+
+#include "type.h"
+#include "common.h"
+
+struct cpu;
+
+/*
+ * Vector extension subset: Zve32x with VLEN = 128. Integer elements of 8,
+ * 16 and 32 bits, LMUL 1/8 to 8, unit-stride and strided loads and stores,
+ * integer arithmetic, compares, merges and single-width reductions.
+ *
+ * Elements are kept in host order (the host is little-endian, like the
+ * guest), so a register group is a plain byte array and whole registers
+ * can be handed to host SIMD kernels. Unmasked element-wise ops run 16
+ * bytes at a time with GCC vector types; everything else, and every op
+ * when @reference is set, goes one element at a time.
+ */
+#define VLEN 128 // bits per vector register
+#define VLENB (VLEN / 8)
+#define ELEN 32
+#define NVREGS 32
+
+/* vtype fields */
+#define VTYPE_VLMUL 0x7u
+#define VTYPE_VSEW (0x7u << 3)
+#define VTYPE_VTA (1u << 6)
+#define VTYPE_VMA (1u << 7)
+#define VTYPE_VILL (1u << 31)
+
+struct vector_state {
+	u8 v[NVREGS][VLENB] __attribute__((aligned(16)));
+	u32 vl;
+	u32 vtype;
+	u32 vstart;
+	u32 vxrm; // fixed-point rounding mode, kept but unused
+	u32 vxsat;
+	bool reference; // element-at-a-time only, for differential testing
+};
+
+/* vtype as set by vsetvl, and illegal until then */
+void vector_reset(struct cpu *c);
+
+/* vstart, vxsat, vxrm, vcsr, vl, vtype and vlenb; false if not accessible */
+bool vector_csr_read(struct cpu *c, u32 addr, u32 *val);
+bool vector_csr_write(struct cpu *c, u32 addr, u32 val);
+
+/*
+ * Handlers for the vector entries of INSN_LIST, bound by name like the
+ * scalar ones in instr.c.
+ */
+void exec_vsetvl(struct cpu *c, const Instruction *instr);
+void exec_vload(struct cpu *c, const Instruction *instr);
+void exec_vstore(struct cpu *c, const Instruction *instr);
+void exec_velem(struct cpu *c, const Instruction *instr);
+void exec_vcmp(struct cpu *c, const Instruction *instr);
+void exec_vmerge(struct cpu *c, const Instruction *instr);
+void exec_vred(struct cpu *c, const Instruction *instr);
+void exec_vmv_x_s(struct cpu *c, const Instruction *instr);
+void exec_vmv_s_x(struct cpu *c, const Instruction *instr);
+
+#endif /* RV32I_VECTOR_H */
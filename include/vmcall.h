@@ -0,0 +1,30 @@
+#ifndef RV32I_VMCALL_H
+#define RV32I_VMCALL_H
+
+#include "type.h"
+
+struct cpu;
+
+/* ra during a vmcall: returning there ends the call */
+#define VMCALL_RETURN 0xFFFFFFFEu
+#define VMCALL_MAX_ARGS 8
+
+enum vmcall_status {
+	VMCALL_OK,
+	VMCALL_HALTED, // the guest exited or stopped before returning
+	VMCALL_BAD_ARGS,
+	VMCALL_BUDGET, // @max_insns ran out before it returned
+};
+
+/*
+ * Call the guest function at @func with @args in a0..a7 and return its a0
+ * in @ret (may be NULL), running at most @max_insns instructions. The
+ * guest runs on its current sp; every register, the pc, the privilege
+ * level and the run state are restored afterwards, also when the call is
+ * abandoned, so calls can be made between runs, after the guest has
+ * exited, or from a host syscall handler.
+ */
+enum vmcall_status vmcall(struct cpu *c, u32 func, const u32 *args,
+			  u32 nargs, u64 max_insns, u32 *ret);
+
+#endif /* RV32I_VMCALL_H */
@@ -0,0 +1,225 @@
+#include "accel.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "fuzz.h"
+#include "elf_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const kind_names[ACCEL_NKINDS] = {
+	"memcpy",
+	"memmove",
+	"memset",
+	"strlen",
+};
+
+// Instructions per byte of the byte loop each routine stands in for:
+// lbu/sb/addi/addi/bne to copy, sb/addi/bne to fill, lbu/addi/bnez to scan
+static const u32 insns_per_byte[ACCEL_NKINDS] = { 5, 5, 3, 3 };
+
+struct accel *accel_create(void)
+{
+	return calloc(1, sizeof(struct accel));
+}
+
+void accel_destroy(struct accel *a)
+{
+	free(a);
+}
+
+bool accel_add(struct accel *a, u32 addr, enum accel_kind kind)
+{
+	for (u32 i = 0; i < a->nroutines; i++) {
+		if (a->routines[i].addr == addr) {
+			a->routines[i].kind = kind;
+			return true;
+		}
+	}
+	if (a->nroutines == ACCEL_MAX_ROUTINES)
+		return false;
+	a->routines[a->nroutines].addr = addr;
+	a->routines[a->nroutines].kind = kind;
+	a->nroutines++;
+	return true;
+}
+
+u32 accel_add_symbols(struct accel *a, const struct symtab *syms)
+{
+	enum accel_kind kind;
+	u32 n = 0;
+
+	for (u32 i = 0; i < syms->count; i++) {
+		if (accel_kind_parse(syms->syms[i].name, &kind) &&
+		    accel_add(a, syms->syms[i].addr, kind))
+			n++;
+	}
+	return n;
+}
+
+bool accel_kind_parse(const char *name, enum accel_kind *kind)
+{
+	for (int k = 0; k < ACCEL_NKINDS; k++) {
+		if (!strcmp(name, kind_names[k])) {
+			*kind = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Host pointer to @len > 0 guest bytes at @vaddr, or NULL unless every
+ * page is accessible as-is and follows the previous one in host memory.
+ */
+static u8 *accel_range(struct cpu *c, u32 vaddr, u32 len,
+		       enum mmu_access acc)
+{
+	u8 *host = mmu_peek(c, vaddr, acc);
+
+	if (!host || len - 1 > ~vaddr)
+		return NULL;
+	for (u32 off = PAGE_SIZE - (vaddr & PAGE_MASK); off < len;
+	     off += PAGE_SIZE) {
+		if (mmu_peek(c, vaddr + off, acc) != host + off)
+			return NULL;
+	}
+	return host;
+}
+
+// The fuzzer restores only the pages it saw written
+static void accel_mark_dirty(struct cpu *c, const u8 *host, u32 len)
+{
+	u32 paddr = host - c->memory;
+
+	if (!c->fuzz)
+		return;
+	for (u32 p = paddr & ~PAGE_MASK; p < paddr + len; p += PAGE_SIZE)
+		fuzz_mark_dirty(c->fuzz, p);
+}
+
+static bool overlap(const u8 *a, const u8 *b, u32 len)
+{
+	return a < b + len && b < a + len;
+}
+
+// memcpy, memmove or memset; false to leave the call to the guest
+static bool accel_mem(struct cpu *c, enum accel_kind kind)
+{
+	u32 dst = c->registers[10];
+	u32 src = c->registers[11];
+	u32 n = c->registers[12];
+	u8 *d, *s = NULL;
+
+	if (!n)
+		return true;
+	d = accel_range(c, dst, n, MMU_STORE);
+	if (!d)
+		return false;
+	if (kind == ACCEL_MEMSET) {
+		memset(d, (u8)src, n);
+		accel_mark_dirty(c, d, n);
+		return true;
+	}
+	s = accel_range(c, src, n, MMU_LOAD);
+	if (!s)
+		return false;
+	if (overlap(d, s, n)) {
+		// Undefined for memcpy; memmove picks its direction from the
+		// virtual addresses, which must then agree with the physical
+		if (kind == ACCEL_MEMCPY || d - s != (long)(dst - src))
+			return false;
+	}
+	memmove(d, s, n);
+	accel_mark_dirty(c, d, n);
+	return true;
+}
+
+// Length of the string at a0, or false if it runs into an unusable page
+static bool accel_strlen(struct cpu *c, u32 *len)
+{
+	u32 vaddr = c->registers[10];
+	u32 n = 0;
+
+	for (;;) {
+		u32 chunk = PAGE_SIZE - (vaddr & PAGE_MASK);
+		u8 *p = mmu_peek(c, vaddr, MMU_LOAD);
+		u8 *nul;
+
+		if (!p)
+			return false;
+		nul = memchr(p, 0, chunk);
+		if (nul) {
+			*len = n + (nul - p);
+			return true;
+		}
+		n += chunk;
+		vaddr += chunk;
+		if (!vaddr) // wrapped around the address space
+			return false;
+	}
+}
+
+bool accel_call(struct accel *a, struct cpu *c, u64 budget)
+{
+	const struct accel_routine *r = NULL;
+	u32 bytes;
+	u64 cost;
+
+	for (u32 i = 0; i < a->nroutines; i++) {
+		if (a->routines[i].addr == c->pc) {
+			r = &a->routines[i];
+			break;
+		}
+	}
+	if (!r)
+		return false;
+#ifdef CONFIG_INSN_MIX
+	// The mix would miss the routine's instructions
+	a->stats.declined++;
+	return false;
+#endif
+	// Models that watch every access, branch or return need the guest
+	// code, and the entry must be fetchable for the call to get this far
+	if (c->cachesim || c->bpred || c->callgraph ||
+	    !mmu_peek(c, c->pc, MMU_FETCH))
+		goto decline;
+
+	if (r->kind == ACCEL_STRLEN) {
+		if (!accel_strlen(c, &bytes))
+			goto decline;
+		cost = ACCEL_CALL_INSNS + (u64)insns_per_byte[r->kind] * (bytes + 1);
+		if (cost > budget)
+			goto decline;
+		c->registers[10] = bytes;
+	} else {
+		bytes = c->registers[12];
+		cost = ACCEL_CALL_INSNS + (u64)insns_per_byte[r->kind] * bytes;
+		if (cost > budget || !accel_mem(c, r->kind))
+			goto decline;
+		// a0 is returned unchanged: the destination
+	}
+
+	a->stats.calls[r->kind]++;
+	a->stats.bytes[r->kind] += bytes;
+	c->insn_count += cost;
+	c->pc = c->registers[1] & ~1u;
+	return true;
+
+decline:
+	a->stats.declined++;
+	return false;
+}
+
+void accel_print_stats(const struct accel *a, FILE *out)
+{
+	fprintf(out, "Accelerated routines: %u registered, %llu calls left to the guest\n",
+		a->nroutines, (unsigned long long)a->stats.declined);
+	for (int k = 0; k < ACCEL_NKINDS; k++) {
+		if (!a->stats.calls[k])
+			continue;
+		fprintf(out, "  %-8s %llu calls, %llu bytes\n", kind_names[k],
+			(unsigned long long)a->stats.calls[k],
+			(unsigned long long)a->stats.bytes[k]);
+	}
+}
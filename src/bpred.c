@@ -0,0 +1,464 @@
+#include "bpred.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Geometric history lengths of the tagged TAGE tables */
+static const u32 tage_history[TAGE_TABLES] = { 4, 9, 19, 40 };
+
+#define TAGE_TAG_BITS 8
+#define TAGE_TAG_VALID 0x100 /* keeps a computed tag from matching empty slots */
+
+static const char *const kind_names[] = { "bimodal", "gshare", "tage" };
+static const char *const type_names[] = { "cond", "jump", "call", "ret",
+					   "indirect" };
+
+// Parse "bimodal", "gshare:14", "tage:12" (the number is table_bits)
+bool bpred_config_parse(const char *spec, struct bpred_config *cfg)
+{
+	size_t len = strcspn(spec, ":");
+	int kind = -1;
+
+	for (int i = 0; i < 3; i++) {
+		if (strlen(kind_names[i]) == len &&
+		    !strncmp(spec, kind_names[i], len))
+			kind = i;
+	}
+	if (kind < 0)
+		return false;
+
+	cfg->kind = kind;
+	cfg->table_bits = 12;
+	if (spec[len] == ':') {
+		char *end;
+
+		cfg->table_bits = strtoul(spec + len + 1, &end, 0);
+		if (*end != '\0' || cfg->table_bits < 4 ||
+		    cfg->table_bits > 24)
+			return false;
+	}
+	cfg->history_bits = cfg->table_bits;
+	cfg->btb_bits = 9;
+	cfg->ras_depth = 16;
+	return true;
+}
+
+struct bpred *bpred_create(const struct bpred_config *cfg)
+{
+	struct bpred *bp = calloc(1, sizeof(*bp));
+
+	if (!bp)
+		return NULL;
+	bp->cfg = *cfg;
+
+	bp->counters = malloc((size_t)1 << cfg->table_bits);
+	bp->btb = calloc((size_t)1 << cfg->btb_bits, sizeof(*bp->btb));
+	bp->ras = calloc(cfg->ras_depth ? cfg->ras_depth : 1, sizeof(u32));
+	bp->sites_cap = 1024;
+	bp->sites = calloc(bp->sites_cap, sizeof(*bp->sites));
+	if (!bp->counters || !bp->btb || !bp->ras || !bp->sites)
+		goto fail;
+	// Start weakly not-taken
+	memset(bp->counters, 1, (size_t)1 << cfg->table_bits);
+
+	if (cfg->kind == BPRED_TAGE) {
+		bp->tage_bits = cfg->table_bits > 2 ? cfg->table_bits - 2 : 1;
+		for (int i = 0; i < TAGE_TABLES; i++) {
+			bp->tage[i] = calloc((size_t)1 << bp->tage_bits,
+					     sizeof(struct tage_entry));
+			if (!bp->tage[i])
+				goto fail;
+		}
+	}
+	// An invalid BTB pc: odd addresses are never branch sites
+	for (u32 i = 0; i < (1u << cfg->btb_bits); i++) {
+		bp->btb[i].pc = 1;
+	}
+	return bp;
+
+fail:
+	bpred_destroy(bp);
+	return NULL;
+}
+
+void bpred_destroy(struct bpred *bp)
+{
+	if (!bp)
+		return;
+	free(bp->counters);
+	free(bp->btb);
+	free(bp->ras);
+	free(bp->sites);
+	for (int i = 0; i < TAGE_TABLES; i++) {
+		free(bp->tage[i]);
+	}
+	free(bp);
+}
+
+// --- Direction predictors ---
+
+static void ctr2_update(u8 *ctr, bool taken)
+{
+	if (taken && *ctr < 3)
+		(*ctr)++;
+	else if (!taken && *ctr > 0)
+		(*ctr)--;
+}
+
+// XOR-fold the newest @len history bits down to @bits bits
+static u32 fold_history(u64 ghr, u32 len, u32 bits)
+{
+	u64 h = len < 64 ? ghr & ((1ull << len) - 1) : ghr;
+	u32 out = 0;
+
+	while (h) {
+		out ^= h & ((1u << bits) - 1);
+		h >>= bits;
+	}
+	return out;
+}
+
+struct tage_lookup {
+	u32 idx[TAGE_TABLES];
+	u16 tag[TAGE_TABLES];
+	int provider; // longest matching table, -1 for the base predictor
+	int alt; // next longest match, -1 for the base predictor
+	u32 base;
+	bool pred;
+	bool alt_pred;
+};
+
+static void tage_lookup(struct bpred *bp, u32 pc, struct tage_lookup *l)
+{
+	u32 mask = (1u << bp->tage_bits) - 1;
+
+	l->provider = -1;
+	l->alt = -1;
+	l->base = (pc >> 1) & ((1u << bp->cfg.table_bits) - 1);
+
+	for (int i = TAGE_TABLES - 1; i >= 0; i--) {
+		u32 len = tage_history[i];
+
+		l->idx[i] = ((pc >> 1) ^ (pc >> (1 + bp->tage_bits)) ^
+			     fold_history(bp->ghr, len, bp->tage_bits)) &
+			    mask;
+		l->tag[i] = (((pc >> 1) ^ fold_history(bp->ghr, len,
+						       TAGE_TAG_BITS) ^
+			      (fold_history(bp->ghr, len, TAGE_TAG_BITS - 1)
+			       << 1)) &
+			     ((1u << TAGE_TAG_BITS) - 1)) |
+			    TAGE_TAG_VALID;
+
+		if (bp->tage[i][l->idx[i]].tag != l->tag[i])
+			continue;
+		if (l->provider < 0)
+			l->provider = i;
+		else if (l->alt < 0)
+			l->alt = i;
+	}
+
+	l->alt_pred = l->alt >= 0 ? bp->tage[l->alt][l->idx[l->alt]].ctr >= 0 :
+				    bp->counters[l->base] >= 2;
+	l->pred = l->provider >= 0 ?
+			  bp->tage[l->provider][l->idx[l->provider]].ctr >= 0 :
+			  l->alt_pred;
+}
+
+static void tage_update(struct bpred *bp, const struct tage_lookup *l,
+			bool taken)
+{
+	bool allocated = false;
+
+	if (l->provider >= 0) {
+		struct tage_entry *e = &bp->tage[l->provider][l->idx[l->provider]];
+
+		// Usefulness only changes when the provider beat (or lost to)
+		// the alternate prediction.
+		if (l->pred != l->alt_pred) {
+			if (l->pred == taken && e->useful < 3)
+				e->useful++;
+			else if (l->pred != taken && e->useful > 0)
+				e->useful--;
+		}
+		if (taken && e->ctr < 3)
+			e->ctr++;
+		else if (!taken && e->ctr > -4)
+			e->ctr--;
+	} else {
+		ctr2_update(&bp->counters[l->base], taken);
+	}
+
+	if (l->pred == taken)
+		return;
+
+	// Mispredicted: claim an entry in a table with longer history
+	for (int i = l->provider + 1; i < TAGE_TABLES; i++) {
+		struct tage_entry *e = &bp->tage[i][l->idx[i]];
+
+		if (e->useful == 0) {
+			e->tag = l->tag[i];
+			e->ctr = taken ? 0 : -1;
+			allocated = true;
+			break;
+		}
+	}
+	if (!allocated) {
+		for (int i = l->provider + 1; i < TAGE_TABLES; i++) {
+			struct tage_entry *e = &bp->tage[i][l->idx[i]];
+
+			if (e->useful > 0)
+				e->useful--;
+		}
+	}
+}
+
+// --- Per-branch statistics ---
+
+static u32 site_hash(u32 pc, u32 cap)
+{
+	return ((pc >> 1) * 2654435761u) & (cap - 1);
+}
+
+// Sites are created on first execution, so executed == 0 marks a free slot
+static struct bpred_site *site_slot(struct bpred_site *sites, u32 cap, u32 pc)
+{
+	u32 i = site_hash(pc, cap);
+
+	while (sites[i].executed && sites[i].pc != pc)
+		i = (i + 1) & (cap - 1);
+	return &sites[i];
+}
+
+static bool site_grow(struct bpred *bp)
+{
+	u32 cap = bp->sites_cap * 2;
+	struct bpred_site *sites = calloc(cap, sizeof(*sites));
+
+	if (!sites)
+		return false;
+	for (u32 i = 0; i < bp->sites_cap; i++) {
+		if (bp->sites[i].executed)
+			*site_slot(sites, cap, bp->sites[i].pc) = bp->sites[i];
+	}
+	free(bp->sites);
+	bp->sites = sites;
+	bp->sites_cap = cap;
+	return true;
+}
+
+// NULL for a new site when the table is at its load limit and cannot
+// grow: known sites keep counting, and the free slots keep probes finite
+static struct bpred_site *site_get(struct bpred *bp, u32 pc, u32 type)
+{
+	struct bpred_site *s;
+	bool full = (bp->nsites + 1) * 2 > bp->sites_cap && !site_grow(bp);
+
+	s = site_slot(bp->sites, bp->sites_cap, pc);
+	if (!s->executed) {
+		if (full) {
+			bp->stats.sites_dropped++;
+			return NULL;
+		}
+		s->pc = pc;
+		s->type = type;
+		bp->nsites++;
+	}
+	return s;
+}
+
+const struct bpred_site *bpred_site_find(const struct bpred *bp, u32 pc)
+{
+	const struct bpred_site *s = site_slot(bp->sites, bp->sites_cap, pc);
+
+	return s->executed ? s : NULL;
+}
+
+// --- Target prediction ---
+
+// Look up and train the BTB; true if it held the right target
+static bool btb_access(struct bpred *bp, u32 pc, u32 target)
+{
+	struct btb_entry *e =
+		&bp->btb[(pc >> 1) & ((1u << bp->cfg.btb_bits) - 1)];
+	bool hit = e->pc == pc && e->target == target;
+
+	bp->stats.btb_lookups++;
+	if (!hit)
+		bp->stats.btb_misses++;
+	e->pc = pc;
+	e->target = target;
+	return hit;
+}
+
+static void ras_push(struct bpred *bp, u32 addr)
+{
+	if (!bp->cfg.ras_depth)
+		return;
+	bp->ras[bp->ras_next] = addr;
+	bp->ras_next = (bp->ras_next + 1) % bp->cfg.ras_depth;
+	if (bp->ras_top < bp->cfg.ras_depth)
+		bp->ras_top++;
+	bp->stats.ras_pushes++;
+}
+
+static u32 ras_pop(struct bpred *bp)
+{
+	bp->ras_next = (bp->ras_next + bp->cfg.ras_depth - 1) %
+		       bp->cfg.ras_depth;
+	bp->ras_top--;
+	bp->stats.ras_pops++;
+	return bp->ras[bp->ras_next];
+}
+
+void bpred_branch(struct bpred *bp, u32 pc, u32 target, bool taken)
+{
+	struct tage_lookup l;
+	struct bpred_site *site;
+	u32 mask = (1u << bp->cfg.table_bits) - 1;
+	u32 idx;
+	bool pred;
+
+	switch (bp->cfg.kind) {
+	case BPRED_GSHARE:
+		idx = ((pc >> 1) ^ (u32)(bp->ghr & ((1ull << bp->cfg.history_bits) - 1))) &
+		      mask;
+		pred = bp->counters[idx] >= 2;
+		ctr2_update(&bp->counters[idx], taken);
+		break;
+	case BPRED_TAGE:
+		tage_lookup(bp, pc, &l);
+		pred = l.pred;
+		tage_update(bp, &l, taken);
+		break;
+	default:
+		idx = (pc >> 1) & mask;
+		pred = bp->counters[idx] >= 2;
+		ctr2_update(&bp->counters[idx], taken);
+		break;
+	}
+
+	// A taken branch also needs its target from the BTB
+	if (taken)
+		btb_access(bp, pc, target);
+
+	bp->ghr = (bp->ghr << 1) | taken;
+	bp->stats.cond++;
+	bp->stats.cond_mispredicts += pred != taken;
+
+	site = site_get(bp, pc, BRANCH_COND);
+	if (!site)
+		return;
+	site->executed++;
+	site->taken += taken;
+	site->mispredicts += pred != taken;
+}
+
+static bool is_link_reg(u32 r)
+{
+	return r == 1 || r == 5;
+}
+
+void bpred_jump(struct bpred *bp, u32 pc, u32 target, u32 rd, u32 rs1,
+		bool indirect, u32 link)
+{
+	struct bpred_site *site;
+	bool push = is_link_reg(rd);
+	bool pop = false;
+	bool mispredict = false;
+	u32 type;
+
+	// Return-address stack hints from the unprivileged spec (rd/rs1 = x1/x5)
+	if (!indirect) {
+		type = push ? BRANCH_CALL : BRANCH_JUMP;
+	} else if (is_link_reg(rs1)) {
+		pop = !push || rd != rs1;
+		type = push ? BRANCH_CALL : BRANCH_RET;
+	} else {
+		type = push ? BRANCH_CALL : BRANCH_INDIRECT;
+	}
+
+	if (pop && bp->ras_top > 0) {
+		if (ras_pop(bp) != target) {
+			bp->stats.ras_mispredicts++;
+			mispredict = true;
+		}
+	} else if (!btb_access(bp, pc, target)) {
+		// A direct jump's target is known at decode; only indirect
+		// targets count as mispredictions.
+		mispredict = indirect;
+	}
+
+	if (push)
+		ras_push(bp, link);
+
+	bp->stats.jumps++;
+	bp->stats.target_mispredicts += mispredict;
+
+	site = site_get(bp, pc, type);
+	if (!site)
+		return;
+	site->executed++;
+	site->taken++;
+	site->mispredicts += mispredict;
+}
+
+// --- Reporting ---
+
+static int site_cmp(const void *a, const void *b)
+{
+	const struct bpred_site *x = a, *y = b;
+
+	if (x->mispredicts != y->mispredicts)
+		return x->mispredicts < y->mispredicts ? 1 : -1;
+	return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+static double pct(u64 part, u64 total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+void bpred_print_stats(const struct bpred *bp, u32 top, FILE *out)
+{
+	const struct bpred_stats *s = &bp->stats;
+	struct bpred_site *sorted;
+	u32 n = 0;
+
+	fprintf(out, "Branch predictor: %s, %u entries, BTB %u, RAS %u\n",
+		kind_names[bp->cfg.kind], 1u << bp->cfg.table_bits,
+		1u << bp->cfg.btb_bits, bp->cfg.ras_depth);
+	fprintf(out, "Conditional: %llu executed, %llu mispredicted (%.2f%%)\n",
+		s->cond, s->cond_mispredicts, pct(s->cond_mispredicts, s->cond));
+	fprintf(out, "Jumps: %llu executed, %llu target mispredicts (%.2f%%)\n",
+		s->jumps, s->target_mispredicts,
+		pct(s->target_mispredicts, s->jumps));
+	fprintf(out, "BTB: %llu lookups, %llu misses; RAS: %llu pushes, %llu pops, %llu mispredicts\n",
+		s->btb_lookups, s->btb_misses, s->ras_pushes, s->ras_pops,
+		s->ras_mispredicts);
+	if (s->sites_dropped)
+		fprintf(out, "  %llu executions of branches not tracked (out of memory)\n",
+			s->sites_dropped);
+
+	if (!top || !bp->nsites)
+		return;
+	sorted = malloc(bp->nsites * sizeof(*sorted));
+	if (!sorted)
+		return;
+	for (u32 i = 0; i < bp->sites_cap; i++) {
+		if (bp->sites[i].executed)
+			sorted[n++] = bp->sites[i];
+	}
+	qsort(sorted, n, sizeof(*sorted), site_cmp);
+
+	fprintf(out, "  %-10s  %-8s  %12s  %7s  %12s  %7s\n", "pc", "type",
+		"executed", "taken", "mispredicts", "rate");
+	for (u32 i = 0; i < n && i < top; i++) {
+		const struct bpred_site *site = &sorted[i];
+
+		fprintf(out, "  0x%08x  %-8s  %12llu  %6.2f%%  %12llu  %6.2f%%\n",
+			site->pc, type_names[site->type], site->executed,
+			pct(site->taken, site->executed), site->mispredicts,
+			pct(site->mispredicts, site->executed));
+	}
+	free(sorted);
+}
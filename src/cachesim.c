@@ -0,0 +1,298 @@
+#include "cachesim.h"
+#include "cpu.h"
+#include "mmu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool is_pow2(u32 x)
+{
+	return x && !(x & (x - 1));
+}
+
+static u32 log2u(u32 x)
+{
+	u32 n = 0;
+
+	while (x >>= 1)
+		n++;
+	return n;
+}
+
+// Parse "size:ways:line[:policy]", size accepting a k/m suffix
+bool cache_config_parse(const char *spec, struct cache_config *cfg)
+{
+	char *end;
+	unsigned long v;
+
+	v = strtoul(spec, &end, 0);
+	if (*end == 'k' || *end == 'K') {
+		v <<= 10;
+		end++;
+	} else if (*end == 'm' || *end == 'M') {
+		v <<= 20;
+		end++;
+	}
+	if (*end != ':')
+		return false;
+	cfg->size = v;
+
+	cfg->ways = strtoul(end + 1, &end, 0);
+	if (*end != ':')
+		return false;
+	cfg->line_size = strtoul(end + 1, &end, 0);
+
+	cfg->policy = CACHE_LRU;
+	if (*end == ':') {
+		end++;
+		if (!strcmp(end, "lru"))
+			cfg->policy = CACHE_LRU;
+		else if (!strcmp(end, "fifo"))
+			cfg->policy = CACHE_FIFO;
+		else if (!strcmp(end, "random"))
+			cfg->policy = CACHE_RANDOM;
+		else
+			return false;
+	} else if (*end != '\0') {
+		return false;
+	}
+
+	// Sets must come out as a power of two for index masking. Checking
+	// ways first keeps ways * line_size from overflowing.
+	if (!is_pow2(cfg->line_size) || cfg->ways == 0 ||
+	    cfg->ways > cfg->size / cfg->line_size ||
+	    cfg->size % (cfg->ways * cfg->line_size))
+		return false;
+	return is_pow2(cfg->size / (cfg->ways * cfg->line_size));
+}
+
+static bool cache_init(struct cache *cache, const char *name,
+		       const struct cache_config *cfg, struct cache *next)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->name = name;
+	cache->ways = cfg->ways;
+	cache->sets = cfg->size / (cfg->ways * cfg->line_size);
+	cache->line_shift = log2u(cfg->line_size);
+	cache->policy = cfg->policy;
+	cache->next = next;
+	cache->rng = 0x2545F491;
+	cache->lines = calloc((size_t)cache->sets * cache->ways,
+			      sizeof(struct cache_line));
+	return cache->lines != NULL;
+}
+
+// xorshift32: deterministic victim choice for the random policy
+static u32 cache_rand(struct cache *cache)
+{
+	u32 x = cache->rng;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	cache->rng = x;
+	return x;
+}
+
+// Look up @addr, filling on a miss. Returns true on a hit.
+static bool cache_access(struct cache *cache, u32 addr, bool write)
+{
+	u32 line = addr >> cache->line_shift;
+	u32 set = line & (cache->sets - 1);
+	struct cache_line *ways = &cache->lines[(size_t)set * cache->ways];
+	struct cache_line *victim = NULL;
+
+	cache->accesses++;
+	cache->tick++;
+
+	for (u32 w = 0; w < cache->ways; w++) {
+		if (ways[w].valid && ways[w].tag == line) {
+			if (cache->policy == CACHE_LRU)
+				ways[w].stamp = cache->tick;
+			ways[w].dirty |= write;
+			return true;
+		}
+	}
+
+	cache->misses++;
+	if (cache->next)
+		cache_access(cache->next, addr, false);
+
+	// Prefer an empty way, then apply the replacement policy
+	for (u32 w = 0; w < cache->ways && !victim; w++) {
+		if (!ways[w].valid)
+			victim = &ways[w];
+	}
+	if (!victim && cache->policy == CACHE_RANDOM) {
+		victim = &ways[cache_rand(cache) % cache->ways];
+	} else if (!victim) {
+		victim = &ways[0];
+		for (u32 w = 1; w < cache->ways; w++) {
+			if (ways[w].stamp < victim->stamp)
+				victim = &ways[w];
+		}
+	}
+
+	if (victim->valid && victim->dirty)
+		cache->writebacks++;
+	victim->tag = line;
+	victim->valid = true;
+	victim->dirty = write;
+	victim->stamp = cache->tick;
+	return false;
+}
+
+struct cachesim *cachesim_create(const struct cache_config *l1i,
+				 const struct cache_config *l1d,
+				 const struct cache_config *l2)
+{
+	struct cachesim *sim = calloc(1, sizeof(*sim));
+	struct cache *next = NULL;
+
+	if (!sim)
+		return NULL;
+
+	if (l2) {
+		if (!cache_init(&sim->l2, "L2", l2, NULL))
+			goto fail;
+		sim->has_l2 = true;
+		next = &sim->l2;
+	}
+	if (!cache_init(&sim->l1i, "L1I", l1i, next) ||
+	    !cache_init(&sim->l1d, "L1D", l1d, next))
+		goto fail;
+	return sim;
+
+fail:
+	cachesim_destroy(sim);
+	return NULL;
+}
+
+void cachesim_destroy(struct cachesim *sim)
+{
+	if (!sim)
+		return;
+	free(sim->l1i.lines);
+	free(sim->l1d.lines);
+	free(sim->l2.lines);
+	free(sim);
+}
+
+bool cachesim_add_range(struct cachesim *sim, u32 start, u32 end)
+{
+	struct cache_range *r;
+
+	if (sim->nranges == CACHESIM_MAX_RANGES || end <= start)
+		return false;
+	r = &sim->ranges[sim->nranges++];
+	memset(r, 0, sizeof(*r));
+	r->start = start;
+	r->end = end;
+	return true;
+}
+
+void cachesim_attach(struct cpu *c, struct cachesim *sim)
+{
+	c->cachesim = sim;
+	// Refill every TLB entry so it picks up (or drops) the slow-path tag
+	mmu_flush(c);
+}
+
+// Access every line of [@paddr, @paddr + @size); true if all of them hit
+static bool cache_access_range(struct cache *cache, u32 paddr, u32 size,
+			       bool write)
+{
+	u32 line = paddr >> cache->line_shift;
+	u32 last = (paddr + size - 1) >> cache->line_shift;
+	bool hit = true;
+
+	for (; line <= last; line++)
+		hit &= cache_access(cache, line << cache->line_shift, write);
+	return hit;
+}
+
+void cachesim_access(struct cachesim *sim, u32 pc, u32 paddr, u32 size,
+		     enum mmu_access acc)
+{
+	cachesim_access_split(sim, pc, paddr, size, 0, 0, acc);
+}
+
+void cachesim_access_split(struct cachesim *sim, u32 pc, u32 paddr, u32 size,
+			   u32 paddr2, u32 size2, enum mmu_access acc)
+{
+	struct cache *cache = acc == MMU_FETCH ? &sim->l1i : &sim->l1d;
+	bool write = acc == MMU_STORE;
+	bool hit;
+
+	hit = cache_access_range(cache, paddr, size, write);
+	if (size2)
+		hit &= cache_access_range(cache, paddr2, size2, write);
+
+	for (u32 i = 0; i < sim->nranges; i++) {
+		struct cache_range *r = &sim->ranges[i];
+
+		if (pc < r->start || pc >= r->end)
+			continue;
+		if (acc == MMU_FETCH) {
+			r->fetches++;
+			r->fetch_misses += !hit;
+		} else {
+			r->data_accesses++;
+			r->data_misses += !hit;
+		}
+	}
+}
+
+u64 cachesim_event(const struct cachesim *sim, enum cache_event ev)
+{
+	if (!sim)
+		return 0;
+
+	switch (ev) {
+	case CACHE_EV_L1I_MISS:
+		return sim->l1i.misses;
+	case CACHE_EV_L1D_MISS:
+		return sim->l1d.misses;
+	case CACHE_EV_L2_MISS:
+		return sim->l2.misses;
+	case CACHE_EV_L1I_ACCESS:
+		return sim->l1i.accesses;
+	case CACHE_EV_L1D_ACCESS:
+		return sim->l1d.accesses;
+	case CACHE_EV_L2_ACCESS:
+		return sim->l2.accesses;
+	default:
+		return 0;
+	}
+}
+
+static double pct(u64 part, u64 total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+static void cache_print(const struct cache *cache, FILE *out)
+{
+	fprintf(out,
+		"%-3s: %llu accesses, %llu misses (%.2f%% miss rate), %llu writebacks\n",
+		cache->name, cache->accesses, cache->misses,
+		pct(cache->misses, cache->accesses), cache->writebacks);
+}
+
+void cachesim_print_stats(const struct cachesim *sim, FILE *out)
+{
+	cache_print(&sim->l1i, out);
+	cache_print(&sim->l1d, out);
+	if (sim->has_l2)
+		cache_print(&sim->l2, out);
+
+	for (u32 i = 0; i < sim->nranges; i++) {
+		const struct cache_range *r = &sim->ranges[i];
+
+		fprintf(out,
+			"  pc [0x%08x, 0x%08x): fetch %llu/%llu miss (%.2f%%), data %llu/%llu miss (%.2f%%)\n",
+			r->start, r->end, r->fetch_misses, r->fetches,
+			pct(r->fetch_misses, r->fetches), r->data_misses,
+			r->data_accesses, pct(r->data_misses, r->data_accesses));
+	}
+}
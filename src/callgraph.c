@@ -0,0 +1,443 @@
+#include "callgraph.h"
+#include "cpu.h"
+#include "elf_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct callgraph *callgraph_create(const struct symtab *syms)
+{
+	struct callgraph *cg = calloc(1, sizeof(*cg));
+
+	if (!cg)
+		return NULL;
+	cg->syms = syms;
+	cg->fn_slots_cap = 256;
+	cg->fn_slots = calloc(cg->fn_slots_cap, sizeof(u32));
+	cg->edge_slots_cap = 256;
+	cg->edge_slots = calloc(cg->edge_slots_cap, sizeof(u32));
+	if (!cg->fn_slots || !cg->edge_slots) {
+		callgraph_destroy(cg);
+		return NULL;
+	}
+	return cg;
+}
+
+void callgraph_destroy(struct callgraph *cg)
+{
+	if (!cg)
+		return;
+	free(cg->fns);
+	free(cg->edges);
+	free(cg->fn_slots);
+	free(cg->edge_slots);
+	free(cg->stack);
+	free(cg);
+}
+
+// --- Functions and edges ---
+
+static u32 cg_hash(u32 key, u32 cap)
+{
+	return (key * 2654435761u) & (cap - 1);
+}
+
+static u32 edge_hash(u32 caller, u32 site, u32 callee, u32 cap)
+{
+	return cg_hash((site >> 1) ^ (caller * 0x9E3779B9u) ^
+			       (callee * 0x85EBCA6Bu),
+		       cap);
+}
+
+static u32 *fn_slot(const struct callgraph *cg, u32 *slots, u32 cap,
+		    u32 addr)
+{
+	u32 i = cg_hash(addr >> 1, cap);
+
+	while (slots[i] && cg->fns[slots[i] - 1].addr != addr)
+		i = (i + 1) & (cap - 1);
+	return &slots[i];
+}
+
+static u32 *edge_slot(const struct callgraph *cg, u32 *slots, u32 cap,
+		      u32 caller, u32 site, u32 callee)
+{
+	u32 i = edge_hash(caller, site, callee, cap);
+
+	while (slots[i]) {
+		const struct callgraph_edge *e = &cg->edges[slots[i] - 1];
+
+		if (e->caller == caller && e->site == site &&
+		    e->callee == callee)
+			break;
+		i = (i + 1) & (cap - 1);
+	}
+	return &slots[i];
+}
+
+// Make room for one more element in *@arr, doubling its capacity
+static bool cg_reserve(void **arr, u32 *cap, u32 n, size_t size)
+{
+	u32 new_cap = *cap ? *cap * 2 : 64;
+	void *p;
+
+	if (n < *cap)
+		return true;
+	p = realloc(*arr, new_cap * size);
+	if (!p)
+		return false;
+	*arr = p;
+	*cap = new_cap;
+	return true;
+}
+
+// Rehash the function index at twice the size once it is half full
+static bool fn_index_grow(struct callgraph *cg)
+{
+	u32 cap = cg->fn_slots_cap * 2;
+	u32 *slots;
+
+	if ((cg->nfns + 1) * 2 <= cg->fn_slots_cap)
+		return true;
+	slots = calloc(cap, sizeof(u32));
+	if (!slots)
+		return false;
+	for (u32 i = 0; i < cg->nfns; i++)
+		*fn_slot(cg, slots, cap, cg->fns[i].addr) = i + 1;
+	free(cg->fn_slots);
+	cg->fn_slots = slots;
+	cg->fn_slots_cap = cap;
+	return true;
+}
+
+static bool edge_index_grow(struct callgraph *cg)
+{
+	u32 cap = cg->edge_slots_cap * 2;
+	u32 *slots;
+
+	if ((cg->nedges + 1) * 2 <= cg->edge_slots_cap)
+		return true;
+	slots = calloc(cap, sizeof(u32));
+	if (!slots)
+		return false;
+	for (u32 i = 0; i < cg->nedges; i++) {
+		const struct callgraph_edge *e = &cg->edges[i];
+
+		*edge_slot(cg, slots, cap, e->caller, e->site, e->callee) =
+			i + 1;
+	}
+	free(cg->edge_slots);
+	cg->edge_slots = slots;
+	cg->edge_slots_cap = cap;
+	return true;
+}
+
+// The function @target belongs to, created on first use
+static u32 cg_fn(struct callgraph *cg, u32 target)
+{
+	const struct symbol *s = NULL;
+	struct callgraph_fn *f;
+	u32 addr = target;
+	u32 *slot;
+
+	if (cg->syms && cg->syms->count)
+		s = symtab_find(cg->syms, target);
+	// A sized symbol must contain the target; an unsized one is a label
+	// that runs up to the next symbol
+	if (s && (!s->size || target - s->addr < s->size))
+		addr = s->addr;
+	else
+		s = NULL;
+
+	if (!fn_index_grow(cg))
+		return CALLGRAPH_NONE;
+	slot = fn_slot(cg, cg->fn_slots, cg->fn_slots_cap, addr);
+	if (*slot)
+		return *slot - 1;
+	if (!cg_reserve((void **)&cg->fns, &cg->fns_cap, cg->nfns,
+			sizeof(*cg->fns)))
+		return CALLGRAPH_NONE;
+	f = &cg->fns[cg->nfns];
+	memset(f, 0, sizeof(*f));
+	f->addr = addr;
+	f->name = s ? s->name : NULL;
+	*slot = ++cg->nfns;
+	return cg->nfns - 1;
+}
+
+static u32 cg_edge(struct callgraph *cg, u32 caller, u32 site, u32 callee)
+{
+	struct callgraph_edge *e;
+	u32 *slot;
+
+	if (!edge_index_grow(cg))
+		return CALLGRAPH_NONE;
+	slot = edge_slot(cg, cg->edge_slots, cg->edge_slots_cap, caller, site,
+			 callee);
+	if (*slot)
+		return *slot - 1;
+	if (!cg_reserve((void **)&cg->edges, &cg->edges_cap, cg->nedges,
+			sizeof(*cg->edges)))
+		return CALLGRAPH_NONE;
+	e = &cg->edges[cg->nedges];
+	memset(e, 0, sizeof(*e));
+	e->caller = caller;
+	e->site = site;
+	e->callee = callee;
+	*slot = ++cg->nedges;
+	return cg->nedges - 1;
+}
+
+// --- Shadow stack ---
+
+static bool cg_push(struct callgraph *cg, u32 fn, u32 edge, u32 ret, u64 now)
+{
+	struct callgraph_frame *f;
+
+	if (!cg_reserve((void **)&cg->stack, &cg->stack_cap, cg->depth,
+			sizeof(*cg->stack)))
+		return false;
+	f = &cg->stack[cg->depth++];
+	f->fn = fn;
+	f->edge = edge;
+	f->ret = ret;
+	f->entry = now;
+	cg->fns[fn].active++;
+	if (cg->depth > cg->stats.max_depth)
+		cg->stats.max_depth = cg->depth;
+	return true;
+}
+
+static void cg_pop(struct callgraph *cg, u64 now)
+{
+	const struct callgraph_frame *f = &cg->stack[--cg->depth];
+	struct callgraph_fn *fn = &cg->fns[f->fn];
+
+	if (f->edge != CALLGRAPH_NONE)
+		cg->edges[f->edge].inclusive += now - f->entry;
+	// Recursive activations are inside the outermost one
+	if (!--fn->active)
+		fn->inclusive += now - f->entry;
+}
+
+// Assign everything up to @now to the function on top of the stack
+static void cg_charge(struct callgraph *cg, u64 now)
+{
+	cg->fns[cg->stack[cg->depth - 1].fn].self += now - cg->charged;
+	cg->charged = now;
+}
+
+bool callgraph_start(struct callgraph *cg, const struct cpu *c)
+{
+	u32 root;
+
+	if (cg->depth)
+		return false;
+	root = cg_fn(cg, c->pc);
+	// An odd return address: no return ever pops the root
+	if (root == CALLGRAPH_NONE || !cg_push(cg, root, CALLGRAPH_NONE, 1,
+					       c->insn_count))
+		return false;
+	cg->charged = c->insn_count;
+	return true;
+}
+
+static bool is_link_reg(u32 r)
+{
+	return r == 1 || r == 5;
+}
+
+static void cg_return(struct callgraph *cg, u32 target, u64 now)
+{
+	u32 i = cg->depth - 1;
+
+	while (i > 0 && cg->stack[i].ret != target)
+		i--;
+	if (i == 0) {
+		cg->stats.unmatched++;
+		return;
+	}
+	while (cg->depth > i)
+		cg_pop(cg, now);
+	cg->stats.returns++;
+}
+
+static void cg_call(struct callgraph *cg, u32 site, u32 target, u32 link,
+		    u64 now)
+{
+	u32 caller = cg->stack[cg->depth - 1].fn;
+	u32 callee, edge;
+
+	if (cg->depth == CALLGRAPH_MAX_DEPTH)
+		goto drop;
+	callee = cg_fn(cg, target);
+	if (callee == CALLGRAPH_NONE)
+		goto drop;
+	edge = cg_edge(cg, caller, site, callee);
+	if (edge == CALLGRAPH_NONE || !cg_push(cg, callee, edge, link, now))
+		goto drop;
+	cg->fns[callee].calls++;
+	cg->edges[edge].calls++;
+	cg->stats.calls++;
+	return;
+
+drop:
+	cg->stats.dropped++;
+}
+
+void callgraph_jump(struct callgraph *cg, const struct cpu *c, u32 target,
+		    u32 rd, u32 rs1, bool indirect, u32 link)
+{
+	// Return-address stack hints from the unprivileged spec, as in bpred
+	bool push = is_link_reg(rd);
+	bool pop = indirect && is_link_reg(rs1) && (!push || rd != rs1);
+	u64 now = cpu_insn_count(c) + 1;
+
+	if (!cg->depth || (!push && !pop))
+		return;
+	// The jump itself belongs to the function it leaves
+	cg_charge(cg, now);
+	if (pop)
+		cg_return(cg, target, now);
+	if (push)
+		cg_call(cg, c->pc, target, link, now);
+}
+
+void callgraph_stop(struct callgraph *cg, const struct cpu *c)
+{
+	if (!cg->depth)
+		return;
+	cg_charge(cg, c->insn_count);
+	while (cg->depth)
+		cg_pop(cg, c->insn_count);
+}
+
+// --- Reporting ---
+
+// Callgrind name compression: "(id) name" the first time, "(id)" after
+static void put_fn(const struct callgraph *cg, FILE *out, u32 fn, bool *named)
+{
+	const struct callgraph_fn *f = &cg->fns[fn];
+
+	fprintf(out, "(%u)", fn + 1);
+	if (!named[fn]) {
+		named[fn] = true;
+		if (f->name)
+			fprintf(out, " %s", f->name);
+		else
+			fprintf(out, " 0x%08x", f->addr);
+	}
+	fputc('\n', out);
+}
+
+static int edge_cmp(const void *a, const void *b)
+{
+	const struct callgraph_edge *x = a, *y = b;
+
+	if (x->caller != y->caller)
+		return x->caller < y->caller ? -1 : 1;
+	if (x->site != y->site)
+		return x->site < y->site ? -1 : 1;
+	return x->callee < y->callee ? -1 : x->callee > y->callee;
+}
+
+bool callgraph_write_callgrind(const struct callgraph *cg, FILE *out,
+			       const char *cmd)
+{
+	struct callgraph_edge *edges = NULL;
+	bool *named = calloc(cg->nfns ? cg->nfns : 1, sizeof(bool));
+	u64 total = 0;
+	u32 e = 0;
+
+	if (cg->nedges)
+		edges = malloc(cg->nedges * sizeof(*edges));
+	if (!named || (cg->nedges && !edges)) {
+		free(named);
+		free(edges);
+		return false;
+	}
+	if (cg->nedges)
+		memcpy(edges, cg->edges, cg->nedges * sizeof(*edges));
+	qsort(edges, cg->nedges, sizeof(*edges), edge_cmp);
+	for (u32 i = 0; i < cg->nfns; i++)
+		total += cg->fns[i].self;
+
+	fprintf(out, "# callgrind format\n");
+	fprintf(out, "version: 1\n");
+	fprintf(out, "creator: rv32i\n");
+	fprintf(out, "cmd: %s\n", cmd);
+	fprintf(out, "positions: instr\n");
+	fprintf(out, "events: Ir\n");
+	fprintf(out, "summary: %llu\n", total);
+
+	// Self cost sits on the entry; calls on their call sites
+	for (u32 i = 0; i < cg->nfns; i++) {
+		const struct callgraph_fn *f = &cg->fns[i];
+
+		fprintf(out, "\nfn=");
+		put_fn(cg, out, i, named);
+		fprintf(out, "0x%08x %llu\n", f->addr, f->self);
+		for (; e < cg->nedges && edges[e].caller == i; e++) {
+			fprintf(out, "cfn=");
+			put_fn(cg, out, edges[e].callee, named);
+			fprintf(out, "calls=%llu 0x%08x\n", edges[e].calls,
+				cg->fns[edges[e].callee].addr);
+			fprintf(out, "0x%08x %llu\n", edges[e].site,
+				edges[e].inclusive);
+		}
+	}
+	free(edges);
+	free(named);
+	return !ferror(out);
+}
+
+static int fn_cmp(const void *a, const void *b)
+{
+	const struct callgraph_fn *x = a, *y = b;
+
+	if (x->inclusive != y->inclusive)
+		return x->inclusive < y->inclusive ? 1 : -1;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static double pct(u64 part, u64 total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+void callgraph_print_stats(const struct callgraph *cg, u32 top, FILE *out)
+{
+	const struct callgraph_stats *s = &cg->stats;
+	struct callgraph_fn *sorted;
+	u64 total = 0;
+
+	for (u32 i = 0; i < cg->nfns; i++)
+		total += cg->fns[i].self;
+	fprintf(out, "Call graph: %u functions, %llu calls, %llu returns (%llu unmatched), max depth %u\n",
+		cg->nfns, s->calls, s->returns, s->unmatched, s->max_depth);
+	if (s->dropped)
+		fprintf(out, "  %llu calls not followed\n", s->dropped);
+
+	if (!top || !cg->nfns)
+		return;
+	sorted = malloc(cg->nfns * sizeof(*sorted));
+	if (!sorted)
+		return;
+	memcpy(sorted, cg->fns, cg->nfns * sizeof(*sorted));
+	qsort(sorted, cg->nfns, sizeof(*sorted), fn_cmp);
+
+	fprintf(out, "  %12s  %7s  %12s  %7s  %10s  %s\n", "inclusive", "",
+		"self", "", "calls", "function");
+	for (u32 i = 0; i < cg->nfns && i < top; i++) {
+		const struct callgraph_fn *f = &sorted[i];
+
+		fprintf(out, "  %12llu  %6.2f%%  %12llu  %6.2f%%  %10llu  ",
+			f->inclusive, pct(f->inclusive, total), f->self,
+			pct(f->self, total), f->calls);
+		if (f->name)
+			fprintf(out, "%s\n", f->name);
+		else
+			fprintf(out, "0x%08x\n", f->addr);
+	}
+	free(sorted);
+}
@@ -0,0 +1,77 @@
+#include "clint.h"
+#include "cpu.h"
+#include "csr.h"
+
+#include <string.h>
+
+void clint_reset(struct cpu *c)
+{
+	memset(&c->clint, 0, sizeof(c->clint));
+	c->clint.mtimecmp = CLINT_NEVER;
+}
+
+u64 clint_mtime(const struct cpu *c)
+{
+	return cpu_insn_count(c) + c->clint.mtime_offset;
+}
+
+void clint_skip(struct cpu *c, u64 ticks)
+{
+	c->clint.mtime_offset += ticks;
+	c->clint.stats.ticks_skipped += ticks;
+}
+
+// Replace the 32-bit half of @reg that @off selects
+static u64 set_half(u64 reg, u32 off, u32 val)
+{
+	if (off & 4)
+		return (reg & 0xFFFFFFFFull) | ((u64)val << 32);
+	return (reg & ~0xFFFFFFFFull) | val;
+}
+
+bool clint_load(struct cpu *c, u32 off, int size, u32 *val)
+{
+	if (size != 4 || (off & 3))
+		return false;
+	if (off == CLINT_MSIP) {
+		*val = c->clint.msip;
+	} else if ((off & ~4u) == CLINT_MTIMECMP) {
+		*val = (u32)(c->clint.mtimecmp >> (off & 4 ? 32 : 0));
+	} else if ((off & ~4u) == CLINT_MTIME) {
+		*val = (u32)(clint_mtime(c) >> (off & 4 ? 32 : 0));
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool clint_store(struct cpu *c, u32 off, int size, u32 val)
+{
+	if (size != 4 || (off & 3))
+		return false;
+	if (off == CLINT_MSIP) {
+		c->clint.msip = val & 1;
+	} else if ((off & ~4u) == CLINT_MTIMECMP) {
+		c->clint.mtimecmp = set_half(c->clint.mtimecmp, off, val);
+	} else if ((off & ~4u) == CLINT_MTIME) {
+		// Time keeps counting from the value written
+		u64 t = set_half(clint_mtime(c), off, val);
+
+		c->clint.mtime_offset = t - cpu_insn_count(c);
+	} else {
+		return false;
+	}
+	clint_update_mip(c);
+	return true;
+}
+
+void clint_update_mip(struct cpu *c)
+{
+	u32 mip = c->csr.mip & ~(MIP_MTIP | MIP_MSIP);
+
+	if (clint_mtime(c) >= c->clint.mtimecmp)
+		mip |= MIP_MTIP;
+	if (c->clint.msip)
+		mip |= MIP_MSIP;
+	c->csr.mip = mip;
+}
@@ -1,28 +1,45 @@
 #include "cpu.h"
 #include "memory.h"
 #include "instr.h"
+#include "mmu.h"
+#include "perfmap.h"
+#include "trace.h"
+#include "accel.h"
+#include "idle.h"
+#include "clint.h"
+#include "fpu.h"
+#include "replay.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
 
 struct cpu *cpu_create(u32 mem_size)
 {
 	struct cpu *c = malloc(sizeof(struct cpu));
-	if (!c) {
-		fprintf(stderr, "Failed to allocate CPU\n");
-		exit(1);
-	}
+	if (!c)
+		return NULL;
 
-	c->pc = 0;
-	memset(c->registers, 0, sizeof(c->registers));
-	memset(c->prev_registers, 0, sizeof(c->prev_registers));
-	c->memory = memory_create(mem_size);
-	c->state = CPU_STATE_RUNNING;
-	c->reservation_set = 0;
-	c->reservation_address = 0;
-	memset(c->output_buffer, 0, OUTPUT_BUFFER_SIZE);
-	c->output_buffer_pos = 0;
+	// Physical memory is a whole number of pages so a TLB entry never
+	// maps a partial page.
+	c->mem_size = (mem_size + PAGE_MASK) & ~PAGE_MASK;
+	if (c->mem_size < mem_size || c->mem_size == 0 ||
+	    !(c->memory = memory_create(c->mem_size))) {
+		free(c);
+		return NULL;
+	}
+	c->cachesim = NULL;
+	c->bpred = NULL;
+	c->replay = NULL;
+	c->perfmap = NULL;
+	c->fuzz = NULL;
+	c->traces = NULL;
+	c->accel = NULL;
+	c->idle = NULL;
+	c->callgraph = NULL;
+	c->break_pc = CPU_NO_BREAK;
+	c->nhost_syscalls = 0;
+	c->vec.reference = false;
+	cpu_reset(c);
 
 	return c;
 }
@@ -31,6 +48,7 @@ void cpu_destroy(struct cpu *c)
 {
 	if (!c)
 		return;
+	fpu_release(c);
 	memory_destroy(c->memory);
 	free(c);
 }
@@ -42,32 +60,384 @@ void cpu_reset(struct cpu *c)
 	c->pc = 0;
 	memset(c->registers, 0, sizeof(c->registers));
 	memset(c->prev_registers, 0, sizeof(c->prev_registers));
-	memset(c->memory, 0, MEM_SIZE);
+	memset(c->memory, 0, c->mem_size);
 	c->state = CPU_STATE_RUNNING;
+	c->stop = CPU_STOP_HALT;
+	c->resume_pc = 0;
+	c->insn_count = 0;
+	c->block_pc = CPU_NO_BLOCK;
+	c->block_counted = 0;
+	c->exit_code = 0;
+	c->trap_cause = CPU_NO_TRAP;
+	c->trap_tval = 0;
 	c->reservation_set = 0;
 	c->reservation_address = 0;
 	memset(c->output_buffer, 0, OUTPUT_BUFFER_SIZE);
 	c->output_buffer_pos = 0;
+
+	c->priv = PRV_M;
+	csr_reset(c);
+	clint_reset(c);
+	vector_reset(c);
+	fpu_reset(c);
+	c->in_trace = false;
+	c->trace_device_exit = false;
+	mmu_flush(c);
+	memset(&c->mmu_stats, 0, sizeof(c->mmu_stats));
+#ifdef CONFIG_INSN_MIX
+	memset(&c->mix, 0, sizeof(c->mix));
+#endif
+
+	// An odd pc never matches, so every entry starts out invalid
+	for (u32 i = 0; i < DECODE_CACHE_SIZE; i++) {
+		c->decode_cache[i].pc = 1;
+	}
+}
+
+bool cpu_register_syscall(struct cpu *c, u32 num, syscall_fn fn,
+			  void *opaque)
+{
+	u32 i;
+
+	for (i = 0; i < c->nhost_syscalls; i++) {
+		if (c->host_syscalls[i].num == num)
+			break;
+	}
+	if (!fn) {
+		// Unregister: move the last entry into the hole
+		if (i < c->nhost_syscalls)
+			c->host_syscalls[i] =
+				c->host_syscalls[--c->nhost_syscalls];
+		return true;
+	}
+	if (i == CPU_MAX_HOST_SYSCALLS)
+		return false;
+	if (i == c->nhost_syscalls)
+		c->nhost_syscalls++;
+	c->host_syscalls[i].num = num;
+	c->host_syscalls[i].fn = fn;
+	c->host_syscalls[i].opaque = opaque;
+	return true;
+}
+
+void cpu_set_priv(struct cpu *c, u32 priv)
+{
+	// TLB entries carry the permission checks of the mode that filled
+	// them, so they are only reusable across modes without translation.
+	if (priv != c->priv && (c->csr.satp & SATP_MODE))
+		mmu_flush(c);
+	c->priv = priv;
+}
+
+// Enter the S- or M-mode handler for @cause, returning its trap vector,
+// or 0 without touching anything when none is installed
+static u32 cpu_enter_handler(struct cpu *c, u32 cause, u32 tval, bool to_s)
+{
+	u32 tvec = to_s ? c->csr.stvec : c->csr.mtvec;
+
+	if (tvec == 0)
+		return 0;
+	if (to_s) {
+		u32 s = c->csr.mstatus;
+
+		c->csr.sepc = c->pc;
+		c->csr.scause = cause;
+		c->csr.stval = tval;
+		s = (s & ~MSTATUS_SPIE) | ((s & MSTATUS_SIE) ? MSTATUS_SPIE : 0);
+		s = (s & ~MSTATUS_SPP) | (c->priv == PRV_S ? MSTATUS_SPP : 0);
+		c->csr.mstatus = s & ~MSTATUS_SIE;
+		cpu_set_priv(c, PRV_S);
+	} else {
+		u32 s = c->csr.mstatus;
+
+		c->csr.mepc = c->pc;
+		c->csr.mcause = cause;
+		c->csr.mtval = tval;
+		s = (s & ~MSTATUS_MPIE) | ((s & MSTATUS_MIE) ? MSTATUS_MPIE : 0);
+		s = (s & ~MSTATUS_MPP) | (c->priv << 11);
+		c->csr.mstatus = s & ~MSTATUS_MIE;
+		cpu_set_priv(c, PRV_M);
+	}
+	return tvec;
+}
+
+void cpu_trap(struct cpu *c, u32 cause, u32 tval)
+{
+	bool to_s = c->priv <= PRV_S && ((c->csr.medeleg >> cause) & 1);
+	u32 tvec;
+
+#ifdef CONFIG_INSN_MIX
+	c->mix.traps++;
+#endif
+	// The instruction is still stepped but does not retire
+	c->csr.minstret_offset--;
+	tvec = cpu_enter_handler(c, cause, tval, to_s);
+	if (tvec == 0) {
+		// No handler installed: stop at the faulting instruction, like
+		// EBREAK does, and leave reporting it to the host.
+		c->trap_cause = cause;
+		c->trap_tval = tval;
+		cpu_halt(c, CPU_STOP_HALT);
+		return;
+	}
+
+	// Exceptions always use the base address.
+	c->next_pc = tvec & ~3u;
+}
+
+bool cpu_interrupt(struct cpu *c)
+{
+	// Machine before supervisor; external, software, then timer
+	static const u8 order[] = { 11, 3, 7, 9, 1, 5 };
+	u32 s = c->csr.mstatus;
+	bool m_on = c->priv < PRV_M || (s & MSTATUS_MIE);
+	bool s_on = c->priv < PRV_S || (c->priv == PRV_S && (s & MSTATUS_SIE));
+	u32 pending;
+
+	clint_update_mip(c);
+	pending = c->csr.mip & c->csr.mie;
+	if (!pending)
+		return false;
+
+	for (u32 i = 0; i < sizeof(order); i++) {
+		u32 irq = order[i];
+		bool to_s = (c->csr.mideleg >> irq) & 1;
+		u32 tvec;
+
+		if (!((pending >> irq) & 1) || !(to_s ? s_on : m_on))
+			continue;
+		tvec = cpu_enter_handler(c, CAUSE_INTERRUPT | irq, 0, to_s);
+		if (tvec == 0) {
+			c->trap_cause = CAUSE_INTERRUPT | irq;
+			c->trap_tval = 0;
+			cpu_halt(c, CPU_STOP_HALT);
+			return true;
+		}
+		// Vectored mode enters at base + 4 * cause
+		c->pc = (tvec & ~3u) + ((tvec & 1) ? 4 * irq : 0);
+		return true;
+	}
+	return false;
+}
+
+void cpu_wfi(struct cpu *c, u32 size)
+{
+	u64 now;
+
+	c->clint.stats.wfis++;
+	clint_update_mip(c);
+	if (c->csr.mip & c->csr.mie)
+		return;
+
+	// Only the timer can fire on its own: sleep until its deadline, and
+	// the interrupt is taken (or WFI falls through) right after
+	now = clint_mtime(c);
+	if ((c->csr.mie & MIP_MTIP) && c->clint.mtimecmp != CLINT_NEVER) {
+		clint_skip(c, c->clint.mtimecmp - now);
+		return;
+	}
+	cpu_halt(c, CPU_STOP_IDLE);
+	c->resume_pc = c->pc + size;
+}
+
+void cpu_set_irq(struct cpu *c, u32 bits, bool level)
+{
+	bits &= MIP_MEIP | MIP_SEIP;
+	if (c->replay) {
+		replay_irq(c, bits, level);
+		return;
+	}
+	if (level)
+		c->csr.mip |= bits;
+	else
+		c->csr.mip &= ~bits;
+}
+
+// Fetch and decode the instruction at pc, or return NULL after a fetch
+// fault. Compressed instructions are expanded once and then reused.
+static const Instruction *cpu_fetch(struct cpu *c)
+{
+	struct decode_entry *e;
+	u32 raw;
+
+	if (!mmu_fetch_insn(c, c->pc, &raw))
+		return NULL;
+
+	e = &c->decode_cache[(c->pc >> 1) & (DECODE_CACHE_SIZE - 1)];
+	if (e->pc != c->pc || e->instr.raw != raw) {
+		instr_decode(&e->instr, raw);
+		e->pc = c->pc;
+	}
+	return &e->instr;
 }
 
 void cpu_step(struct cpu *c)
 {
+	if (c->csr.mie && cpu_interrupt(c) && c->state != CPU_STATE_RUNNING)
+		return;
+
 	// Store current registers before execution
 	memcpy(c->prev_registers, c->registers, sizeof(c->registers));
 
-	// Fetch the raw instruction
-	u32 raw_instr = mem_load32(c->memory, c->pc);
+	// A block of one instruction
+	cpu_exec_block(c, 1);
+}
 
-	// Execute the instruction
-	instr_exec(c, raw_instr);
+void cpu_run(struct cpu *c)
+{
+	while (cpu_run_for(c, ~0ull, NULL) == CPU_STOP_BUDGET)
+		;
+}
 
-	// Move to the next instruction
-	c->pc += 4;
+void cpu_halt(struct cpu *c, enum cpu_stop why)
+{
+	c->state = CPU_STATE_HALTED;
+	c->stop = why;
+	c->next_pc = c->pc;
 }
 
-void cpu_run(struct cpu *c)
+// Control leaves the straight line on a taken branch, jump, trap or halt,
+// and the block ends in front of break_pc. Unlike cpu_step, the previous
+// registers are not kept for the TUI.
+void cpu_exec_block(struct cpu *c, u32 max)
 {
+	const u32 break_pc = c->break_pc;
+	u32 n;
+
+	c->block_pc = c->pc;
+	c->block_counted = 0;
+	for (n = 1;; n++) {
+		const Instruction *instr = cpu_fetch(c);
+		u32 fallthrough;
+
+		// A fetch fault has set next_pc; the instruction still counts
+		if (!instr) {
+			c->pc = c->next_pc;
+			break;
+		}
+		fallthrough = c->pc + instr->size;
+		c->next_pc = fallthrough;
+		instr_exec_decoded(c, instr);
+		c->pc = c->next_pc;
+		if (c->pc != fallthrough || c->pc == break_pc || n == max)
+			break;
+	}
+	c->insn_count += n - c->block_counted;
+	c->block_pc = CPU_NO_BLOCK;
+}
+
+// A block spans at most CPU_BLOCK_MAX instructions of up to two slots
+_Static_assert(DECODE_CACHE_SIZE >= 2 * CPU_BLOCK_MAX,
+	       "a block's instructions must not share decode cache entries");
+
+u64 cpu_insn_count(const struct cpu *c)
+{
+	u64 n = c->insn_count;
+	u32 pc;
+
+	if (c->block_pc == CPU_NO_BLOCK)
+		return n;
+	// The block ran straight from block_pc, and every instruction of it
+	// is still in its own decode cache entry
+	n -= c->block_counted;
+	for (pc = c->block_pc; pc != c->pc;) {
+		const struct decode_entry *e =
+			&c->decode_cache[(pc >> 1) & (DECODE_CACHE_SIZE - 1)];
+
+		if (e->pc != pc)
+			break;
+		pc += e->instr.size;
+		n++;
+	}
+	return n;
+}
+
+// Shorten @left so that a block ends when the timer is due
+static u64 cpu_timer_limit(struct cpu *c, u64 left)
+{
+	u64 now;
+
+	if (!(c->csr.mie & MIP_MTIP))
+		return left;
+	now = clint_mtime(c);
+	if (c->clint.mtimecmp > now && c->clint.mtimecmp - now < left)
+		return c->clint.mtimecmp - now;
+	return left;
+}
+
+enum cpu_stop cpu_run_for(struct cpu *c, u64 max_insns, u64 *retired)
+{
+	u32 outer_pc = c->block_pc;
+	u32 outer_counted;
+	u64 start;
+
+	// Called from inside a block (a vmcall from a syscall handler): count
+	// it up to here, and leave the rest to it once this returns
+	if (outer_pc != CPU_NO_BLOCK) {
+		u64 now = cpu_insn_count(c);
+
+		c->block_counted += now - c->insn_count;
+		c->insn_count = now;
+		c->block_pc = CPU_NO_BLOCK;
+	}
+	outer_counted = c->block_counted;
+	start = c->insn_count;
+
 	while (c->state == CPU_STATE_RUNNING) {
-		cpu_step(c);
+		u64 used = c->insn_count - start;
+		u64 left = max_insns - used;
+		u32 pc = c->pc;
+
+		// A vmcall from a syscall handler can run past the budget
+		if (used >= max_insns)
+			break;
+		if (pc == c->break_pc) {
+			cpu_halt(c, CPU_STOP_BREAKPOINT);
+			break;
+		}
+		if (c->replay) {
+			replay_irq_sync(c);
+			if (c->state != CPU_STATE_RUNNING)
+				break;
+			left = replay_irq_limit(c, left);
+		}
+		// Interrupts are taken between blocks, which end at the deadline
+		if (c->csr.mie) {
+			if (cpu_interrupt(c))
+				continue;
+			left = cpu_timer_limit(c, left);
+		}
+		// Blocks start where calls land, so this sees every call
+		if (c->accel && accel_call(c->accel, c, left))
+			continue;
+		if (left > CPU_BLOCK_MAX)
+			left = CPU_BLOCK_MAX;
+		if (c->perfmap)
+			perfmap_exec_block(c->perfmap, c, left);
+		else if (c->traces)
+			trace_exec_block(c->traces, c, left);
+		else
+			cpu_exec_block(c, left);
+		// Only a block that jumps back to its own start can be a spin
+		if (c->idle && c->pc == pc && c->state == CPU_STATE_RUNNING) {
+			left = max_insns - (c->insn_count - start);
+			if (c->replay)
+				left = replay_irq_limit(c, left);
+			idle_loop(c->idle, c, left);
+		}
 	}
+	fpu_sync(c);
+	c->block_pc = outer_pc;
+	c->block_counted = outer_counted;
+	if (retired)
+		*retired = c->insn_count - start;
+	return c->state == CPU_STATE_RUNNING ? CPU_STOP_BUDGET : c->stop;
+}
+
+void cpu_resume(struct cpu *c)
+{
+	if (c->state != CPU_STATE_HALTED || c->stop == CPU_STOP_HALT)
+		return;
+	c->pc = c->resume_pc;
+	c->state = CPU_STATE_RUNNING;
 }
@@ -0,0 +1,362 @@
+#include "csr.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "cachesim.h"
+#include "clint.h"
+#include "fpu.h"
+#include "vector.h"
+
+#include <string.h>
+
+/* RV32 with I, M, A, F, D, B, C, S and U */
+#define MISA_VALUE                                                    \
+	((1u << 30) | (1u << ('I' - 'A')) | (1u << ('M' - 'A')) |    \
+	 (1u << ('A' - 'A')) | (1u << ('F' - 'A')) | (1u << ('D' - 'A')) | \
+	 (1u << ('B' - 'A')) | (1u << ('C' - 'A')) | (1u << ('S' - 'A')) | \
+	 (1u << ('U' - 'A')))
+
+#define MSTATUS_MASK                                                  \
+	(MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE |   \
+	 MSTATUS_SPP | MSTATUS_VS | MSTATUS_MPP | MSTATUS_FS |       \
+	 MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR | MSTATUS_TW)
+
+/* Supervisor software, timer and external interrupts */
+#define SIP_MASK ((1u << 1) | (1u << 5) | (1u << 9))
+
+/* Every exception except an ECALL from M-mode can be delegated */
+#define MEDELEG_MASK 0x0000B3FFu
+
+void csr_reset(struct cpu *c)
+{
+	memset(&c->csr, 0, sizeof(c->csr));
+	// The vector unit and FPU start on, so bare-metal code needs no setup
+	c->csr.mstatus = MSTATUS_VS_INITIAL | MSTATUS_FS_INITIAL;
+}
+
+// mstatus as read: SD summarises the extension state fields
+static u32 csr_mstatus(const struct csr_state *s)
+{
+	if ((s->mstatus & MSTATUS_VS) == MSTATUS_VS_DIRTY ||
+	    (s->mstatus & MSTATUS_FS) == MSTATUS_FS_DIRTY)
+		return s->mstatus | MSTATUS_SD;
+	return s->mstatus;
+}
+
+// Counter n (3..31) reports cache model event n - 2, if there is one
+static u32 csr_hpm_event(u32 n)
+{
+	return n - 2 < CACHE_EV_COUNT ? n - 2 : CACHE_EV_NONE;
+}
+
+// mhpmcounterN[h], hpmcounterN[h] and mhpmeventN for N = 3..31
+static bool csr_is_hpm(u32 addr)
+{
+	u32 base = addr & ~0x1Fu;
+
+	if (addr >= CSR_MHPMEVENT3 && addr <= CSR_MHPMEVENT31)
+		return true;
+	if (base != 0xB00 && base != 0xB80 && base != 0xC00 && base != 0xC80)
+		return false;
+	return (addr & 0x1F) >= 3;
+}
+
+static u32 csr_read_hpm(struct cpu *c, u32 addr)
+{
+	u64 count;
+
+	if (addr >= CSR_MHPMEVENT3 && addr <= CSR_MHPMEVENT31)
+		return csr_hpm_event(addr - CSR_MHPMEVENT3 + 3);
+
+	count = cachesim_event(c->cachesim, csr_hpm_event(addr & 0x1F));
+	return (addr & 0x80) ? (u32)(count >> 32) : (u32)count;
+}
+
+// The unprivileged counters (cycle, time, instret, hpmcounterN and their
+// upper halves) need their bit in mcounteren below M-mode, and in
+// scounteren too in U-mode
+static bool csr_counter_enabled(const struct cpu *c, u32 addr)
+{
+	u32 bit = 1u << (addr & 0x1F);
+
+	if ((addr & ~0x9Fu) != CSR_CYCLE || c->priv == PRV_M)
+		return true;
+	if (!(c->csr.mcounteren & bit))
+		return false;
+	return c->priv == PRV_S || (c->csr.scounteren & bit);
+}
+
+static u64 csr_cycle(const struct cpu *c)
+{
+	return cpu_insn_count(c) + c->csr.mcycle_offset;
+}
+
+static u64 csr_instret(const struct cpu *c)
+{
+	return cpu_insn_count(c) + c->csr.minstret_offset;
+}
+
+// Replace the @high or low half of a counter, counted as insn_count plus
+// *@offset, so that the next instruction reads the value written
+static void csr_write_counter(struct cpu *c, u64 *offset, bool high, u32 val)
+{
+	u64 next = cpu_insn_count(c) + 1;
+	u64 v = next + *offset;
+
+	if (high)
+		v = (v & 0xFFFFFFFFull) | ((u64)val << 32);
+	else
+		v = (v & ~0xFFFFFFFFull) | val;
+	*offset = v - next;
+}
+
+bool csr_read(struct cpu *c, u32 addr, u32 *val)
+{
+	struct csr_state *s = &c->csr;
+
+	// Bits [9:8] encode the lowest privilege allowed to access the CSR
+	if (((addr >> 8) & 3) > c->priv)
+		return false;
+	if (!csr_counter_enabled(c, addr))
+		return false;
+
+	if (csr_is_hpm(addr)) {
+		*val = csr_read_hpm(c, addr);
+		return true;
+	}
+
+	switch (addr) {
+	case CSR_FFLAGS:
+	case CSR_FRM:
+	case CSR_FCSR:
+		return fpu_csr_read(c, addr, val);
+	case CSR_VSTART:
+	case CSR_VXSAT:
+	case CSR_VXRM:
+	case CSR_VCSR:
+	case CSR_VL:
+	case CSR_VTYPE:
+	case CSR_VLENB:
+		return vector_csr_read(c, addr, val);
+	case CSR_SSTATUS:
+		*val = csr_mstatus(s) & (SSTATUS_MASK | MSTATUS_SD);
+		break;
+	case CSR_SIE:
+		*val = s->mie & s->mideleg;
+		break;
+	case CSR_STVEC:
+		*val = s->stvec;
+		break;
+	case CSR_SCOUNTEREN:
+		*val = s->scounteren;
+		break;
+	case CSR_SSCRATCH:
+		*val = s->sscratch;
+		break;
+	case CSR_SEPC:
+		*val = s->sepc;
+		break;
+	case CSR_SCAUSE:
+		*val = s->scause;
+		break;
+	case CSR_STVAL:
+		*val = s->stval;
+		break;
+	case CSR_SIP:
+		clint_update_mip(c);
+		*val = s->mip & s->mideleg;
+		break;
+	case CSR_SATP:
+		*val = s->satp;
+		break;
+	case CSR_MSTATUS:
+		*val = csr_mstatus(s);
+		break;
+	case CSR_MISA:
+		*val = MISA_VALUE;
+		break;
+	case CSR_MEDELEG:
+		*val = s->medeleg;
+		break;
+	case CSR_MIDELEG:
+		*val = s->mideleg;
+		break;
+	case CSR_MIE:
+		*val = s->mie;
+		break;
+	case CSR_MTVEC:
+		*val = s->mtvec;
+		break;
+	case CSR_MCOUNTEREN:
+		*val = s->mcounteren;
+		break;
+	case CSR_MSCRATCH:
+		*val = s->mscratch;
+		break;
+	case CSR_MEPC:
+		*val = s->mepc;
+		break;
+	case CSR_MCAUSE:
+		*val = s->mcause;
+		break;
+	case CSR_MTVAL:
+		*val = s->mtval;
+		break;
+	case CSR_MIP:
+		clint_update_mip(c);
+		*val = s->mip;
+		break;
+	case CSR_MHARTID:
+		*val = 0;
+		break;
+	case CSR_MCYCLE:
+	case CSR_CYCLE:
+		*val = (u32)csr_cycle(c);
+		break;
+	case CSR_MCYCLEH:
+	case CSR_CYCLEH:
+		*val = (u32)(csr_cycle(c) >> 32);
+		break;
+	case CSR_TIME:
+		*val = (u32)clint_mtime(c);
+		break;
+	case CSR_TIMEH:
+		*val = (u32)(clint_mtime(c) >> 32);
+		break;
+	case CSR_MINSTRET:
+	case CSR_INSTRET:
+		*val = (u32)csr_instret(c);
+		break;
+	case CSR_MINSTRETH:
+	case CSR_INSTRETH:
+		*val = (u32)(csr_instret(c) >> 32);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+// Update mstatus, flushing cached translations when their checks change
+static void csr_write_mstatus(struct cpu *c, u32 val, u32 mask)
+{
+	u32 old = c->csr.mstatus;
+	u32 new = (old & ~mask) | (val & mask);
+
+	// MPP is WARL: the reserved encoding 2 keeps the previous value
+	if (((new & MSTATUS_MPP) >> 11) == 2)
+		new = (new & ~MSTATUS_MPP) | (old & MSTATUS_MPP);
+
+	if ((old ^ new) & (MSTATUS_MPRV | MSTATUS_MPP | MSTATUS_SUM |
+			   MSTATUS_MXR))
+		mmu_flush(c);
+	c->csr.mstatus = new;
+}
+
+bool csr_write(struct cpu *c, u32 addr, u32 val)
+{
+	struct csr_state *s = &c->csr;
+
+	if (((addr >> 8) & 3) > c->priv)
+		return false;
+	// Bits [11:10] == 3 mark a read-only CSR
+	if (((addr >> 10) & 3) == 3)
+		return false;
+
+	// Events are hardwired and counters follow the cache model (WARL)
+	if (csr_is_hpm(addr))
+		return true;
+
+	switch (addr) {
+	case CSR_FFLAGS:
+	case CSR_FRM:
+	case CSR_FCSR:
+		return fpu_csr_write(c, addr, val);
+	case CSR_VSTART:
+	case CSR_VXSAT:
+	case CSR_VXRM:
+	case CSR_VCSR:
+		return vector_csr_write(c, addr, val);
+	case CSR_SSTATUS:
+		csr_write_mstatus(c, val, SSTATUS_MASK);
+		break;
+	case CSR_SIE:
+		s->mie = (s->mie & ~s->mideleg) | (val & s->mideleg);
+		break;
+	case CSR_STVEC:
+		s->stvec = val & ~2u;
+		break;
+	case CSR_SCOUNTEREN:
+		s->scounteren = val;
+		break;
+	case CSR_SSCRATCH:
+		s->sscratch = val;
+		break;
+	case CSR_SEPC:
+		s->sepc = val & ~1u;
+		break;
+	case CSR_SCAUSE:
+		s->scause = val;
+		break;
+	case CSR_STVAL:
+		s->stval = val;
+		break;
+	case CSR_SIP:
+		// Only the software interrupt is writable from S-mode
+		s->mip = (s->mip & ~(s->mideleg & 2)) | (val & s->mideleg & 2);
+		break;
+	case CSR_SATP:
+		// No ASIDs: only MODE and PPN are writable
+		s->satp = val & (SATP_MODE | SATP_PPN);
+		mmu_flush(c);
+		break;
+	case CSR_MSTATUS:
+		csr_write_mstatus(c, val, MSTATUS_MASK);
+		break;
+	case CSR_MISA:
+		// WARL: the extension set is fixed
+		break;
+	case CSR_MEDELEG:
+		s->medeleg = val & MEDELEG_MASK;
+		break;
+	case CSR_MIDELEG:
+		s->mideleg = val & SIP_MASK;
+		break;
+	case CSR_MIE:
+		s->mie = val & MIP_ALL;
+		break;
+	case CSR_MTVEC:
+		s->mtvec = val & ~2u;
+		break;
+	case CSR_MCOUNTEREN:
+		s->mcounteren = val;
+		break;
+	case CSR_MSCRATCH:
+		s->mscratch = val;
+		break;
+	case CSR_MEPC:
+		s->mepc = val & ~1u;
+		break;
+	case CSR_MCAUSE:
+		s->mcause = val;
+		break;
+	case CSR_MTVAL:
+		s->mtval = val;
+		break;
+	case CSR_MIP:
+		s->mip = (s->mip & ~SIP_MASK) | (val & SIP_MASK);
+		break;
+	case CSR_MCYCLE:
+	case CSR_MCYCLEH:
+		csr_write_counter(c, &s->mcycle_offset, addr == CSR_MCYCLEH,
+				  val);
+		break;
+	case CSR_MINSTRET:
+	case CSR_MINSTRETH:
+		csr_write_counter(c, &s->minstret_offset,
+				  addr == CSR_MINSTRETH, val);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
@@ -1,383 +1,566 @@
 #include "disassembler.h"
 #include "instr.h"
+#include "insn.h"
 #include "common.h"
-#include <stdio.h>
+#include "elf_file.h"
+#include "rvc.h"
+#include "vector.h"
+#include <pthread.h>
+#include <string.h>
+
+static const char *const reg_abi_names[32] = {
+	"zero", "ra", "sp",  "gp",  "tp", "t0", "t1", "t2",
+	"s0",	"s1", "a0",  "a1",  "a2", "a3", "a4", "a5",
+	"a6",	"a7", "s2",  "s3",  "s4", "s5", "s6", "s7",
+	"s8",	"s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+static const char *const freg_abi_names[32] = {
+	"ft0", "ft1", "ft2",  "ft3",  "ft4", "ft5", "ft6",  "ft7",
+	"fs0", "fs1", "fa0",  "fa1",  "fa2", "fa3", "fa4",  "fa5",
+	"fa6", "fa7", "fs2",  "fs3",  "fs4", "fs5", "fs6",  "fs7",
+	"fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft10", "ft11"
+};
+
+// Rounding modes by rm field; 5 and 6 are reserved
+static const char *const rm_names[8] = {
+	"rne", "rtz", "rdn", "rup", "rmm", "frm5", "frm6", "dyn"
+};
 
 // Helper function to get register ABI name
 const char *reg_abi_name(u32 reg_idx)
 {
-	const char *reg_abi_names[32] = {
-		"zero", "ra", "sp",  "gp",  "tp", "t0", "t1", "t2",
-		"s0",	"s1", "a0",  "a1",  "a2", "a3", "a4", "a5",
-		"a6",	"a7", "s2",  "s3",  "s4", "s5", "s6", "s7",
-		"s8",	"s9", "s10", "s11", "t3", "t4", "t5", "t6"
-	};
 	if (reg_idx < 32) {
 		return reg_abi_names[reg_idx];
 	}
 	return "inv";
 }
 
-void disassemble(u32 raw_instr, char *buffer, size_t size)
+/*
+ * Text is produced by the small writers below rather than snprintf. They
+ * return the new end of the text and never check for space: callers size
+ * their buffers with DISASM_INSN_MAX or disassemble_range_bound().
+ */
+static const char hex_digits[] = "0123456789abcdef";
+
+static char *put_str(char *p, const char *s)
 {
-	Instruction instr;
-	instr_decode(&instr, raw_instr);
-
-	switch (instr.opcode) {
-	case 0x33: // R-type
-		if (instr.funct7 == 0x01) { // M-extension
-			switch (instr.funct3) {
-			case 0x0: // MUL
-				snprintf(buffer, size, "mul %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x1: // MULH
-				snprintf(buffer, size, "mulh %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x2: // MULHSU
-				snprintf(buffer, size, "mulhsu %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x3: // MULHU
-				snprintf(buffer, size, "mulhu %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x4: // DIV
-				snprintf(buffer, size, "div %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x5: // DIVU
-				snprintf(buffer, size, "divu %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x6: // REM
-				snprintf(buffer, size, "rem %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x7: // REMU
-				snprintf(buffer, size, "remu %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			}
-		} else {
-			switch (instr.funct3) {
-			case 0x0: // ADD or SUB
-				if (instr.funct7 == 0x00) { // ADD
-					snprintf(buffer, size, "add %s, %s, %s",
-						 reg_abi_name(instr.rd),
-						 reg_abi_name(instr.rs1),
-						 reg_abi_name(instr.rs2));
-				} else if (instr.funct7 == 0x20) { // SUB
-					snprintf(buffer, size, "sub %s, %s, %s",
-						 reg_abi_name(instr.rd),
-						 reg_abi_name(instr.rs1),
-						 reg_abi_name(instr.rs2));
-				}
-				break;
-			case 0x1: // SLL
-				snprintf(buffer, size, "sll %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x2: // SLT
-				snprintf(buffer, size, "slt %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x3: // SLTU
-				snprintf(buffer, size, "sltu %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x4: // XOR
-				snprintf(buffer, size, "xor %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x5: // SRL or SRA
-				if (instr.funct7 == 0x00) { // SRL
-					snprintf(buffer, size, "srl %s, %s, %s",
-						 reg_abi_name(instr.rd),
-						 reg_abi_name(instr.rs1),
-						 reg_abi_name(instr.rs2));
-				} else if (instr.funct7 == 0x20) { // SRA
-					snprintf(buffer, size, "sra %s, %s, %s",
-						 reg_abi_name(instr.rd),
-						 reg_abi_name(instr.rs1),
-						 reg_abi_name(instr.rs2));
-				}
-				break;
-			case 0x6: // OR
-				snprintf(buffer, size, "or %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			case 0x7: // AND
-				snprintf(buffer, size, "and %s, %s, %s",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1),
-					 reg_abi_name(instr.rs2));
-				break;
-			}
-		}
-		break;
-	case 0x13: // I-type
-		switch (instr.funct3) {
-		case 0x0: // ADDI
-			snprintf(buffer, size, "addi %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
-			break;
-		case 0x1: // SLLI
-			snprintf(buffer, size, "slli %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
-			break;
-		case 0x2: // SLTI
-			snprintf(buffer, size, "slti %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
-			break;
-		case 0x3: // SLTIU
-			snprintf(buffer, size, "sltiu %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
-			break;
-		case 0x4: // XORI
-			snprintf(buffer, size, "xori %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
+	while (*s)
+		*p++ = *s++;
+	return p;
+}
+
+static char *put_udec(char *p, u32 v)
+{
+	char tmp[10];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	while (n)
+		*p++ = tmp[--n];
+	return p;
+}
+
+static char *put_dec(char *p, s32 v)
+{
+	if (v < 0) {
+		*p++ = '-';
+		return put_udec(p, -(u32)v);
+	}
+	return put_udec(p, v);
+}
+
+// Same as "0x%x"
+static char *put_hex(char *p, u32 v)
+{
+	int shift = 28;
+
+	*p++ = '0';
+	*p++ = 'x';
+	while (shift > 0 && !(v >> shift))
+		shift -= 4;
+	for (; shift >= 0; shift -= 4)
+		*p++ = hex_digits[(v >> shift) & 0xF];
+	return p;
+}
+
+// Same as "%0*x" with @digits
+static char *put_hex_fixed(char *p, u32 v, int digits)
+{
+	for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4)
+		*p++ = hex_digits[(v >> shift) & 0xF];
+	return p;
+}
+
+// vtype as the assembler takes it: "e32, m1, ta, ma"
+static char *put_vtype(char *p, u32 vtype)
+{
+	u32 lmul = vtype & VTYPE_VLMUL;
+
+	if ((vtype & ~0xFFu) || (vtype & VTYPE_VSEW) > (3u << 3) || lmul == 4)
+		return put_hex(p, vtype);
+	p = put_str(p, "e");
+	p = put_udec(p, 8u << ((vtype & VTYPE_VSEW) >> 3));
+	p = put_str(p, lmul < 4 ? ", m" : ", mf");
+	p = put_udec(p, lmul < 4 ? 1u << lmul : 1u << (8 - lmul));
+	p = put_str(p, vtype & VTYPE_VTA ? ", ta" : ", tu");
+	return put_str(p, vtype & VTYPE_VMA ? ", ma" : ", mu");
+}
+
+static char *put_vreg(char *p, u32 reg)
+{
+	*p++ = 'v';
+	return put_udec(p, reg);
+}
+
+/*
+ * Operand templates: D, S and T are rd, rs1 and rs2, I is the immediate in
+ * decimal, U the upper immediate in hex, C the CSR number and Z the rs1
+ * field as an unsigned immediate. E, F and G are rd, rs1 and rs2 as vector
+ * registers, M the ", v0.t" of a masked vector op and Y the immediate as a
+ * vtype. J, K, L and N are rd, rs1, rs2 and rs3 as FP registers and R the
+ * ", rm" of an op that rounds. Anything else is copied as is.
+ */
+static char *put_operands(char *p, const char *tmpl, const Instruction *instr)
+{
+	for (; *tmpl; tmpl++) {
+		switch (*tmpl) {
+		case 'D':
+			p = put_str(p, reg_abi_names[instr->rd]);
 			break;
-		case 0x5: // SRLI or SRAI
-			if (instr.funct7 == 0x00) { // SRLI
-				snprintf(buffer, size, "srli %s, %s, %d",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1), instr.imm);
-			} else if (instr.funct7 == 0x20) { // SRAI
-				snprintf(buffer, size, "srai %s, %s, %d",
-					 reg_abi_name(instr.rd),
-					 reg_abi_name(instr.rs1), instr.imm);
-			}
+		case 'S':
+			p = put_str(p, reg_abi_names[instr->rs1]);
 			break;
-		case 0x6: // ORI
-			snprintf(buffer, size, "ori %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
+		case 'T':
+			p = put_str(p, reg_abi_names[instr->rs2]);
 			break;
-		case 0x7: // ANDI
-			snprintf(buffer, size, "andi %s, %s, %d",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1), instr.imm);
+		case 'I':
+			p = put_dec(p, instr->imm);
 			break;
-		}
-		break;
-	case 0x03: // I-type (loads)
-		switch (instr.funct3) {
-		case 0x0: // LB
-			snprintf(buffer, size, "lb %s, %d(%s)",
-				 reg_abi_name(instr.rd), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'U':
+			p = put_hex(p, (u32)instr->imm >> 12);
 			break;
-		case 0x1: // LH
-			snprintf(buffer, size, "lh %s, %d(%s)",
-				 reg_abi_name(instr.rd), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'C':
+			p = put_hex(p, (u32)instr->imm);
 			break;
-		case 0x2: // LW
-			snprintf(buffer, size, "lw %s, %d(%s)",
-				 reg_abi_name(instr.rd), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'Z':
+			p = put_udec(p, instr->rs1);
 			break;
-		case 0x4: // LBU
-			snprintf(buffer, size, "lbu %s, %d(%s)",
-				 reg_abi_name(instr.rd), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'E':
+			p = put_vreg(p, instr->rd);
 			break;
-		case 0x5: // LHU
-			snprintf(buffer, size, "lhu %s, %d(%s)",
-				 reg_abi_name(instr.rd), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'F':
+			p = put_vreg(p, instr->rs1);
 			break;
-		}
-		break;
-	case 0x23: // S-type
-		switch (instr.funct3) {
-		case 0x0: // SB
-			snprintf(buffer, size, "sb %s, %d(%s)",
-				 reg_abi_name(instr.rs2), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'G':
+			p = put_vreg(p, instr->rs2);
 			break;
-		case 0x1: // SH
-			snprintf(buffer, size, "sh %s, %d(%s)",
-				 reg_abi_name(instr.rs2), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'M':
+			if (!(instr->funct7 & 1))
+				p = put_str(p, ", v0.t");
 			break;
-		case 0x2: // SW
-			snprintf(buffer, size, "sw %s, %d(%s)",
-				 reg_abi_name(instr.rs2), instr.imm,
-				 reg_abi_name(instr.rs1));
+		case 'Y':
+			p = put_vtype(p, (u32)instr->imm);
 			break;
-		}
-		break;
-	case 0x63: // B-type
-		switch (instr.funct3) {
-		case 0x0: // BEQ
-			snprintf(buffer, size, "beq %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		case 'J':
+			p = put_str(p, freg_abi_names[instr->rd]);
 			break;
-		case 0x1: // BNE
-			snprintf(buffer, size, "bne %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		case 'K':
+			p = put_str(p, freg_abi_names[instr->rs1]);
 			break;
-		case 0x4: // BLT
-			snprintf(buffer, size, "blt %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		case 'L':
+			p = put_str(p, freg_abi_names[instr->rs2]);
 			break;
-		case 0x5: // BGE
-			snprintf(buffer, size, "bge %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		case 'N':
+			p = put_str(p, freg_abi_names[instr->funct7 >> 2]);
 			break;
-		case 0x6: // BLTU
-			snprintf(buffer, size, "bltu %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		case 'R':
+			p = put_str(p, ", ");
+			p = put_str(p, rm_names[instr->funct3]);
 			break;
-		case 0x7: // BGEU
-			snprintf(buffer, size, "bgeu %s, %s, %d",
-				 reg_abi_name(instr.rs1),
-				 reg_abi_name(instr.rs2), instr.imm);
+		default:
+			*p++ = *tmpl;
 			break;
 		}
-		break;
-	case 0x37: // LUI
-		snprintf(buffer, size, "lui %s, 0x%x", reg_abi_name(instr.rd),
-			 (u32)instr.imm >> 12);
-		break;
-	case 0x17: // AUIPC
-		snprintf(buffer, size, "auipc %s, 0x%x", reg_abi_name(instr.rd),
-			 (u32)instr.imm >> 12);
-		break;
-	case 0x6F: // JAL
-		snprintf(buffer, size, "jal %s, %d", reg_abi_name(instr.rd),
-			 instr.imm);
-		break;
-	case 0x67: // JALR
-		snprintf(buffer, size, "jalr %s, %d(%s)",
-			 reg_abi_name(instr.rd), instr.imm,
-			 reg_abi_name(instr.rs1));
-		break;
-	case 0x73: // SYSTEM
-		if (instr.imm == 0x0) {
-			snprintf(buffer, size, "ecall");
-		} else if (instr.imm == 0x1) {
-			snprintf(buffer, size, "ebreak");
+	}
+	return p;
+}
+
+static char *put_insn(char *p, const char *name, const char *tmpl,
+		      const Instruction *instr)
+{
+	p = put_str(p, name);
+	if (*tmpl) {
+		*p++ = ' ';
+		p = put_operands(p, tmpl, instr);
+	}
+	return p;
+}
+
+// The operand layout of each decode table format
+static const char *const format_operands[FMT_COUNT] = {
+	[FMT_NONE] = "",
+	[FMT_R] = "D, S, T",
+	[FMT_I] = "D, S, I",
+	[FMT_SHIFT] = "D, S, I",
+	[FMT_LOAD] = "D, I(S)",
+	[FMT_S] = "T, I(S)",
+	[FMT_B] = "S, T, I",
+	[FMT_U] = "D, U",
+	[FMT_J] = "D, I",
+	[FMT_CSR] = "D, C, S",
+	[FMT_CSRI] = "D, C, Z",
+	[FMT_LR] = "D, (S)",
+	[FMT_AMO] = "D, T, (S)",
+	[FMT_FENCE_VMA] = "S, T",
+	[FMT_UNARY] = "D, S",
+	[FMT_VSETVLI] = "D, S, Y",
+	[FMT_VSETIVLI] = "D, Z, Y",
+	[FMT_VMEM] = "E, (S)M",
+	[FMT_VMEM_STRIDED] = "E, (S), TM",
+	[FMT_VV] = "E, G, FM",
+	[FMT_VX] = "E, G, SM",
+	[FMT_VI] = "E, G, IM",
+	[FMT_VI_U] = "E, G, ZM",
+	[FMT_VMAC_VV] = "E, F, GM",
+	[FMT_VMAC_VX] = "E, S, GM",
+	[FMT_VMV_V] = "E, F",
+	[FMT_VMV_X] = "E, S",
+	[FMT_VMV_I] = "E, I",
+	[FMT_VMERGE_VV] = "E, G, F, v0",
+	[FMT_VMERGE_VX] = "E, G, S, v0",
+	[FMT_VMERGE_VI] = "E, G, I, v0",
+	[FMT_VMV_XS] = "D, G",
+	[FMT_FLOAD] = "J, I(S)",
+	[FMT_FSTORE] = "L, I(S)",
+	[FMT_FR4] = "J, K, L, NR",
+	[FMT_FR_RM] = "J, K, LR",
+	[FMT_FR] = "J, K, L",
+	[FMT_FR1_RM] = "J, KR",
+	[FMT_FR1] = "J, K",
+	[FMT_FCMP] = "D, K, L",
+	[FMT_F2X_RM] = "D, KR",
+	[FMT_F2X] = "D, K",
+	[FMT_X2F_RM] = "J, SR",
+	[FMT_X2F] = "J, S",
+};
+
+// Compressed instructions are printed with their own mnemonics, using the
+// register and immediate fields of the expanded 32-bit form.
+static char *disassemble_rvc(char *p, u32 raw_instr, const Instruction *instr)
+{
+	u32 quadrant = raw_instr & 0x3;
+	u32 funct3 = (raw_instr >> 13) & 0x7;
+
+	if (instr->opcode == 0)
+		goto unknown;
+
+	switch ((quadrant << 3) | funct3) {
+	case 0x00: // C.ADDI4SPN
+		return put_insn(p, "c.addi4spn", "D, sp, I", instr);
+	case 0x01: // C.FLD
+		return put_insn(p, "c.fld", "J, I(S)", instr);
+	case 0x02: // C.LW
+		return put_insn(p, "c.lw", "D, I(S)", instr);
+	case 0x03: // C.FLW
+		return put_insn(p, "c.flw", "J, I(S)", instr);
+	case 0x05: // C.FSD
+		return put_insn(p, "c.fsd", "L, I(S)", instr);
+	case 0x06: // C.SW
+		return put_insn(p, "c.sw", "T, I(S)", instr);
+	case 0x07: // C.FSW
+		return put_insn(p, "c.fsw", "L, I(S)", instr);
+	case 0x08: // C.ADDI / C.NOP
+		if (instr->rd == 0)
+			return put_str(p, "c.nop");
+		return put_insn(p, "c.addi", "D, I", instr);
+	case 0x09: // C.JAL
+		return put_insn(p, "c.jal", "I", instr);
+	case 0x0A: // C.LI
+		return put_insn(p, "c.li", "D, I", instr);
+	case 0x0B: // C.ADDI16SP / C.LUI
+		if (instr->opcode == 0x13)
+			return put_insn(p, "c.addi16sp", "sp, I", instr);
+		return put_insn(p, "c.lui", "D, U", instr);
+	case 0x0C: // C.SRLI, C.SRAI, C.ANDI, C.SUB, C.XOR, C.OR, C.AND
+		if (instr->opcode == 0x13) {
+			if (instr->funct3 == 0x7)
+				return put_insn(p, "c.andi", "D, I", instr);
+			return put_insn(p,
+					instr->funct7 == 0x20 ? "c.srai" :
+								"c.srli",
+					"D, I", instr);
 		}
-		break;
-	case 0x0F: // FENCE
-		snprintf(buffer, size, "fence");
-		break;
-	case 0x2F: // Atomic
-	{
-		u32 funct5 = (instr.funct7 & 0b1111100) >> 2;
-		switch (funct5) {
-		case 0b00010: // LR.W
-			snprintf(buffer, size, "lr.w %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b00011: // SC.W
-			snprintf(buffer, size, "sc.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b00001: // AMOSWAP.W
-			snprintf(buffer, size, "amoswap.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b00000: // AMOADD.W
-			snprintf(buffer, size, "amoadd.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b00100: // AMOXOR.W
-			snprintf(buffer, size, "amoxor.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b01100: // AMOAND.W
-			snprintf(buffer, size, "amoand.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b01000: // AMOOR.W
-			snprintf(buffer, size, "amoor.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b10000: // AMOMIN.W
-			snprintf(buffer, size, "amomin.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b10100: // AMOMAX.W
-			snprintf(buffer, size, "amomax.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b11000: // AMOMINU.W
-			snprintf(buffer, size, "amominu.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		case 0b11100: // AMOMAXU.W
-			snprintf(buffer, size, "amomaxu.w %s, %s, (%s)",
-				 reg_abi_name(instr.rd),
-				 reg_abi_name(instr.rs2),
-				 reg_abi_name(instr.rs1));
-			break;
-		default:
-			snprintf(buffer, size, "unknown amo");
+		if (instr->funct7 == 0x20)
+			return put_insn(p, "c.sub", "D, T", instr);
+		if (instr->funct3 == 0x4)
+			return put_insn(p, "c.xor", "D, T", instr);
+		if (instr->funct3 == 0x6)
+			return put_insn(p, "c.or", "D, T", instr);
+		return put_insn(p, "c.and", "D, T", instr);
+	case 0x0D: // C.J
+		return put_insn(p, "c.j", "I", instr);
+	case 0x0E: // C.BEQZ
+		return put_insn(p, "c.beqz", "S, I", instr);
+	case 0x0F: // C.BNEZ
+		return put_insn(p, "c.bnez", "S, I", instr);
+	case 0x10: // C.SLLI
+		return put_insn(p, "c.slli", "D, I", instr);
+	case 0x11: // C.FLDSP
+		return put_insn(p, "c.fldsp", "J, I(sp)", instr);
+	case 0x12: // C.LWSP
+		return put_insn(p, "c.lwsp", "D, I(sp)", instr);
+	case 0x13: // C.FLWSP
+		return put_insn(p, "c.flwsp", "J, I(sp)", instr);
+	case 0x14: // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+		if (instr->opcode == 0x73)
+			return put_str(p, "c.ebreak");
+		if (instr->opcode == 0x67)
+			return put_insn(p, instr->rd == 0 ? "c.jr" : "c.jalr",
+					"S", instr);
+		if (instr->rs1 == 0)
+			return put_insn(p, "c.mv", "D, T", instr);
+		return put_insn(p, "c.add", "D, T", instr);
+	case 0x15: // C.FSDSP
+		return put_insn(p, "c.fsdsp", "L, I(sp)", instr);
+	case 0x16: // C.SWSP
+		return put_insn(p, "c.swsp", "T, I(sp)", instr);
+	case 0x17: // C.FSWSP
+		return put_insn(p, "c.fswsp", "L, I(sp)", instr);
+	}
+
+unknown:
+	p = put_str(p, "unknown compressed 0x");
+	return put_hex_fixed(p, raw_instr, 4);
+}
+
+// Decode @raw into @instr and write its text, without a newline, at @p
+static char *disassemble_insn(char *p, u32 raw, Instruction *instr)
+{
+	instr_decode(instr, raw);
+
+	if (instr->size == 2)
+		return disassemble_rvc(p, raw & 0xFFFF, instr);
+	if (instr->id == INSN_ILLEGAL) {
+		p = put_str(p, "unknown opcode ");
+		return put_hex(p, instr->opcode);
+	}
+	// The operand layout comes straight from the shared decode table
+	return put_insn(p, insn_info[instr->id].name,
+			format_operands[insn_info[instr->id].format], instr);
+}
+
+void disassemble(u32 raw_instr, char *buffer, size_t size)
+{
+	char line[DISASM_INSN_MAX];
+	Instruction instr;
+	size_t n;
+
+	if (!size)
+		return;
+	n = disassemble_insn(line, raw_instr, &instr) - line;
+	if (n >= size)
+		n = size - 1;
+	memcpy(buffer, line, n);
+	buffer[n] = '\0';
+}
+
+// --- Bulk disassembly ---
+
+// Below this many bytes per thread, a thread costs more than it saves
+#define DISASM_MIN_CHUNK (64 * 1024)
+
+struct disasm_job {
+	const u8 *image;
+	u32 base;
+	u32 len; // of the whole image: a chunk's last instruction may overhang
+	u32 start; // image offsets of this chunk
+	u32 end;
+	const struct symtab *syms;
+	char *out;
+	char *out_end; // filled in by the worker
+};
+
+// "<name>" or "<name+0x10>"
+static char *put_symbol(char *p, const struct symbol *s, u32 addr)
+{
+	*p++ = '<';
+	p = put_str(p, s->name);
+	if (addr != s->addr) {
+		*p++ = '+';
+		p = put_hex(p, addr - s->addr);
+	}
+	*p++ = '>';
+	return p;
+}
+
+// A header for the first symbol at @pc; aliases and labels that fall
+// inside an instruction are passed over.
+static char *put_labels(char *p, const struct symtab *syms, u32 *next,
+			u32 pc)
+{
+	while (*next < syms->count && syms->syms[*next].addr <= pc) {
+		const struct symbol *s = &syms->syms[(*next)++];
+
+		if (s->addr != pc ||
+		    (*next > 1 && syms->syms[*next - 2].addr == pc))
+			continue;
+		*p++ = '\n';
+		p = put_hex_fixed(p, pc, 8);
+		*p++ = ' ';
+		p = put_symbol(p, s, pc);
+		*p++ = ':';
+		*p++ = '\n';
+	}
+	return p;
+}
+
+static void *disasm_worker(void *arg)
+{
+	struct disasm_job *job = arg;
+	const struct symtab *syms = job->syms;
+	u32 next_sym = 0;
+	char *p = job->out;
+	u32 off = job->start;
+
+	if (syms)
+		next_sym = symtab_lower_bound(syms, job->base + job->start);
+
+	while (off < job->end) {
+		const u8 *b = job->image + off;
+		u32 pc = job->base + off;
+		u32 left = job->len - off;
+		Instruction instr;
+		u32 raw;
+
+		if (syms)
+			p = put_labels(p, syms, &next_sym, pc);
+
+		p = put_hex_fixed(p, pc, 8);
+		p = put_str(p, ":  ");
+
+		// Trailing bytes too few for the instruction they start
+		if (left < 2 || ((b[0] & 3) == 3 && left < 4)) {
+			for (u32 i = 0; i < left; i++) {
+				p = put_str(p, i ? ", " : ".byte ");
+				p = put_hex(p, b[i]);
+			}
+			*p++ = '\n';
 			break;
 		}
-	} break;
-	default:
-		snprintf(buffer, size, "unknown opcode 0x%x", instr.opcode);
-		break;
+
+		if ((b[0] & 3) == 3) {
+			raw = b[0] | b[1] << 8 | b[2] << 16 | (u32)b[3] << 24;
+			p = put_hex_fixed(p, raw, 8);
+		} else {
+			raw = b[0] | b[1] << 8;
+			p = put_hex_fixed(p, raw, 4);
+			p = put_str(p, "    ");
+		}
+		p = put_str(p, "  ");
+		p = disassemble_insn(p, raw, &instr);
+
+		// Name the targets of direct branches and jumps
+		if (syms && (insn_info[instr.id].format == FMT_B ||
+			     insn_info[instr.id].format == FMT_J)) {
+			u32 target = pc + instr.imm;
+			const struct symbol *s = symtab_find(syms, target);
+
+			if (s) {
+				*p++ = ' ';
+				p = put_symbol(p, s, target);
+			}
+		}
+		*p++ = '\n';
+		off += instr.size;
+	}
+	job->out_end = p;
+	return NULL;
+}
+
+static size_t line_bound(const struct symtab *syms)
+{
+	// Symbol headers and branch annotations add a name and an offset
+	return DISASM_LINE_MAX + (syms ? syms->max_name_len + 16 : 0);
+}
+
+size_t disassemble_range_bound(u32 len, const struct symtab *syms)
+{
+	size_t lines = (size_t)len / 2 + DISASM_MAX_THREADS;
+
+	if (syms)
+		lines += syms->count;
+	return lines * line_bound(syms) + 1;
+}
+
+size_t disassemble_range(const u8 *image, u32 base, u32 len,
+			 const struct symtab *syms, char *arena,
+			 size_t arena_size, unsigned threads)
+{
+	struct disasm_job jobs[DISASM_MAX_THREADS];
+	pthread_t tids[DISASM_MAX_THREADS];
+	bool started[DISASM_MAX_THREADS];
+	char *p = arena;
+	u32 off = 0;
+
+	if (arena_size < disassemble_range_bound(len, syms))
+		return 0;
+
+	if (threads > len / DISASM_MIN_CHUNK)
+		threads = len / DISASM_MIN_CHUNK;
+	if (threads > DISASM_MAX_THREADS)
+		threads = DISASM_MAX_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	// Chunks have to start on instruction boundaries. Finding those only
+	// needs the length bits, which is much cheaper than formatting.
+	for (unsigned t = 0; t < threads; t++) {
+		u32 nominal = (u64)len * (t + 1) / threads;
+		size_t lines;
+
+		jobs[t].image = image;
+		jobs[t].base = base;
+		jobs[t].len = len;
+		jobs[t].syms = syms;
+		jobs[t].start = off;
+		while (off < nominal)
+			off += (image[off] & 3) == 3 ? 4 : 2;
+		if (off > len)
+			off = len;
+		jobs[t].end = off;
+
+		// Each chunk formats into its own worst-case slice of the arena
+		lines = (jobs[t].end - jobs[t].start) / 2 + 1;
+		if (syms)
+			lines += symtab_lower_bound(syms, base + jobs[t].end) -
+				 symtab_lower_bound(syms, base + jobs[t].start);
+		jobs[t].out = p;
+		p += lines * line_bound(syms);
+	}
+
+	for (unsigned t = 1; t < threads; t++) {
+		started[t] = !pthread_create(&tids[t], NULL, disasm_worker,
+					     &jobs[t]);
+		if (!started[t])
+			disasm_worker(&jobs[t]);
+	}
+	disasm_worker(&jobs[0]);
+
+	// Slide each slice down onto the end of the one before it
+	p = jobs[0].out_end;
+	for (unsigned t = 1; t < threads; t++) {
+		size_t n;
+
+		if (started[t])
+			pthread_join(tids[t], NULL);
+		n = jobs[t].out_end - jobs[t].out;
+		memmove(p, jobs[t].out, n);
+		p += n;
 	}
+	*p = '\0';
+	return p - arena;
 }
@@ -0,0 +1,264 @@
+#include "elf_file.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sym_sort {
+	struct symbol sym;
+	u32 order; // keeps qsort stable: earlier input wins on equal addresses
+};
+
+static int sym_cmp(const void *a, const void *b)
+{
+	const struct sym_sort *x = a, *y = b;
+
+	if (x->sym.addr != y->sym.addr)
+		return x->sym.addr < y->sym.addr ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+bool symtab_init(struct symtab *tab, const struct symbol *syms, u32 count)
+{
+	struct sym_sort *tmp;
+	size_t bytes = 0;
+	char *p;
+
+	memset(tab, 0, sizeof(*tab));
+	if (!count)
+		return true;
+
+	for (u32 i = 0; i < count; i++) {
+		bytes += strlen(syms[i].name) + 1;
+	}
+	tmp = malloc(count * sizeof(*tmp));
+	tab->syms = malloc(count * sizeof(*tab->syms));
+	tab->strings = malloc(bytes);
+	if (!tmp || !tab->syms || !tab->strings) {
+		free(tmp);
+		symtab_free(tab);
+		return false;
+	}
+
+	for (u32 i = 0; i < count; i++) {
+		tmp[i].sym = syms[i];
+		tmp[i].order = i;
+	}
+	qsort(tmp, count, sizeof(*tmp), sym_cmp);
+
+	p = tab->strings;
+	for (u32 i = 0; i < count; i++) {
+		size_t len = strlen(tmp[i].sym.name);
+
+		memcpy(p, tmp[i].sym.name, len + 1);
+		tab->syms[i] = tmp[i].sym;
+		tab->syms[i].name = p;
+		p += len + 1;
+		if (len > tab->max_name_len)
+			tab->max_name_len = len;
+	}
+	tab->count = count;
+	free(tmp);
+	return true;
+}
+
+void symtab_free(struct symtab *tab)
+{
+	free(tab->syms);
+	free(tab->strings);
+	memset(tab, 0, sizeof(*tab));
+}
+
+u32 symtab_lower_bound(const struct symtab *tab, u32 addr)
+{
+	u32 lo = 0, hi = tab->count;
+
+	while (lo < hi) {
+		u32 mid = lo + (hi - lo) / 2;
+
+		if (tab->syms[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+const struct symbol *symtab_find(const struct symtab *tab, u32 addr)
+{
+	u32 i = symtab_lower_bound(tab, addr);
+
+	if (i < tab->count && tab->syms[i].addr == addr)
+		return &tab->syms[i];
+	// Step back over a run of equal addresses to the first of them
+	if (i == 0)
+		return NULL;
+	i--;
+	while (i > 0 && tab->syms[i - 1].addr == tab->syms[i].addr)
+		i--;
+	return &tab->syms[i];
+}
+
+static u8 *read_file(const char *path, size_t *size)
+{
+	FILE *fp = fopen(path, "rb");
+	u8 *buf = NULL;
+	long len;
+
+	if (!fp)
+		return NULL;
+	if (fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) > 0 &&
+	    fseek(fp, 0, SEEK_SET) == 0) {
+		buf = malloc(len);
+		if (buf && fread(buf, 1, len, fp) != (size_t)len) {
+			free(buf);
+			buf = NULL;
+		}
+		*size = len;
+	}
+	fclose(fp);
+	return buf;
+}
+
+// Is [off, off + len) inside a file of @size bytes?
+static bool in_file(size_t size, u64 off, u64 len)
+{
+	return off <= size && len <= size - off;
+}
+
+// Check the parts of the ELF header both readers rely on
+static const Elf32_Ehdr *elf_header(const u8 *buf, size_t size)
+{
+	const Elf32_Ehdr *eh = (const Elf32_Ehdr *)buf;
+
+	// The structures are read in place, which assumes a little-endian host
+	if (size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) ||
+	    eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+	    eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_RISCV)
+		return NULL;
+	return eh;
+}
+
+bool elf_load(const char *path, u8 *mem, u32 mem_size, struct elf_image *img)
+{
+	const Elf32_Ehdr *eh;
+	const Elf32_Phdr *ph;
+	u64 lo = ~0ull, hi = 0;
+	size_t size = 0;
+	bool ok = false;
+	u8 *buf;
+
+	buf = read_file(path, &size);
+	if (!buf)
+		return false;
+	eh = elf_header(buf, size);
+	if (!eh || eh->e_phentsize != sizeof(Elf32_Phdr) ||
+	    !in_file(size, eh->e_phoff, (u64)eh->e_phnum * sizeof(*ph)))
+		goto out;
+	ph = (const Elf32_Phdr *)(buf + eh->e_phoff);
+
+	for (u32 i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type != PT_LOAD || !ph[i].p_memsz)
+			continue;
+		if (ph[i].p_filesz > ph[i].p_memsz ||
+		    !in_file(size, ph[i].p_offset, ph[i].p_filesz))
+			goto out;
+		if (ph[i].p_paddr < lo)
+			lo = ph[i].p_paddr;
+		if ((u64)ph[i].p_paddr + ph[i].p_memsz > hi)
+			hi = (u64)ph[i].p_paddr + ph[i].p_memsz;
+	}
+	if (lo > hi || hi - lo > mem_size || eh->e_entry < lo ||
+	    eh->e_entry >= hi)
+		goto out;
+
+	for (u32 i = 0; i < eh->e_phnum; i++) {
+		u8 *dst = mem + (ph[i].p_paddr - lo);
+
+		if (ph[i].p_type != PT_LOAD || !ph[i].p_memsz)
+			continue;
+		memcpy(dst, buf + ph[i].p_offset, ph[i].p_filesz);
+		memset(dst + ph[i].p_filesz, 0, ph[i].p_memsz - ph[i].p_filesz);
+	}
+	img->base = lo;
+	img->entry = eh->e_entry - lo;
+	img->size = hi - lo;
+	ok = true;
+
+out:
+	free(buf);
+	return ok;
+}
+
+bool elf_read_symbols(const char *path, struct symtab *tab)
+{
+	struct symbol *syms = NULL;
+	const Elf32_Ehdr *eh;
+	const Elf32_Shdr *sh;
+	size_t size = 0;
+	u32 count = 0;
+	bool ok = false;
+	u8 *buf;
+
+	memset(tab, 0, sizeof(*tab));
+	buf = read_file(path, &size);
+	if (!buf)
+		return false;
+
+	eh = elf_header(buf, size);
+	if (!eh || eh->e_shentsize != sizeof(Elf32_Shdr) ||
+	    !in_file(size, eh->e_shoff, (u64)eh->e_shnum * sizeof(*sh)))
+		goto out;
+	sh = (const Elf32_Shdr *)(buf + eh->e_shoff);
+
+	for (u32 s = 0; s < eh->e_shnum; s++) {
+		const Elf32_Shdr *strs;
+		const Elf32_Sym *st;
+		u32 n;
+
+		if (sh[s].sh_type != SHT_SYMTAB)
+			continue;
+		if (sh[s].sh_link >= eh->e_shnum ||
+		    !in_file(size, sh[s].sh_offset, sh[s].sh_size))
+			goto out;
+		strs = &sh[sh[s].sh_link];
+		if (!in_file(size, strs->sh_offset, strs->sh_size) ||
+		    strs->sh_size == 0 ||
+		    buf[strs->sh_offset + strs->sh_size - 1] != '\0')
+			goto out;
+
+		st = (const Elf32_Sym *)(buf + sh[s].sh_offset);
+		n = sh[s].sh_size / sizeof(*st);
+		syms = malloc((n ? n : 1) * sizeof(*syms));
+		if (!syms)
+			goto out;
+
+		for (u32 i = 0; i < n; i++) {
+			u32 type = ELF32_ST_TYPE(st[i].st_info);
+			const char *name;
+
+			if ((type != STT_FUNC && type != STT_OBJECT &&
+			     type != STT_NOTYPE) ||
+			    st[i].st_shndx == SHN_UNDEF ||
+			    st[i].st_name >= strs->sh_size)
+				continue;
+			name = (const char *)buf + strs->sh_offset +
+			       st[i].st_name;
+			// Skip unnamed entries and assembler mapping symbols
+			if (name[0] == '\0' || name[0] == '$')
+				continue;
+			syms[count].addr = st[i].st_value;
+			syms[count].size = st[i].st_size;
+			syms[count].name = name;
+			count++;
+		}
+		break;
+	}
+	ok = symtab_init(tab, syms, count);
+
+out:
+	free(syms);
+	free(buf);
+	return ok;
+}
@@ -0,0 +1,586 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "csr.h"
+#include "mmu.h"
+
+#include <fenv.h>
+#include <math.h>
+#include <string.h>
+
+#define FFLAGS_MASK 0x1Fu
+#define HOST_FLAGS \
+	(FE_INVALID | FE_DIVBYZERO | FE_OVERFLOW | FE_UNDERFLOW | FE_INEXACT)
+
+// Not a rounding mode: fpu_enter_rm() raised an illegal instruction trap
+#define FPU_TRAP 8
+
+// The CPU whose instructions raised the flags now set in this thread's
+// host FPU, NULL if none did
+static _Thread_local struct cpu *fpu_owner;
+
+static const int host_round[] = {
+	[FRM_RNE] = FE_TONEAREST,
+	[FRM_RTZ] = FE_TOWARDZERO,
+	[FRM_RDN] = FE_DOWNWARD,
+	[FRM_RUP] = FE_UPWARD,
+};
+
+static u32 host_fflags(void)
+{
+	int e = fetestexcept(HOST_FLAGS);
+
+	return (e & FE_INVALID ? FFLAG_NV : 0) |
+	       (e & FE_DIVBYZERO ? FFLAG_DZ : 0) |
+	       (e & FE_OVERFLOW ? FFLAG_OF : 0) |
+	       (e & FE_UNDERFLOW ? FFLAG_UF : 0) |
+	       (e & FE_INEXACT ? FFLAG_NX : 0);
+}
+
+// Credit the host flags to their owner and clear them
+static void fpu_flush_host(void)
+{
+	if (fpu_owner)
+		fpu_owner->fpu.fflags |= host_fflags();
+	feclearexcept(HOST_FLAGS);
+}
+
+void fpu_sync(struct cpu *c)
+{
+	if (fpu_owner == c) {
+		fpu_flush_host();
+		fpu_owner = NULL;
+	}
+}
+
+void fpu_release(struct cpu *c)
+{
+	if (fpu_owner == c) {
+		feclearexcept(HOST_FLAGS);
+		fpu_owner = NULL;
+	}
+}
+
+void fpu_reset(struct cpu *c)
+{
+	fpu_release(c);
+	memset(&c->fpu, 0, sizeof(c->fpu));
+}
+
+// FP instructions and CSRs trap while mstatus.FS is off
+static bool fpu_enabled(struct cpu *c)
+{
+	return (c->csr.mstatus & MSTATUS_FS) != MSTATUS_FS_OFF;
+}
+
+bool fpu_csr_read(struct cpu *c, u32 addr, u32 *val)
+{
+	struct fpu_state *f = &c->fpu;
+
+	if (!fpu_enabled(c))
+		return false;
+	fpu_sync(c);
+	switch (addr) {
+	case CSR_FFLAGS:
+		*val = f->fflags;
+		break;
+	case CSR_FRM:
+		*val = f->frm;
+		break;
+	case CSR_FCSR:
+		*val = (f->frm << 5) | f->fflags;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+bool fpu_csr_write(struct cpu *c, u32 addr, u32 val)
+{
+	struct fpu_state *f = &c->fpu;
+
+	if (!fpu_enabled(c))
+		return false;
+	// Pending flags are part of what gets overwritten
+	fpu_sync(c);
+	switch (addr) {
+	case CSR_FFLAGS:
+		f->fflags = val & FFLAGS_MASK;
+		break;
+	case CSR_FRM:
+		// Reserved modes are accepted here and trap when used
+		f->frm = val & 7;
+		break;
+	case CSR_FCSR:
+		f->fflags = val & FFLAGS_MASK;
+		f->frm = (val >> 5) & 7;
+		break;
+	default:
+		return false;
+	}
+	c->csr.mstatus |= MSTATUS_FS_DIRTY;
+	return true;
+}
+
+// Check FS, take over the host flags and mark the FP state dirty
+static inline bool fpu_enter(struct cpu *c, const Instruction *instr)
+{
+	if (!fpu_enabled(c)) {
+		cpu_trap(c, CAUSE_ILLEGAL_INSN, instr->raw);
+		return false;
+	}
+	if (fpu_owner != c) {
+		fpu_flush_host();
+		fpu_owner = c;
+	}
+	c->csr.mstatus |= MSTATUS_FS_DIRTY;
+	return true;
+}
+
+// fpu_enter() for an instruction with an rm field: the rounding mode it
+// uses, or FPU_TRAP for a reserved one
+static inline u32 fpu_enter_rm(struct cpu *c, const Instruction *instr)
+{
+	u32 rm = instr->funct3 == FRM_DYN ? c->fpu.frm : instr->funct3;
+
+	if (rm > FRM_RMM) {
+		cpu_trap(c, CAUSE_ILLEGAL_INSN, instr->raw);
+		return FPU_TRAP;
+	}
+	return fpu_enter(c, instr) ? rm : FPU_TRAP;
+}
+
+/* Register access. Results are written with NaNs made canonical, as
+ * RISC-V never propagates a NaN payload; moves and sign injection keep
+ * the bits. */
+
+static inline u32 bits_s(float x)
+{
+	u32 b;
+
+	memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+static inline float from_bits_s(u32 b)
+{
+	float x;
+
+	memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+static inline u64 bits_d(double x)
+{
+	u64 b;
+
+	memcpy(&b, &x, sizeof(b));
+	return b;
+}
+
+static inline double from_bits_d(u64 b)
+{
+	double x;
+
+	memcpy(&x, &b, sizeof(x));
+	return x;
+}
+
+// A single that is not properly NaN-boxed reads as the canonical NaN
+static inline u32 unbox(u64 v)
+{
+	return (v & F32_BOX) == F32_BOX ? (u32)v : F32_QNAN;
+}
+
+static inline float get_s(const struct cpu *c, u32 r)
+{
+	return from_bits_s(unbox(c->fpu.f[r]));
+}
+
+static inline double get_d(const struct cpu *c, u32 r)
+{
+	return from_bits_d(c->fpu.f[r]);
+}
+
+static inline void set_s(struct cpu *c, u32 r, float x)
+{
+	c->fpu.f[r] = F32_BOX | (isnan(x) ? F32_QNAN : bits_s(x));
+}
+
+static inline void set_d(struct cpu *c, u32 r, double x)
+{
+	c->fpu.f[r] = isnan(x) ? F64_QNAN : bits_d(x);
+}
+
+static bool snan_s(u32 b)
+{
+	return (b & 0x7FC00000u) == 0x7F800000u && (b & 0x003FFFFFu);
+}
+
+static bool snan_d(u64 b)
+{
+	return (b & 0x7FF8000000000000ull) == 0x7FF0000000000000ull &&
+	       (b & 0x0007FFFFFFFFFFFFull);
+}
+
+/* Operands of the handler being defined: f registers as singles or
+ * doubles, and x registers */
+#define S1 get_s(c, instr->rs1)
+#define S2 get_s(c, instr->rs2)
+#define S3 get_s(c, instr->funct7 >> 2)
+#define D1 get_d(c, instr->rs1)
+#define D2 get_d(c, instr->rs2)
+#define D3 get_d(c, instr->funct7 >> 2)
+#define X1 c->registers[instr->rs1]
+
+/* Loads and stores move bits: flw boxes, fsw stores the low half as is */
+
+void exec_flw(struct cpu *c, const Instruction *instr)
+{
+	u32 val;
+
+	if (fpu_enter(c, instr) && mmu_load32(c, X1 + instr->imm, &val))
+		c->fpu.f[instr->rd] = F32_BOX | val;
+}
+
+void exec_fsw(struct cpu *c, const Instruction *instr)
+{
+	if (fpu_enter(c, instr))
+		mmu_store32(c, X1 + instr->imm, (u32)c->fpu.f[instr->rs2]);
+}
+
+// Two word accesses; the register is only written once neither faults
+void exec_fld(struct cpu *c, const Instruction *instr)
+{
+	u32 addr = X1 + instr->imm, lo, hi;
+
+	if (fpu_enter(c, instr) && mmu_load32(c, addr, &lo) &&
+	    mmu_load32(c, addr + 4, &hi))
+		c->fpu.f[instr->rd] = ((u64)hi << 32) | lo;
+}
+
+void exec_fsd(struct cpu *c, const Instruction *instr)
+{
+	u32 addr = X1 + instr->imm;
+	u64 val = c->fpu.f[instr->rs2];
+
+	if (fpu_enter(c, instr) && mmu_store32(c, addr, (u32)val))
+		mmu_store32(c, addr + 4, (u32)(val >> 32));
+}
+
+/* Rounding */
+
+// Exact error of @r = @a + @b rounded to nearest (Knuth's TwoSum); every
+// step is exact, so the host raises nothing
+static double two_sum_s(float a, float b, float r)
+{
+	float bb = r - a;
+
+	return (a - (r - bb)) + (b - bb);
+}
+
+static double two_sum_d(double a, double b, double r)
+{
+	double bb = r - a;
+
+	return (a - (r - bb)) + (b - bb);
+}
+
+/*
+ * RMM from the finite nearest-even result @r and its exact error @e. The
+ * two only differ on a tie that nearest-even broke towards zero, where
+ * RMM takes the next value away from zero: one up in the magnitude bits.
+ */
+static float rmm_s(float r, double e)
+{
+	float n;
+
+	if (r == 0 || e == 0 || (r < 0) != (e < 0))
+		return r;
+	n = from_bits_s(bits_s(r) + 1);
+	return (double)n - r == 2 * e ? n : r;
+}
+
+static double rmm_d(double r, double e)
+{
+	double n;
+
+	if (r == 0 || e == 0 || (r < 0) != (e < 0))
+		return r;
+	n = from_bits_d(bits_d(r) + 1);
+	return n - r == 2 * e ? n : r;
+}
+
+/*
+ * An instruction that rounds. @expr reads the operands and computes the
+ * result in the host's rounding mode. @err is the exact error of the
+ * nearest-even result, for RMM: 0 where a tie is impossible (division,
+ * square root, widening) or not worth finding (fused multiply-add, which
+ * breaks RMM ties to even).
+ *
+ * For a directed rm the operands are loaded after the mode switch and the
+ * result stored before the switch back. Both are memory accesses through
+ * @c, which the compiler may not move across the calls, so neither can
+ * the arithmetic between them.
+ */
+#define FP_ROUNDED(name, type, sfx, expr, err)                             \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		u32 rm = fpu_enter_rm(c, instr);                          \
+		type r;                                                   \
+                                                                          \
+		if (rm == FRM_RNE) {                                      \
+			set_##sfx(c, instr->rd, (expr));                  \
+		} else if (rm == FRM_RMM) {                               \
+			r = (expr);                                       \
+			if (isfinite(r))                                  \
+				r = rmm_##sfx(r, (err));                  \
+			set_##sfx(c, instr->rd, r);                       \
+		} else if (rm != FPU_TRAP) {                              \
+			fesetround(host_round[rm]);                       \
+			set_##sfx(c, instr->rd, (expr));                  \
+			fesetround(FE_TONEAREST);                         \
+		}                                                         \
+	}
+
+// An instruction with an rm field whose result is always exact
+#define FP_EXACT(name, sfx, expr)                                         \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		if (fpu_enter_rm(c, instr) != FPU_TRAP)                   \
+			set_##sfx(c, instr->rd, (expr));                  \
+	}
+
+FP_ROUNDED(fadd_s, float, s, S1 + S2, two_sum_s(S1, S2, r))
+FP_ROUNDED(fsub_s, float, s, S1 - S2, two_sum_s(S1, -S2, r))
+FP_ROUNDED(fmul_s, float, s, S1 * S2, (double)S1 * S2 - r)
+FP_ROUNDED(fdiv_s, float, s, S1 / S2, 0)
+FP_ROUNDED(fsqrt_s, float, s, sqrtf(S1), 0)
+FP_ROUNDED(fmadd_s, float, s, fmaf(S1, S2, S3), 0)
+FP_ROUNDED(fmsub_s, float, s, fmaf(S1, S2, -S3), 0)
+FP_ROUNDED(fnmsub_s, float, s, fmaf(-S1, S2, S3), 0)
+FP_ROUNDED(fnmadd_s, float, s, fmaf(-S1, S2, -S3), 0)
+FP_ROUNDED(fcvt_s_w, float, s, (float)(s32)X1, (double)(s32)X1 - r)
+FP_ROUNDED(fcvt_s_wu, float, s, (float)X1, (double)X1 - r)
+FP_ROUNDED(fcvt_s_d, float, s, (float)D1, D1 - r)
+
+FP_ROUNDED(fadd_d, double, d, D1 + D2, two_sum_d(D1, D2, r))
+FP_ROUNDED(fsub_d, double, d, D1 - D2, two_sum_d(D1, -D2, r))
+FP_ROUNDED(fmul_d, double, d, D1 * D2, fma(D1, D2, -r))
+FP_ROUNDED(fdiv_d, double, d, D1 / D2, 0)
+FP_ROUNDED(fsqrt_d, double, d, sqrt(D1), 0)
+FP_ROUNDED(fmadd_d, double, d, fma(D1, D2, D3), 0)
+FP_ROUNDED(fmsub_d, double, d, fma(D1, D2, -D3), 0)
+FP_ROUNDED(fnmsub_d, double, d, fma(-D1, D2, D3), 0)
+FP_ROUNDED(fnmadd_d, double, d, fma(-D1, D2, -D3), 0)
+
+FP_EXACT(fcvt_d_s, d, (double)S1)
+FP_EXACT(fcvt_d_w, d, (double)(s32)X1)
+FP_EXACT(fcvt_d_wu, d, (double)X1)
+
+/* Conversions to integers saturate where x86 returns 0x80000000, so they
+ * are done in software and set their flags directly */
+
+// @x rounded to an integer in mode @rm, raising no host flags
+static double round_int(double x, u32 rm)
+{
+	switch (rm) {
+	case FRM_RTZ:
+		return trunc(x);
+	case FRM_RDN:
+		return floor(x);
+	case FRM_RUP:
+		return ceil(x);
+	case FRM_RMM:
+		return round(x);
+	default:
+		return nearbyint(x);
+	}
+}
+
+static u32 to_int(struct cpu *c, double x, u32 rm, bool is_signed)
+{
+	double lo = is_signed ? -2147483648.0 : 0.0;
+	double hi = is_signed ? 2147483647.0 : 4294967295.0;
+	u32 max = is_signed ? 0x7FFFFFFFu : 0xFFFFFFFFu;
+	double r;
+
+	if (isnan(x)) {
+		c->fpu.fflags |= FFLAG_NV;
+		return max;
+	}
+	r = round_int(x, rm);
+	if (r < lo || r > hi) {
+		c->fpu.fflags |= FFLAG_NV;
+		return r < lo ? (u32)(s32)lo : max;
+	}
+	if (r != x)
+		c->fpu.fflags |= FFLAG_NX;
+	return is_signed ? (u32)(s32)r : (u32)r;
+}
+
+#define FP_TO_INT(name, src, is_signed)                                    \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		u32 rm = fpu_enter_rm(c, instr);                          \
+                                                                          \
+		if (rm != FPU_TRAP)                                       \
+			c->registers[instr->rd] =                         \
+				to_int(c, (src), rm, is_signed);          \
+	}
+
+FP_TO_INT(fcvt_w_s, S1, true)
+FP_TO_INT(fcvt_wu_s, S1, false)
+FP_TO_INT(fcvt_w_d, D1, true)
+FP_TO_INT(fcvt_wu_d, D1, false)
+
+/* Sign injection works on the bits, so NaNs pass through unchanged */
+
+#define FP_SGNJ(name, expr)                                                \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		u32 a, b;                                                 \
+                                                                          \
+		if (!fpu_enter(c, instr))                                 \
+			return;                                           \
+		a = unbox(c->fpu.f[instr->rs1]);                          \
+		b = unbox(c->fpu.f[instr->rs2]);                          \
+		c->fpu.f[instr->rd] = F32_BOX | (a & 0x7FFFFFFFu) |       \
+				      ((expr) & 0x80000000u);             \
+	}
+
+#define FP_SGNJ_D(name, expr)                                              \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		u64 a, b;                                                 \
+                                                                          \
+		if (!fpu_enter(c, instr))                                 \
+			return;                                           \
+		a = c->fpu.f[instr->rs1];                                 \
+		b = c->fpu.f[instr->rs2];                                 \
+		c->fpu.f[instr->rd] = (a & ~(1ull << 63)) |               \
+				      ((expr) & (1ull << 63));            \
+	}
+
+FP_SGNJ(fsgnj_s, b)
+FP_SGNJ(fsgnjn_s, ~b)
+FP_SGNJ(fsgnjx_s, a ^ b)
+FP_SGNJ_D(fsgnj_d, b)
+FP_SGNJ_D(fsgnjn_d, ~b)
+FP_SGNJ_D(fsgnjx_d, a ^ b)
+
+/*
+ * fmin/fmax: a NaN operand gives way to the other one, two give the
+ * canonical NaN, and -0 is less than +0. Only a signaling NaN raises NV.
+ */
+#define FP_MINMAX(name, type, sfx, is_max)                                 \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		type a, b, r;                                             \
+                                                                          \
+		if (!fpu_enter(c, instr))                                 \
+			return;                                           \
+		a = get_##sfx(c, instr->rs1);                             \
+		b = get_##sfx(c, instr->rs2);                             \
+		if (snan_##sfx(bits_##sfx(a)) || snan_##sfx(bits_##sfx(b))) \
+			c->fpu.fflags |= FFLAG_NV;                        \
+		if (isnan(a))                                             \
+			r = b;                                            \
+		else if (isnan(b))                                        \
+			r = a;                                            \
+		else if (a == b)                                          \
+			r = (bool)signbit(a) != is_max ? a : b;           \
+		else                                                      \
+			r = (a < b) != is_max ? a : b;                    \
+		set_##sfx(c, instr->rd, r);                               \
+	}
+
+FP_MINMAX(fmin_s, float, s, false)
+FP_MINMAX(fmax_s, float, s, true)
+FP_MINMAX(fmin_d, double, d, false)
+FP_MINMAX(fmax_d, double, d, true)
+
+/* Compares write 0 for unordered operands. feq is quiet and only raises
+ * NV for a signaling NaN, flt and fle raise it for any NaN. */
+#define FP_CMP(name, type, sfx, op, quiet)                                 \
+	void exec_##name(struct cpu *c, const Instruction *instr)         \
+	{                                                                 \
+		type a, b;                                                \
+                                                                          \
+		if (!fpu_enter(c, instr))                                 \
+			return;                                           \
+		a = get_##sfx(c, instr->rs1);                             \
+		b = get_##sfx(c, instr->rs2);                             \
+		if (isnan(a) || isnan(b)) {                               \
+			if (!quiet || snan_##sfx(bits_##sfx(a)) ||        \
+			    snan_##sfx(bits_##sfx(b)))                    \
+				c->fpu.fflags |= FFLAG_NV;                \
+			c->registers[instr->rd] = 0;                      \
+			return;                                           \
+		}                                                         \
+		c->registers[instr->rd] = a op b;                         \
+	}
+
+FP_CMP(feq_s, float, s, ==, true)
+FP_CMP(flt_s, float, s, <, false)
+FP_CMP(fle_s, float, s, <=, false)
+FP_CMP(feq_d, double, d, ==, true)
+FP_CMP(flt_d, double, d, <, false)
+FP_CMP(fle_d, double, d, <=, false)
+
+// fclass from the fields, since classifying a signaling NaN through the
+// host would raise NV
+static u32 fclass(bool neg, bool exp_max, bool exp_zero, bool man_zero,
+		  bool quiet)
+{
+	if (exp_max) {
+		if (!man_zero)
+			return quiet ? 1u << 9 : 1u << 8;
+		return neg ? 1u << 0 : 1u << 7;
+	}
+	if (!exp_zero)
+		return neg ? 1u << 1 : 1u << 6;
+	if (!man_zero)
+		return neg ? 1u << 2 : 1u << 5;
+	return neg ? 1u << 3 : 1u << 4;
+}
+
+void exec_fclass_s(struct cpu *c, const Instruction *instr)
+{
+	u32 b, exp;
+
+	if (!fpu_enter(c, instr))
+		return;
+	b = unbox(c->fpu.f[instr->rs1]);
+	exp = (b >> 23) & 0xFF;
+	c->registers[instr->rd] = fclass(b >> 31, exp == 0xFF, exp == 0,
+					 !(b & 0x7FFFFF), (b >> 22) & 1);
+}
+
+void exec_fclass_d(struct cpu *c, const Instruction *instr)
+{
+	u64 b;
+	u32 exp;
+
+	if (!fpu_enter(c, instr))
+		return;
+	b = c->fpu.f[instr->rs1];
+	exp = (b >> 52) & 0x7FF;
+	c->registers[instr->rd] = fclass(b >> 63, exp == 0x7FF, exp == 0,
+					 !(b & 0xFFFFFFFFFFFFFull),
+					 (b >> 51) & 1);
+}
+
+/* Moves between register files copy bits, without unboxing */
+
+void exec_fmv_x_w(struct cpu *c, const Instruction *instr)
+{
+	if (fpu_enter(c, instr))
+		c->registers[instr->rd] = (u32)c->fpu.f[instr->rs1];
+}
+
+void exec_fmv_w_x(struct cpu *c, const Instruction *instr)
+{
+	if (fpu_enter(c, instr))
+		c->fpu.f[instr->rd] = F32_BOX | X1;
+}
@@ -0,0 +1,240 @@
+#include "fuzz.h"
+#include "cpu.h"
+#include "mmu.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/shm.h>
+
+#define FUZZ_INPUT_MAX (1u << 20) // largest test case fuzz_afl_loop() reads
+
+// afl-fuzz talks to its fork server on these descriptors
+#define FORKSRV_FD 198
+#define SIGSEGV_STATUS 11 // a wait() status for "killed by SIGSEGV"
+
+// read(fd, buf, count): fd 0 returns the rest of the test case
+static void fuzz_sys_read(struct cpu *c, void *opaque)
+{
+	struct fuzz *f = opaque;
+	u32 vaddr = c->registers[11];
+	u32 len = c->registers[12];
+	u32 done = 0;
+
+	if (c->registers[10] != 0) {
+		c->registers[10] = -EBADF;
+		return;
+	}
+	if (len > f->input_len - f->input_pos)
+		len = f->input_len - f->input_pos;
+	while (done < len) {
+		u32 n = PAGE_SIZE - (vaddr & PAGE_MASK);
+		u8 *p = mmu_translate(c, vaddr, MMU_STORE);
+
+		if (!p)
+			return; // the trap the guest's own store would raise
+		if (n > len - done)
+			n = len - done;
+		memcpy(p, f->input + f->input_pos + done, n);
+		vaddr += n;
+		done += n;
+	}
+	f->input_pos += done;
+	c->registers[10] = done;
+}
+
+// exit(code): the one way a run counts as clean
+static void fuzz_sys_exit(struct cpu *c, void *opaque)
+{
+	struct fuzz *f = opaque;
+
+	f->exited = true;
+	c->exit_code = c->registers[10];
+	cpu_halt(c, CPU_STOP_HALT);
+}
+
+static u8 *fuzz_map_attach(bool *shm)
+{
+	const char *id = getenv("__AFL_SHM_ID");
+	void *p;
+
+	*shm = false;
+	if (id) {
+		p = shmat(atoi(id), NULL, 0);
+		if (p != (void *)-1) {
+			*shm = true;
+			return p;
+		}
+	}
+	return calloc(1, FUZZ_MAP_SIZE);
+}
+
+struct fuzz *fuzz_create(struct cpu *c, const struct fuzz_config *cfg)
+{
+	u32 npages = c->mem_size >> FUZZ_PAGE_SHIFT;
+	struct fuzz *f;
+
+	if (cfg->input_max && (cfg->input_addr >= c->mem_size ||
+			       cfg->input_max > c->mem_size - cfg->input_addr))
+		return NULL;
+	f = calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->cfg = *cfg;
+	f->cpu = c;
+	f->map = fuzz_map_attach(&f->shm);
+	f->memory = malloc(c->mem_size);
+	f->dirty = calloc(npages, 1);
+	f->dirty_pages = malloc(npages * sizeof(*f->dirty_pages));
+	if (!f->map || !f->memory || !f->dirty || !f->dirty_pages ||
+	    !cpu_register_syscall(c, 63, fuzz_sys_read, f) ||
+	    !cpu_register_syscall(c, 93, fuzz_sys_exit, f)) {
+		fuzz_destroy(f);
+		return NULL;
+	}
+
+	memcpy(f->memory, c->memory, c->mem_size);
+	memcpy(f->regs.registers, c->registers, sizeof(c->registers));
+	f->regs.pc = c->pc;
+	f->regs.priv = c->priv;
+	// insn_count restarts from 0 on every run; the counters carry on
+	f->regs.csr = c->csr;
+	f->regs.csr.mcycle_offset += c->insn_count;
+	f->regs.csr.minstret_offset += c->insn_count;
+	f->regs.clint = c->clint;
+	f->regs.clint.mtime_offset += c->insn_count;
+	f->regs.vec = c->vec;
+	fpu_sync(c);
+	f->regs.fpu = c->fpu;
+	f->regs.reservation_set = c->reservation_set;
+	f->regs.reservation_address = c->reservation_address;
+	f->regs.output_buffer_pos = c->output_buffer_pos;
+
+	// Cached store translations would let writes go unnoticed
+	mmu_flush(c);
+	c->fuzz = f;
+	return f;
+}
+
+void fuzz_destroy(struct fuzz *f)
+{
+	if (!f)
+		return;
+	if (f->cpu->fuzz == f) {
+		f->cpu->fuzz = NULL;
+		cpu_register_syscall(f->cpu, 63, NULL, NULL);
+		cpu_register_syscall(f->cpu, 93, NULL, NULL);
+	}
+	if (f->shm)
+		shmdt(f->map);
+	else
+		free(f->map);
+	free(f->memory);
+	free(f->dirty);
+	free(f->dirty_pages);
+	free(f);
+}
+
+// Put the guest back as it was at fuzz_create()
+static void fuzz_restore(struct fuzz *f)
+{
+	struct cpu *c = f->cpu;
+
+	for (u32 i = 0; i < f->ndirty; i++) {
+		u32 off = f->dirty_pages[i] << FUZZ_PAGE_SHIFT;
+
+		memcpy(c->memory + off, f->memory + off, 1u << FUZZ_PAGE_SHIFT);
+		f->dirty[f->dirty_pages[i]] = 0;
+	}
+	f->ndirty = 0;
+
+	memcpy(c->registers, f->regs.registers, sizeof(c->registers));
+	c->pc = f->regs.pc;
+	c->priv = f->regs.priv;
+	c->csr = f->regs.csr;
+	c->clint = f->regs.clint;
+	c->vec = f->regs.vec;
+	// Flags still in the host FPU belong to the run being discarded
+	fpu_sync(c);
+	c->fpu = f->regs.fpu;
+	c->reservation_set = f->regs.reservation_set;
+	c->reservation_address = f->regs.reservation_address;
+	c->output_buffer_pos = f->regs.output_buffer_pos;
+	c->output_buffer[c->output_buffer_pos] = '\0';
+	c->state = CPU_STATE_RUNNING;
+	c->stop = CPU_STOP_HALT;
+	c->insn_count = 0;
+	c->exit_code = 0;
+	c->trap_cause = CPU_NO_TRAP;
+	mmu_flush(c);
+}
+
+enum fuzz_result fuzz_run(struct fuzz *f, const u8 *data, u32 len)
+{
+	struct cpu *c = f->cpu;
+	enum cpu_stop stop;
+
+	fuzz_restore(f);
+	f->prev_loc = 0;
+	f->input = data;
+	f->input_len = len;
+	f->input_pos = 0;
+	f->exited = false;
+
+	if (f->cfg.input_max) {
+		u32 n = len < f->cfg.input_max ? len : f->cfg.input_max;
+
+		memcpy(c->memory + f->cfg.input_addr, data, n);
+		for (u32 off = 0; off < n; off += 1u << FUZZ_PAGE_SHIFT)
+			fuzz_mark_dirty(f, f->cfg.input_addr + off);
+		if (n)
+			fuzz_mark_dirty(f, f->cfg.input_addr + n - 1);
+		c->registers[10] = f->cfg.input_addr;
+		c->registers[11] = n;
+	}
+
+	stop = cpu_run_for(c, f->cfg.max_insns, NULL);
+	f->execs++;
+	if (stop == CPU_STOP_BUDGET || stop == CPU_STOP_IDLE)
+		return FUZZ_TIMEOUT;
+	return f->exited ? FUZZ_OK : FUZZ_CRASH;
+}
+
+static bool fuzz_read_full(int fd, void *buf, size_t len)
+{
+	return read(fd, buf, len) == (ssize_t)len;
+}
+
+bool fuzz_afl_loop(struct fuzz *f)
+{
+	u32 msg = 0;
+	u8 *buf;
+
+	if (write(FORKSRV_FD + 1, &msg, 4) != 4)
+		return false;
+	buf = malloc(FUZZ_INPUT_MAX);
+	if (!buf)
+		return false;
+
+	// afl-fuzz believes it forks a child per test case; the "child" is
+	// this process, and a guest hang is reported as a clean exit since
+	// killing it would kill the server.
+	while (fuzz_read_full(FORKSRV_FD, &msg, 4)) {
+		u32 pid = getpid();
+		u32 status;
+		ssize_t n;
+
+		if (write(FORKSRV_FD + 1, &pid, 4) != 4)
+			break;
+		lseek(STDIN_FILENO, 0, SEEK_SET);
+		n = read(STDIN_FILENO, buf, FUZZ_INPUT_MAX);
+		status = fuzz_run(f, buf, n > 0 ? n : 0) == FUZZ_CRASH ?
+				 SIGSEGV_STATUS :
+				 0;
+		if (write(FORKSRV_FD + 1, &status, 4) != 4)
+			break;
+	}
+	free(buf);
+	return true;
+}
@@ -0,0 +1,462 @@
+#include "idle.h"
+#include "cpu.h"
+#include "csr.h"
+#include "clint.h"
+#include "instr.h"
+#include "insn.h"
+#include "mmu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NEVER (~0ull)
+
+// The straight line from pc round to the branch or jump back to pc
+struct loop {
+	Instruction in[IDLE_MAX_INSNS];
+	u32 pc[IDLE_MAX_INSNS];
+	u32 n;
+};
+
+enum idle_decoded {
+	LOOP_OK,
+	LOOP_BUSY, // never a spin loop, whatever the registers hold
+	LOOP_UNKNOWN, // not now, maybe later
+};
+
+enum idle_sim {
+	SIM_ROUND, // back to pc
+	SIM_EXIT,
+	SIM_UNKNOWN, // something this does not model
+};
+
+struct idle *idle_create(void)
+{
+	struct idle *d = calloc(1, sizeof(struct idle));
+
+	if (!d)
+		return NULL;
+	for (u32 i = 0; i < IDLE_CACHE_SIZE; i++)
+		d->busy[i] = 1;
+	return d;
+}
+
+void idle_destroy(struct idle *d)
+{
+	free(d);
+}
+
+static bool is_branch(u32 id)
+{
+	return id >= INSN_BEQ && id <= INSN_BGEU;
+}
+
+static bool is_load(u32 id)
+{
+	return id >= INSN_LB && id <= INSN_LHU;
+}
+
+static bool is_alu_imm(u32 id)
+{
+	return id >= INSN_ADDI && id <= INSN_SRAI;
+}
+
+static bool is_alu_reg(u32 id)
+{
+	return id >= INSN_ADD && id <= INSN_AND;
+}
+
+// rdtime, rdcycle, rdinstret or the upper halves: CSRRS rd, counter, x0
+static bool is_counter_read(const Instruction *in)
+{
+	u32 addr = (u32)in->imm & 0xFFF;
+
+	return in->id == INSN_CSRRS && in->rs1 == 0 &&
+	       (addr & ~0x80u) >= CSR_CYCLE && (addr & ~0x80u) <= CSR_INSTRET;
+}
+
+// How far the counter at @addr runs ahead of mtime; all three advance
+// with insn_count
+static u64 idle_skew(const struct cpu *c, u32 addr)
+{
+	switch (addr & ~0x80u) {
+	case CSR_CYCLE:
+		return c->csr.mcycle_offset - c->clint.mtime_offset;
+	case CSR_INSTRET:
+		return c->csr.minstret_offset - c->clint.mtime_offset;
+	default:
+		return 0;
+	}
+}
+
+static u32 reads(const Instruction *in)
+{
+	if (is_branch(in->id) || is_alu_reg(in->id))
+		return (1u << in->rs1) | (1u << in->rs2);
+	if (is_alu_imm(in->id) || is_load(in->id))
+		return 1u << in->rs1;
+	return 0;
+}
+
+static u32 writes(const Instruction *in)
+{
+	if (in->id == INSN_LUI || in->id == INSN_AUIPC || is_load(in->id) ||
+	    is_alu_imm(in->id) || is_alu_reg(in->id) || is_counter_read(in))
+		return (1u << in->rd) & ~1u;
+	return 0;
+}
+
+static bool idle_fetch(struct cpu *c, u32 pc, Instruction *in)
+{
+	u8 *p = mmu_peek(c, pc, MMU_FETCH);
+	u8 *hi;
+	u32 raw;
+
+	if (!p)
+		return false;
+	raw = mem_load16(p, 0);
+	if ((raw & 3) == 3) {
+		hi = mmu_in_page(pc, 4) ? p + 2 : mmu_peek(c, pc + 2, MMU_FETCH);
+		if (!hi)
+			return false;
+		raw |= (u32)mem_load16(hi, 0) << 16;
+	}
+	instr_decode(in, raw);
+	return true;
+}
+
+static enum idle_decoded idle_decode(struct cpu *c, struct loop *l)
+{
+	u32 pc = c->pc;
+
+	for (l->n = 0; l->n < IDLE_MAX_INSNS; pc += l->in[l->n++].size) {
+		Instruction *in = &l->in[l->n];
+
+		if (!idle_fetch(c, pc, in))
+			return LOOP_UNKNOWN;
+		l->pc[l->n] = pc;
+		if (in->id == INSN_JAL) {
+			if (in->rd != 0 || pc + in->imm != c->pc)
+				return LOOP_BUSY;
+			l->n++;
+			return LOOP_OK;
+		}
+		if (is_branch(in->id)) {
+			if (pc + in->imm == c->pc) {
+				l->n++;
+				return LOOP_OK;
+			}
+			continue; // a way out, if taken
+		}
+		if (in->id != INSN_LUI && in->id != INSN_AUIPC &&
+		    in->id != INSN_FENCE && !is_load(in->id) &&
+		    !is_alu_imm(in->id) && !is_alu_reg(in->id) &&
+		    !is_counter_read(in))
+			return LOOP_BUSY;
+	}
+	return LOOP_BUSY;
+}
+
+// No instruction may read a register that a later one (or it) writes:
+// then every iteration computes the same values as the one before
+static bool idle_invariant(const struct loop *l)
+{
+	u32 later = 0;
+
+	for (u32 i = l->n; i-- > 0;) {
+		later |= writes(&l->in[i]);
+		if (reads(&l->in[i]) & later)
+			return false;
+	}
+	return true;
+}
+
+static u32 idle_alu(u32 id, u32 a, u32 b)
+{
+	switch (id) {
+	case INSN_ADD:
+	case INSN_ADDI:
+		return a + b;
+	case INSN_SUB:
+		return a - b;
+	case INSN_SLL:
+	case INSN_SLLI:
+		return a << (b & 31);
+	case INSN_SLT:
+	case INSN_SLTI:
+		return (s32)a < (s32)b;
+	case INSN_SLTU:
+	case INSN_SLTIU:
+		return a < b;
+	case INSN_XOR:
+	case INSN_XORI:
+		return a ^ b;
+	case INSN_SRL:
+	case INSN_SRLI:
+		return a >> (b & 31);
+	case INSN_SRA:
+	case INSN_SRAI:
+		return (u32)((s32)a >> (b & 31));
+	case INSN_OR:
+	case INSN_ORI:
+		return a | b;
+	default:
+		return a & b;
+	}
+}
+
+static bool idle_taken(u32 id, u32 a, u32 b)
+{
+	switch (id) {
+	case INSN_BEQ:
+		return a == b;
+	case INSN_BNE:
+		return a != b;
+	case INSN_BLT:
+		return (s32)a < (s32)b;
+	case INSN_BGE:
+		return (s32)a >= (s32)b;
+	case INSN_BLTU:
+		return a < b;
+	default:
+		return a >= b;
+	}
+}
+
+// Loads see physical addresses, and so the CLINT, without translation
+static bool idle_bare(struct cpu *c)
+{
+	u32 priv = c->priv;
+
+	if (priv == PRV_M && (c->csr.mstatus & MSTATUS_MPRV))
+		priv = (c->csr.mstatus & MSTATUS_MPP) >> 11;
+	return priv == PRV_M || !(c->csr.satp & SATP_MODE);
+}
+
+/*
+ * Ticks after @tp, the time a word of mtime (the high one if @hi) is
+ * loaded, until `word >= @t` changes value, or NEVER. Only the low word
+ * wraps in the lifetime of a guest.
+ */
+static u64 idle_flip(u64 tp, bool hi, u64 t)
+{
+	u32 lo = (u32)tp;
+
+	if (t == 0 || t > 0xFFFFFFFFull)
+		return NEVER;
+	if (!hi)
+		return lo < t ? t - lo : (1ull << 32) - lo;
+	return (tp >> 32) < t ? (t << 32) - tp : NEVER;
+}
+
+/*
+ * Run one iteration of @l starting at mtime @t on the registers @r. A word
+ * of time, cycle or instret counts as a word of mtime. Every branch on a
+ * word of mtime must be an unsigned compare with a value that
+ * does not depend on time; *@wait is lowered to the number of iterations
+ * after which the first of those branches goes the other way, and
+ * *@polls set if there are any.
+ */
+static enum idle_sim idle_sim(struct cpu *c, const struct loop *l, u64 t,
+			      u32 *r, u64 *wait, bool *polls)
+{
+	u32 timed = 0; // registers holding a word of mtime
+	u64 loaded[NREGS]; // when it was loaded
+	bool hi[NREGS];
+
+	for (u32 i = 0; i < l->n; i++) {
+		const Instruction *in = &l->in[i];
+		u32 a = r[in->rs1], b = r[in->rs2], val = 0;
+		u32 id = in->id;
+
+		if (is_branch(id)) {
+			u32 v = (timed >> in->rs1) & 1 ? in->rs1 : in->rs2;
+			bool taken = idle_taken(id, a, b);
+			bool back = l->pc[i] + in->imm == c->pc;
+
+			if ((timed >> in->rs1) & (timed >> in->rs2) & 1)
+				return SIM_UNKNOWN;
+			if ((timed >> v) & 1) {
+				u64 th, ticks;
+
+				if (id != INSN_BLTU && id != INSN_BGEU)
+					return SIM_UNKNOWN;
+				// As `v >= th`: v < x, v >= x, x < v or x >= v
+				th = v == in->rs1 ? (u64)b : (u64)a + 1;
+				*polls = true;
+				ticks = idle_flip(loaded[v], hi[v], th);
+				if (ticks != NEVER &&
+				    (ticks + l->n - 1) / l->n < *wait)
+					*wait = (ticks + l->n - 1) / l->n;
+			}
+			if (taken != back)
+				return SIM_EXIT;
+			continue;
+		}
+		if (reads(in) & timed)
+			return SIM_UNKNOWN;
+		if (id == INSN_LUI) {
+			val = in->imm;
+		} else if (id == INSN_AUIPC) {
+			val = l->pc[i] + in->imm;
+		} else if (is_alu_imm(id)) {
+			val = idle_alu(id, a, in->imm);
+		} else if (is_alu_reg(id)) {
+			val = idle_alu(id, a, b);
+		} else if (is_load(id)) {
+			u32 addr = a + in->imm;
+			u32 off = addr - CLINT_BASE;
+			u8 *p;
+
+			if (idle_bare(c) && addr >= c->mem_size &&
+			    off < CLINT_SIZE) {
+				if (id != INSN_LW)
+					return SIM_UNKNOWN;
+				if ((off & ~4u) == CLINT_MTIME && !(off & 3)) {
+					val = (u32)((t + i) >> (off & 4 ? 32 : 0));
+					if (in->rd) {
+						loaded[in->rd] = t + i;
+						hi[in->rd] = off & 4;
+						r[in->rd] = val;
+						timed |= 1u << in->rd;
+					}
+					continue;
+				}
+				if (!clint_load(c, off, 4, &val))
+					return SIM_UNKNOWN;
+			} else {
+				p = mmu_peek(c, addr, MMU_LOAD);
+				if (!p || !mmu_in_page(addr, 1 << (in->funct3 & 3)))
+					return SIM_UNKNOWN;
+				switch (id) {
+				case INSN_LB:
+					val = (s32)(s8)mem_load8(p, 0);
+					break;
+				case INSN_LH:
+					val = (s32)(s16)mem_load16(p, 0);
+					break;
+				case INSN_LW:
+					val = mem_load32(p, 0);
+					break;
+				case INSN_LBU:
+					val = mem_load8(p, 0);
+					break;
+				default:
+					val = mem_load16(p, 0);
+					break;
+				}
+			}
+		} else if (is_counter_read(in)) {
+			u32 addr = (u32)in->imm & 0xFFF;
+			u64 tp = t + i + idle_skew(c, addr);
+
+			// Only counteren can make the read trap
+			if (!csr_read(c, addr, &val))
+				return SIM_UNKNOWN;
+			if (in->rd) {
+				loaded[in->rd] = tp;
+				hi[in->rd] = addr & 0x80;
+				r[in->rd] = (u32)(tp >> (addr & 0x80 ? 32 : 0));
+				timed |= 1u << in->rd;
+			}
+			continue;
+		} else {
+			continue; // FENCE, or JAL back to pc
+		}
+		if (in->rd) {
+			r[in->rd] = val;
+			timed &= ~(1u << in->rd);
+		}
+	}
+	return SIM_ROUND;
+}
+
+// Whole iterations of @len that fit before the timer interrupt, or NEVER
+static u64 idle_timer(struct cpu *c, u64 now, u32 len)
+{
+	bool on = c->priv < PRV_M || (c->csr.mstatus & MSTATUS_MIE);
+
+	if (!on || !(c->csr.mie & MIP_MTIP) ||
+	    c->clint.mtimecmp == CLINT_NEVER || c->clint.mtimecmp <= now)
+		return NEVER;
+	return (c->clint.mtimecmp - now) / len;
+}
+
+void idle_loop(struct idle *d, struct cpu *c, u64 budget)
+{
+	u32 slot = (c->pc >> 1) & (IDLE_CACHE_SIZE - 1);
+	u32 r[NREGS];
+	struct loop l;
+	u64 now, k = NEVER, k_last = NEVER, irq;
+	bool polls = false;
+
+	if (c->cachesim || c->bpred || d->busy[slot] == c->pc)
+		return;
+	switch (idle_decode(c, &l)) {
+	case LOOP_OK:
+		break;
+	case LOOP_BUSY:
+		d->busy[slot] = c->pc;
+		return;
+	default:
+		return;
+	}
+	if (!idle_invariant(&l)) {
+		d->busy[slot] = c->pc;
+		return;
+	}
+
+	now = clint_mtime(c);
+	memcpy(r, c->registers, sizeof(r));
+	if (idle_sim(c, &l, now, r, &k, &polls) != SIM_ROUND)
+		return;
+	irq = idle_timer(c, now, l.n);
+	if (irq == NEVER && k == NEVER) {
+		d->stats.stops++;
+		cpu_halt(c, CPU_STOP_IDLE);
+		c->resume_pc = c->pc;
+		return;
+	}
+	if (irq < k)
+		k = irq;
+	if (k > budget / l.n)
+		k = budget / l.n;
+	if (k == 0)
+		return;
+
+	// Registers end as the last iteration skipped leaves them; only
+	// words of mtime differ from the iteration just run
+	if (polls) {
+		memcpy(r, c->registers, sizeof(r));
+		idle_sim(c, &l, now + (k - 1) * l.n, r, &k_last, &polls);
+		memcpy(c->registers, r, sizeof(r));
+		d->stats.polls++;
+	} else {
+		d->stats.spins++;
+	}
+	c->insn_count += k * l.n;
+	d->stats.skipped += k * l.n;
+#ifdef CONFIG_INSN_MIX
+	// Each round skipped retires the whole loop, its back edge taken
+	for (u32 i = 0; i < l.n; i++) {
+		c->mix.count[l.in[i].id] += k;
+		if (l.in[i].size == 2)
+			c->mix.compressed += k;
+	}
+	if (is_branch(l.in[l.n - 1].id))
+		c->mix.branch_taken += k;
+#endif
+}
+
+void idle_print_stats(const struct idle *d, const struct cpu *c, FILE *out)
+{
+	const struct idle_stats *s = &d->stats;
+
+	fprintf(out, "Idle: %llu WFIs, %llu timer ticks skipped\n",
+		(unsigned long long)c->clint.stats.wfis,
+		(unsigned long long)c->clint.stats.ticks_skipped);
+	fprintf(out,
+		"  %llu spin and %llu poll loops skipped (%llu instructions), %llu stopped\n",
+		(unsigned long long)s->spins, (unsigned long long)s->polls,
+		(unsigned long long)s->skipped, (unsigned long long)s->stops);
+}
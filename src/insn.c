@@ -0,0 +1,110 @@
+#include "insn.h"
+#include <pthread.h>
+#include <string.h>
+
+_Static_assert(INSN_COUNT <= 65536, "decode table stores IDs in 16 bits");
+
+const struct insn_info insn_info[INSN_COUNT] = {
+	[INSN_ILLEGAL] = { "unknown", FMT_NONE, 0, 0 },
+#define X(id, handler, name, fmt, match, mask) \
+	[INSN_##id] = { name, fmt, match, mask },
+	INSN_LIST(X)
+#undef X
+};
+
+struct insn_slot insn_table[1u << INSN_KEY_BITS];
+u16 insn_alts[INSN_ALTS_MAX];
+bool insn_table_ready;
+static pthread_once_t insn_table_once = PTHREAD_ONCE_INIT;
+
+static bool insn_covers(u32 id, u32 key)
+{
+	return ((key ^ insn_key(insn_info[id].match)) &
+		insn_key(insn_info[id].mask)) == 0;
+}
+
+// Store the entries after @owner that also cover @key, sharing an equal
+// list already stored; INSN_ALT_SCAN when there is no room left
+static u8 insn_alts_add(u32 owner, u32 key, u32 *used)
+{
+	u16 list[INSN_ALTS_MAX];
+	u32 n = 0;
+
+	for (u32 id = owner + 1; id < INSN_COUNT && n < INSN_ALTS_MAX; id++) {
+		if (insn_covers(id, key))
+			list[n++] = id;
+	}
+	if (n == INSN_ALTS_MAX)
+		return INSN_ALT_SCAN;
+	list[n++] = INSN_ILLEGAL;
+
+	for (u32 i = 1; i + n <= *used; i++) {
+		if (!memcmp(&insn_alts[i], list, n * sizeof(*list)))
+			return i;
+	}
+	if (*used + n > INSN_ALTS_MAX || *used >= INSN_ALT_SCAN)
+		return INSN_ALT_SCAN;
+	memcpy(&insn_alts[*used], list, n * sizeof(*list));
+	*used += n;
+	return *used - n;
+}
+
+// Fill every key an entry can produce. Entries are walked backwards so an
+// earlier entry keeps the slot when two share it (ECALL over EBREAK); a
+// slot that was already taken gets the list of the others afterwards.
+static void insn_table_fill(void)
+{
+	u32 used = 1; // insn_alts[0] is the empty list
+
+	for (u32 id = INSN_COUNT - 1; id > INSN_ILLEGAL; id--) {
+		struct insn_slot slot = { id, insn_info[id].format, 0 };
+		u32 fixed = insn_key(insn_info[id].mask);
+		u32 base = insn_key(insn_info[id].match);
+		u32 dontcare = ~fixed & ((1u << INSN_KEY_BITS) - 1);
+		u32 s = 0;
+
+		// Enumerate all subsets of the don't-care key bits
+		do {
+			slot.alt = insn_table[base | s].id ? INSN_ALT_SCAN : 0;
+			insn_table[base | s] = slot;
+			s = (s - dontcare) & dontcare;
+		} while (s);
+	}
+	for (u32 key = 0; key < (1u << INSN_KEY_BITS); key++) {
+		if (insn_table[key].alt)
+			insn_table[key].alt =
+				insn_alts_add(insn_table[key].id, key, &used);
+	}
+	__atomic_store_n(&insn_table_ready, true, __ATOMIC_RELEASE);
+}
+
+void insn_table_init(void)
+{
+	pthread_once(&insn_table_once, insn_table_fill);
+}
+
+// Encodings the table slot did not confirm: check the other entries with
+// the key in table order, or every entry when they did not fit
+struct insn_slot insn_scan(u32 raw, struct insn_slot slot)
+{
+	struct insn_slot found = { INSN_ILLEGAL, FMT_NONE, 0 };
+
+	if (slot.alt == INSN_ALT_SCAN) {
+		for (u32 id = INSN_ILLEGAL + 1; id < INSN_COUNT; id++) {
+			if ((raw & insn_info[id].mask) == insn_info[id].match) {
+				found.id = id;
+				found.format = insn_info[id].format;
+				break;
+			}
+		}
+		return found;
+	}
+	for (const u16 *id = &insn_alts[slot.alt]; *id; id++) {
+		if ((raw & insn_info[*id].mask) == insn_info[*id].match) {
+			found.id = *id;
+			found.format = insn_info[*id].format;
+			break;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,117 @@
+#include "insn_mix.h"
+
+#include <stdlib.h>
+
+enum insn_class insn_class(enum insn_id id)
+{
+	u32 match = insn_info[id].match;
+
+	switch (match & MASK_OPCODE) {
+	case 0x03:
+	case 0x07: // flw/fld and vector loads
+		return INSN_CLASS_LOAD;
+	case 0x23:
+	case 0x27: // fsw/fsd and vector stores
+		return INSN_CLASS_STORE;
+	case 0x63:
+		return INSN_CLASS_BRANCH;
+	case 0x67:
+	case 0x6f:
+		return INSN_CLASS_JUMP;
+	case 0x2f:
+		return INSN_CLASS_AMO;
+	case 0x43: // fmadd, fmsub, fnmsub, fnmadd
+	case 0x47:
+	case 0x4b:
+	case 0x4f:
+	case 0x53: // OP-FP
+		return INSN_CLASS_FP;
+	case 0x57: // OP-V
+		return INSN_CLASS_VECTOR;
+	case 0x0f:
+	case 0x73:
+		return INSN_CLASS_SYSTEM;
+	case 0x33:
+		// funct7 = 1 is the M extension
+		if ((match >> 25) == 1)
+			return INSN_CLASS_MULDIV;
+		return INSN_CLASS_ALU;
+	}
+	// Illegal instructions never retire, so their class does not matter
+	return INSN_CLASS_ALU;
+}
+
+static const char *const insn_class_names[INSN_CLASS_COUNT] = {
+	[INSN_CLASS_ALU] = "alu",
+	[INSN_CLASS_MULDIV] = "muldiv",
+	[INSN_CLASS_LOAD] = "load",
+	[INSN_CLASS_STORE] = "store",
+	[INSN_CLASS_BRANCH] = "branch",
+	[INSN_CLASS_JUMP] = "jump",
+	[INSN_CLASS_AMO] = "amo",
+	[INSN_CLASS_FP] = "fp",
+	[INSN_CLASS_VECTOR] = "vector",
+	[INSN_CLASS_SYSTEM] = "system",
+};
+
+const char *insn_class_name(enum insn_class cls)
+{
+	return insn_class_names[cls];
+}
+
+#ifdef CONFIG_INSN_MIX
+static const struct insn_mix *sort_mix;
+
+// Most executed first, ties in table order
+static int by_count(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+
+	if (sort_mix->count[x] != sort_mix->count[y])
+		return sort_mix->count[x] < sort_mix->count[y] ? 1 : -1;
+	return x < y ? -1 : 1;
+}
+
+void insn_mix_dump_json(const struct insn_mix *m, FILE *out)
+{
+	u64 classes[INSN_CLASS_COUNT] = { 0 };
+	u32 ids[INSN_COUNT], n = 0;
+	u64 retired = 0;
+
+	for (u32 id = 0; id < INSN_COUNT; id++) {
+		if (!m->count[id])
+			continue;
+		classes[insn_class(id)] += m->count[id];
+		retired += m->count[id];
+		ids[n++] = id;
+	}
+	sort_mix = m;
+	qsort(ids, n, sizeof(ids[0]), by_count);
+
+	fprintf(out, "{\n  \"retired\": %llu,\n  \"compressed\": %llu,\n"
+		     "  \"traps\": %llu,\n  \"classes\": {\n",
+		(unsigned long long)retired, (unsigned long long)m->compressed,
+		(unsigned long long)m->traps);
+	for (int cls = 0; cls < INSN_CLASS_COUNT; cls++) {
+		if (cls == INSN_CLASS_BRANCH) {
+			fprintf(out,
+				"    \"branch_taken\": %llu,\n"
+				"    \"branch_not_taken\": %llu,\n",
+				(unsigned long long)m->branch_taken,
+				(unsigned long long)(classes[cls] -
+						     m->branch_taken));
+			continue;
+		}
+		fprintf(out, "    \"%s\": %llu%s\n", insn_class_names[cls],
+			(unsigned long long)classes[cls],
+			cls + 1 < INSN_CLASS_COUNT ? "," : "");
+	}
+	fprintf(out, "  },\n  \"mnemonics\": {");
+	for (u32 i = 0; i < n; i++) {
+		fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "",
+			insn_info[ids[i]].name,
+			(unsigned long long)m->count[ids[i]]);
+	}
+	fprintf(out, "%s}\n}\n", n ? "\n  " : "");
+}
+#endif
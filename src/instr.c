@@ -1,8 +1,28 @@
+// clock_gettime() and read()
+#define _POSIX_C_SOURCE 200809L
+
 #include "instr.h"
+#include "bpred.h"
+#include "callgraph.h"
 #include "common.h"
 #include "cpu.h"
+#include "csr.h"
+#include "fpu.h"
+#include "fuzz.h"
+#include "insn.h"
 #include "memory.h"
+#include "mmu.h"
+#include "replay.h"
+#include "rvc.h"
+#include "vector.h"
+#include <errno.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest read() serviced in one call; shorter reads are always allowed
+#define SYSCALL_IO_MAX 4096
 
 static void syscall_handler(struct cpu *c);
 
@@ -12,374 +32,478 @@ static inline u32 get_bits(u32 x, int hi, int lo)
 	return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
 }
 
-// Decodes a raw 32-bit instruction into an Instruction struct.
+/*
+ * Every immediate bit comes from one of a few fixed rotations of the
+ * instruction, or from a sign bit, so a format's layout is a mask per
+ * source. The rotations do not wait for the table lookup and no branch
+ * depends on the format, which a mixed stream would mispredict. Formats
+ * without an immediate have no masks and decode as zero.
+ */
+struct imm_layout {
+	u32 sign31; // bits filled with raw[31]
+	u32 sign19; // with raw[19], the sign of a 5-bit rs1-field immediate
+	u32 rot0;
+	u32 rot7;
+	u32 rot9;
+	u32 rot15;
+	u32 rot20;
+	u32 rot28;
+};
+
+#define IMM_I { .sign31 = 0xFFFFF800, .rot20 = 0x7FF }
+#define IMM_S { .sign31 = 0xFFFFF800, .rot20 = 0x7E0, .rot7 = 0x1F }
+#define IMM_CSR { .rot20 = 0xFFF } // CSR address, not sign-extended
+#define IMM_VI { .sign19 = 0xFFFFFFF0, .rot15 = 0xF }
+
+static const struct imm_layout imm_layouts[FMT_COUNT] = {
+	[FMT_I] = IMM_I,
+	[FMT_LOAD] = IMM_I,
+	[FMT_FLOAD] = IMM_I,
+	[FMT_S] = IMM_S,
+	[FMT_FSTORE] = IMM_S,
+	[FMT_B] = { .sign31 = 0xFFFFF000, .rot28 = 0x800, .rot20 = 0x7E0,
+		    .rot7 = 0x1E },
+	// U-type immediate covers bits 31-12
+	[FMT_U] = { .rot0 = 0xFFFFF000 },
+	[FMT_J] = { .sign31 = 0xFFF00000, .rot0 = 0xFF000, .rot9 = 0x800,
+		    .rot20 = 0x7FE },
+	// SLLI/SRLI/SRAI: shamt only, funct7 selects the shift
+	[FMT_SHIFT] = { .rot20 = 0x1F },
+	[FMT_CSR] = IMM_CSR,
+	[FMT_CSRI] = IMM_CSR,
+	// vtype for vsetvli/vsetivli
+	[FMT_VSETVLI] = { .rot20 = 0x7FF },
+	[FMT_VSETIVLI] = { .rot20 = 0x3FF },
+	[FMT_VI] = IMM_VI,
+	[FMT_VMV_I] = IMM_VI,
+	[FMT_VMERGE_VI] = IMM_VI,
+	[FMT_VI_U] = { .rot15 = 0x1F },
+};
+
+static inline s32 decode_imm(u32 raw, enum insn_format format)
+{
+	const struct imm_layout *l = &imm_layouts[format];
+
+	return (s32)(((u32)((s32)raw >> 31) & l->sign31) |
+		     ((u32)((s32)(raw << 12) >> 31) & l->sign19) |
+		     (raw & l->rot0) | (ror32(raw, 7) & l->rot7) |
+		     (ror32(raw, 9) & l->rot9) | (ror32(raw, 15) & l->rot15) |
+		     (ror32(raw, 20) & l->rot20) | (ror32(raw, 28) & l->rot28));
+}
+
+// Decodes a raw instruction into an Instruction struct. Compressed
+// instructions are expanded first so they share the 32-bit handlers.
 void instr_decode(Instruction *instr, u32 raw)
 {
+	struct insn_slot slot;
+
+	instr->raw = raw;
+	instr->size = 4;
+	if (RVC_IS_COMPRESSED(raw)) {
+		instr->raw = raw & 0xFFFF;
+		instr->size = 2;
+		raw = rvc_expand(raw & 0xFFFF);
+	}
+
+	slot = insn_decode_slot(raw);
+	instr->id = slot.id;
 	instr->opcode = get_bits(raw, 6, 0);
 	instr->rd = get_bits(raw, 11, 7);
 	instr->funct3 = get_bits(raw, 14, 12);
 	instr->rs1 = get_bits(raw, 19, 15);
 	instr->rs2 = get_bits(raw, 24, 20);
 	instr->funct7 = get_bits(raw, 31, 25);
+	instr->imm = decode_imm(raw, slot.format);
+}
 
-	// Default immediate to 0
-	instr->imm = 0;
-
-	// Decode the immediate value based on the instruction format (opcode)
-	switch (instr->opcode) {
-	case 0x13: { // I-type (ADDI, SLLI, etc.)
-		// Shift instructions (SLLI, SRLI, SRAI) have a special immediate format
-		// that is NOT sign-extended....
-		if (instr->funct3 == 0x1 || instr->funct3 == 0x5) {
-			instr->imm = (s32)get_bits(raw, 24, 20);
-			instr->funct7 = get_bits(raw, 31, 25);
-		} else {
-			// Other I-type instructions like ADDI have a sign-extended immediate.
-			instr->imm = sign_extend(get_bits(raw, 31, 20), 12);
-		}
-		break;
-	}
-	case 0x03: // I-type loads
-	case 0x67: // JALR
-		instr->imm = sign_extend(get_bits(raw, 31, 20), 12);
-		break;
+// --- Instruction Execution Functions ---
+//
+// One handler per entry in INSN_LIST, bound by name in insn_handlers[].
+// Operands are read before rd is written so rd may alias a source.
 
-	case 0x23: { // S-type (stores)
-		u32 imm11_5 = get_bits(raw, 31, 25);
-		u32 imm4_0 = get_bits(raw, 11, 7);
-		instr->imm = sign_extend((imm11_5 << 5) | imm4_0, 12);
-		break;
-	}
+static void exec_illegal(struct cpu *c, const Instruction *instr)
+{
+	cpu_trap(c, CAUSE_ILLEGAL_INSN, instr->raw);
+}
 
-	case 0x63: { // B-type (branches)
-		u32 imm12 = get_bits(raw, 31, 31);
-		u32 imm10_5 = get_bits(raw, 30, 25);
-		u32 imm4_1 = get_bits(raw, 11, 8);
-		u32 imm11 = get_bits(raw, 7, 7);
-		instr->imm = sign_extend((imm12 << 12) | (imm11 << 11) |
-						 (imm10_5 << 5) | (imm4_1 << 1),
-					 13);
-		break;
-	}
+static void exec_lui(struct cpu *c, const Instruction *instr)
+{
+	c->registers[instr->rd] = instr->imm;
+}
 
-	case 0x37: // LUI
-	case 0x17: // AUIPC
-		// U-type immediate covers bits 31-12
-		instr->imm = (s32)(raw & 0xFFFFF000);
-		break;
+static void exec_auipc(struct cpu *c, const Instruction *instr)
+{
+	c->registers[instr->rd] = c->pc + instr->imm;
+}
 
-	case 0x6F: { // J-type (JAL)
-		u32 imm20 = get_bits(raw, 31, 31);
-		u32 imm10_1 = get_bits(raw, 30, 21);
-		u32 imm11 = get_bits(raw, 20, 20);
-		u32 imm19_12 = get_bits(raw, 19, 12);
-		instr->imm = sign_extend((imm20 << 20) | (imm19_12 << 12) |
-						 (imm11 << 11) | (imm10_1 << 1),
-					 21);
-		break;
+static void exec_jal(struct cpu *c, const Instruction *instr)
+{
+	if (c->bpred)
+		bpred_jump(c->bpred, c->pc, c->pc + instr->imm, instr->rd, 0,
+			   false, c->next_pc);
+	if (c->callgraph)
+		callgraph_jump(c->callgraph, c, c->pc + instr->imm, instr->rd,
+			       0, false, c->next_pc);
+	// Store the return address (the next instruction); x0 is re-zeroed.
+	c->registers[instr->rd] = c->next_pc;
+	c->next_pc = c->pc + instr->imm;
+	if (c->fuzz)
+		fuzz_edge(c->fuzz, c->next_pc);
+}
+
+static void exec_jalr(struct cpu *c, const Instruction *instr)
+{
+	// Store the return address before changing the PC.
+	u32 return_addr = c->next_pc;
+
+	// Calculate the target address: (rs1 + imm) and clear the LSB.
+	u32 target_addr = (c->registers[instr->rs1] + instr->imm) & ~1U;
+
+	if (c->bpred)
+		bpred_jump(c->bpred, c->pc, target_addr, instr->rd, instr->rs1,
+			   true, return_addr);
+	if (c->callgraph)
+		callgraph_jump(c->callgraph, c, target_addr, instr->rd,
+			       instr->rs1, true, return_addr);
+
+	c->next_pc = target_addr;
+	c->registers[instr->rd] = return_addr;
+	if (c->fuzz)
+		fuzz_edge(c->fuzz, target_addr);
+}
+
+static inline void branch(struct cpu *c, const Instruction *instr, bool taken)
+{
+	if (c->bpred)
+		bpred_branch(c->bpred, c->pc, c->pc + instr->imm, taken);
+#ifdef CONFIG_INSN_MIX
+	c->mix.branch_taken += taken;
+#endif
+	if (taken)
+		c->next_pc = c->pc + instr->imm;
+	if (c->fuzz)
+		fuzz_edge(c->fuzz, c->next_pc);
+}
+
+#define BRANCH(name, cond)                                               \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		u32 a = c->registers[instr->rs1];                        \
+		u32 b = c->registers[instr->rs2];                        \
+		branch(c, instr, cond);                                  \
 	}
 
-	case 0x73:
-		instr->imm = sign_extend(get_bits(raw, 31, 20), 12);
-		break;
+BRANCH(beq, a == b)
+BRANCH(bne, a != b)
+BRANCH(blt, (s32)a < (s32)b)
+BRANCH(bge, (s32)a >= (s32)b)
+BRANCH(bltu, a < b)
+BRANCH(bgeu, a >= b)
+
+// A failed translation has already raised the trap, so rd is only written
+// once the access is known not to fault.
+#define LOAD(name, load, ext)                                             \
+	static void exec_##name(struct cpu *c, const Instruction *instr)  \
+	{                                                                 \
+		u32 val;                                                  \
+		if (load(c, c->registers[instr->rs1] + instr->imm, &val)) \
+			c->registers[instr->rd] = ext;                    \
+	}
 
-		// R-type instructions do not have an immediate field.
-	case 0x33:
-	default:
-		instr->imm = 0;
+LOAD(lb, mmu_load8, (s32)(s8)val)
+LOAD(lh, mmu_load16, (s32)(s16)val)
+LOAD(lw, mmu_load32, val)
+LOAD(lbu, mmu_load8, val)
+LOAD(lhu, mmu_load16, val)
+
+#define STORE(name, store)                                               \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		store(c, c->registers[instr->rs1] + instr->imm,          \
+		      c->registers[instr->rs2]);                         \
 	}
-}
 
-// --- Instruction Execution Functions ---
+STORE(sb, mmu_store8)
+STORE(sh, mmu_store16)
+STORE(sw, mmu_store32)
 
-static void r_type_exec(struct cpu *c, const Instruction *instr)
-{
-	u32 rd = instr->rd;
-	u32 rs1 = instr->rs1;
-	u32 rs2 = instr->rs2;
-
-	if (instr->funct7 == 0x01) {
-		s64 val1 = (s64)(s32)c->registers[rs1];
-		s64 val2 = (s64)(s32)c->registers[rs2];
-		u64 u_val1 = (u64)c->registers[rs1];
-		u64 u_val2 = (u64)c->registers[rs2];
-		switch (instr->funct3) {
-		case 0x0: //MUL
-			c->registers[rd] = (u32)(val1 * val2);
-			break;
-		case 0x1: // MULH
-			c->registers[rd] = (u32)((val1 * val2) >> 32);
-			break;
-		case 0x2: // MULHSU
-			c->registers[rd] = (u32)(val1 * (s64)(u_val2) >> 32);
-			break;
-		case 0x3: // MULHU
-			c->registers[rd] = (u32)((u_val1 * u_val2) >> 32);
-			break;
-		case 0x4: // DIV
-			if (c->registers[rs2] == 0) {
-				c->registers[rd] =
-					0xFFFFFFFF; // Division by zero gives all 1s
-			} else {
-				c->registers[rd] =
-					(u32)((s32)c->registers[rs1] /
-					      (s32)c->registers[rs2]);
-			}
-			break;
-		case 0x5: // DIVU
-			if (c->registers[rs2] == 0) {
-				c->registers[rd] = 0xFFFFFFFF;
-			} else {
-				c->registers[rd] =
-					c->registers[rs1] / c->registers[rs2];
-			}
-			break;
-		case 0x6: // REM : signed reminder
-			if (c->registers[rs2] == 0) {
-				c->registers[rd] =
-					c->registers[rs1]; // reminder
-			} else {
-				c->registers[rd] =
-					(u32)((s32)c->registers[rs1] %
-					      (s32)c->registers[rs2]);
-			}
-			break;
-		case 0x7: // REMU : unsigned reminder
-			if (c->registers[rs2] == 0) {
-				c->registers[rd] = c->registers[rs1];
-			} else {
-				c->registers[rd] =
-					c->registers[rs1] % c->registers[rs2];
-			}
-			break;
-		}
-		return;
+#define OP_IMM(name, expr)                                               \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		u32 a = c->registers[instr->rs1];                        \
+		s32 imm = instr->imm;                                    \
+		c->registers[instr->rd] = (expr);                        \
 	}
 
-	switch (instr->funct3) {
-	case 0x0: // ADD or SUB
-		if (instr->funct7 == 0x00) { // ADD
-			c->registers[rd] =
-				c->registers[rs1] + c->registers[rs2];
-		} else if (instr->funct7 == 0x20) { // SUB
-			c->registers[rd] =
-				c->registers[rs1] - c->registers[rs2];
-		}
-		break;
-	case 0x1: // SLL
-		u32 shamt = c->registers[rs2] & 0x1F;
-		c->registers[rd] = c->registers[rs1] << shamt;
-		break;
-	case 0x2: // SLT
-		c->registers[rd] =
-			((s32)c->registers[rs1] < (s32)c->registers[rs2]) ? 1 :
-									    0;
-		break;
-	case 0x3: // SLTU (Set if Less Than, Unsigned)
-		// Default comparison is unsigned.
-		c->registers[rd] = (c->registers[rs1] < c->registers[rs2]) ? 1 :
-									     0;
-		break;
-	case 0x4: // XOR
-		c->registers[rd] = c->registers[rs1] ^ c->registers[rs2];
-		break;
-	case 0x05: { // SRL or SRA
-		// use only the lower 5 bits of rs2 as the shift amount
-		u32 shamt = c->registers[rs2] & 0x1F;
-		if (instr->funct7 == 0x00) { // SRL
-			c->registers[rd] = c->registers[rs1] >> shamt;
-		} else if (instr->funct7 == 0x20) { // SRA
-			c->registers[rd] = (s32)c->registers[rs1] >> shamt;
-		}
-		break;
+OP_IMM(addi, a + imm)
+OP_IMM(slti, (s32)a < imm)
+OP_IMM(sltiu, a < (u32)imm)
+OP_IMM(xori, a ^ imm)
+OP_IMM(ori, a | imm)
+OP_IMM(andi, a & imm)
+OP_IMM(slli, a << (imm & 0x1F))
+OP_IMM(srli, a >> (imm & 0x1F))
+OP_IMM(srai, (s32)a >> (imm & 0x1F))
+OP_IMM(rori, ror32(a, imm))
+OP_IMM(bclri, a & ~(1u << (imm & 0x1F)))
+OP_IMM(bexti, (a >> (imm & 0x1F)) & 1)
+OP_IMM(binvi, a ^ (1u << (imm & 0x1F)))
+OP_IMM(bseti, a | (1u << (imm & 0x1F)))
+
+#define UNARY(name, expr)                                                \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		u32 a = c->registers[instr->rs1];                        \
+		c->registers[instr->rd] = (expr);                        \
 	}
 
-	case 0x6: // OR
-		c->registers[rd] = c->registers[rs1] | c->registers[rs2];
-		break;
-	case 0x7: // AND
-		c->registers[rd] = c->registers[rs1] & c->registers[rs2];
-		break;
+UNARY(clz, clz32(a))
+UNARY(ctz, ctz32(a))
+UNARY(cpop, (u32)__builtin_popcount(a))
+UNARY(sext_b, (s32)(s8)a)
+UNARY(sext_h, (s32)(s16)a)
+UNARY(zext_h, a & 0xFFFF)
+UNARY(orc_b, orc_b(a))
+UNARY(rev8, __builtin_bswap32(a))
+
+#define OP(name, expr)                                                   \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		u32 a = c->registers[instr->rs1];                        \
+		u32 b = c->registers[instr->rs2];                        \
+		c->registers[instr->rd] = (expr);                        \
 	}
-}
 
-static void i_type_exec(struct cpu *c, const Instruction *instr)
+OP(add, a + b)
+OP(sub, a - b)
+OP(sll, a << (b & 0x1F))
+OP(slt, (s32)a < (s32)b)
+OP(sltu, a < b)
+OP(xor, a ^ b)
+OP(srl, a >> (b & 0x1F))
+OP(sra, (s32)a >> (b & 0x1F))
+OP(or, a | b)
+OP(and, a & b)
+OP(mul, a * b)
+OP(mulh, (u32)(((s64)(s32)a * (s64)(s32)b) >> 32))
+OP(mulhsu, (u32)(((s64)(s32)a * (s64)b) >> 32))
+OP(mulhu, (u32)(((u64)a * b) >> 32))
+OP(div, div_signed(a, b))
+OP(divu, b ? a / b : 0xFFFFFFFF)
+OP(rem, rem_signed(a, b))
+OP(remu, b ? a % b : a)
+OP(sh1add, (a << 1) + b)
+OP(sh2add, (a << 2) + b)
+OP(sh3add, (a << 3) + b)
+OP(andn, a & ~b)
+OP(orn, a | ~b)
+OP(xnor, ~(a ^ b))
+OP(min, (s32)a < (s32)b ? a : b)
+OP(minu, a < b ? a : b)
+OP(max, (s32)a > (s32)b ? a : b)
+OP(maxu, a > b ? a : b)
+OP(rol, rol32(a, b))
+OP(ror, ror32(a, b))
+OP(bclr, a & ~(1u << (b & 0x1F)))
+OP(bext, (a >> (b & 0x1F)) & 1)
+OP(binv, a ^ (1u << (b & 0x1F)))
+OP(bset, a | (1u << (b & 0x1F)))
+
+static void exec_fence(struct cpu *c, const Instruction *instr)
 {
-	u32 rd = instr->rd;
-	u32 rs1 = instr->rs1;
-	s32 imm = instr->imm;
+	// Memory is sequentially consistent and the decode cache checks the
+	// raw encoding on every fetch, so FENCE and FENCE.I have nothing to do.
+	(void)c;
+	(void)instr;
+}
 
-	switch (instr->funct3) {
-	case 0x0: // ADDI
-		c->registers[rd] = c->registers[rs1] + imm;
-		break;
+// Zicsr: CSRRW, CSRRS, CSRRC and their immediate forms
+static void exec_csr(struct cpu *c, const Instruction *instr)
+{
+	u32 addr = (u32)instr->imm & 0xFFF;
+	u32 op = instr->funct3 & 0x3;
+	// The immediate forms use the rs1 field as a 5-bit zero-extended value
+	u32 src = (instr->funct3 & 0x4) ? instr->rs1 : c->registers[instr->rs1];
+	u32 old = 0;
+	u32 val;
 
-	case 0x1: { // SLLI (Shift Left Logical Immediate)
+	// CSRRW with rd=x0 must not read; CSRRS/C with rs1=x0 must not write
+	bool do_read = op != 0x1 || instr->rd != 0;
+	bool do_write = op == 0x1 || instr->rs1 != 0;
 
-		u32 shamt = (u32)imm & 0x1F;
-		c->registers[rd] = c->registers[rs1] << shamt;
-		break;
-	}
-	case 0x2: // SLTI
-		c->registers[rd] = ((s32)c->registers[rs1] < imm) ? 1 : 0;
-		break;
-	case 0x3: // SLTIU
-		c->registers[rd] = (c->registers[rs1] < (u32)imm) ? 1 : 0;
-		break;
-	case 0x4: // XORI
-		c->registers[rd] = c->registers[rs1] ^ imm;
-		break;
+	if (do_read && !csr_read(c, addr, &old))
+		goto illegal;
 
-	case 0x5: { // SRLI or SRAI
-		u32 shamt = instr->imm & 0x1F;
-		if (instr->funct7 == 0x00) { // SRLI
-			c->registers[rd] = ((u32)c->registers[rs1]) >> shamt;
-		} else if (instr->funct7 == 0x20) { // SRAI
-			// For arithmetic right shift, cast to signed int32
-			c->registers[rd] = ((s32)c->registers[rs1]) >> shamt;
-		}
+	switch (op) {
+	case 0x1: // CSRRW
+		val = src;
 		break;
-	}
-	case 0x6: // ORI
-		c->registers[rd] = c->registers[rs1] | imm;
+	case 0x2: // CSRRS
+		val = old | src;
 		break;
-	case 0x7: // ANDI
-		c->registers[rd] = c->registers[rs1] & imm;
+	case 0x3: // CSRRC
+		val = old & ~src;
 		break;
+	default:
+		goto illegal;
 	}
+
+	if (do_write && !csr_write(c, addr, val))
+		goto illegal;
+	c->registers[instr->rd] = old;
+	return;
+
+illegal:
+	cpu_trap(c, CAUSE_ILLEGAL_INSN, 0);
 }
 
-static void b_type_exec(struct cpu *c, const Instruction *instr)
+static void exec_mret(struct cpu *c, const Instruction *instr)
 {
-	bool take_branch = false;
-	u32 val1 = c->registers[instr->rs1];
-	u32 val2 = c->registers[instr->rs2];
+	u32 s = c->csr.mstatus;
+	u32 mpp = (s & MSTATUS_MPP) >> 11;
 
-	switch (instr->funct3) {
-	case 0x0: // BEQ
-		take_branch = (val1 == val2);
-		break;
-	case 0x1: // BNE
-		take_branch = (val1 != val2);
-		break;
-	case 0x4: // BLT (signed)
-		take_branch = ((s32)val1 < (s32)val2);
-		break;
-	case 0x5: // BGE (signed)
-		take_branch = ((s32)val1 >= (s32)val2);
-		break;
-	case 0x6: // BLTU (unsigned)
-		take_branch = (val1 < val2);
-		break;
-	case 0x7: // BGEU (unsigned)
-		take_branch = (val1 >= val2);
-		break;
+	if (c->priv != PRV_M) {
+		exec_illegal(c, instr);
+		return;
 	}
+	s = (s & ~MSTATUS_MIE) | ((s & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+	s = (s | MSTATUS_MPIE) & ~MSTATUS_MPP;
+	if (mpp != PRV_M)
+		s &= ~MSTATUS_MPRV;
+	c->csr.mstatus = s;
+	cpu_set_priv(c, mpp);
+	c->next_pc = c->csr.mepc;
+}
 
-	if (take_branch) {
-		// The PC will be incremented by 4 in cpu_step, so we pre-compensate.
-		c->pc += instr->imm - 4;
+static void exec_sret(struct cpu *c, const Instruction *instr)
+{
+	u32 s = c->csr.mstatus;
+	u32 spp = (s & MSTATUS_SPP) ? PRV_S : PRV_U;
+
+	if (c->priv < PRV_S) {
+		exec_illegal(c, instr);
+		return;
 	}
+	s = (s & ~MSTATUS_SIE) | ((s & MSTATUS_SPIE) ? MSTATUS_SIE : 0);
+	s = (s | MSTATUS_SPIE) & ~(MSTATUS_SPP | MSTATUS_MPRV);
+	c->csr.mstatus = s;
+	cpu_set_priv(c, spp);
+	c->next_pc = c->csr.sepc;
 }
 
-static void u_type_exec(struct cpu *c, const Instruction *instr)
+// TW traps WFI in S-mode; U-mode may never wait
+static void exec_wfi(struct cpu *c, const Instruction *instr)
 {
-	switch (instr->opcode) {
-	case 0x37: // LUI
-		c->registers[instr->rd] = instr->imm;
-		break;
-	case 0x17: // AUIPC
-		c->registers[instr->rd] = c->pc + instr->imm;
-		break;
+	if (c->priv == PRV_U ||
+	    (c->priv == PRV_S && (c->csr.mstatus & MSTATUS_TW))) {
+		exec_illegal(c, instr);
+		return;
 	}
+	cpu_wfi(c, instr->size);
 }
 
-static void j_type_exec(struct cpu *c, const Instruction *instr)
+static void exec_sfence_vma(struct cpu *c, const Instruction *instr)
 {
-	// Store the return address (pc + 4) if rd is not the zero register.
-	if (instr->rd != 0) {
-		c->registers[instr->rd] = c->pc + 4;
+	if (c->priv < PRV_S) {
+		exec_illegal(c, instr);
+	} else if (instr->rs1 != 0) {
+		mmu_flush_page(c, c->registers[instr->rs1]);
+	} else {
+		mmu_flush(c);
 	}
-	// Jump to the new address, compensating for the upcoming pc += 4.
-	c->pc += instr->imm - 4;
 }
 
-static void store_exec(struct cpu *c, const Instruction *instr)
+static void exec_ecall(struct cpu *c, const Instruction *instr)
 {
-	// Calculate the memory address: base register (rs1) + immediate offset
-	u32 addr = c->registers[instr->rs1] + instr->imm;
-
-	// get the value to store from the source register (r2)
-	u32 val = c->registers[instr->rs2];
-
-	switch (instr->funct3) {
-	case 0x00: // SB
-		mem_store8(c->memory, addr, (u8)val);
-		break;
-	case 0x01: // SH
-		mem_store16(c->memory, addr, (u16)val);
-		break;
-	case 0x02: // SW
-		mem_store32(c->memory, addr, val);
+	(void)instr;
+	// Once the guest installs a trap vector it handles its own
+	// environment calls; otherwise the emulator services them.
+	if (c->csr.mtvec != 0) {
+		cpu_trap(c, CAUSE_ECALL_U + c->priv, 0);
+	} else {
+		syscall_handler(c);
 	}
 }
 
-static void load_exec(struct cpu *c, const Instruction *instr)
+static void exec_ebreak(struct cpu *c, const Instruction *instr)
 {
-	u32 addr = c->registers[instr->rs1] + instr->imm;
-	u32 rd = instr->rd;
+	cpu_halt(c, CPU_STOP_BREAKPOINT);
+	c->resume_pc = c->pc + instr->size;
+}
 
-	switch (instr->funct3) {
-	case 0x0: // LB (Load Byte, sign-extended)
-		c->registers[rd] = (s32)(s8)mem_load8(c->memory, addr);
-		break;
-	case 0x1: // LH (Load Half-word, sign-extended)
-		c->registers[rd] = (s32)(s16)mem_load16(c->memory, addr);
-		break;
-	case 0x2: // LW (Load Word)
-		c->registers[rd] = mem_load32(c->memory, addr);
-		break;
-	case 0x4: // LBU (Load Byte, zero-extended)
-		c->registers[rd] = mem_load8(c->memory, addr);
-		break;
-	case 0x5: // LHU (Load Half-word, zero-extended)
-		c->registers[rd] = mem_load16(c->memory, addr);
-		break;
+// Copy syscall results into guest memory. A fault raises the trap the
+// guest's own store would have.
+static bool copy_to_guest(struct cpu *c, u32 vaddr, const u8 *src, u32 len)
+{
+	while (len) {
+		u32 n = PAGE_SIZE - (vaddr & PAGE_MASK);
+		u8 *p = mmu_translate(c, vaddr, MMU_STORE);
+
+		if (!p)
+			return false;
+		if (n > len)
+			n = len;
+		memcpy(p, src, n);
+		vaddr += n;
+		src += n;
+		len -= n;
 	}
+	return true;
 }
 
-static void jalr_exec(struct cpu *c, const Instruction *instr)
+// read(fd, buf, count): only the console (fd 0) can be read
+static void sys_read(struct cpu *c)
 {
-	// Store the return address before changing the PC.
-	u32 return_addr = c->pc + 4;
+	u8 buf[SYSCALL_IO_MAX];
+	u32 count = c->registers[12];
+	s32 ret;
 
-	// Calculate the target address: (rs1 + imm) and clear the LSB.
-	u32 target_addr = (c->registers[instr->rs1] + instr->imm) & ~1U;
+	if (c->registers[10] != 0) {
+		c->registers[10] = -EBADF;
+		return;
+	}
+	if (count > sizeof(buf))
+		count = sizeof(buf);
 
-	// Jump, compensating for the upcoming pc += 4.
-	c->pc = target_addr - 4;
+	// Console input differs between runs, so it goes through the log
+	if (!replay_fetch(c, REPLAY_EV_READ, &ret, buf, count)) {
+		ssize_t n = read(STDIN_FILENO, buf, count);
 
-	// Write the return address to rd if it's not x0.
-	if (instr->rd != 0) {
-		c->registers[instr->rd] = return_addr;
+		ret = n < 0 ? -errno : (s32)n;
+		replay_log(c, REPLAY_EV_READ, ret, buf, ret > 0 ? ret : 0);
 	}
+	if (c->state != CPU_STATE_RUNNING)
+		return;
+	if (ret > 0 && !copy_to_guest(c, c->registers[11], buf, ret))
+		return;
+	c->registers[10] = ret;
 }
 
-static void system_exec(struct cpu *c, const Instruction *instr)
+// clock_gettime(clock, tp) with a 32-bit tv_sec and tv_nsec
+static void sys_clock_gettime(struct cpu *c)
 {
-	switch (instr->imm) {
-	case 0x0: // ECALL
-		syscall_handler(c);
-		break;
-	case 0x1: // EBREAK
-		printf("EBREAK executed. Halting.\n");
-		c->state = CPU_STATE_HALTED;
-		c->pc -= 4;
-		break;
-	default:
-		printf("Error: Unknown SYSTEM instruction with imm=0x%x\n",
-		       instr->imm);
+	u8 tp[8];
+	s32 ret;
+
+	if (c->registers[10] != CLOCK_REALTIME &&
+	    c->registers[10] != CLOCK_MONOTONIC) {
+		c->registers[10] = -EINVAL;
+		return;
 	}
+
+	if (!replay_fetch(c, REPLAY_EV_CLOCK, &ret, tp, sizeof(tp))) {
+		struct timespec ts = { 0, 0 };
+
+		ret = clock_gettime(c->registers[10], &ts) ? -errno : 0;
+		mem_store32(tp, 0, (u32)ts.tv_sec);
+		mem_store32(tp, 4, (u32)ts.tv_nsec);
+		replay_log(c, REPLAY_EV_CLOCK, ret, tp, sizeof(tp));
+	}
+	if (c->state != CPU_STATE_RUNNING)
+		return;
+	if (ret == 0 && !copy_to_guest(c, c->registers[11], tp, sizeof(tp)))
+		return;
+	c->registers[10] = ret;
 }
 
 static void syscall_handler(struct cpu *c)
@@ -388,6 +512,14 @@ static void syscall_handler(struct cpu *c)
 	// add a0-a6 for arguments.
 	u32 syscall_num = c->registers[17];
 
+	for (u32 i = 0; i < c->nhost_syscalls; i++) {
+		if (c->host_syscalls[i].num == syscall_num) {
+			fpu_sync(c);
+			c->host_syscalls[i].fn(c, c->host_syscalls[i].opaque);
+			return;
+		}
+	}
+
 	switch (syscall_num) {
 	// A custom syscall number for printing a single char
 	case 1: {
@@ -400,84 +532,119 @@ static void syscall_handler(struct cpu *c)
 		}
 		break;
 	}
+	case 63:
+		sys_read(c);
+		break;
 	// Standard RISC-V syscall number for exiting the program
-	case 93: {
-		// // exit code is in register a0(x10)
-		// int exit_code = (int)c->registers[10];
-		// printf("\nECALL: exit(%d) called.\n", exit_code);
-		c->state = CPU_STATE_HALTED;
+	case 93:
+		c->exit_code = c->registers[10];
+		cpu_halt(c, CPU_STOP_HALT); // stay on the ECALL, like EBREAK
+		break;
+	case 113:
+		sys_clock_gettime(c);
 		break;
-	}
 	default:
-		printf("\nECALL: Unknown syscall number &u\n", syscall_num);
-		c->state = CPU_STATE_HALTED;
+		// Left to the host: a7 holds the number, cpu_resume() goes on
+		cpu_halt(c, CPU_STOP_SYSCALL);
+		c->resume_pc = c->pc + 4;
 		break;
 	}
 }
 
-static void amo_exec(struct cpu *c, const Instruction *instr)
+// LR/SC and the AMOs need a naturally aligned word
+static u8 *amo_translate(struct cpu *c, u32 addr, enum mmu_access acc)
+{
+	if (addr & 3) {
+		cpu_trap(c, acc == MMU_LOAD ? CAUSE_LOAD_MISALIGNED :
+					      CAUSE_STORE_MISALIGNED,
+			 addr);
+		return NULL;
+	}
+	return mmu_translate(c, addr, acc);
+}
+
+static void exec_lr_w(struct cpu *c, const Instruction *instr)
 {
 	u32 addr = c->registers[instr->rs1];
-	u32 val = c->registers[instr->rs2];
-	u32 loaded_val = mem_load32(c->memory, addr);
+	// LR.W only reads; SC.W and the AMOs need write permission.
+	u8 *p = amo_translate(c, addr, MMU_LOAD);
 
-	if (instr->rd != 0) {
-		c->registers[instr->rd] = loaded_val;
-	}
+	if (!p)
+		return;
+	c->registers[instr->rd] = mem_load32(p, 0);
+	c->reservation_set = 1;
+	c->reservation_address = addr;
+}
 
-	u32 result;
-	u32 funct5 = (instr->funct7 & 0b1111100) >> 2;
+static void exec_sc_w(struct cpu *c, const Instruction *instr)
+{
+	u32 addr = c->registers[instr->rs1];
+	u8 *p = amo_translate(c, addr, MMU_STORE);
 
-	switch (funct5) {
-	case 0b00010: // LR.W
-		c->registers[instr->rd] = loaded_val;
-		c->reservation_set = 1;
-		c->reservation_address = addr;
-		break;
-	case 0b00011: // SC.W
-		if (c->reservation_set && c->reservation_address == addr) {
-			mem_store32(c->memory, addr, val);
-			c->registers[instr->rd] = 0;
-			c->reservation_set = 0;
-		} else {
-			c->registers[instr->rd] = 1;
-		}
-		break;
-	case 0b00001: // AMOSWAP.W
-		result = val;
-		break;
-	case 0b00000: // AMOADD.W
-		result = loaded_val + val;
-		break;
-	case 0b00100: // AMOXOR.W
-		result = loaded_val ^ val;
-		break;
-	case 0b01100: // AMOAND.W
-		result = loaded_val & val;
-		break;
-	case 0b01000: // AMOOR.W
-		result = loaded_val | val;
-		break;
-	case 0b10000: // AMOMIN.W
-		result = ((s32)loaded_val < (s32)val) ? loaded_val : val;
-		break;
-	case 0b10100: // AMOMAX.W
-		result = ((s32)loaded_val > (s32)val) ? loaded_val : val;
-		break;
-	case 0b11000: // AMOMINU.W
-		result = (loaded_val < val) ? loaded_val : val;
-		break;
-	case 0b11100: // AMOMAXU.W
-		result = (loaded_val > val) ? loaded_val : val;
-		break;
-	default:
-		printf("Error: Unknown AMO instruction with funct5=0x%x\n",
-		       funct5);
+	if (!p)
 		return;
+	if (c->reservation_set && c->reservation_address == addr) {
+		mem_store32(p, 0, c->registers[instr->rs2]);
+		c->registers[instr->rd] = 0;
+	} else {
+		c->registers[instr->rd] = 1;
 	}
-	if (funct5 != 0b00010 && funct5 != 0b00011) {
-		mem_store32(c->memory, addr, result);
+	// SC.W gives up the reservation whether or not it succeeded
+	c->reservation_set = 0;
+}
+
+#define AMO(name, expr)                                                  \
+	static void exec_##name(struct cpu *c, const Instruction *instr) \
+	{                                                                \
+		u8 *p = amo_translate(c, c->registers[instr->rs1],       \
+				      MMU_STORE);                        \
+		u32 b = c->registers[instr->rs2];                        \
+		u32 a;                                                   \
+		if (!p)                                                  \
+			return;                                          \
+		a = mem_load32(p, 0);                                    \
+		mem_store32(p, 0, (expr));                               \
+		c->registers[instr->rd] = a;                             \
+	}
+
+AMO(amoswap_w, b)
+AMO(amoadd_w, a + b)
+AMO(amoxor_w, a ^ b)
+AMO(amoand_w, a & b)
+AMO(amoor_w, a | b)
+AMO(amomin_w, (s32)a < (s32)b ? a : b)
+AMO(amomax_w, (s32)a > (s32)b ? a : b)
+AMO(amominu_w, a < b ? a : b)
+AMO(amomaxu_w, a > b ? a : b)
+
+static void (*const insn_handlers[INSN_COUNT])(struct cpu *c,
+						const Instruction *instr) = {
+	[INSN_ILLEGAL] = exec_illegal,
+#define X(id, handler, name, fmt, match, mask) [INSN_##id] = exec_##handler,
+	INSN_LIST(X)
+#undef X
+};
+
+// Executes a decoded instruction. c->next_pc must already hold the
+// fall-through address; control transfers and traps overwrite it.
+void instr_exec_decoded(struct cpu *c, const Instruction *instr)
+{
+#ifdef CONFIG_INSN_MIX
+	u64 traps = c->mix.traps;
+#endif
+
+	insn_handlers[instr->id](c, instr);
+
+	// The zero register x0 is hardwired to 0 and cannot be written to.
+	c->registers[0] = 0;
+
+#ifdef CONFIG_INSN_MIX
+	// A trap taken by the handler means it did not retire
+	if (c->mix.traps == traps) {
+		c->mix.count[instr->id]++;
+		c->mix.compressed += instr->size == 2;
 	}
+#endif
 }
 
 // Main execution function: Decodes and then executes an instruction.
@@ -487,48 +654,7 @@ void instr_exec(struct cpu *c, u32 raw_instr)
 	Instruction instr;
 	instr_decode(&instr, raw_instr);
 
-	// 2. Execute based on the decoded opcode.
-	switch (instr.opcode) {
-	case 0x33: // R-type (ADD, SUB, etc.)
-		r_type_exec(c, &instr);
-		break;
-	case 0x13: // I-type (ADDI, SLTI, etc.)
-		i_type_exec(c, &instr);
-		break;
-	case 0x37: // LUI
-	case 0x17: // AUIPC
-		u_type_exec(c, &instr);
-		break;
-	case 0x6F: // JAL
-		j_type_exec(c, &instr);
-		break;
-	case 0x67: // JALR
-		jalr_exec(c, &instr);
-		break;
-	case 0x63: // B-type (BEQ, BNE, etc.)
-		b_type_exec(c, &instr);
-		break;
-	case 0x03: // Load instructions (LB, LW, etc.)
-		load_exec(c, &instr);
-		break;
-	case 0x23: // Store instructions (SB, SH, SW)
-		store_exec(c, &instr);
-		break;
-	case 0x0F: // MISC-MEM (FENCE, FENCE.I)
-		/*currently the emulator has a simple memory model, so FENCE is a no-operation
-        * we decode it but do nothing. the PC will advance normally
-        * */
-		break;
-	case 0x73: // SYSTEM instruction (ECALL, EBREAK)
-		system_exec(c, &instr);
-		break;
-	case 0x2F: // Atomic instruction
-		amo_exec(c, &instr);
-		break;
-	default:
-		printf("Error: Unknown opcode=0x%x\n", instr.opcode);
-	}
-
-	// The zero register x0 is hardwired to 0 and cannot be written to.
-	c->registers[0] = 0;
+	// 2. Execute it, falling through to the next instruction by default.
+	c->next_pc = c->pc + instr.size;
+	instr_exec_decoded(c, &instr);
 }
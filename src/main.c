@@ -1,8 +1,28 @@
 #include "cpu.h"
 #include "memory.h"
+#include "mmu.h"
+#include "cachesim.h"
+#include "bpred.h"
+#include "callgraph.h"
+#include "sample.h"
+#include "replay.h"
 #include "tui.h"
+#include "disassembler.h"
+#include "elf_file.h"
+#include "insn_mix.h"
+#include "perfmap.h"
+#include "fuzz.h"
+#include "trace.h"
+#include "accel.h"
+#include "idle.h"
+#include "server.h"
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h> // Required for exit()
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 #include <ncurses.h>
 
 // ANSI color codes
@@ -34,13 +54,475 @@ void print_registers(struct cpu *cpu)
 	printf("-----------------------------------------------------\n");
 }
 
-int main(void)
+static void usage(const char *prog)
 {
+	fprintf(stderr,
+		"Usage: %s [options] [program.bin]\n"
+		"  -r, --run              run to completion without the TUI\n"
+		"      --cache            enable the cache model with default geometry\n"
+		"      --l1i SPEC         L1 instruction cache, SPEC = size:ways:line[:lru|fifo|random]\n"
+		"      --l1d SPEC         L1 data cache\n"
+		"      --l2 SPEC          unified L2 cache\n"
+		"      --cache-range A:B  report cache statistics for pc in [A, B)\n"
+		"      --bpred SPEC       branch predictor, SPEC = bimodal|gshare|tage[:bits]\n"
+		"      --bpred-top N      list the N most mispredicted branches (default 10)\n"
+		"      --sample SPEC      with --run, attach the cache and branch models only\n"
+		"                         in windows, SPEC = start:interval:window[:warmup]\n"
+		"      --record LOG       log console input and clock reads to LOG\n"
+		"      --replay LOG       feed a recorded LOG back for an identical run\n"
+		"      --symbols ELF      read symbols from ELF for --disasm and profiling\n"
+		"      --disasm           print the disassembly of the program and exit\n"
+		"      --disasm-threads N threads for --disasm (default: online CPUs)\n"
+		"      --perf-map         write /tmp/perf-<pid>.map naming guest code for perf\n"
+		"      --jitdump          write /tmp/jit-<pid>.dump for perf inject --jit\n"
+		"      --insn-mix FILE    write the retired instruction mix to FILE as JSON\n"
+		"                         (needs a build with INSN_MIX=1)\n"
+		"      --fuzz ADDR:MAX    fuzz the program: up to MAX input bytes at ADDR\n"
+		"                         (MAX = 0: read(0, ...) only); serves afl-fuzz,\n"
+		"                         otherwise runs stdin once\n"
+		"      --fuzz-budget N    instructions per fuzz run (default 1000000)\n"
+		"      --traces           optimize hot code into traces and report them\n"
+		"      --accel            run memcpy, memmove, memset and strlen from --symbols\n"
+		"                         on the host\n"
+		"      --accel-at NAME=ADDR  the same for a routine at ADDR (NAME as above)\n"
+		"      --idle             skip spin loops that wait for an interrupt or mtime\n"
+		"      --callgraph FILE   profile calls and returns into FILE in callgrind\n"
+		"                         format (functions from --symbols)\n"
+		"      --serve SOCKET     run jobs sent to the Unix socket SOCKET; --traces\n"
+		"                         and --idle apply to every pooled instance\n"
+		"      --pool N           instances kept by --serve (default 8)\n"
+		"      --submit SOCKET    run program.bin with stdin as input on the server\n"
+		"      --budget N         instructions per job (default 100000000)\n",
+		prog);
+}
+
+enum {
+	OPT_CACHE = 256,
+	OPT_L1I,
+	OPT_L1D,
+	OPT_L2,
+	OPT_CACHE_RANGE,
+	OPT_BPRED,
+	OPT_BPRED_TOP,
+	OPT_SAMPLE,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_SYMBOLS,
+	OPT_DISASM,
+	OPT_DISASM_THREADS,
+	OPT_INSN_MIX,
+	OPT_PERF_MAP,
+	OPT_JITDUMP,
+	OPT_FUZZ,
+	OPT_FUZZ_BUDGET,
+	OPT_TRACES,
+	OPT_ACCEL,
+	OPT_ACCEL_AT,
+	OPT_IDLE,
+	OPT_CALLGRAPH,
+	OPT_SERVE,
+	OPT_POOL,
+	OPT_SUBMIT,
+	OPT_BUDGET,
+};
+
+// Dump the loaded image through disassemble_range()
+static int dump_disassembly(const struct cpu *cpu, u32 len,
+			    const char *sym_path, unsigned threads)
+{
+	struct symtab syms = { 0 };
+	size_t size, n;
+	char *arena;
+
+	if (sym_path && !elf_read_symbols(sym_path, &syms)) {
+		fprintf(stderr, "Error: cannot read symbols from '%s'.\n",
+			sym_path);
+		return 1;
+	}
+	size = disassemble_range_bound(len, sym_path ? &syms : NULL);
+	arena = malloc(size);
+	if (!arena) {
+		fprintf(stderr, "Error: out of memory.\n");
+		symtab_free(&syms);
+		return 1;
+	}
+	n = disassemble_range(cpu->memory, 0, len, sym_path ? &syms : NULL,
+			      arena, size, threads);
+	fwrite(arena, 1, n, stdout);
+	free(arena);
+	symtab_free(&syms);
+	return 0;
+}
+
+// --fuzz: serve afl-fuzz, or run the test case on stdin once to triage it
+static int fuzz_main(struct cpu *cpu, const struct fuzz_config *cfg)
+{
+	static const char *const names[] = { "ok", "crash", "timeout" };
+	struct fuzz *f = fuzz_create(cpu, cfg);
+	enum fuzz_result res;
+	size_t len = 0, size = 1 << 20;
+	u8 *buf;
+
+	if (!f) {
+		fprintf(stderr, "Error: cannot set up fuzzing (bad input region?).\n");
+		return 1;
+	}
+	if (fuzz_afl_loop(f)) {
+		fuzz_destroy(f);
+		return 0;
+	}
+	buf = malloc(size);
+	if (!buf) {
+		fuzz_destroy(f);
+		return 1;
+	}
+	len = fread(buf, 1, size, stdin);
+	res = fuzz_run(f, buf, len);
+	printf("Fuzz run: %s after %llu instructions, %zu input bytes.\n",
+	       names[res], (unsigned long long)cpu->insn_count, len);
+	free(buf);
+	fuzz_destroy(f);
+	return res == FUZZ_OK ? 0 : res == FUZZ_CRASH ? 1 : 2;
+}
+
+static struct server *serving;
+
+static void stop_serving(int sig)
+{
+	(void)sig;
+	server_stop(serving);
+}
+
+// --serve: run jobs until SIGINT or SIGTERM
+static int serve_main(const struct server_config *cfg)
+{
+	serving = server_create(cfg);
+	if (!serving) {
+		fprintf(stderr, "Error: cannot serve on '%s': %s.\n", cfg->path,
+			strerror(errno));
+		return 1;
+	}
+	signal(SIGINT, stop_serving);
+	signal(SIGTERM, stop_serving);
+	fprintf(stderr, "Serving on %s.\n", cfg->path);
+	server_run(serving);
+	server_destroy(serving);
+	return 0;
+}
+
+// Read all of @fp, up to @max bytes, into a new buffer
+static u8 *read_all(FILE *fp, u32 max, u32 *len)
+{
+	u8 *buf = malloc(max ? max : 1);
+
+	if (buf)
+		*len = fread(buf, 1, max, fp);
+	return buf;
+}
+
+// --submit: run the image with stdin as input on a server, exit with its code
+static int submit_main(const char *path, const char *filename, u64 budget)
+{
+	static char output[OUTPUT_BUFFER_SIZE];
+	struct server_job job = { .budget = budget, .by_hash = true };
+	struct server_reply reply;
+	u8 *image, *input;
+	int fd, ret = 1;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		fprintf(stderr, "Error: Cannot open file '%s'.\n", filename);
+		return 1;
+	}
+	image = read_all(fp, MEM_SIZE, &job.image_len);
+	fclose(fp);
+	input = read_all(stdin, SERVER_INPUT_MAX, &job.input_len);
+	job.image = image;
+	job.input = input;
+
+	fd = server_connect(path);
+	if (fd < 0) {
+		fprintf(stderr, "Error: cannot connect to '%s': %s.\n", path,
+			strerror(errno));
+	} else if (!image || !input || !server_submit(fd, &job, &reply, output)) {
+		fprintf(stderr, "Error: the server dropped the job.\n");
+	} else if (reply.status != SERVER_OK) {
+		fprintf(stderr, "Error: the server refused the job (status %u).\n",
+			reply.status);
+	} else {
+		fputs(output, stdout);
+		fprintf(stderr,
+			"Job: stop %u, %llu instructions in %llu ns%s.\n",
+			reply.stop, (unsigned long long)reply.insns,
+			(unsigned long long)reply.run_ns,
+			reply.pool_hit ? ", pooled" : "");
+		ret = reply.stop == CPU_STOP_HALT ? (int)reply.exit_code : 1;
+	}
+	if (fd >= 0)
+		close(fd);
+	free(image);
+	free(input);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "run", no_argument, NULL, 'r' },
+		{ "cache", no_argument, NULL, OPT_CACHE },
+		{ "l1i", required_argument, NULL, OPT_L1I },
+		{ "l1d", required_argument, NULL, OPT_L1D },
+		{ "l2", required_argument, NULL, OPT_L2 },
+		{ "cache-range", required_argument, NULL, OPT_CACHE_RANGE },
+		{ "bpred", required_argument, NULL, OPT_BPRED },
+		{ "bpred-top", required_argument, NULL, OPT_BPRED_TOP },
+		{ "sample", required_argument, NULL, OPT_SAMPLE },
+		{ "record", required_argument, NULL, OPT_RECORD },
+		{ "replay", required_argument, NULL, OPT_REPLAY },
+		{ "symbols", required_argument, NULL, OPT_SYMBOLS },
+		{ "disasm", no_argument, NULL, OPT_DISASM },
+		{ "disasm-threads", required_argument, NULL, OPT_DISASM_THREADS },
+		{ "insn-mix", required_argument, NULL, OPT_INSN_MIX },
+		{ "perf-map", no_argument, NULL, OPT_PERF_MAP },
+		{ "jitdump", no_argument, NULL, OPT_JITDUMP },
+		{ "fuzz", required_argument, NULL, OPT_FUZZ },
+		{ "fuzz-budget", required_argument, NULL, OPT_FUZZ_BUDGET },
+		{ "traces", no_argument, NULL, OPT_TRACES },
+		{ "accel", no_argument, NULL, OPT_ACCEL },
+		{ "accel-at", required_argument, NULL, OPT_ACCEL_AT },
+		{ "idle", no_argument, NULL, OPT_IDLE },
+		{ "callgraph", required_argument, NULL, OPT_CALLGRAPH },
+		{ "serve", required_argument, NULL, OPT_SERVE },
+		{ "pool", required_argument, NULL, OPT_POOL },
+		{ "submit", required_argument, NULL, OPT_SUBMIT },
+		{ "budget", required_argument, NULL, OPT_BUDGET },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	// Default hierarchy used by --cache; any --l1i/--l1d/--l2 enables it
+	struct cache_config l1i = { 16 << 10, 2, 64, CACHE_LRU };
+	struct cache_config l1d = { 16 << 10, 4, 64, CACHE_LRU };
+	struct cache_config l2 = { 256 << 10, 8, 64, CACHE_LRU };
+	bool use_cache = false;
+	bool use_l2 = true;
+	bool run_mode = false;
+	u32 range_start[CACHESIM_MAX_RANGES];
+	u32 range_end[CACHESIM_MAX_RANGES];
+	u32 nranges = 0;
+	struct cachesim *sim = NULL;
+	struct bpred_config bp_cfg;
+	struct bpred *bp = NULL;
+	bool use_bpred = false;
+	u32 bpred_top = 10;
+	struct sample_config sample_cfg;
+	struct sampler *sampler = NULL;
+	bool use_sample = false;
+	const char *replay_path = NULL;
+	enum replay_mode replay_mode = REPLAY_RECORD;
+	struct replay *replay = NULL;
+	int status = 0;
+	const char *sym_path = NULL;
+	bool disasm_mode = false;
+	long disasm_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned perf_flags = 0;
+	struct symtab syms = { 0 };
+	struct perfmap *perfmap = NULL;
+	struct fuzz_config fuzz_cfg = { 0, 0, 1000000 };
+	bool fuzz_mode = false;
+	struct trace_cache *traces = NULL;
+	bool use_traces = false;
+	struct accel_routine accel_at[ACCEL_MAX_ROUTINES];
+	u32 naccel_at = 0;
+	struct accel *accel = NULL;
+	bool use_accel = false;
+	struct idle *idle = NULL;
+	bool use_idle = false;
+	const char *callgraph_path = NULL;
+	struct callgraph *callgraph = NULL;
+	struct server_config serve_cfg = { 0 };
+	const char *submit_path = NULL;
+#ifdef CONFIG_INSN_MIX
+	const char *mix_path = NULL;
+#endif
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "rh", long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'r':
+			run_mode = true;
+			break;
+		case OPT_CACHE:
+			use_cache = true;
+			break;
+		case OPT_L1I:
+		case OPT_L1D:
+		case OPT_L2: {
+			struct cache_config *cfg = opt == OPT_L1I ? &l1i :
+						   opt == OPT_L1D ? &l1d :
+								    &l2;
+			if (!strcmp(optarg, "none") && opt == OPT_L2) {
+				use_l2 = false;
+			} else if (!cache_config_parse(optarg, cfg)) {
+				fprintf(stderr, "Error: bad cache spec '%s'.\n",
+					optarg);
+				return 1;
+			}
+			use_cache = true;
+			break;
+		}
+		case OPT_CACHE_RANGE: {
+			char *end;
+
+			if (nranges == CACHESIM_MAX_RANGES) {
+				fprintf(stderr, "Error: too many cache ranges.\n");
+				return 1;
+			}
+			range_start[nranges] = strtoul(optarg, &end, 0);
+			if (*end != ':') {
+				fprintf(stderr, "Error: bad range '%s'.\n",
+					optarg);
+				return 1;
+			}
+			range_end[nranges++] = strtoul(end + 1, NULL, 0);
+			use_cache = true;
+			break;
+		}
+		case OPT_BPRED:
+			if (!bpred_config_parse(optarg, &bp_cfg)) {
+				fprintf(stderr, "Error: bad predictor spec '%s'.\n",
+					optarg);
+				return 1;
+			}
+			use_bpred = true;
+			break;
+		case OPT_BPRED_TOP:
+			bpred_top = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_SAMPLE:
+			if (!sample_config_parse(optarg, &sample_cfg)) {
+				fprintf(stderr, "Error: bad sample spec '%s'.\n",
+					optarg);
+				return 1;
+			}
+			use_sample = true;
+			break;
+		case OPT_RECORD:
+		case OPT_REPLAY:
+			replay_path = optarg;
+			replay_mode = opt == OPT_RECORD ? REPLAY_RECORD :
+							  REPLAY_REPLAY;
+			break;
+		case OPT_SYMBOLS:
+			sym_path = optarg;
+			break;
+		case OPT_DISASM:
+			disasm_mode = true;
+			break;
+		case OPT_DISASM_THREADS:
+			disasm_threads = strtol(optarg, NULL, 0);
+			break;
+		case OPT_PERF_MAP:
+			perf_flags |= PERFMAP_MAP;
+			break;
+		case OPT_JITDUMP:
+			perf_flags |= PERFMAP_JITDUMP;
+			break;
+		case OPT_FUZZ: {
+			char *end;
+
+			fuzz_cfg.input_addr = strtoul(optarg, &end, 0);
+			if (*end != ':') {
+				fprintf(stderr, "Error: bad fuzz spec '%s'.\n",
+					optarg);
+				return 1;
+			}
+			fuzz_cfg.input_max = strtoul(end + 1, NULL, 0);
+			fuzz_mode = true;
+			break;
+		}
+		case OPT_FUZZ_BUDGET:
+			fuzz_cfg.max_insns = strtoull(optarg, NULL, 0);
+			break;
+		case OPT_TRACES:
+			use_traces = true;
+			break;
+		case OPT_ACCEL:
+			use_accel = true;
+			break;
+		case OPT_IDLE:
+			use_idle = true;
+			break;
+		case OPT_CALLGRAPH:
+			callgraph_path = optarg;
+			break;
+		case OPT_SERVE:
+			serve_cfg.path = optarg;
+			break;
+		case OPT_POOL:
+			serve_cfg.pool_size = strtoul(optarg, NULL, 0);
+			break;
+		case OPT_SUBMIT:
+			submit_path = optarg;
+			break;
+		case OPT_BUDGET:
+			serve_cfg.budget = strtoull(optarg, NULL, 0);
+			break;
+		case OPT_ACCEL_AT: {
+			char *eq = strchr(optarg, '=');
+
+			if (eq)
+				*eq = '\0';
+			if (!eq || naccel_at == ACCEL_MAX_ROUTINES ||
+			    !accel_kind_parse(optarg,
+					      &accel_at[naccel_at].kind)) {
+				fprintf(stderr, "Error: bad routine '%s'.\n",
+					optarg);
+				return 1;
+			}
+			accel_at[naccel_at++].addr = strtoul(eq + 1, NULL, 0);
+			break;
+		}
+		case OPT_INSN_MIX:
+#ifdef CONFIG_INSN_MIX
+			mix_path = optarg;
+			break;
+#else
+			fprintf(stderr,
+				"Error: --insn-mix needs a build with INSN_MIX=1.\n");
+			return 1;
+#endif
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (use_sample && !run_mode) {
+		fprintf(stderr, "Error: --sample needs --run.\n");
+		return 1;
+	}
+
+	if (serve_cfg.path) {
+		serve_cfg.mem_size = MEM_SIZE;
+		serve_cfg.traces = use_traces;
+		serve_cfg.idle = use_idle;
+		return serve_main(&serve_cfg);
+	}
+	if (submit_path)
+		return submit_main(submit_path,
+				   optind < argc ? argv[optind] : "program.bin",
+				   serve_cfg.budget);
+
 	// Create CPU with 64KB memory
 	struct cpu *cpu = cpu_create(MEM_SIZE);
+	if (!cpu) {
+		fprintf(stderr, "Error: cannot allocate the CPU.\n");
+		return 1;
+	}
 
 	// --- Load program from file ---
-	const char *filename = "program.bin";
+	const char *filename = optind < argc ? argv[optind] : "program.bin";
 	FILE *fp = fopen(filename, "rb"); // Open in binary read mode
 	if (fp == NULL) {
 		fprintf(stderr, "Error: Cannot open file '%s'.\n", filename);
@@ -49,30 +531,245 @@ int main(void)
 		cpu_destroy(cpu);
 		exit(1);
 	}
-	size_t bytes_read = fread(cpu->memory, 1, MEM_SIZE, fp);
+	size_t bytes_read = fread(cpu->memory, 1, cpu->mem_size, fp);
 	fclose(fp);
 
-	// --- Initialize TUI ---
-	tui_init();
+	if (disasm_mode) {
+		int ret = dump_disassembly(cpu, bytes_read, sym_path,
+					   disasm_threads > 0 ? disasm_threads :
+								1);
 
-	// --- Main Execution Loop ---
-	int ch;
-	tui_update(cpu); // Initial draw
+		cpu_destroy(cpu);
+		return ret;
+	}
 
-	while ((ch = getch()) != 'q') {
-		if (ch == 's') {
-			if (cpu->state == CPU_STATE_RUNNING) {
-				cpu_step(cpu);
-			}
-			tui_update(cpu);
+	if (use_cache) {
+		sim = cachesim_create(&l1i, &l1d, use_l2 ? &l2 : NULL);
+		if (!sim) {
+			fprintf(stderr, "Error: cannot create cache model.\n");
+			cpu_destroy(cpu);
+			return 1;
 		}
+		for (u32 i = 0; i < nranges; i++) {
+			cachesim_add_range(sim, range_start[i], range_end[i]);
+		}
+		cachesim_attach(cpu, sim);
 	}
 
-	// --- Cleanup ---
-	tui_destroy();
-	cpu_destroy(cpu);
+	if (use_bpred) {
+		bp = bpred_create(&bp_cfg);
+		if (!bp) {
+			fprintf(stderr, "Error: cannot create branch predictor.\n");
+			cpu_destroy(cpu);
+			cachesim_destroy(sim);
+			return 1;
+		}
+		cpu->bpred = bp;
+	}
+
+	if (use_sample) {
+		sampler = sample_create(&sample_cfg, sim, bp);
+		if (!sampler) {
+			fprintf(stderr, "Error: cannot create sampler.\n");
+			cpu_destroy(cpu);
+			cachesim_destroy(sim);
+			bpred_destroy(bp);
+			return 1;
+		}
+	}
+
+	if (replay_path) {
+		replay = replay_open(replay_path, replay_mode);
+		if (!replay) {
+			fprintf(stderr, "Error: cannot open replay log '%s'.\n",
+				replay_path);
+			cpu_destroy(cpu);
+			sample_destroy(sampler);
+			cachesim_destroy(sim);
+			bpred_destroy(bp);
+			return 1;
+		}
+		cpu->replay = replay;
+	}
+
+	if (sym_path && (perf_flags || use_accel || callgraph_path) &&
+	    !elf_read_symbols(sym_path, &syms)) {
+		fprintf(stderr, "Warning: no symbols from '%s'.\n", sym_path);
+	}
+
+	if (perf_flags) {
+		perfmap = perfmap_create(&syms, NULL, perf_flags);
+		if (!perfmap) {
+			fprintf(stderr, "Error: cannot set up perf output.\n");
+			cpu_destroy(cpu);
+			replay_close(replay);
+			sample_destroy(sampler);
+			cachesim_destroy(sim);
+			bpred_destroy(bp);
+			symtab_free(&syms);
+			return 1;
+		}
+		cpu->perfmap = perfmap;
+	}
+
+	if (use_traces) {
+		traces = trace_cache_create();
+		if (!traces) {
+			fprintf(stderr, "Warning: no memory for traces, interpreting only.\n");
+		}
+		cpu->traces = traces;
+	}
+
+	if (use_accel || naccel_at) {
+		accel = accel_create();
+		if (!accel) {
+			fprintf(stderr, "Warning: no memory for --accel, running the guest routines.\n");
+		} else {
+			if (use_accel)
+				accel_add_symbols(accel, &syms);
+			for (u32 i = 0; i < naccel_at; i++)
+				accel_add(accel, accel_at[i].addr,
+					  accel_at[i].kind);
+			if (use_accel && !accel->nroutines)
+				fprintf(stderr, "Warning: --accel found no routines; give --symbols.\n");
+		}
+		cpu->accel = accel;
+	}
+	if (use_idle) {
+		idle = idle_create();
+		if (!idle)
+			fprintf(stderr, "Warning: no memory for --idle, running spin loops.\n");
+		cpu->idle = idle;
+	}
+
+	if (callgraph_path) {
+		callgraph = callgraph_create(&syms);
+		if (!callgraph || !callgraph_start(callgraph, cpu)) {
+			fprintf(stderr, "Warning: no memory for --callgraph, not profiling.\n");
+			callgraph_destroy(callgraph);
+			callgraph = NULL;
+		}
+		cpu->callgraph = callgraph;
+	}
+
+	if (fuzz_mode) {
+		status = fuzz_main(cpu, &fuzz_cfg);
+	} else if (run_mode) {
+		if (sampler) {
+			sample_run(sampler, cpu);
+		} else {
+			cpu_run(cpu);
+		}
+		if (cpu->stop == CPU_STOP_BREAKPOINT) {
+			printf("EBREAK executed. Halting.\n");
+		} else if (cpu->stop == CPU_STOP_SYSCALL) {
+			printf("\nECALL: Unknown syscall number %u\n",
+			       cpu->registers[17]);
+		} else if (cpu->stop == CPU_STOP_IDLE) {
+			printf("Guest is idle with nothing to wake it. Halting.\n");
+		} else if (cpu->trap_cause != CPU_NO_TRAP &&
+			   (cpu->trap_cause & CAUSE_INTERRUPT)) {
+			printf("Unhandled interrupt: cause=%u pc=0x%08x. Halting.\n",
+			       cpu->trap_cause & ~CAUSE_INTERRUPT, cpu->pc);
+		} else if (cpu->trap_cause != CPU_NO_TRAP) {
+			printf("Unhandled exception: cause=%u tval=0x%08x pc=0x%08x. Halting.\n",
+			       cpu->trap_cause, cpu->trap_tval, cpu->pc);
+		}
+		printf("%s", cpu->output_buffer);
+	} else {
+		// --- Initialize TUI ---
+		tui_init();
+
+		// --- Main Execution Loop ---
+		int ch;
+		tui_update(cpu); // Initial draw
+
+		while ((ch = getch()) != 'q') {
+			if (ch == 's') {
+				if (cpu->state == CPU_STATE_RUNNING) {
+					cpu_step(cpu);
+				}
+				tui_update(cpu);
+			}
+		}
+
+		// --- Cleanup ---
+		tui_destroy();
+	}
 
 	printf("Emulator exited gracefully after loading %zu bytes.\n",
 	       bytes_read);
-	return 0;
+	mmu_print_stats(cpu, stdout);
+	if (sim) {
+		cachesim_print_stats(sim, stdout);
+	}
+	if (bp) {
+		bpred_print_stats(bp, bpred_top, stdout);
+	}
+	if (sampler) {
+		sample_print_stats(sampler, stdout);
+	}
+	if (traces) {
+		trace_print_stats(traces, stdout);
+	}
+	if (accel) {
+		accel_print_stats(accel, stdout);
+	}
+	if (idle) {
+		idle_print_stats(idle, cpu, stdout);
+	}
+	if (callgraph) {
+		FILE *out = fopen(callgraph_path, "w");
+
+		callgraph_stop(callgraph, cpu);
+		callgraph_print_stats(callgraph, 10, stdout);
+		if (!out || !callgraph_write_callgrind(callgraph, out, filename)) {
+			fprintf(stderr, "Error: cannot write '%s'.\n",
+				callgraph_path);
+			status = 1;
+		}
+		if (out && fclose(out))
+			status = 1;
+	}
+#ifdef CONFIG_INSN_MIX
+	if (mix_path) {
+		FILE *mix = fopen(mix_path, "w");
+
+		if (mix) {
+			insn_mix_dump_json(&cpu->mix, mix);
+			fclose(mix);
+		} else {
+			fprintf(stderr, "Error: cannot write '%s'.\n", mix_path);
+			status = 1;
+		}
+	}
+#endif
+	if (replay && replay->diverged) {
+		fprintf(stderr,
+			"replay: diverged at instruction %llu (event %llu, %s): %s\n",
+			(unsigned long long)replay->diverged_at,
+			(unsigned long long)replay->events,
+			replay_event_name(replay->diverged_event), replay->why);
+		status = 1;
+	}
+	if (!replay_close(replay)) {
+		fprintf(stderr, "Error: writing replay log '%s' failed.\n",
+			replay_path);
+		status = 1;
+	}
+	// In batch mode the guest's exit code becomes ours
+	if (run_mode && !status) {
+		status = cpu->exit_code & 0xff;
+	}
+	cpu_destroy(cpu);
+	sample_destroy(sampler);
+	cachesim_destroy(sim);
+	bpred_destroy(bp);
+	perfmap_destroy(perfmap);
+	trace_cache_destroy(traces);
+	accel_destroy(accel);
+	idle_destroy(idle);
+	callgraph_destroy(callgraph);
+	symtab_free(&syms);
+	return status;
 }
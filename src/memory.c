@@ -1,15 +1,9 @@
 #include "memory.h"
 #include <stdlib.h>
-#include <stdio.h>
 
 u8 *memory_create(u32 size)
 {
-	u8 *mem = malloc(size);
-	if (!mem) {
-		fprintf(stderr, "Failed to allocate memory\n");
-		exit(1);
-	}
-	return mem;
+	return malloc(size);
 }
 
 void memory_destroy(u8 *mem)
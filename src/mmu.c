@@ -0,0 +1,372 @@
+#include "mmu.h"
+#include "cpu.h"
+#include "csr.h"
+#include "memory.h"
+#include "cachesim.h"
+#include "fuzz.h"
+#include "clint.h"
+
+#include <string.h>
+
+static const u32 page_fault_cause[MMU_NACCESS] = {
+	CAUSE_INSN_PAGE_FAULT,
+	CAUSE_LOAD_PAGE_FAULT,
+	CAUSE_STORE_PAGE_FAULT,
+};
+
+static const u32 access_fault_cause[MMU_NACCESS] = {
+	CAUSE_INSN_ACCESS,
+	CAUSE_LOAD_ACCESS,
+	CAUSE_STORE_ACCESS,
+};
+
+void mmu_flush(struct cpu *c)
+{
+	for (int acc = 0; acc < MMU_NACCESS; acc++) {
+		for (u32 i = 0; i < TLB_SIZE; i++) {
+			c->tlb[acc][i].vpn = TLB_INVALID;
+		}
+	}
+	c->mmu_stats.flushes++;
+}
+
+void mmu_flush_page(struct cpu *c, u32 vaddr)
+{
+	// Entries are cached per 4 KiB page even for 4 MiB superpages, so
+	// drop everything inside the megapage that contains @vaddr.
+	u32 megapage = vaddr >> 22;
+
+	for (int acc = 0; acc < MMU_NACCESS; acc++) {
+		for (u32 i = 0; i < TLB_SIZE; i++) {
+			struct tlb_entry *e = &c->tlb[acc][i];
+
+			if (e->vpn != TLB_INVALID &&
+			    ((e->vpn & TLB_VPN_MASK) >> 10) == megapage)
+				e->vpn = TLB_INVALID;
+		}
+	}
+}
+
+// Privilege used for an access; MPRV makes M-mode loads/stores act as MPP
+static u32 mmu_access_priv(struct cpu *c, enum mmu_access acc)
+{
+	if (acc != MMU_FETCH && c->priv == PRV_M &&
+	    (c->csr.mstatus & MSTATUS_MPRV))
+		return (c->csr.mstatus & MSTATUS_MPP) >> 11;
+	return c->priv;
+}
+
+// Check the leaf PTE permissions for an access at privilege @priv
+static bool mmu_pte_allows(struct cpu *c, u32 pte, enum mmu_access acc,
+			   u32 priv)
+{
+	u32 mstatus = c->csr.mstatus;
+
+	switch (acc) {
+	case MMU_FETCH:
+		if (!(pte & PTE_X))
+			return false;
+		break;
+	case MMU_LOAD:
+		if (!(pte & PTE_R) && !((mstatus & MSTATUS_MXR) && (pte & PTE_X)))
+			return false;
+		break;
+	case MMU_STORE:
+		if (!(pte & PTE_W))
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	if (priv == PRV_U)
+		return (pte & PTE_U) != 0;
+	if (pte & PTE_U)
+		return acc != MMU_FETCH && (mstatus & MSTATUS_SUM);
+	return true;
+}
+
+/*
+ * Walk the two-level Sv32 page table. On success the physical address is
+ * stored in @paddr; on failure @cause holds the exception to raise.
+ * Accessed/dirty bits are updated in place rather than faulting; without
+ * @update a walk that would have to set them fails instead.
+ */
+static bool mmu_walk(struct cpu *c, u32 vaddr, enum mmu_access acc, u32 priv,
+		     bool update, u64 *paddr, u32 *cause)
+{
+	u64 table = (u64)(c->csr.satp & SATP_PPN) << PAGE_SHIFT;
+	u64 pte_addr = 0;
+	u32 pte = 0;
+	int level;
+
+	c->mmu_stats.walks++;
+
+	for (level = 1; level >= 0; level--) {
+		u32 vpn_i = (vaddr >> (PAGE_SHIFT + 10 * level)) & 0x3FF;
+
+		pte_addr = table + vpn_i * 4;
+		if (pte_addr + 4 > c->mem_size) {
+			*cause = access_fault_cause[acc];
+			return false;
+		}
+		pte = mem_load32(c->memory, (u32)pte_addr);
+
+		if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+			goto page_fault;
+		if (pte & (PTE_R | PTE_X))
+			break; // leaf
+		table = (u64)(pte >> 10) << PAGE_SHIFT;
+	}
+	if (level < 0)
+		goto page_fault;
+
+	if (!mmu_pte_allows(c, pte, acc, priv))
+		goto page_fault;
+
+	// A superpage leaf must have a zero PPN[0]
+	if (level == 1 && ((pte >> 10) & 0x3FF))
+		goto page_fault;
+
+	u32 updated = pte | PTE_A | (acc == MMU_STORE ? PTE_D : 0);
+	if (updated != pte && !update)
+		goto page_fault;
+	if (updated != pte) {
+		mem_store32(c->memory, (u32)pte_addr, updated);
+		if (c->fuzz)
+			fuzz_mark_dirty(c->fuzz, (u32)pte_addr);
+	}
+
+	if (level == 1)
+		*paddr = ((u64)(pte >> 20) << 22) | (vaddr & 0x3FFFFF);
+	else
+		*paddr = ((u64)(pte >> 10) << PAGE_SHIFT) | (vaddr & PAGE_MASK);
+	return true;
+
+page_fault:
+	*cause = page_fault_cause[acc];
+	return false;
+}
+
+/*
+ * Translate and refill the TLB. A physical address past the end of RAM
+ * faults, unless @device is given and a device decodes it: then NULL is
+ * returned without a trap and the address stored in *@device.
+ */
+static u8 *mmu_fill(struct cpu *c, u32 vaddr, enum mmu_access acc,
+		    u64 *device)
+{
+	u32 vpn = vaddr >> PAGE_SHIFT;
+	struct tlb_entry *e = &c->tlb[acc][vpn & (TLB_SIZE - 1)];
+	u32 priv;
+	u64 paddr;
+	u32 cause;
+	u8 *host;
+
+	// Entries tagged for the slow path are still valid translations
+	if (e->vpn == (vpn | TLB_SLOW_PATH)) {
+		c->mmu_stats.hits[acc]++;
+		return (u8 *)(e->addend + vaddr);
+	}
+
+	c->mmu_stats.misses[acc]++;
+	priv = mmu_access_priv(c, acc);
+
+	if (priv == PRV_M || !(c->csr.satp & SATP_MODE)) {
+		paddr = vaddr; // bare mode
+	} else if (!mmu_walk(c, vaddr, acc, priv, true, &paddr, &cause)) {
+		cpu_trap(c, cause, vaddr);
+		return NULL;
+	}
+
+	if (paddr >= c->mem_size) {
+		if (device && paddr - CLINT_BASE < CLINT_SIZE) {
+			*device = paddr;
+			return NULL;
+		}
+		cpu_trap(c, access_fault_cause[acc], vaddr);
+		return NULL;
+	}
+
+	// mem_size is page aligned, so the whole physical page is backed
+	e->vpn = vpn | (c->cachesim ? TLB_SLOW_PATH : 0);
+	e->addend = (uintptr_t)(c->memory + (paddr & ~(u64)PAGE_MASK)) -
+		    (vaddr & ~PAGE_MASK);
+	host = c->memory + paddr;
+	// Only the first store to a page after a flush gets here
+	if (c->fuzz && acc == MMU_STORE)
+		fuzz_mark_dirty(c->fuzz, (u32)paddr);
+	return host;
+}
+
+// mmu_translate() without feeding the cache model
+static u8 *mmu_translate_quiet(struct cpu *c, u32 vaddr, enum mmu_access acc)
+{
+	u8 *p = mmu_tlb_lookup(c, vaddr, acc);
+
+	return p ? p : mmu_fill(c, vaddr, acc, NULL);
+}
+
+// Feed one access to the cache model: @size bytes at @p, and @size2 more
+// at @p2 if it crosses into another page
+static void mmu_observe(struct cpu *c, const u8 *p, u32 size, const u8 *p2,
+			u32 size2, enum mmu_access acc)
+{
+	if (c->cachesim)
+		cachesim_access_split(c->cachesim, c->pc, p - c->memory, size,
+				      p2 ? p2 - c->memory : 0, size2, acc);
+}
+
+u8 *mmu_translate_slow(struct cpu *c, u32 vaddr, enum mmu_access acc)
+{
+	u8 *p = mmu_fill(c, vaddr, acc, NULL);
+	u32 size = 1; // an AMO or a syscall copy, charged to its first line
+
+	if (!p || !c->cachesim)
+		return p;
+	// A fetch is of the whole instruction, which the parcel tells
+	if (acc == MMU_FETCH) {
+		size = (mem_load16(p, 0) & 0x3) == 0x3 ? 4 : 2;
+		// Charged with its upper half by mmu_fetch_split()
+		if (!mmu_in_page(vaddr, size))
+			return p;
+	}
+	mmu_observe(c, p, size, NULL, 0, acc);
+	return p;
+}
+
+u8 *mmu_fetch_split(struct cpu *c, u32 vaddr, const u8 *lo)
+{
+	u8 *hi = mmu_translate_quiet(c, vaddr + 2, MMU_FETCH);
+
+	if (hi)
+		mmu_observe(c, lo, 2, hi, 2, MMU_FETCH);
+	return hi;
+}
+
+// Load or store *@val at the device address @paddr
+static bool mmu_device(struct cpu *c, u32 vaddr, u64 paddr,
+		       enum mmu_access acc, u32 *val, int size)
+{
+	bool ok;
+
+	// Device registers may depend on insn_count, which is only exact
+	// between instructions, not inside a trace
+	if (c->in_trace) {
+		c->trace_device_exit = true;
+		return false;
+	}
+	if (acc == MMU_LOAD)
+		ok = clint_load(c, paddr - CLINT_BASE, size, val);
+	else
+		ok = clint_store(c, paddr - CLINT_BASE, size, *val);
+	if (!ok)
+		cpu_trap(c, access_fault_cause[acc], vaddr);
+	return ok;
+}
+
+u8 *mmu_peek(struct cpu *c, u32 vaddr, enum mmu_access acc)
+{
+	u32 priv = mmu_access_priv(c, acc);
+	u64 paddr;
+	u32 cause;
+
+	if (priv == PRV_M || !(c->csr.satp & SATP_MODE))
+		paddr = vaddr;
+	else if (!mmu_walk(c, vaddr, acc, priv, false, &paddr, &cause))
+		return NULL;
+	return paddr < c->mem_size ? c->memory + paddr : NULL;
+}
+
+bool mmu_load_slow(struct cpu *c, u32 vaddr, u32 *val, int size)
+{
+	u64 device = 0;
+	u32 v = 0, n;
+	u8 *p, *hi;
+
+	if (mmu_in_page(vaddr, size)) {
+		p = mmu_fill(c, vaddr, MMU_LOAD, &device);
+		if (!p)
+			return device &&
+			       mmu_device(c, vaddr, device, MMU_LOAD, val, size);
+		mmu_observe(c, p, size, NULL, 0, MMU_LOAD);
+		if (size == 1)
+			*val = mem_load8(p, 0);
+		else if (size == 2)
+			*val = mem_load16(p, 0);
+		else
+			*val = mem_load32(p, 0);
+		return true;
+	}
+
+	// Page-crossing access: assemble it from the end of one page and
+	// the start of the next
+	n = PAGE_SIZE - (vaddr & PAGE_MASK);
+	p = mmu_translate_quiet(c, vaddr, MMU_LOAD);
+	if (!p)
+		return false;
+	hi = mmu_translate_quiet(c, vaddr + n, MMU_LOAD);
+	if (!hi)
+		return false;
+	mmu_observe(c, p, n, hi, size - n, MMU_LOAD);
+	for (u32 i = 0; i < (u32)size; i++)
+		v |= (u32)(i < n ? p[i] : hi[i - n]) << (8 * i);
+	*val = v;
+	return true;
+}
+
+bool mmu_store_slow(struct cpu *c, u32 vaddr, u32 val, int size)
+{
+	u64 device = 0;
+	u8 *p, *hi;
+	u32 n;
+
+	if (mmu_in_page(vaddr, size)) {
+		p = mmu_fill(c, vaddr, MMU_STORE, &device);
+		if (!p)
+			return device &&
+			       mmu_device(c, vaddr, device, MMU_STORE, &val,
+					  size);
+		mmu_observe(c, p, size, NULL, 0, MMU_STORE);
+		if (size == 1)
+			mem_store8(p, 0, (u8)val);
+		else if (size == 2)
+			mem_store16(p, 0, (u16)val);
+		else
+			mem_store32(p, 0, val);
+		return true;
+	}
+
+	// Make sure both pages are writable before touching either
+	n = PAGE_SIZE - (vaddr & PAGE_MASK);
+	p = mmu_translate_quiet(c, vaddr, MMU_STORE);
+	if (!p)
+		return false;
+	hi = mmu_translate_quiet(c, vaddr + n, MMU_STORE);
+	if (!hi)
+		return false;
+	mmu_observe(c, p, n, hi, size - n, MMU_STORE);
+	for (u32 i = 0; i < (u32)size; i++) {
+		if (i < n)
+			p[i] = (val >> (8 * i)) & 0xFF;
+		else
+			hi[i - n] = (val >> (8 * i)) & 0xFF;
+	}
+	return true;
+}
+
+void mmu_print_stats(struct cpu *c, FILE *out)
+{
+	static const char *names[MMU_NACCESS] = { "fetch", "load", "store" };
+	struct mmu_stats *s = &c->mmu_stats;
+
+	for (int acc = 0; acc < MMU_NACCESS; acc++) {
+		u64 total = s->hits[acc] + s->misses[acc];
+		double rate = total ? 100.0 * s->hits[acc] / total : 0.0;
+
+		fprintf(out, "TLB %-5s: %llu hits, %llu misses (%.2f%% hit rate)\n",
+			names[acc], s->hits[acc], s->misses[acc], rate);
+	}
+	fprintf(out, "Page walks: %llu, TLB flushes: %llu\n", s->walks,
+		s->flushes);
+}
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+#include "perfmap.h"
+#include "cpu.h"
+#include "elf_file.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+typedef void (*block_fn)(struct cpu *c, u32 max);
+typedef void (*trampoline_fn)(struct cpu *c, u32 max, block_fn fn);
+
+/*
+ * The trampoline template: set up a frame so unwinders step through it,
+ * call the third argument with the first two, return.
+ */
+#if defined(__x86_64__)
+#define PERFMAP_ELF_MACH 62 // EM_X86_64
+static const u8 trampoline[] = {
+	0x55, // push %rbp
+	0x48, 0x89, 0xe5, // mov %rsp, %rbp
+	0xff, 0xd2, // call *%rdx
+	0x5d, // pop %rbp
+	0xc3, // ret
+};
+#elif defined(__aarch64__)
+#define PERFMAP_ELF_MACH 183 // EM_AARCH64
+static const u32 trampoline[] = {
+	0xa9bf7bfd, // stp x29, x30, [sp, #-16]!
+	0x910003fd, // mov x29, sp
+	0xd63f0040, // blr x2
+	0xa8c17bfd, // ldp x29, x30, [sp], #16
+	0xd65f03c0, // ret
+};
+#else
+static const u8 trampoline[1]; // unused, perfmap_create() fails
+#endif
+
+#define PERFMAP_HASH_BITS 16
+#define PERFMAP_HASH_SIZE (1u << PERFMAP_HASH_BITS)
+#define PERFMAP_CODE_SIZE (PERFMAP_SLOT * PERFMAP_MAX_TRAMPOLINES)
+
+_Static_assert(PERFMAP_HASH_SIZE >= 2 * PERFMAP_MAX_TRAMPOLINES,
+	       "trampoline table must stay at most half full");
+
+#define JITDUMP_MAGIC 0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD 0
+
+struct jitdump_header {
+	u32 magic;
+	u32 version;
+	u32 total_size;
+	u32 elf_mach;
+	u32 pad1;
+	u32 pid;
+	u64 timestamp;
+	u64 flags;
+};
+
+struct jitdump_load {
+	u32 id;
+	u32 total_size;
+	u64 timestamp;
+	u32 pid;
+	u32 tid;
+	u64 vma;
+	u64 code_addr;
+	u64 code_size;
+	u64 code_index;
+	// followed by the NUL-terminated name and the code bytes
+};
+
+// perf matches jitdump records against CLOCK_MONOTONIC (`perf record -k 1`)
+static u64 timestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static FILE *open_in(const char *dir, const char *fmt, const char *mode)
+{
+	char path[4096];
+
+	snprintf(path, sizeof(path), fmt, dir, (int)getpid());
+	return fopen(path, mode);
+}
+
+static bool jitdump_open(struct perfmap *pm, const char *dir)
+{
+	struct jitdump_header h = {
+		.magic = JITDUMP_MAGIC,
+		.version = JITDUMP_VERSION,
+		.total_size = sizeof(h),
+		.pid = getpid(),
+		.timestamp = timestamp(),
+	};
+	long page = sysconf(_SC_PAGESIZE);
+
+#ifdef PERFMAP_ELF_MACH
+	h.elf_mach = PERFMAP_ELF_MACH;
+#endif
+	pm->jitdump = open_in(dir, "%s/jit-%d.dump", "w+");
+	if (!pm->jitdump)
+		return false;
+	if (fwrite(&h, sizeof(h), 1, pm->jitdump) != 1 ||
+	    fflush(pm->jitdump))
+		return false;
+	// perf record only picks up the dump through an executable mapping
+	pm->jitdump_marker = mmap(NULL, page, PROT_READ | PROT_EXEC,
+				  MAP_PRIVATE, fileno(pm->jitdump), 0);
+	if (pm->jitdump_marker == MAP_FAILED) {
+		pm->jitdump_marker = NULL;
+		return false;
+	}
+	return true;
+}
+
+struct perfmap *perfmap_create(const struct symtab *syms, const char *dir,
+			       unsigned flags)
+{
+	struct perfmap *pm;
+
+#ifndef PERFMAP_ELF_MACH
+	(void)syms;
+	(void)dir;
+	(void)flags;
+	return NULL;
+#endif
+	pm = calloc(1, sizeof(*pm));
+	if (!pm)
+		return NULL;
+	if (!dir)
+		dir = "/tmp";
+	pm->syms = syms;
+	pm->keys = malloc(PERFMAP_HASH_SIZE * sizeof(*pm->keys));
+	pm->slots = calloc(PERFMAP_HASH_SIZE, sizeof(*pm->slots));
+	pm->code = mmap(NULL, PERFMAP_CODE_SIZE, PROT_READ | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pm->code == MAP_FAILED)
+		pm->code = NULL;
+	if (!pm->keys || !pm->slots || !pm->code)
+		goto fail;
+	// An odd pc never matches, so every entry starts out invalid
+	for (u32 i = 0; i < (1u << PERFMAP_CACHE_BITS); i++)
+		pm->cache[i].pc = 1;
+
+	if (flags & PERFMAP_MAP) {
+		pm->map = open_in(dir, "%s/perf-%d.map", "w");
+		if (!pm->map)
+			goto fail;
+	}
+	if ((flags & PERFMAP_JITDUMP) && !jitdump_open(pm, dir))
+		goto fail;
+	return pm;
+
+fail:
+	perfmap_destroy(pm);
+	return NULL;
+}
+
+void perfmap_destroy(struct perfmap *pm)
+{
+	if (!pm)
+		return;
+	if (pm->map)
+		fclose(pm->map);
+	if (pm->jitdump_marker)
+		munmap(pm->jitdump_marker, sysconf(_SC_PAGESIZE));
+	if (pm->jitdump)
+		fclose(pm->jitdump);
+	// The trampolines stay mapped: a late sample may still point into
+	// them, and the address range must not be reused under their names.
+	free(pm->keys);
+	free(pm->slots);
+	free(pm);
+}
+
+static void announce(struct perfmap *pm, const u8 *code, const char *name)
+{
+	u64 addr = (u64)(uintptr_t)code;
+
+	if (pm->map) {
+		fprintf(pm->map, "%llx %x %s\n", (unsigned long long)addr,
+			(unsigned)sizeof(trampoline), name);
+		fflush(pm->map);
+	}
+	if (pm->jitdump) {
+		struct jitdump_load r = {
+			.id = JIT_CODE_LOAD,
+			.total_size = sizeof(r) + strlen(name) + 1 +
+				      sizeof(trampoline),
+			.timestamp = timestamp(),
+			.pid = getpid(),
+			.tid = syscall(SYS_gettid),
+			.vma = addr,
+			.code_addr = addr,
+			.code_size = sizeof(trampoline),
+			.code_index = pm->code_index++,
+		};
+
+		fwrite(&r, sizeof(r), 1, pm->jitdump);
+		fwrite(name, strlen(name) + 1, 1, pm->jitdump);
+		fwrite(code, sizeof(trampoline), 1, pm->jitdump);
+		fflush(pm->jitdump);
+	}
+}
+
+// Copy the template into the next slot; false when the region is full
+static bool emit(struct perfmap *pm, const char *name)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	u8 *code = pm->code + pm->ntramps * PERFMAP_SLOT;
+	u8 *base = (u8 *)((uintptr_t)code & ~(uintptr_t)(page - 1));
+
+	if (pm->ntramps == PERFMAP_MAX_TRAMPOLINES)
+		return false;
+	if (mprotect(base, page, PROT_READ | PROT_WRITE))
+		return false;
+	memcpy(code, trampoline, sizeof(trampoline));
+	if (mprotect(base, page, PROT_READ | PROT_EXEC))
+		return false;
+	__builtin___clear_cache((char *)code,
+				(char *)code + sizeof(trampoline));
+	pm->ntramps++;
+	announce(pm, code, name);
+	return true;
+}
+
+// Trampoline slot for the block at @pc, or -1 if none can be made
+static s32 lookup(struct perfmap *pm, u32 pc)
+{
+	const struct symbol *sym = pm->syms ? symtab_find(pm->syms, pc) : NULL;
+	u32 key, h;
+	char name[128];
+
+	// Symbols group their blocks; code outside any symbol goes by block
+	if (sym && sym->size && pc - sym->addr >= sym->size)
+		sym = NULL;
+	key = sym ? sym->addr : pc;
+
+	for (h = (key * 0x9E3779B1u) >> (32 - PERFMAP_HASH_BITS);
+	     pm->slots[h]; h = (h + 1) & (PERFMAP_HASH_SIZE - 1)) {
+		if (pm->keys[h] == key)
+			return pm->slots[h] - 1;
+	}
+
+	if (sym)
+		snprintf(name, sizeof(name), "rv32i:%s@0x%08x", sym->name, key);
+	else
+		snprintf(name, sizeof(name), "rv32i:0x%08x", key);
+	if (!emit(pm, name))
+		return -1;
+	pm->keys[h] = key;
+	pm->slots[h] = pm->ntramps;
+	return pm->ntramps - 1;
+}
+
+void perfmap_exec_block(struct perfmap *pm, struct cpu *c, u32 max)
+{
+	u32 i = (c->pc >> 1) & ((1u << PERFMAP_CACHE_BITS) - 1);
+	s32 slot;
+
+	if (pm->cache[i].pc == c->pc) {
+		slot = pm->cache[i].slot;
+	} else {
+		slot = lookup(pm, c->pc);
+		if (slot < 0) {
+			cpu_exec_block(c, max);
+			return;
+		}
+		pm->cache[i].pc = c->pc;
+		pm->cache[i].slot = slot;
+	}
+	((trampoline_fn)(pm->code + slot * PERFMAP_SLOT))(c, max,
+							   cpu_exec_block);
+}
@@ -0,0 +1,228 @@
+#include "replay.h"
+#include "cpu.h"
+#include "csr.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct replay *replay_open(const char *path, enum replay_mode mode)
+{
+	struct replay *r = calloc(1, sizeof(*r));
+	char magic[sizeof(REPLAY_MAGIC) - 1];
+
+	if (!r)
+		return NULL;
+	r->mode = mode;
+	r->fp = fopen(path, mode == REPLAY_RECORD ? "wb" : "rb");
+	if (!r->fp)
+		goto fail;
+
+	if (mode == REPLAY_RECORD) {
+		// Events are small; let stdio batch them into large writes
+		setvbuf(r->fp, NULL, _IOFBF, 1 << 16);
+		fwrite(REPLAY_MAGIC, 1, sizeof(magic), r->fp);
+	} else if (fread(magic, 1, sizeof(magic), r->fp) != sizeof(magic) ||
+		   memcmp(magic, REPLAY_MAGIC, sizeof(magic))) {
+		fclose(r->fp);
+		goto fail;
+	}
+	return r;
+
+fail:
+	free(r);
+	return NULL;
+}
+
+bool replay_close(struct replay *r)
+{
+	bool ok;
+
+	if (!r)
+		return true;
+	ok = !ferror(r->fp);
+	ok &= fclose(r->fp) == 0;
+	free(r);
+	return ok;
+}
+
+static void put_varint(FILE *fp, u64 v)
+{
+	while (v >= 0x80) {
+		putc((int)(v & 0x7F) | 0x80, fp);
+		v >>= 7;
+	}
+	putc((int)v, fp);
+}
+
+static bool get_varint(FILE *fp, u64 *v)
+{
+	*v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int b = getc(fp);
+
+		if (b == EOF)
+			return false;
+		*v |= (u64)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static const char *const replay_event_names[] = {
+	[REPLAY_EV_READ] = "read",
+	[REPLAY_EV_CLOCK] = "clock",
+	[REPLAY_EV_IRQ] = "irq",
+};
+
+const char *replay_event_name(enum replay_event ev)
+{
+	return replay_event_names[ev];
+}
+
+// Stop the guest where the log and the run part ways, keeping the first
+// reason for the caller
+static bool diverge(struct cpu *c, const char *why, enum replay_event ev)
+{
+	struct replay *r = c->replay;
+
+	if (!r->diverged) {
+		r->diverged = true;
+		r->why = why;
+		r->diverged_event = ev;
+		r->diverged_at = cpu_insn_count(c);
+	}
+	cpu_halt(c, CPU_STOP_HALT);
+	return true;
+}
+
+// Read the header of the next event, if not done yet; NULL if there is one
+static const char *replay_peek(struct replay *r)
+{
+	u64 delta;
+
+	if (r->peeked)
+		return NULL;
+	r->next_type = getc(r->fp);
+	if (r->next_type == EOF)
+		return "log ended";
+	if (!get_varint(r->fp, &delta) || !get_varint(r->fp, &r->next_ret) ||
+	    !get_varint(r->fp, &r->next_len))
+		return "truncated log";
+	r->next_count = r->last_count + delta;
+	r->peeked = true;
+	return NULL;
+}
+
+// Take the peeked event, which matched, with its payload in @data
+static bool replay_take(struct cpu *c, enum replay_event ev, s32 *ret,
+			void *data, u32 max)
+{
+	struct replay *r = c->replay;
+
+	r->peeked = false;
+	if (r->next_len > max ||
+	    (r->next_len && fread(data, 1, r->next_len, r->fp) != r->next_len))
+		return diverge(c, "bad payload", ev);
+	r->last_count = cpu_insn_count(c);
+	r->events++;
+	*ret = (s32)((u32)(r->next_ret >> 1) ^ -(u32)(r->next_ret & 1));
+	return true;
+}
+
+bool replay_fetch(struct cpu *c, enum replay_event ev, s32 *ret, void *data,
+		  u32 max)
+{
+	struct replay *r = c->replay;
+	const char *why;
+
+	if (!r || r->mode != REPLAY_REPLAY)
+		return false;
+
+	*ret = -1;
+	if (r->diverged)
+		return diverge(c, "earlier divergence", ev);
+
+	why = replay_peek(r);
+	if (why)
+		return diverge(c, why, ev);
+	if (r->next_type != (int)ev)
+		return diverge(c, "different event", ev);
+	if (r->next_count != cpu_insn_count(c))
+		return diverge(c, "different instruction count", ev);
+	return replay_take(c, ev, ret, data, max);
+}
+
+void replay_log(struct cpu *c, enum replay_event ev, s32 ret,
+		const void *data, u32 len)
+{
+	struct replay *r = c->replay;
+
+	if (!r || r->mode != REPLAY_RECORD)
+		return;
+
+	putc(ev, r->fp);
+	put_varint(r->fp, cpu_insn_count(c) - r->last_count);
+	// Zigzag keeps small negative results (-errno) to one byte
+	put_varint(r->fp, ((u32)ret << 1) ^ (u32)(ret >> 31));
+	put_varint(r->fp, len);
+	fwrite(data, 1, len, r->fp);
+	r->last_count = cpu_insn_count(c);
+	r->events++;
+}
+
+void replay_irq(struct cpu *c, u32 bits, bool level)
+{
+	struct replay *r = c->replay;
+
+	if (r->mode == REPLAY_REPLAY)
+		return;
+	if (level) {
+		r->irq_set |= bits;
+		r->irq_clear &= ~bits;
+	} else {
+		r->irq_clear |= bits;
+		r->irq_set &= ~bits;
+	}
+}
+
+void replay_irq_sync(struct cpu *c)
+{
+	struct replay *r = c->replay;
+	s32 lines;
+
+	if (r->mode == REPLAY_RECORD) {
+		if (!(r->irq_set | r->irq_clear))
+			return;
+		c->csr.mip = (c->csr.mip & ~r->irq_clear) | r->irq_set;
+		replay_log(c, REPLAY_EV_IRQ, c->csr.mip & (MIP_MEIP | MIP_SEIP),
+			   "", 0);
+		r->irq_set = 0;
+		r->irq_clear = 0;
+		return;
+	}
+	// The end of the log is only a divergence if the guest needs more
+	while (!r->diverged && !replay_peek(r) &&
+	       r->next_type == REPLAY_EV_IRQ &&
+	       r->next_count <= cpu_insn_count(c)) {
+		if (r->next_count != cpu_insn_count(c)) {
+			diverge(c, "different instruction count", REPLAY_EV_IRQ);
+			return;
+		}
+		if (!replay_take(c, REPLAY_EV_IRQ, &lines, NULL, 0))
+			return;
+		c->csr.mip = (c->csr.mip & ~(MIP_MEIP | MIP_SEIP)) |
+			     ((u32)lines & (MIP_MEIP | MIP_SEIP));
+	}
+}
+
+u64 replay_irq_limit(struct cpu *c, u64 left)
+{
+	struct replay *r = c->replay;
+
+	if (r->mode != REPLAY_REPLAY || r->diverged || replay_peek(r) ||
+	    r->next_type != REPLAY_EV_IRQ || r->next_count < cpu_insn_count(c))
+		return left;
+	return r->next_count - cpu_insn_count(c) < left ?
+		       r->next_count - cpu_insn_count(c) : left;
+}
@@ -0,0 +1,240 @@
+#include "rvc.h"
+
+// Extract bit range [hi:lo] from x
+static inline u32 bits(u32 x, int hi, int lo)
+{
+	return (x >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+static inline s32 sext(u32 val, int width)
+{
+	s32 m = 1U << (width - 1);
+	return (val ^ m) - m;
+}
+
+// --- 32-bit encoders for each base format ---
+
+static u32 enc_r(u32 opcode, u32 rd, u32 funct3, u32 rs1, u32 rs2, u32 funct7)
+{
+	return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+	       (rd << 7) | opcode;
+}
+
+static u32 enc_i(u32 opcode, u32 rd, u32 funct3, u32 rs1, s32 imm)
+{
+	return (((u32)imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) |
+	       (rd << 7) | opcode;
+}
+
+static u32 enc_s(u32 opcode, u32 funct3, u32 rs1, u32 rs2, s32 imm)
+{
+	u32 u = (u32)imm;
+
+	return (bits(u, 11, 5) << 25) | (rs2 << 20) | (rs1 << 15) |
+	       (funct3 << 12) | (bits(u, 4, 0) << 7) | opcode;
+}
+
+static u32 enc_b(u32 funct3, u32 rs1, u32 rs2, s32 imm)
+{
+	u32 u = (u32)imm;
+
+	return (bits(u, 12, 12) << 31) | (bits(u, 10, 5) << 25) | (rs2 << 20) |
+	       (rs1 << 15) | (funct3 << 12) | (bits(u, 4, 1) << 8) |
+	       (bits(u, 11, 11) << 7) | 0x63;
+}
+
+static u32 enc_j(u32 rd, s32 imm)
+{
+	u32 u = (u32)imm;
+
+	return (bits(u, 20, 20) << 31) | (bits(u, 10, 1) << 21) |
+	       (bits(u, 11, 11) << 20) | (bits(u, 19, 12) << 12) | (rd << 7) |
+	       0x6F;
+}
+
+// CJ-format jump offset shared by C.J and C.JAL
+static s32 cj_offset(u32 i)
+{
+	u32 off = (bits(i, 12, 12) << 11) | (bits(i, 11, 11) << 4) |
+		  (bits(i, 10, 9) << 8) | (bits(i, 8, 8) << 10) |
+		  (bits(i, 7, 7) << 6) | (bits(i, 6, 6) << 7) |
+		  (bits(i, 5, 3) << 1) | (bits(i, 2, 2) << 5);
+	return sext(off, 12);
+}
+
+// CB-format branch offset shared by C.BEQZ and C.BNEZ
+static s32 cb_offset(u32 i)
+{
+	u32 off = (bits(i, 12, 12) << 8) | (bits(i, 11, 10) << 3) |
+		  (bits(i, 6, 5) << 6) | (bits(i, 4, 3) << 1) |
+		  (bits(i, 2, 2) << 5);
+	return sext(off, 9);
+}
+
+// Quadrant 0: stack-pointer based addi and register-based loads/stores
+static u32 expand_q0(u32 i)
+{
+	u32 rd_ = bits(i, 4, 2) + 8; // rd' / rs2'
+	u32 rs1_ = bits(i, 9, 7) + 8;
+	u32 uimm = (bits(i, 12, 10) << 3) | (bits(i, 6, 6) << 2) |
+		   (bits(i, 5, 5) << 6);
+	u32 uimm_d = (bits(i, 12, 10) << 3) | (bits(i, 6, 5) << 6);
+
+	switch (bits(i, 15, 13)) {
+	case 0x0: { // C.ADDI4SPN
+		u32 nzuimm = (bits(i, 12, 11) << 4) | (bits(i, 10, 7) << 6) |
+			     (bits(i, 6, 6) << 2) | (bits(i, 5, 5) << 3);
+		if (nzuimm == 0)
+			return 0;
+		return enc_i(0x13, rd_, 0x0, 2, nzuimm);
+	}
+	case 0x1: // C.FLD
+		return enc_i(0x07, rd_, 0x3, rs1_, uimm_d);
+	case 0x2: // C.LW
+		return enc_i(0x03, rd_, 0x2, rs1_, uimm);
+	case 0x3: // C.FLW
+		return enc_i(0x07, rd_, 0x2, rs1_, uimm);
+	case 0x5: // C.FSD
+		return enc_s(0x27, 0x3, rs1_, rd_, uimm_d);
+	case 0x6: // C.SW
+		return enc_s(0x23, 0x2, rs1_, rd_, uimm);
+	case 0x7: // C.FSW
+		return enc_s(0x27, 0x2, rs1_, rd_, uimm);
+	}
+	return 0;
+}
+
+// Quadrant 1: immediates, arithmetic on x8-x15, jumps and branches
+static u32 expand_q1(u32 i)
+{
+	u32 rd = bits(i, 11, 7);
+	u32 rd_ = bits(i, 9, 7) + 8;
+	u32 rs2_ = bits(i, 4, 2) + 8;
+	s32 imm = sext((bits(i, 12, 12) << 5) | bits(i, 6, 2), 6);
+
+	switch (bits(i, 15, 13)) {
+	case 0x0: // C.ADDI (C.NOP when rd = x0)
+		return enc_i(0x13, rd, 0x0, rd, imm);
+	case 0x1: // C.JAL
+		return enc_j(1, cj_offset(i));
+	case 0x2: // C.LI
+		return enc_i(0x13, rd, 0x0, 0, imm);
+	case 0x3:
+		if (rd == 2) { // C.ADDI16SP
+			u32 nz = (bits(i, 12, 12) << 9) | (bits(i, 6, 6) << 4) |
+				 (bits(i, 5, 5) << 6) | (bits(i, 4, 3) << 7) |
+				 (bits(i, 2, 2) << 5);
+			if (nz == 0)
+				return 0;
+			return enc_i(0x13, 2, 0x0, 2, sext(nz, 10));
+		}
+		// C.LUI
+		if (imm == 0)
+			return 0;
+		return ((u32)imm << 12) | (rd << 7) | 0x37;
+	case 0x4:
+		switch (bits(i, 11, 10)) {
+		case 0x0: // C.SRLI
+		case 0x1: // C.SRAI
+			if (bits(i, 12, 12)) // shamt[5] must be zero on RV32
+				return 0;
+			return enc_i(0x13, rd_, 0x5, rd_,
+				     bits(i, 6, 2) |
+					     (bits(i, 10, 10) ? 0x400 : 0));
+		case 0x2: // C.ANDI
+			return enc_i(0x13, rd_, 0x7, rd_, imm);
+		default:
+			if (bits(i, 12, 12)) // C.SUBW/C.ADDW are RV64 only
+				return 0;
+			switch (bits(i, 6, 5)) {
+			case 0x0: // C.SUB
+				return enc_r(0x33, rd_, 0x0, rd_, rs2_, 0x20);
+			case 0x1: // C.XOR
+				return enc_r(0x33, rd_, 0x4, rd_, rs2_, 0x00);
+			case 0x2: // C.OR
+				return enc_r(0x33, rd_, 0x6, rd_, rs2_, 0x00);
+			default: // C.AND
+				return enc_r(0x33, rd_, 0x7, rd_, rs2_, 0x00);
+			}
+		}
+	case 0x5: // C.J
+		return enc_j(0, cj_offset(i));
+	case 0x6: // C.BEQZ
+		return enc_b(0x0, rd_, 0, cb_offset(i));
+	case 0x7: // C.BNEZ
+		return enc_b(0x1, rd_, 0, cb_offset(i));
+	}
+	return 0;
+}
+
+// Quadrant 2: stack-pointer loads/stores, shifts, moves and jumps
+static u32 expand_q2(u32 i)
+{
+	u32 rd = bits(i, 11, 7);
+	u32 rs2 = bits(i, 6, 2);
+
+	switch (bits(i, 15, 13)) {
+	case 0x0: // C.SLLI
+		if (bits(i, 12, 12))
+			return 0;
+		return enc_i(0x13, rd, 0x1, rd, rs2);
+	case 0x1: { // C.FLDSP
+		u32 uimm = (bits(i, 12, 12) << 5) | (bits(i, 6, 5) << 3) |
+			   (bits(i, 4, 2) << 6);
+		return enc_i(0x07, rd, 0x3, 2, uimm);
+	}
+	case 0x2: // C.LWSP
+	case 0x3: { // C.FLWSP: rd may be f0
+		u32 uimm = (bits(i, 12, 12) << 5) | (bits(i, 6, 4) << 2) |
+			   (bits(i, 3, 2) << 6);
+		if (bits(i, 13, 13))
+			return enc_i(0x07, rd, 0x2, 2, uimm);
+		if (rd == 0)
+			return 0;
+		return enc_i(0x03, rd, 0x2, 2, uimm);
+	}
+	case 0x4:
+		if (!bits(i, 12, 12)) {
+			if (rs2 == 0) { // C.JR
+				if (rd == 0)
+					return 0;
+				return enc_i(0x67, 0, 0x0, rd, 0);
+			}
+			// C.MV
+			return enc_r(0x33, rd, 0x0, 0, rs2, 0x00);
+		}
+		if (rs2 == 0) {
+			if (rd == 0) // C.EBREAK
+				return 0x00100073;
+			// C.JALR
+			return enc_i(0x67, 1, 0x0, rd, 0);
+		}
+		// C.ADD
+		return enc_r(0x33, rd, 0x0, rd, rs2, 0x00);
+	case 0x5: { // C.FSDSP
+		u32 uimm = (bits(i, 12, 10) << 3) | (bits(i, 9, 7) << 6);
+		return enc_s(0x27, 0x3, 2, rs2, uimm);
+	}
+	case 0x6: // C.SWSP
+	case 0x7: { // C.FSWSP
+		u32 uimm = (bits(i, 12, 9) << 2) | (bits(i, 8, 7) << 6);
+		return enc_s(bits(i, 13, 13) ? 0x27 : 0x23, 0x2, 2, rs2, uimm);
+	}
+	}
+	return 0;
+}
+
+u32 rvc_expand(u16 raw)
+{
+	u32 i = raw;
+
+	switch (i & 0x3) {
+	case 0x0:
+		return expand_q0(i);
+	case 0x1:
+		return expand_q1(i);
+	case 0x2:
+		return expand_q2(i);
+	}
+	return 0;
+}
@@ -0,0 +1,249 @@
+#include "sample.h"
+#include "cpu.h"
+#include "cachesim.h"
+#include "bpred.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Parse a count with an optional k/m/g suffix (powers of 1000)
+static bool parse_count(const char *s, char **end, u64 *v)
+{
+	*v = strtoull(s, end, 0);
+	if (*end == s)
+		return false;
+	switch (**end) {
+	case 'k':
+	case 'K':
+		*v *= 1000;
+		(*end)++;
+		break;
+	case 'm':
+	case 'M':
+		*v *= 1000000;
+		(*end)++;
+		break;
+	case 'g':
+	case 'G':
+		*v *= 1000000000;
+		(*end)++;
+		break;
+	}
+	return true;
+}
+
+bool sample_config_parse(const char *spec, struct sample_config *cfg)
+{
+	char *end;
+
+	memset(cfg, 0, sizeof(*cfg));
+	if (!parse_count(spec, &end, &cfg->start) || *end != ':')
+		return false;
+	if (!parse_count(end + 1, &end, &cfg->interval) || *end != ':')
+		return false;
+	if (!parse_count(end + 1, &end, &cfg->window))
+		return false;
+	if (*end == ':' && !parse_count(end + 1, &end, &cfg->warmup))
+		return false;
+	if (*end != '\0' || cfg->window == 0)
+		return false;
+	// Windows (with their warmup) must not overlap
+	return cfg->interval == 0 || cfg->interval >= cfg->window + cfg->warmup;
+}
+
+struct sampler *sample_create(const struct sample_config *cfg,
+			      struct cachesim *sim, struct bpred *bp)
+{
+	struct sampler *s = calloc(1, sizeof(*s));
+
+	if (!s)
+		return NULL;
+	s->cfg = *cfg;
+	s->sim = sim;
+	s->bp = bp;
+	return s;
+}
+
+void sample_destroy(struct sampler *s)
+{
+	if (!s)
+		return;
+	free(s->windows);
+	free(s);
+}
+
+// Run until @n instructions have run or the CPU halts; returns the count
+static u64 run_for(struct cpu *c, u64 n)
+{
+	u64 done;
+
+	cpu_run_for(c, n, &done);
+	return done;
+}
+
+static void attach_models(struct sampler *s, struct cpu *c, bool on)
+{
+	// Detaching the cache model also puts the TLB back on the fast path
+	if (s->sim)
+		cachesim_attach(c, on ? s->sim : NULL);
+	c->bpred = on ? s->bp : NULL;
+}
+
+static void snapshot(const struct sampler *s, u64 *ev)
+{
+	memset(ev, 0, SAMPLE_EV_COUNT * sizeof(*ev));
+	if (s->sim) {
+		ev[SAMPLE_EV_L1I_ACCESS] =
+			cachesim_event(s->sim, CACHE_EV_L1I_ACCESS);
+		ev[SAMPLE_EV_L1I_MISS] = cachesim_event(s->sim, CACHE_EV_L1I_MISS);
+		ev[SAMPLE_EV_L1D_ACCESS] =
+			cachesim_event(s->sim, CACHE_EV_L1D_ACCESS);
+		ev[SAMPLE_EV_L1D_MISS] = cachesim_event(s->sim, CACHE_EV_L1D_MISS);
+		ev[SAMPLE_EV_L2_ACCESS] =
+			cachesim_event(s->sim, CACHE_EV_L2_ACCESS);
+		ev[SAMPLE_EV_L2_MISS] = cachesim_event(s->sim, CACHE_EV_L2_MISS);
+	}
+	if (s->bp) {
+		ev[SAMPLE_EV_BRANCH] = s->bp->stats.cond;
+		ev[SAMPLE_EV_BRANCH_MISS] = s->bp->stats.cond_mispredicts;
+		ev[SAMPLE_EV_JUMP] = s->bp->stats.jumps;
+		ev[SAMPLE_EV_TARGET_MISS] = s->bp->stats.target_mispredicts;
+	}
+}
+
+static bool add_window(struct sampler *s, const struct sample_window *w)
+{
+	if (s->nwindows == s->cap) {
+		u32 cap = s->cap ? 2 * s->cap : 64;
+		struct sample_window *p =
+			realloc(s->windows, cap * sizeof(*p));
+
+		if (!p)
+			return false;
+		s->windows = p;
+		s->cap = cap;
+	}
+	s->windows[s->nwindows++] = *w;
+	return true;
+}
+
+void sample_run(struct sampler *s, struct cpu *c)
+{
+	u64 next = s->cfg.start;
+
+	attach_models(s, c, false);
+	while (c->state == CPU_STATE_RUNNING) {
+		struct sample_window w;
+		u64 before[SAMPLE_EV_COUNT];
+		u64 warm_from = next > s->cfg.warmup ? next - s->cfg.warmup : 0;
+
+		// Fast-forward, then warm the models up to the window start
+		if (s->total_insns < warm_from)
+			s->total_insns += run_for(c, warm_from - s->total_insns);
+		attach_models(s, c, true);
+		if (s->total_insns < next)
+			s->total_insns += run_for(c, next - s->total_insns);
+
+		snapshot(s, before);
+		w.begin = s->total_insns;
+		s->total_insns += run_for(c, s->cfg.window);
+		snapshot(s, w.ev);
+		attach_models(s, c, false);
+
+		for (int i = 0; i < SAMPLE_EV_COUNT; i++)
+			w.ev[i] -= before[i];
+		w.ev[SAMPLE_EV_INSNS] = s->total_insns - w.begin;
+		// A window cut short by the end of the program still counts
+		if (w.ev[SAMPLE_EV_INSNS] && !add_window(s, &w))
+			break;
+
+		if (!s->cfg.interval)
+			break;
+		next += s->cfg.interval;
+	}
+	s->total_insns += run_for(c, UINT64_MAX);
+}
+
+bool sample_estimate(const struct sampler *s, enum sample_event ev,
+		     double *total, double *ci)
+{
+	double n = s->total_insns, mean = 0, avg = 0, var = 0;
+
+	if (!s->nwindows)
+		return false;
+
+	for (u32 i = 0; i < s->nwindows; i++) {
+		const struct sample_window *w = &s->windows[i];
+		u64 from = i ? w->begin : 0;
+		u64 to = i + 1 < s->nwindows ? s->windows[i + 1].begin :
+					       s->total_insns;
+		double rate = (double)w->ev[ev] / w->ev[SAMPLE_EV_INSNS];
+
+		mean += rate * (to - from) / n;
+		avg += rate / s->nwindows;
+	}
+	*total = mean * n;
+
+	// Spread of the per-window rates, treating windows as independent
+	for (u32 i = 0; i < s->nwindows; i++) {
+		const struct sample_window *w = &s->windows[i];
+		double d = (double)w->ev[ev] / w->ev[SAMPLE_EV_INSNS] - avg;
+
+		var += d * d;
+	}
+	*ci = 0;
+	if (s->nwindows > 1)
+		*ci = 1.96 * sqrt(var / (s->nwindows - 1) / s->nwindows) * n;
+	return true;
+}
+
+static const char *const sample_event_names[SAMPLE_EV_COUNT] = {
+	[SAMPLE_EV_INSNS] = "instructions",
+	[SAMPLE_EV_L1I_ACCESS] = "L1I accesses",
+	[SAMPLE_EV_L1I_MISS] = "L1I misses",
+	[SAMPLE_EV_L1D_ACCESS] = "L1D accesses",
+	[SAMPLE_EV_L1D_MISS] = "L1D misses",
+	[SAMPLE_EV_L2_ACCESS] = "L2 accesses",
+	[SAMPLE_EV_L2_MISS] = "L2 misses",
+	[SAMPLE_EV_BRANCH] = "branches",
+	[SAMPLE_EV_BRANCH_MISS] = "branch misses",
+	[SAMPLE_EV_JUMP] = "jumps",
+	[SAMPLE_EV_TARGET_MISS] = "target misses",
+};
+
+void sample_print_stats(const struct sampler *s, FILE *out)
+{
+	u64 detailed = 0;
+
+	for (u32 i = 0; i < s->nwindows; i++)
+		detailed += s->windows[i].ev[SAMPLE_EV_INSNS];
+
+	fprintf(out, "Sampling: %u windows, %llu of %llu instructions detailed",
+		s->nwindows, (unsigned long long)detailed,
+		(unsigned long long)s->total_insns);
+	if (s->total_insns)
+		fprintf(out, " (%.2f%%)", 100.0 * detailed / s->total_insns);
+	fprintf(out, "\n");
+	if (!s->nwindows) {
+		fprintf(out, "  program ended before the first window\n");
+		return;
+	}
+
+	fprintf(out, "  %-14s %16s %12s %10s\n", "event", "estimate",
+		"per 1k insn", "+/- 95%");
+	for (int ev = SAMPLE_EV_L1I_ACCESS; ev < SAMPLE_EV_COUNT; ev++) {
+		double total, ci;
+
+		if ((ev < SAMPLE_EV_BRANCH && !s->sim) ||
+		    (ev >= SAMPLE_EV_BRANCH && !s->bp) ||
+		    (ev <= SAMPLE_EV_L2_MISS && ev >= SAMPLE_EV_L2_ACCESS &&
+		     !s->sim->has_l2))
+			continue;
+		sample_estimate(s, ev, &total, &ci);
+		fprintf(out, "  %-14s %16.0f %12.3f %9.1f%%\n",
+			sample_event_names[ev], total,
+			1000.0 * total / s->total_insns,
+			total > 0 ? 100.0 * ci / total : 0.0);
+	}
+}
@@ -0,0 +1,539 @@
+// clock_gettime() and the socket API
+#define _POSIX_C_SOURCE 200809L
+#include "server.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "trace.h"
+#include "idle.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#define SERVER_POLL_MS 200 // how often server_run() looks at server_stop()
+#define SERVER_SEND_TIMEOUT_MS 1000 // a client not reading its reply is dropped
+
+struct server_instance {
+	struct cpu *cpu;
+	struct trace_cache *traces;
+	struct idle *idle;
+	u8 *image; // what the instance is reset to, NULL while unused
+	u32 image_len;
+	u64 hash;
+	u64 last_used;
+
+	// Console input of the job running
+	const u8 *input;
+	u32 input_len;
+	u32 input_pos;
+};
+
+// A connection and the request arriving on it, read as it comes so that a
+// slow client does not hold up the others
+struct server_client {
+	int fd;
+	struct server_request req;
+	u32 got; // bytes of the request so far, header included
+	u8 *buf; // payload: image, then input
+	u32 buf_cap;
+};
+
+struct server {
+	struct server_config cfg;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	struct server_client clients[SERVER_MAX_CLIENTS];
+	u32 nclients;
+	struct server_instance *pool;
+	u64 jobs;
+	volatile sig_atomic_t stopping;
+};
+
+u64 server_hash(const void *data, u32 len)
+{
+	const u8 *p = data;
+	u64 h = 0xCBF29CE484222325ull;
+
+	for (u32 i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001B3ull;
+	}
+	return h;
+}
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+	u8 *p = buf;
+
+	while (len) {
+		ssize_t n = read(fd, p, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+// MSG_NOSIGNAL: a client that went away must not kill the server
+static bool write_full(int fd, const void *buf, size_t len)
+{
+	const u8 *p = buf;
+
+	while (len) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+// read(fd, buf, count): fd 0 returns the rest of the job's input
+static void server_sys_read(struct cpu *c, void *opaque)
+{
+	struct server_instance *in = opaque;
+	u32 vaddr = c->registers[11];
+	u32 len = c->registers[12];
+	u32 done = 0;
+
+	if (c->registers[10] != 0) {
+		c->registers[10] = -EBADF;
+		return;
+	}
+	if (len > in->input_len - in->input_pos)
+		len = in->input_len - in->input_pos;
+	while (done < len) {
+		u32 n = PAGE_SIZE - (vaddr & PAGE_MASK);
+		u8 *p = mmu_translate(c, vaddr, MMU_STORE);
+
+		if (!p)
+			return; // the trap the guest's own store would raise
+		if (n > len - done)
+			n = len - done;
+		memcpy(p, in->input + in->input_pos + done, n);
+		vaddr += n;
+		done += n;
+	}
+	in->input_pos += done;
+	c->registers[10] = done;
+}
+
+// Put the instance back to its image, ready for the next job
+static void server_prepare(struct server_instance *in)
+{
+	cpu_reset(in->cpu);
+	memcpy(in->cpu->memory, in->image, in->image_len);
+}
+
+static bool server_load(struct server_instance *in, const u8 *image,
+			u32 len, u64 hash)
+{
+	u8 *copy = malloc(len ? len : 1);
+
+	if (!copy)
+		return false;
+	memcpy(copy, image, len);
+	free(in->image);
+	in->image = copy;
+	in->image_len = len;
+	in->hash = hash;
+	server_prepare(in);
+	return true;
+}
+
+// The instance holding @hash, or NULL
+static struct server_instance *server_find(struct server *s, u64 hash)
+{
+	for (u32 i = 0; i < s->cfg.pool_size; i++) {
+		if (s->pool[i].image && s->pool[i].hash == hash)
+			return &s->pool[i];
+	}
+	return NULL;
+}
+
+// An unused instance, otherwise the least recently used
+static struct server_instance *server_victim(struct server *s)
+{
+	struct server_instance *v = &s->pool[0];
+
+	for (u32 i = 0; i < s->cfg.pool_size; i++) {
+		if (!s->pool[i].image)
+			return &s->pool[i];
+		if (s->pool[i].last_used < v->last_used)
+			v = &s->pool[i];
+	}
+	return v;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool server_reply(int fd, struct server_reply *rep, const char *out)
+{
+	return write_full(fd, rep, sizeof(*rep)) &&
+	       write_full(fd, out, rep->output_len);
+}
+
+// Check a request header and make room for its payload; false, after
+// replying, to drop the connection
+static bool server_header(struct server *s, struct server_client *cl)
+{
+	const struct server_request *req = &cl->req;
+	struct server_reply rep;
+	u32 len = req->image_len + req->input_len;
+
+	memset(&rep, 0, sizeof(rep));
+	rep.magic = SERVER_MAGIC;
+	if (req->magic != SERVER_MAGIC || (req->flags & ~SERVER_BY_HASH) ||
+	    req->image_len > s->cfg.mem_size ||
+	    req->input_len > SERVER_INPUT_MAX ||
+	    ((req->flags & SERVER_BY_HASH) && req->image_len)) {
+		// The stream cannot be trusted past a bad header
+		rep.status = SERVER_BAD_REQUEST;
+		server_reply(cl->fd, &rep, "");
+		return false;
+	}
+	if (len > cl->buf_cap) {
+		u8 *buf = realloc(cl->buf, len);
+
+		if (!buf) {
+			rep.status = SERVER_NO_MEMORY;
+			server_reply(cl->fd, &rep, "");
+			return false;
+		}
+		cl->buf = buf;
+		cl->buf_cap = len;
+	}
+	return true;
+}
+
+// Read what has arrived of @cl's request without waiting for the rest:
+// 1 once it is complete, 0 for more to come, -1 to drop the connection
+static int server_receive(struct server *s, struct server_client *cl)
+{
+	const u32 head = sizeof(cl->req);
+
+	for (;;) {
+		u32 total = head + cl->req.image_len + cl->req.input_len;
+		u8 *p;
+		u32 want;
+		ssize_t n;
+
+		if (cl->got < head) {
+			p = (u8 *)&cl->req + cl->got;
+			want = head - cl->got;
+		} else if (cl->got < total) {
+			p = cl->buf + (cl->got - head);
+			want = total - cl->got;
+		} else {
+			return 1;
+		}
+		n = recv(cl->fd, p, want, MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		cl->got += n;
+		if (cl->got == head && !server_header(s, cl))
+			return -1;
+	}
+}
+
+// Serve the job received on @cl; false to drop the connection
+static bool server_job(struct server *s, struct server_client *cl)
+{
+	const struct server_request *req = &cl->req;
+	struct server_reply rep;
+	struct server_instance *in;
+	bool by_hash = req->flags & SERVER_BY_HASH;
+	int fd = cl->fd;
+	u64 hash, start;
+
+	memset(&rep, 0, sizeof(rep));
+	rep.magic = SERVER_MAGIC;
+	cl->got = 0; // the next request starts afresh
+
+	hash = by_hash ? req->image_hash : server_hash(cl->buf, req->image_len);
+	in = server_find(s, hash);
+	if (in && !by_hash &&
+	    (in->image_len != req->image_len ||
+	     memcmp(in->image, cl->buf, req->image_len)))
+		in = NULL; // a hash collision
+	if (in) {
+		rep.pool_hit = 1;
+	} else if (by_hash) {
+		rep.status = SERVER_UNKNOWN_IMAGE;
+		return server_reply(fd, &rep, "");
+	} else {
+		in = server_victim(s);
+		if (!server_load(in, cl->buf, req->image_len, hash)) {
+			rep.status = SERVER_NO_MEMORY;
+			return server_reply(fd, &rep, "");
+		}
+	}
+	in->last_used = ++s->jobs;
+
+	in->input = cl->buf + req->image_len;
+	in->input_len = req->input_len;
+	in->input_pos = 0;
+	start = now_ns();
+	rep.stop = cpu_run_for(in->cpu,
+			       req->budget ? req->budget : s->cfg.budget,
+			       &rep.insns);
+	rep.run_ns = now_ns() - start;
+	rep.exit_code = in->cpu->exit_code;
+	rep.output_len = in->cpu->output_buffer_pos;
+	in->input = NULL;
+
+	if (!server_reply(fd, &rep, in->cpu->output_buffer))
+		return false;
+	// Off the client's clock: the next job finds the instance ready
+	server_prepare(in);
+	return true;
+}
+
+static bool server_pool_init(struct server *s)
+{
+	s->pool = calloc(s->cfg.pool_size, sizeof(*s->pool));
+	if (!s->pool)
+		return false;
+	for (u32 i = 0; i < s->cfg.pool_size; i++) {
+		struct server_instance *in = &s->pool[i];
+
+		in->cpu = cpu_create(s->cfg.mem_size);
+		if (!in->cpu)
+			return false;
+		cpu_register_syscall(in->cpu, 63, server_sys_read, in);
+		if (s->cfg.traces) {
+			in->traces = trace_cache_create();
+			if (!in->traces)
+				return false;
+			in->cpu->traces = in->traces;
+		}
+		if (s->cfg.idle) {
+			in->idle = idle_create();
+			if (!in->idle)
+				return false;
+			in->cpu->idle = in->idle;
+		}
+	}
+	return true;
+}
+
+struct server *server_create(const struct server_config *cfg)
+{
+	struct sockaddr_un addr;
+	struct server *s;
+	int err;
+
+	if (strlen(cfg->path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->cfg = *cfg;
+	if (!s->cfg.pool_size)
+		s->cfg.pool_size = SERVER_POOL_DEFAULT;
+	if (!s->cfg.mem_size)
+		s->cfg.mem_size = MEM_SIZE;
+	if (!s->cfg.budget)
+		s->cfg.budget = SERVER_BUDGET_DEFAULT;
+	strcpy(s->path, cfg->path);
+	s->listen_fd = -1;
+
+	if (!server_pool_init(s)) {
+		errno = ENOMEM;
+		goto fail;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, s->path);
+	s->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s->listen_fd < 0)
+		goto fail;
+	unlink(s->path);
+	if (bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(s->listen_fd, SERVER_MAX_CLIENTS))
+		goto fail;
+	return s;
+
+fail:
+	err = errno;
+	if (s->listen_fd >= 0) {
+		close(s->listen_fd);
+		s->listen_fd = -1;
+	}
+	s->path[0] = '\0'; // not ours to unlink
+	server_destroy(s);
+	errno = err;
+	return NULL;
+}
+
+void server_destroy(struct server *s)
+{
+	if (!s)
+		return;
+	for (u32 i = 0; i < s->nclients; i++) {
+		close(s->clients[i].fd);
+		free(s->clients[i].buf);
+	}
+	if (s->listen_fd >= 0)
+		close(s->listen_fd);
+	if (s->path[0])
+		unlink(s->path);
+	for (u32 i = 0; s->pool && i < s->cfg.pool_size; i++) {
+		cpu_destroy(s->pool[i].cpu);
+		trace_cache_destroy(s->pool[i].traces);
+		idle_destroy(s->pool[i].idle);
+		free(s->pool[i].image);
+	}
+	free(s->pool);
+	free(s);
+}
+
+void server_stop(struct server *s)
+{
+	s->stopping = 1;
+}
+
+static void server_accept(struct server *s)
+{
+	struct timeval tv = {
+		.tv_sec = SERVER_SEND_TIMEOUT_MS / 1000,
+		.tv_usec = SERVER_SEND_TIMEOUT_MS % 1000 * 1000,
+	};
+	int fd = accept(s->listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+	if (s->nclients == SERVER_MAX_CLIENTS ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv))) {
+		close(fd);
+		return;
+	}
+	memset(&s->clients[s->nclients], 0, sizeof(s->clients[0]));
+	s->clients[s->nclients++].fd = fd;
+}
+
+void server_run(struct server *s)
+{
+	struct pollfd fds[1 + SERVER_MAX_CLIENTS];
+
+	while (!s->stopping) {
+		u32 n = s->nclients, kept = 0;
+
+		fds[0].fd = s->listen_fd;
+		fds[0].events = POLLIN;
+		for (u32 i = 0; i < n; i++) {
+			fds[1 + i].fd = s->clients[i].fd;
+			fds[1 + i].events = POLLIN;
+		}
+		if (poll(fds, 1 + n, SERVER_POLL_MS) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		// Requests are read as they arrive; jobs run to completion,
+		// one at a time, once the whole request is in
+		for (u32 i = 0; i < n; i++) {
+			struct server_client *cl = &s->clients[i];
+			int r = fds[1 + i].revents ? server_receive(s, cl) : 0;
+
+			if (r < 0 || (r > 0 && !server_job(s, cl))) {
+				close(cl->fd);
+				free(cl->buf);
+				continue;
+			}
+			s->clients[kept++] = *cl;
+		}
+		s->nclients = kept;
+
+		if (fds[0].revents & POLLIN)
+			server_accept(s);
+	}
+}
+
+int server_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		int err = errno;
+
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	return fd;
+}
+
+bool server_submit(int fd, const struct server_job *job,
+		   struct server_reply *reply, char output[OUTPUT_BUFFER_SIZE])
+{
+	struct server_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.magic = SERVER_MAGIC;
+	req.image_hash = server_hash(job->image, job->image_len);
+	req.image_len = job->image_len;
+	req.input_len = job->input_len;
+	req.budget = job->budget;
+	if (job->by_hash) {
+		req.flags = SERVER_BY_HASH;
+		req.image_len = 0;
+	}
+
+	for (;;) {
+		if (!write_full(fd, &req, sizeof(req)) ||
+		    !write_full(fd, job->image, req.image_len) ||
+		    !write_full(fd, job->input, req.input_len) ||
+		    !read_full(fd, reply, sizeof(*reply)) ||
+		    reply->magic != SERVER_MAGIC ||
+		    reply->output_len >= OUTPUT_BUFFER_SIZE ||
+		    !read_full(fd, output, reply->output_len))
+			return false;
+		output[reply->output_len] = '\0';
+		if (reply->status != SERVER_UNKNOWN_IMAGE || !req.flags)
+			return true;
+		// Not in the pool: send it after all
+		req.flags = 0;
+		req.image_len = job->image_len;
+	}
+}
@@ -0,0 +1,654 @@
+#include "trace.h"
+#include "instr.h"
+#include "insn.h"
+#include "mmu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_VAL 0xFFFF
+#define TRACE_COLD 0xFFFFFFFF // translation failed, stop counting
+#define TRACE_AVAIL 16 // loads remembered for reuse
+
+// The IR op a guest instruction lifts to; 0 (IR_CONST) for none
+static const u8 lift_kind[INSN_COUNT] = {
+	[INSN_ADD] = IR_ADD,	 [INSN_SUB] = IR_SUB,
+	[INSN_SLL] = IR_SLL,	 [INSN_SLT] = IR_SLT,
+	[INSN_SLTU] = IR_SLTU,	 [INSN_XOR] = IR_XOR,
+	[INSN_SRL] = IR_SRL,	 [INSN_SRA] = IR_SRA,
+	[INSN_OR] = IR_OR,	 [INSN_AND] = IR_AND,
+	[INSN_MUL] = IR_MUL,	 [INSN_MULH] = IR_MULH,
+	[INSN_MULHSU] = IR_MULHSU, [INSN_MULHU] = IR_MULHU,
+	[INSN_DIV] = IR_DIV,	 [INSN_DIVU] = IR_DIVU,
+	[INSN_REM] = IR_REM,	 [INSN_REMU] = IR_REMU,
+	[INSN_ADDI] = IR_ADD,	 [INSN_SLTI] = IR_SLT,
+	[INSN_SLTIU] = IR_SLTU,	 [INSN_XORI] = IR_XOR,
+	[INSN_ORI] = IR_OR,	 [INSN_ANDI] = IR_AND,
+	[INSN_SLLI] = IR_SLL,	 [INSN_SRLI] = IR_SRL,
+	[INSN_SRAI] = IR_SRA,	 [INSN_LB] = IR_LB,
+	[INSN_LH] = IR_LH,	 [INSN_LW] = IR_LW,
+	[INSN_LBU] = IR_LBU,	 [INSN_LHU] = IR_LHU,
+	[INSN_SB] = IR_SB,	 [INSN_SH] = IR_SH,
+	[INSN_SW] = IR_SW,	 [INSN_BEQ] = IR_BEQ,
+	[INSN_BNE] = IR_BNE,	 [INSN_BLT] = IR_BLT,
+	[INSN_BGE] = IR_BGE,	 [INSN_BLTU] = IR_BLTU,
+	[INSN_BGEU] = IR_BGEU,	 [INSN_SH1ADD] = IR_SH1ADD,
+	[INSN_SH2ADD] = IR_SH2ADD, [INSN_SH3ADD] = IR_SH3ADD,
+	[INSN_ANDN] = IR_ANDN,	 [INSN_ORN] = IR_ORN,
+	[INSN_XNOR] = IR_XNOR,	 [INSN_MIN] = IR_MIN,
+	[INSN_MINU] = IR_MINU,	 [INSN_MAX] = IR_MAX,
+	[INSN_MAXU] = IR_MAXU,	 [INSN_ROL] = IR_ROL,
+	[INSN_ROR] = IR_ROR,	 [INSN_RORI] = IR_ROR,
+	[INSN_BCLR] = IR_BCLR,	 [INSN_BCLRI] = IR_BCLR,
+	[INSN_BEXT] = IR_BEXT,	 [INSN_BEXTI] = IR_BEXT,
+	[INSN_BINV] = IR_BINV,	 [INSN_BINVI] = IR_BINV,
+	[INSN_BSET] = IR_BSET,	 [INSN_BSETI] = IR_BSET,
+	[INSN_CLZ] = IR_CLZ,	 [INSN_CTZ] = IR_CTZ,
+	[INSN_CPOP] = IR_CPOP,	 [INSN_SEXT_B] = IR_SEXT_B,
+	[INSN_SEXT_H] = IR_SEXT_H, [INSN_ZEXT_H] = IR_ZEXT_H,
+	[INSN_ORC_B] = IR_ORC_B, [INSN_REV8] = IR_REV8,
+};
+
+static bool trace_taken(enum trace_kind kind, u32 a, u32 b)
+{
+	switch (kind) {
+	case IR_BEQ:
+		return a == b;
+	case IR_BNE:
+		return a != b;
+	case IR_BLT:
+		return (s32)a < (s32)b;
+	case IR_BGE:
+		return (s32)a >= (s32)b;
+	case IR_BLTU:
+		return a < b;
+	default:
+		return a >= b;
+	}
+}
+
+// Operands that are values (IR_GET keeps a register number in a)
+static int trace_nargs(enum trace_kind kind)
+{
+	if (kind == IR_CONST || kind == IR_GET || kind == IR_JUMP)
+		return 0;
+	if ((kind >= IR_LB && kind <= IR_LHU) || kind == IR_JALR)
+		return 1;
+	return 2;
+}
+
+struct trace_cache *trace_cache_create(void)
+{
+	return calloc(1, sizeof(struct trace_cache));
+}
+
+void trace_cache_destroy(struct trace_cache *tc)
+{
+	if (!tc)
+		return;
+	for (u32 i = 0; i < TRACE_CACHE_SIZE; i++)
+		trace_free(tc->entries[i].t);
+	free(tc);
+}
+
+void trace_free(struct trace *t)
+{
+	if (!t)
+		return;
+	free(t->ops);
+	free(t->exits);
+	free(t->wb);
+	free(t);
+}
+
+// --- Translation ---
+
+struct builder {
+	struct trace_op ops[TRACE_MAX_OPS];
+	u32 nops;
+	struct trace_exit exits[TRACE_MAX_INSNS + 1];
+	u32 nexits;
+	struct trace_writeback wb[(TRACE_MAX_INSNS + 1) * (NREGS - 1)];
+	u32 nwb;
+	u16 reg[NREGS]; // value of each register, NO_VAL until read
+	bool dirty[NREGS]; // written by the trace
+	struct {
+		u8 kind;
+		u16 a;
+		u32 imm;
+		u16 val;
+	} avail[TRACE_AVAIL];
+	u32 navail;
+	u32 writes;
+	struct trace_stats *stats;
+};
+
+static u16 emit(struct builder *b, enum trace_kind kind, u16 x, u16 y, u32 imm)
+{
+	struct trace_op *op = &b->ops[b->nops];
+
+	op->kind = kind;
+	op->a = x;
+	op->b = y;
+	op->exit = 0;
+	op->imm = imm;
+	return b->nops++;
+}
+
+static bool is_const(const struct builder *b, u16 v)
+{
+	return b->ops[v].kind == IR_CONST;
+}
+
+static u16 konst(struct builder *b, u32 k)
+{
+	return emit(b, IR_CONST, 0, 0, k);
+}
+
+static u16 get(struct builder *b, u32 r)
+{
+	if (r == 0)
+		return konst(b, 0);
+	if (b->reg[r] == NO_VAL)
+		b->reg[r] = emit(b, IR_GET, r, 0, 0);
+	return b->reg[r];
+}
+
+static void set(struct builder *b, u32 r, u16 v)
+{
+	if (r == 0)
+		return;
+	b->reg[r] = v;
+	b->dirty[r] = true;
+	b->writes++;
+}
+
+// An ALU op, folded away when its operands allow
+static u16 alu(struct builder *b, enum trace_kind kind, u16 x, u16 y)
+{
+	u32 k;
+
+	if (is_const(b, x) && is_const(b, y)) {
+		b->stats->folded++;
+		return konst(b, trace_eval(kind, b->ops[x].imm, b->ops[y].imm));
+	}
+	if (is_const(b, x) && b->ops[x].imm == 0 &&
+	    (kind == IR_ADD || kind == IR_OR || kind == IR_XOR)) {
+		b->stats->folded++;
+		return y;
+	}
+	if (!is_const(b, y))
+		return emit(b, kind, x, y, 0);
+
+	k = b->ops[y].imm;
+	if (k == 0 && (kind == IR_ADD || kind == IR_SUB || kind == IR_OR ||
+		       kind == IR_XOR || kind == IR_SLL || kind == IR_SRL ||
+		       kind == IR_SRA)) {
+		b->stats->folded++;
+		return x;
+	}
+	if ((k == 0 && (kind == IR_AND || kind == IR_MUL))) {
+		b->stats->folded++;
+		return konst(b, 0);
+	}
+	// (z + c1) + c2 is z + (c1 + c2), so addi chains fold up
+	if (kind == IR_ADD && b->ops[x].kind == IR_ADD &&
+	    is_const(b, b->ops[x].b)) {
+		b->stats->folded++;
+		return emit(b, IR_ADD, b->ops[x].a,
+			    konst(b, b->ops[b->ops[x].b].imm + k), 0);
+	}
+	return emit(b, kind, x, y, 0);
+}
+
+// Record the registers to write back when leaving at this point
+static u16 add_exit(struct builder *b, u32 pc, u32 ninsns)
+{
+	struct trace_exit *x = &b->exits[b->nexits];
+
+	x->pc = pc;
+	x->ninsns = ninsns;
+	x->first = b->nwb;
+	for (u32 r = 1; r < NREGS; r++) {
+		if (b->dirty[r]) {
+			b->wb[b->nwb].reg = r;
+			b->wb[b->nwb].val = b->reg[r];
+			b->nwb++;
+		}
+	}
+	x->count = b->nwb - x->first;
+	return b->nexits++;
+}
+
+static u16 emit_exit(struct builder *b, enum trace_kind kind, u16 x, u16 y,
+		     u32 imm, u32 pc, u32 ninsns)
+{
+	u16 v = emit(b, kind, x, y, imm);
+
+	b->ops[v].exit = add_exit(b, pc, ninsns);
+	return v;
+}
+
+// Fold a constant displacement of the base into the access
+static void mem_base(struct builder *b, u16 *base, u32 *imm)
+{
+	const struct trace_op *op = &b->ops[*base];
+
+	if (op->kind == IR_ADD && is_const(b, op->b)) {
+		*imm += b->ops[op->b].imm;
+		*base = op->a;
+	}
+}
+
+static u16 load(struct builder *b, enum trace_kind kind, u16 base, u32 imm,
+		u32 pc, u32 ninsns)
+{
+	u16 v;
+
+	mem_base(b, &base, &imm);
+	for (u32 i = 0; i < b->navail; i++) {
+		if (b->avail[i].kind == kind && b->avail[i].a == base &&
+		    b->avail[i].imm == imm) {
+			b->stats->loads_reused++;
+			return b->avail[i].val;
+		}
+	}
+	v = emit_exit(b, kind, base, 0, imm, pc, ninsns);
+	if (b->navail < TRACE_AVAIL) {
+		b->avail[b->navail].kind = kind;
+		b->avail[b->navail].a = base;
+		b->avail[b->navail].imm = imm;
+		b->avail[b->navail].val = v;
+		b->navail++;
+	}
+	return v;
+}
+
+static void store(struct builder *b, enum trace_kind kind, u16 base, u32 imm,
+		  u16 val, u32 pc, u32 ninsns)
+{
+	mem_base(b, &base, &imm);
+	emit_exit(b, kind, base, val, imm, pc, ninsns);
+
+	// Any other address may alias, but a word just stored reads back
+	b->navail = 0;
+	if (kind == IR_SW) {
+		b->avail[0].kind = IR_LW;
+		b->avail[0].a = base;
+		b->avail[0].imm = imm;
+		b->avail[0].val = val;
+		b->navail = 1;
+	}
+}
+
+// Drop ops whose values nothing uses, then renumber the rest
+static void eliminate_dead(struct builder *b)
+{
+	bool live[TRACE_MAX_OPS] = { false };
+	u16 map[TRACE_MAX_OPS];
+	u32 n = 0;
+
+	for (u32 i = 0; i < b->nwb; i++)
+		live[b->wb[i].val] = true;
+	for (u32 i = b->nops; i-- > 0;) {
+		const struct trace_op *op = &b->ops[i];
+		int nargs = trace_nargs(op->kind);
+
+		if (op->kind >= IR_LB)
+			live[i] = true; // may fault or leave
+		if (!live[i])
+			continue;
+		if (nargs > 0)
+			live[op->a] = true;
+		if (nargs > 1)
+			live[op->b] = true;
+	}
+
+	for (u32 i = 0; i < b->nops; i++) {
+		struct trace_op op = b->ops[i];
+		int nargs = trace_nargs(op.kind);
+
+		if (!live[i])
+			continue;
+		if (nargs > 0)
+			op.a = map[op.a];
+		if (nargs > 1)
+			op.b = map[op.b];
+		map[i] = n;
+		b->ops[n++] = op;
+	}
+	for (u32 i = 0; i < b->nwb; i++)
+		b->wb[i].val = map[b->wb[i].val];
+	b->stats->dead += b->nops - n;
+	b->nops = n;
+}
+
+// Copy the builder into a trace of its own
+static struct trace *finish(struct builder *b, u32 pc, const u8 *code,
+			    u32 bytes, u32 ninsns)
+{
+	struct trace *t = malloc(sizeof(*t) + bytes);
+
+	if (!t)
+		return NULL;
+	t->pc = pc;
+	t->ninsns = ninsns;
+	t->nops = b->nops;
+	t->nexits = b->nexits;
+	t->nwb = b->nwb;
+	t->bytes = bytes;
+	memcpy(t->code, code, bytes);
+	t->ops = malloc(b->nops * sizeof(*t->ops));
+	t->exits = malloc(b->nexits * sizeof(*t->exits));
+	t->wb = malloc((b->nwb ? b->nwb : 1) * sizeof(*t->wb));
+	if (!t->ops || !t->exits || !t->wb) {
+		trace_free(t);
+		return NULL;
+	}
+	memcpy(t->ops, b->ops, b->nops * sizeof(*t->ops));
+	memcpy(t->exits, b->exits, b->nexits * sizeof(*t->exits));
+	memcpy(t->wb, b->wb, b->nwb * sizeof(*t->wb));
+	return t;
+}
+
+struct trace *trace_translate(struct trace_cache *tc, u32 pc, const u8 *code,
+			      u32 len)
+{
+	static struct builder scratch; // only the emulator thread translates
+	struct builder *b = &scratch;
+	u32 off = 0, n = 0;
+	bool ended = false, lifted = true;
+	struct trace *t;
+
+	b->nops = b->nexits = b->nwb = b->navail = b->writes = 0;
+	b->stats = &tc->stats;
+	for (u32 r = 0; r < NREGS; r++) {
+		b->reg[r] = NO_VAL;
+		b->dirty[r] = false;
+	}
+
+	while (lifted && !ended && n < TRACE_MAX_INSNS &&
+	       b->nops + 6 <= TRACE_MAX_OPS && off + 2 <= len) {
+		u32 ipc = pc + off;
+		u32 raw = mem_load16((u8 *)code, off);
+		enum trace_kind kind;
+		Instruction in;
+
+		if ((raw & 0x3) == 0x3) {
+			if (off + 4 > len)
+				break;
+			raw = mem_load32((u8 *)code, off);
+		}
+		instr_decode(&in, raw);
+		kind = lift_kind[in.id];
+
+		switch (in.id) {
+		case INSN_LUI:
+			set(b, in.rd, konst(b, in.imm));
+			break;
+		case INSN_AUIPC:
+			set(b, in.rd, konst(b, ipc + in.imm));
+			break;
+		case INSN_JAL:
+			set(b, in.rd, konst(b, ipc + in.size));
+			emit_exit(b, IR_JUMP, 0, 0, 0, ipc + in.imm, n + 1);
+			ended = true;
+			break;
+		case INSN_JALR: {
+			u16 target = alu(b, IR_ADD, get(b, in.rs1),
+					 konst(b, in.imm));
+
+			set(b, in.rd, konst(b, ipc + in.size));
+			if (is_const(b, target))
+				emit_exit(b, IR_JUMP, 0, 0, 0,
+					  b->ops[target].imm & ~1u, n + 1);
+			else
+				emit_exit(b, IR_JALR, target, 0, 0, 0, n + 1);
+			ended = true;
+			break;
+		}
+		default:
+			if (!kind) {
+				lifted = false;
+				break;
+			}
+			switch (insn_info[in.id].format) {
+			case FMT_R:
+				set(b, in.rd,
+				    alu(b, kind, get(b, in.rs1), get(b, in.rs2)));
+				break;
+			case FMT_I:
+			case FMT_SHIFT:
+				set(b, in.rd,
+				    alu(b, kind, get(b, in.rs1), konst(b, in.imm)));
+				break;
+			case FMT_UNARY:
+				set(b, in.rd,
+				    alu(b, kind, get(b, in.rs1), konst(b, 0)));
+				break;
+			case FMT_LOAD: {
+				u16 v = load(b, kind, get(b, in.rs1), in.imm,
+					     ipc, n + 1);
+
+				set(b, in.rd, v);
+				break;
+			}
+			case FMT_S:
+				store(b, kind, get(b, in.rs1), in.imm,
+				      get(b, in.rs2), ipc, n + 1);
+				break;
+			case FMT_B: {
+				u16 x = get(b, in.rs1), y = get(b, in.rs2);
+
+				if (!is_const(b, x) || !is_const(b, y)) {
+					emit_exit(b, kind, x, y, 0,
+						  ipc + in.imm, n + 1);
+					break;
+				}
+				b->stats->folded++;
+				if (trace_taken(kind, b->ops[x].imm,
+						b->ops[y].imm)) {
+					emit_exit(b, IR_JUMP, 0, 0, 0,
+						  ipc + in.imm, n + 1);
+					ended = true;
+				}
+				break;
+			}
+			default:
+				lifted = false;
+				break;
+			}
+			break;
+		}
+		if (lifted) {
+			off += in.size;
+			n++;
+		}
+	}
+	if (n == 0)
+		return NULL;
+	// Otherwise fall through to the next instruction, which may be one
+	// the IR cannot express
+	if (!ended)
+		emit_exit(b, IR_JUMP, 0, 0, 0, pc + off, n);
+
+	tc->stats.writes_elided += b->writes - b->exits[b->nexits - 1].count;
+	eliminate_dead(b);
+	t = finish(b, pc, code, off, n);
+	if (t) {
+		tc->stats.translated++;
+		tc->stats.insns += n;
+		tc->stats.ops += t->nops;
+	}
+	return t;
+}
+
+// --- Execution ---
+
+#define TRACE_LOAD(kind, fn, ext)                                       \
+	case kind:                                                      \
+		c->pc = t->exits[op->exit].pc;                          \
+		if (!fn(c, v[op->a] + op->imm, &val))                   \
+			goto fault;                                     \
+		v[i] = ext;                                             \
+		break;
+
+#define TRACE_STORE(kind, fn)                                           \
+	case kind:                                                      \
+		c->pc = t->exits[op->exit].pc;                          \
+		if (!fn(c, v[op->a] + op->imm, v[op->b]))               \
+			goto fault;                                     \
+		break;
+
+#define TRACE_BRANCH(kind, cond)                                        \
+	case kind:                                                      \
+		if (cond)                                               \
+			goto branch;                                    \
+		break;
+
+static void trace_run(const struct trace *t, struct cpu *c)
+{
+	u32 v[TRACE_MAX_OPS];
+	const struct trace_op *op = t->ops;
+	const struct trace_exit *x;
+	u32 i, val, pc, undone = 0;
+
+	for (i = 0;; i++, op++) {
+		switch (op->kind) {
+		case IR_CONST:
+			v[i] = op->imm;
+			break;
+		case IR_GET:
+			v[i] = c->registers[op->a];
+			break;
+		TRACE_LOAD(IR_LB, mmu_load8, (s32)(s8)val)
+		TRACE_LOAD(IR_LH, mmu_load16, (s32)(s16)val)
+		TRACE_LOAD(IR_LW, mmu_load32, val)
+		TRACE_LOAD(IR_LBU, mmu_load8, val)
+		TRACE_LOAD(IR_LHU, mmu_load16, val)
+		TRACE_STORE(IR_SB, mmu_store8)
+		TRACE_STORE(IR_SH, mmu_store16)
+		TRACE_STORE(IR_SW, mmu_store32)
+		TRACE_BRANCH(IR_BEQ, v[op->a] == v[op->b])
+		TRACE_BRANCH(IR_BNE, v[op->a] != v[op->b])
+		TRACE_BRANCH(IR_BLT, (s32)v[op->a] < (s32)v[op->b])
+		TRACE_BRANCH(IR_BGE, (s32)v[op->a] >= (s32)v[op->b])
+		TRACE_BRANCH(IR_BLTU, v[op->a] < v[op->b])
+		TRACE_BRANCH(IR_BGEU, v[op->a] >= v[op->b])
+		case IR_JUMP:
+			goto branch;
+		case IR_JALR:
+			x = &t->exits[op->exit];
+			pc = v[op->a] & ~1u;
+			goto leave;
+		default:
+			v[i] = trace_eval(op->kind, v[op->a], v[op->b]);
+			break;
+		}
+	}
+
+branch:
+	x = &t->exits[op->exit];
+	pc = x->pc;
+	goto leave;
+fault:
+	x = &t->exits[op->exit];
+	if (c->trace_device_exit) {
+		// Stop in front of the device access for the interpreter
+		pc = c->pc;
+		undone = 1;
+	} else {
+		// The trap has set next_pc; the faulting instruction counts
+		pc = c->next_pc;
+	}
+leave:
+	for (u32 k = x->first; k < x->first + x->count; k++)
+		c->registers[t->wb[k].reg] = v[t->wb[k].val];
+	c->pc = pc;
+	c->insn_count += x->ninsns - undone;
+}
+
+void trace_exec_block(struct trace_cache *tc, struct cpu *c, u32 max)
+{
+	struct trace_entry *e;
+	u8 *host;
+
+#ifdef CONFIG_INSN_MIX
+	cpu_exec_block(c, max);
+	return;
+#endif
+	if (c->bpred || c->callgraph || c->fuzz) {
+		cpu_exec_block(c, max);
+		return;
+	}
+
+	e = &tc->entries[(c->pc >> 1) & (TRACE_CACHE_SIZE - 1)];
+	if (e->pc != c->pc) {
+		trace_free(e->t);
+		e->t = NULL;
+		e->pc = c->pc;
+		e->hits = 0;
+	}
+	if (!e->t && (e->hits == TRACE_COLD || ++e->hits < TRACE_HOT)) {
+		cpu_exec_block(c, max);
+		return;
+	}
+
+	host = mmu_translate(c, c->pc, MMU_FETCH);
+	if (!host) {
+		// The fetch fault has been raised, as cpu_exec_block() would
+		c->pc = c->next_pc;
+		c->insn_count++;
+		return;
+	}
+	if (!e->t) {
+		e->t = trace_translate(tc, c->pc, host,
+				       PAGE_SIZE - (c->pc & PAGE_MASK));
+		if (!e->t)
+			e->hits = TRACE_COLD;
+	} else if (memcmp(e->t->code, host, e->t->bytes)) {
+		// The code changed underneath: start counting again
+		trace_free(e->t);
+		e->t = NULL;
+		e->hits = 0;
+	}
+	// The interpreter stops in front of a breakpoint inside the trace
+	if (!e->t || e->t->ninsns > max || c->break_pc - c->pc < e->t->bytes) {
+		cpu_exec_block(c, max);
+		return;
+	}
+	tc->stats.runs++;
+	c->in_trace = true;
+	trace_run(e->t, c);
+	c->in_trace = false;
+	if (c->trace_device_exit) {
+		c->trace_device_exit = false;
+		tc->stats.device_exits++;
+		trace_free(e->t);
+		e->t = NULL;
+		e->hits = TRACE_COLD;
+	}
+}
+
+void trace_print_stats(const struct trace_cache *tc, FILE *out)
+{
+	const struct trace_stats *s = &tc->stats;
+
+	fprintf(out, "Traces: %llu translated, %llu runs\n",
+		(unsigned long long)s->translated,
+		(unsigned long long)s->runs);
+	if (!s->translated)
+		return;
+	fprintf(out,
+		"  %llu instructions lifted to %llu IR ops (%.2f per instruction)\n",
+		(unsigned long long)s->insns, (unsigned long long)s->ops,
+		(double)s->ops / s->insns);
+	fprintf(out,
+		"  %llu ops folded, %llu dead, %llu loads reused, %llu register writes elided\n",
+		(unsigned long long)s->folded, (unsigned long long)s->dead,
+		(unsigned long long)s->loads_reused,
+		(unsigned long long)s->writes_elided);
+	if (s->device_exits)
+		fprintf(out, "  %llu traces dropped for device accesses\n",
+			(unsigned long long)s->device_exits);
+}
@@ -108,8 +108,14 @@ void tui_update(struct cpu *cpu)
 	disassemble(instruction, disassembled,
 		    sizeof(disassembled)); // Disassemble the instruction
 	mvwprintw(cpu_win, 1, 2, "PC          : 0x%08x", cpu->pc);
-	mvwprintw(cpu_win, 2, 2, "Instruction : 0x%08x (%s)", instruction,
-		  disassembled);
+	if ((instruction & 0x3) != 0x3) {
+		// Compressed: only the low half belongs to this instruction
+		mvwprintw(cpu_win, 2, 2, "Instruction : 0x%04x     (%s)",
+			  instruction & 0xFFFF, disassembled);
+	} else {
+		mvwprintw(cpu_win, 2, 2, "Instruction : 0x%08x (%s)",
+			  instruction, disassembled);
+	}
 	mvwprintw(cpu_win, 3, 2, "State       : %s",
 		  (cpu->state == CPU_STATE_RUNNING) ? "Running" : "Halted");
 
@@ -0,0 +1,790 @@
+#include "vector.h"
+#include "cpu.h"
+#include "csr.h"
+#include "insn.h"
+#include "memory.h"
+#include "mmu.h"
+
+#include <string.h>
+
+_Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+	       "vector registers hold guest elements in host order");
+
+/* What an arithmetic entry does to one element */
+enum vop {
+	VO_ADD,
+	VO_SUB,
+	VO_RSUB,
+	VO_MINU,
+	VO_MIN,
+	VO_MAXU,
+	VO_MAX,
+	VO_AND,
+	VO_OR,
+	VO_XOR,
+	VO_SLL,
+	VO_SRL,
+	VO_SRA,
+	VO_SADDU,
+	VO_SADD,
+	VO_SSUBU,
+	VO_SSUB,
+	VO_MUL,
+	VO_MULH,
+	VO_MULHU,
+	VO_MULHSU,
+	VO_DIVU,
+	VO_DIV,
+	VO_REMU,
+	VO_REM,
+	VO_MACC,
+	VO_NMSAC,
+	VO_MADD,
+	VO_NMSUB,
+	VO_SEQ,
+	VO_SNE,
+	VO_SLTU,
+	VO_SLT,
+	VO_SLEU,
+	VO_SLE,
+	VO_SGTU,
+	VO_SGT,
+};
+
+// Entries not listed are not handled by exec_velem, exec_vcmp or exec_vred
+static const u8 vop_of[INSN_COUNT] = {
+	[INSN_VADD_VV] = VO_ADD,	[INSN_VADD_VX] = VO_ADD,
+	[INSN_VADD_VI] = VO_ADD,	[INSN_VSUB_VV] = VO_SUB,
+	[INSN_VSUB_VX] = VO_SUB,	[INSN_VRSUB_VX] = VO_RSUB,
+	[INSN_VRSUB_VI] = VO_RSUB,	[INSN_VMINU_VV] = VO_MINU,
+	[INSN_VMINU_VX] = VO_MINU,	[INSN_VMIN_VV] = VO_MIN,
+	[INSN_VMIN_VX] = VO_MIN,	[INSN_VMAXU_VV] = VO_MAXU,
+	[INSN_VMAXU_VX] = VO_MAXU,	[INSN_VMAX_VV] = VO_MAX,
+	[INSN_VMAX_VX] = VO_MAX,	[INSN_VAND_VV] = VO_AND,
+	[INSN_VAND_VX] = VO_AND,	[INSN_VAND_VI] = VO_AND,
+	[INSN_VOR_VV] = VO_OR,		[INSN_VOR_VX] = VO_OR,
+	[INSN_VOR_VI] = VO_OR,		[INSN_VXOR_VV] = VO_XOR,
+	[INSN_VXOR_VX] = VO_XOR,	[INSN_VXOR_VI] = VO_XOR,
+	[INSN_VSLL_VV] = VO_SLL,	[INSN_VSLL_VX] = VO_SLL,
+	[INSN_VSLL_VI] = VO_SLL,	[INSN_VSRL_VV] = VO_SRL,
+	[INSN_VSRL_VX] = VO_SRL,	[INSN_VSRL_VI] = VO_SRL,
+	[INSN_VSRA_VV] = VO_SRA,	[INSN_VSRA_VX] = VO_SRA,
+	[INSN_VSRA_VI] = VO_SRA,	[INSN_VSADDU_VV] = VO_SADDU,
+	[INSN_VSADDU_VX] = VO_SADDU,	[INSN_VSADDU_VI] = VO_SADDU,
+	[INSN_VSADD_VV] = VO_SADD,	[INSN_VSADD_VX] = VO_SADD,
+	[INSN_VSADD_VI] = VO_SADD,	[INSN_VSSUBU_VV] = VO_SSUBU,
+	[INSN_VSSUBU_VX] = VO_SSUBU,	[INSN_VSSUB_VV] = VO_SSUB,
+	[INSN_VSSUB_VX] = VO_SSUB,	[INSN_VMUL_VV] = VO_MUL,
+	[INSN_VMUL_VX] = VO_MUL,	[INSN_VMULH_VV] = VO_MULH,
+	[INSN_VMULH_VX] = VO_MULH,	[INSN_VMULHU_VV] = VO_MULHU,
+	[INSN_VMULHU_VX] = VO_MULHU,	[INSN_VMULHSU_VV] = VO_MULHSU,
+	[INSN_VMULHSU_VX] = VO_MULHSU,	[INSN_VDIVU_VV] = VO_DIVU,
+	[INSN_VDIVU_VX] = VO_DIVU,	[INSN_VDIV_VV] = VO_DIV,
+	[INSN_VDIV_VX] = VO_DIV,	[INSN_VREMU_VV] = VO_REMU,
+	[INSN_VREMU_VX] = VO_REMU,	[INSN_VREM_VV] = VO_REM,
+	[INSN_VREM_VX] = VO_REM,	[INSN_VMACC_VV] = VO_MACC,
+	[INSN_VMACC_VX] = VO_MACC,	[INSN_VNMSAC_VV] = VO_NMSAC,
+	[INSN_VNMSAC_VX] = VO_NMSAC,	[INSN_VMADD_VV] = VO_MADD,
+	[INSN_VMADD_VX] = VO_MADD,	[INSN_VNMSUB_VV] = VO_NMSUB,
+	[INSN_VNMSUB_VX] = VO_NMSUB,	[INSN_VMSEQ_VV] = VO_SEQ,
+	[INSN_VMSEQ_VX] = VO_SEQ,	[INSN_VMSEQ_VI] = VO_SEQ,
+	[INSN_VMSNE_VV] = VO_SNE,	[INSN_VMSNE_VX] = VO_SNE,
+	[INSN_VMSNE_VI] = VO_SNE,	[INSN_VMSLTU_VV] = VO_SLTU,
+	[INSN_VMSLTU_VX] = VO_SLTU,	[INSN_VMSLT_VV] = VO_SLT,
+	[INSN_VMSLT_VX] = VO_SLT,	[INSN_VMSLEU_VV] = VO_SLEU,
+	[INSN_VMSLEU_VX] = VO_SLEU,	[INSN_VMSLEU_VI] = VO_SLEU,
+	[INSN_VMSLE_VV] = VO_SLE,	[INSN_VMSLE_VX] = VO_SLE,
+	[INSN_VMSLE_VI] = VO_SLE,	[INSN_VMSGTU_VX] = VO_SGTU,
+	[INSN_VMSGTU_VI] = VO_SGTU,	[INSN_VMSGT_VX] = VO_SGT,
+	[INSN_VMSGT_VI] = VO_SGT,	[INSN_VREDSUM_VS] = VO_ADD,
+	[INSN_VREDAND_VS] = VO_AND,	[INSN_VREDOR_VS] = VO_OR,
+	[INSN_VREDXOR_VS] = VO_XOR,	[INSN_VREDMINU_VS] = VO_MINU,
+	[INSN_VREDMIN_VS] = VO_MIN,	[INSN_VREDMAXU_VS] = VO_MAXU,
+	[INSN_VREDMAX_VS] = VO_MAX,
+};
+
+void vector_reset(struct cpu *c)
+{
+	bool reference = c->vec.reference;
+
+	memset(&c->vec, 0, sizeof(c->vec));
+	c->vec.vtype = VTYPE_VILL;
+	c->vec.reference = reference;
+}
+
+// Vector instructions and CSRs trap while mstatus.VS is off
+static bool vector_enabled(struct cpu *c)
+{
+	return (c->csr.mstatus & MSTATUS_VS) != MSTATUS_VS_OFF;
+}
+
+bool vector_csr_read(struct cpu *c, u32 addr, u32 *val)
+{
+	struct vector_state *v = &c->vec;
+
+	if (!vector_enabled(c))
+		return false;
+	switch (addr) {
+	case CSR_VSTART:
+		*val = v->vstart;
+		break;
+	case CSR_VXSAT:
+		*val = v->vxsat;
+		break;
+	case CSR_VXRM:
+		*val = v->vxrm;
+		break;
+	case CSR_VCSR:
+		*val = (v->vxrm << 1) | v->vxsat;
+		break;
+	case CSR_VL:
+		*val = v->vl;
+		break;
+	case CSR_VTYPE:
+		*val = v->vtype;
+		break;
+	case CSR_VLENB:
+		*val = VLENB;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+bool vector_csr_write(struct cpu *c, u32 addr, u32 val)
+{
+	struct vector_state *v = &c->vec;
+
+	if (!vector_enabled(c))
+		return false;
+	switch (addr) {
+	case CSR_VSTART:
+		// WARL: just enough bits for any element index
+		v->vstart = val & (VLEN - 1);
+		break;
+	case CSR_VXSAT:
+		v->vxsat = val & 1;
+		break;
+	case CSR_VXRM:
+		v->vxrm = val & 3;
+		break;
+	case CSR_VCSR:
+		v->vxsat = val & 1;
+		v->vxrm = (val >> 1) & 3;
+		break;
+	default:
+		return false;
+	}
+	c->csr.mstatus |= MSTATUS_VS_DIRTY;
+	return true;
+}
+
+/* vtype fields */
+
+static u32 vsew(u32 vtype)
+{
+	return 8u << ((vtype & VTYPE_VSEW) >> 3);
+}
+
+// log2 of LMUL, -3 to 3
+static int vlmul(u32 vtype)
+{
+	int l = vtype & VTYPE_VLMUL;
+
+	return l >= 4 ? l - 8 : l;
+}
+
+// Registers in a group for a multiplier of 2^@l: fractions take one
+static u32 vgroup(int l)
+{
+	return l > 0 ? 1u << l : 1;
+}
+
+static u32 vlmax(u32 sew, int l)
+{
+	return l >= 0 ? (VLEN / sew) << l : (VLEN / sew) >> -l;
+}
+
+static bool vtype_valid(u32 vtype)
+{
+	u32 sew = vsew(vtype);
+	int l = vlmul(vtype);
+
+	if (vtype & ~(VTYPE_VLMUL | VTYPE_VSEW | VTYPE_VTA | VTYPE_VMA))
+		return false;
+	if (sew > ELEN || (vtype & VTYPE_VLMUL) == 4)
+		return false;
+	// A fractional group must still hold one element of the widest type
+	return l >= 0 || (sew << -l) <= ELEN;
+}
+
+/* Elements: a group is consecutive registers, so element i of the group at
+ * @reg may lie in a later register */
+
+static u8 *velt(struct vector_state *v, u32 reg, u32 i, u32 esz)
+{
+	return &v->v[0][0] + reg * VLENB + i * esz;
+}
+
+static u32 vread(struct vector_state *v, u32 reg, u32 i, u32 esz)
+{
+	u8 *p = velt(v, reg, i, esz);
+
+	if (esz == 1)
+		return *p;
+	return esz == 2 ? mem_load16(p, 0) : mem_load32(p, 0);
+}
+
+static void vwrite(struct vector_state *v, u32 reg, u32 i, u32 esz, u32 val)
+{
+	u8 *p = velt(v, reg, i, esz);
+
+	if (esz == 1)
+		*p = val;
+	else if (esz == 2)
+		mem_store16(p, 0, val);
+	else
+		mem_store32(p, 0, val);
+}
+
+// Mask bit @i, in v0
+static bool vmask(struct vector_state *v, u32 i)
+{
+	return (v->v[0][i / 8] >> (i % 8)) & 1;
+}
+
+static u32 vtrunc(u32 x, u32 sew)
+{
+	return sew == 32 ? x : x & ((1u << sew) - 1);
+}
+
+static s32 vsext(u32 x, u32 sew)
+{
+	return (s32)(x << (32 - sew)) >> (32 - sew);
+}
+
+/*
+ * One element of an element-wise op: @a from vs2, @b from vs1, rs1 or the
+ * immediate, @d the old vd, all truncated to @sew. The caller truncates
+ * the result.
+ */
+static u32 velem(struct vector_state *v, u32 op, u32 a, u32 b, u32 d, u32 sew)
+{
+	u32 mask = vtrunc(~0u, sew);
+	s32 sa = vsext(a, sew), sb = vsext(b, sew);
+	s64 max = mask >> 1, r;
+
+	switch (op) {
+	case VO_ADD:
+		return a + b;
+	case VO_SUB:
+		return a - b;
+	case VO_RSUB:
+		return b - a;
+	case VO_MINU:
+		return a < b ? a : b;
+	case VO_MIN:
+		return sa < sb ? a : b;
+	case VO_MAXU:
+		return a > b ? a : b;
+	case VO_MAX:
+		return sa > sb ? a : b;
+	case VO_AND:
+		return a & b;
+	case VO_OR:
+		return a | b;
+	case VO_XOR:
+		return a ^ b;
+	case VO_SLL:
+		return a << (b & (sew - 1));
+	case VO_SRL:
+		return a >> (b & (sew - 1));
+	case VO_SRA:
+		return (u32)(sa >> (b & (sew - 1)));
+	case VO_SADDU:
+		if ((u64)a + b > mask) {
+			v->vxsat = 1;
+			return mask;
+		}
+		return a + b;
+	case VO_SSUBU:
+		if (a < b) {
+			v->vxsat = 1;
+			return 0;
+		}
+		return a - b;
+	case VO_SADD:
+	case VO_SSUB:
+		r = op == VO_SADD ? (s64)sa + sb : (s64)sa - sb;
+		if (r > max || r < -max - 1) {
+			v->vxsat = 1;
+			return (u32)(r > max ? max : -max - 1);
+		}
+		return (u32)r;
+	case VO_MUL:
+		return a * b;
+	case VO_MULH:
+		return (u32)(((s64)sa * sb) >> sew);
+	case VO_MULHU:
+		return (u32)(((u64)a * b) >> sew);
+	case VO_MULHSU:
+		return (u32)(((s64)sa * (s64)b) >> sew);
+	case VO_DIVU:
+		return b ? a / b : mask;
+	case VO_REMU:
+		return b ? a % b : a;
+	case VO_DIV:
+		if (!b)
+			return mask;
+		// The most negative value over -1 overflows to itself
+		if (sa == -max - 1 && sb == -1)
+			return a;
+		return (u32)(sa / sb);
+	case VO_REM:
+		if (!b)
+			return a;
+		if (sa == -max - 1 && sb == -1)
+			return 0;
+		return (u32)(sa % sb);
+	case VO_MACC:
+		return d + a * b;
+	case VO_NMSAC:
+		return d - a * b;
+	case VO_MADD:
+		return b * d + a;
+	case VO_NMSUB:
+		return a - b * d;
+	}
+	return 0;
+}
+
+static bool vcompare(u32 op, u32 a, u32 b, u32 sew)
+{
+	s32 sa = vsext(a, sew), sb = vsext(b, sew);
+
+	switch (op) {
+	case VO_SEQ:
+		return a == b;
+	case VO_SNE:
+		return a != b;
+	case VO_SLTU:
+		return a < b;
+	case VO_SLT:
+		return sa < sb;
+	case VO_SLEU:
+		return a <= b;
+	case VO_SLE:
+		return sa <= sb;
+	case VO_SGTU:
+		return a > b;
+	case VO_SGT:
+		return sa > sb;
+	}
+	return false;
+}
+
+/*
+ * Host kernels for unmasked element-wise ops, 16 bytes at a time with GCC
+ * vector types (SSE2 or better on x86-64). @b is NULL for a scalar operand
+ * @k. They do the whole 16-byte chunks of @vl elements and return how many
+ * elements that was; the caller finishes the rest, and the ops without a
+ * kernel, one element at a time.
+ */
+#define VSEL(m, x, y) (((m) & (x)) | (~(m) & (y)))
+
+#define VLOOP(expr)                                            \
+	for (i = 0; i < n; i += 16) {                          \
+		vu x, y = ks, z, r;                            \
+		memcpy(&x, a + i, 16);                         \
+		if (b)                                         \
+			memcpy(&y, b + i, 16);                 \
+		memcpy(&z, d + i, 16);                         \
+		r = (expr);                                    \
+		memcpy(d + i, &r, 16);                         \
+	}                                                      \
+	break
+
+#define VKERNEL(bits)                                                         \
+	static u32 vkernel##bits(u32 op, u8 *d, const u8 *a, const u8 *b,    \
+				 u32 k, u32 vl)                               \
+	{                                                                     \
+		typedef u##bits vu __attribute__((vector_size(16)));          \
+		typedef s##bits vs __attribute__((vector_size(16)));          \
+		const u32 n = vl * (bits / 8) & ~15u;                         \
+		const vu ks = (vu){ 0 } + (u##bits)k;                         \
+		const vu sh = (vu){ 0 } + (bits - 1);                         \
+		u32 i;                                                        \
+                                                                              \
+		switch (op) {                                                 \
+		case VO_ADD:                                                  \
+			VLOOP(x + y);                                         \
+		case VO_SUB:                                                  \
+			VLOOP(x - y);                                         \
+		case VO_RSUB:                                                 \
+			VLOOP(y - x);                                         \
+		case VO_MINU:                                                 \
+			VLOOP(VSEL((vu)(x < y), x, y));                       \
+		case VO_MIN:                                                  \
+			VLOOP(VSEL((vu)((vs)x < (vs)y), x, y));               \
+		case VO_MAXU:                                                 \
+			VLOOP(VSEL((vu)(x > y), x, y));                       \
+		case VO_MAX:                                                  \
+			VLOOP(VSEL((vu)((vs)x > (vs)y), x, y));               \
+		case VO_AND:                                                  \
+			VLOOP(x & y);                                         \
+		case VO_OR:                                                   \
+			VLOOP(x | y);                                         \
+		case VO_XOR:                                                  \
+			VLOOP(x ^ y);                                         \
+		case VO_SLL:                                                  \
+			VLOOP(x << (y & sh));                                 \
+		case VO_SRL:                                                  \
+			VLOOP(x >> (y & sh));                                 \
+		case VO_SRA:                                                  \
+			VLOOP((vu)((vs)x >> (vs)(y & sh)));                   \
+		case VO_MUL:                                                  \
+			VLOOP(x * y);                                         \
+		case VO_MACC:                                                 \
+			VLOOP(z + x * y);                                     \
+		case VO_NMSAC:                                                \
+			VLOOP(z - x * y);                                     \
+		case VO_MADD:                                                 \
+			VLOOP(y * z + x);                                     \
+		case VO_NMSUB:                                                \
+			VLOOP(x - y * z);                                     \
+		default:                                                      \
+			return 0;                                             \
+		}                                                             \
+		return n / (bits / 8);                                        \
+	}
+
+VKERNEL(8)
+VKERNEL(16)
+VKERNEL(32)
+
+static u32 vkernel(u32 op, u32 esz, u8 *d, const u8 *a, const u8 *b, u32 k,
+		   u32 vl)
+{
+	if (esz == 1)
+		return vkernel8(op, d, a, b, k, vl);
+	if (esz == 2)
+		return vkernel16(op, d, a, b, k, vl);
+	return vkernel32(op, d, a, b, k, vl);
+}
+
+static void vector_illegal(struct cpu *c, const Instruction *instr)
+{
+	cpu_trap(c, CAUSE_ILLEGAL_INSN, instr->raw);
+}
+
+// Every instruction that completes leaves vstart at 0
+static void vector_done(struct cpu *c)
+{
+	c->vec.vstart = 0;
+	c->csr.mstatus |= MSTATUS_VS_DIRTY;
+}
+
+// OPIVV and OPMVV take vs1; the other arithmetic forms a scalar
+static bool vform_vv(const Instruction *instr)
+{
+	return instr->funct3 == 0 || instr->funct3 == 2;
+}
+
+static bool vmasked(const Instruction *instr)
+{
+	return !(instr->funct7 & 1);
+}
+
+// The rs1 value or immediate of a .vx or .vi form, truncated to @sew
+static u32 vscalar(struct cpu *c, const Instruction *instr, u32 sew)
+{
+	u32 k = instr->funct3 == 3 ? (u32)instr->imm :
+				     c->registers[instr->rs1];
+
+	return vtrunc(k, sew);
+}
+
+/*
+ * Checks shared by the arithmetic ops: the unit is on, vtype is legal and
+ * vd, vs2 and (for .vv) vs1 start at a multiple of their group size. A
+ * masked op may only write v0 when the result is a mask or a scalar.
+ * Traps and returns false otherwise.
+ */
+static bool vcheck(struct cpu *c, const Instruction *instr, u32 nd, u32 ns2,
+		   u32 ns1, bool v0_ok)
+{
+	if (!vector_enabled(c) || (c->vec.vtype & VTYPE_VILL) ||
+	    instr->rd % nd || instr->rs2 % ns2 ||
+	    (vform_vv(instr) && instr->rs1 % ns1) ||
+	    (vmasked(instr) && instr->rd == 0 && !v0_ok)) {
+		vector_illegal(c, instr);
+		return false;
+	}
+	return true;
+}
+
+void exec_vsetvl(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 vtype, avl, max;
+
+	if (!vector_enabled(c)) {
+		vector_illegal(c, instr);
+		return;
+	}
+	vtype = instr->id == INSN_VSETVL ? c->registers[instr->rs2] :
+					   (u32)instr->imm;
+	if (instr->id == INSN_VSETIVLI)
+		avl = instr->rs1;
+	else if (instr->rs1)
+		avl = c->registers[instr->rs1];
+	else if (instr->rd)
+		avl = ~0u; // VLMAX
+	else
+		avl = v->vl; // change vtype, keep vl
+
+	if (vtype_valid(vtype)) {
+		max = vlmax(vsew(vtype), vlmul(vtype));
+		v->vtype = vtype;
+		v->vl = avl < max ? avl : max;
+	} else {
+		v->vtype = VTYPE_VILL;
+		v->vl = 0;
+	}
+	c->registers[instr->rd] = v->vl;
+	vector_done(c);
+}
+
+/*
+ * Unit-stride and strided accesses go one element at a time through the
+ * MMU, so faults, devices and the cache model see what a scalar loop
+ * would. A fault leaves vstart at the element that took it. Unmasked
+ * consecutive elements in a page the TLB already maps are copied at once.
+ */
+static void vmem(struct cpu *c, const Instruction *instr, bool store)
+{
+	static const u8 eew_bytes[8] = { [0] = 1, [5] = 2, [6] = 4 };
+	struct vector_state *v = &c->vec;
+	enum mmu_access acc = store ? MMU_STORE : MMU_LOAD;
+	u32 esz = eew_bytes[instr->funct3];
+	u32 evl = v->vl, base, stride, val;
+	bool masked = vmasked(instr);
+	int emul = 0;
+
+	if (!vector_enabled(c) || (v->vtype & VTYPE_VILL)) {
+		vector_illegal(c, instr);
+		return;
+	}
+	if (instr->id == INSN_VLM_V || instr->id == INSN_VSM_V) {
+		// Mask registers: vl bits, as bytes
+		evl = (v->vl + 7) / 8;
+	} else {
+		// EMUL = EEW / SEW * LMUL, between 1/8 and 8
+		emul = vlmul(v->vtype) + __builtin_ctz(esz * 8) -
+		       __builtin_ctz(vsew(v->vtype));
+	}
+	if (emul < -3 || emul > 3 || instr->rd % vgroup(emul) ||
+	    (!store && masked && instr->rd == 0)) {
+		vector_illegal(c, instr);
+		return;
+	}
+
+	base = c->registers[instr->rs1];
+	stride = ((instr->raw >> 26) & 3) == 2 ? c->registers[instr->rs2] : esz;
+	for (u32 i = v->vstart; i < evl; i++) {
+		u32 addr = base + i * stride;
+		u8 *r = velt(v, instr->rd, i, esz);
+		u8 *p;
+		bool ok;
+
+		if (masked && !vmask(v, i))
+			continue;
+		if (stride == esz && !masked && (p = mmu_tlb_lookup(c, addr, acc))) {
+			u32 run = (PAGE_SIZE - (addr & PAGE_MASK)) / esz;
+
+			if (run > evl - i)
+				run = evl - i;
+			if (run) {
+				memcpy(store ? p : r, store ? r : p, run * esz);
+				i += run - 1;
+				continue;
+			}
+		}
+
+		if (store) {
+			val = vread(v, instr->rd, i, esz);
+			ok = esz == 1 ? mmu_store8(c, addr, val) :
+			     esz == 2 ? mmu_store16(c, addr, val) :
+					mmu_store32(c, addr, val);
+		} else {
+			ok = esz == 1 ? mmu_load8(c, addr, &val) :
+			     esz == 2 ? mmu_load16(c, addr, &val) :
+					mmu_load32(c, addr, &val);
+			if (ok)
+				vwrite(v, instr->rd, i, esz, val);
+		}
+		if (!ok) {
+			v->vstart = i;
+			return;
+		}
+	}
+	vector_done(c);
+}
+
+void exec_vload(struct cpu *c, const Instruction *instr)
+{
+	vmem(c, instr, false);
+}
+
+void exec_vstore(struct cpu *c, const Instruction *instr)
+{
+	vmem(c, instr, true);
+}
+
+void exec_velem(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 n = vgroup(vlmul(v->vtype));
+	u32 op = vop_of[instr->id], sew, esz, k, i;
+	bool vv = vform_vv(instr);
+
+	if (!vcheck(c, instr, n, n, n, false))
+		return;
+	sew = vsew(v->vtype);
+	esz = sew / 8;
+	k = vv ? 0 : vscalar(c, instr, sew);
+
+	i = v->vstart;
+	if (!i && !vmasked(instr) && !v->reference)
+		i = vkernel(op, esz, velt(v, instr->rd, 0, esz),
+			    velt(v, instr->rs2, 0, esz),
+			    vv ? velt(v, instr->rs1, 0, esz) : NULL, k, v->vl);
+	for (; i < v->vl; i++) {
+		u32 a, b, d;
+
+		if (vmasked(instr) && !vmask(v, i))
+			continue;
+		a = vread(v, instr->rs2, i, esz);
+		b = vv ? vread(v, instr->rs1, i, esz) : k;
+		d = vread(v, instr->rd, i, esz);
+		vwrite(v, instr->rd, i, esz, velem(v, op, a, b, d, sew));
+	}
+	vector_done(c);
+}
+
+// The result is one mask register, built aside since vd may overlap vs2
+void exec_vcmp(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 n = vgroup(vlmul(v->vtype));
+	u32 op = vop_of[instr->id], sew, esz, k;
+	bool vv = vform_vv(instr);
+	u8 bits[VLENB];
+
+	if (!vcheck(c, instr, 1, n, n, true))
+		return;
+	sew = vsew(v->vtype);
+	esz = sew / 8;
+	k = vv ? 0 : vscalar(c, instr, sew);
+
+	memcpy(bits, v->v[instr->rd], VLENB);
+	for (u32 i = v->vstart; i < v->vl; i++) {
+		u32 a, b;
+
+		if (vmasked(instr) && !vmask(v, i))
+			continue;
+		a = vread(v, instr->rs2, i, esz);
+		b = vv ? vread(v, instr->rs1, i, esz) : k;
+		bits[i / 8] &= ~(1u << (i % 8));
+		bits[i / 8] |= vcompare(op, a, b, sew) << (i % 8);
+	}
+	memcpy(v->v[instr->rd], bits, VLENB);
+	vector_done(c);
+}
+
+// vmv.v.* copies vs1, rs1 or the immediate; vmerge picks vs2 where v0 is 0
+void exec_vmerge(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 n = vgroup(vlmul(v->vtype));
+	u32 sew, esz, k;
+	bool vv = vform_vv(instr);
+
+	if (!vcheck(c, instr, n, n, n, false))
+		return;
+	sew = vsew(v->vtype);
+	esz = sew / 8;
+	k = vv ? 0 : vscalar(c, instr, sew);
+
+	for (u32 i = v->vstart; i < v->vl; i++) {
+		u32 val = vv ? vread(v, instr->rs1, i, esz) : k;
+
+		if (vmasked(instr) && !vmask(v, i))
+			val = vread(v, instr->rs2, i, esz);
+		vwrite(v, instr->rd, i, esz, val);
+	}
+	vector_done(c);
+}
+
+// vd[0] = vs1[0] op the active elements of vs2
+void exec_vred(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 n = vgroup(vlmul(v->vtype));
+	u32 op = vop_of[instr->id], sew, esz, acc;
+
+	if (!vcheck(c, instr, 1, n, 1, true))
+		return;
+	if (v->vstart) {
+		vector_illegal(c, instr);
+		return;
+	}
+	sew = vsew(v->vtype);
+	esz = sew / 8;
+
+	if (v->vl) {
+		acc = vread(v, instr->rs1, 0, esz);
+		for (u32 i = 0; i < v->vl; i++) {
+			if (vmasked(instr) && !vmask(v, i))
+				continue;
+			acc = vtrunc(velem(v, op, acc,
+					   vread(v, instr->rs2, i, esz), 0, sew),
+				     sew);
+		}
+		vwrite(v, instr->rd, 0, esz, acc);
+	}
+	vector_done(c);
+}
+
+// x[rd] = vs2[0], sign-extended; done even when vl is 0
+void exec_vmv_x_s(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 sew;
+
+	if (!vector_enabled(c) || (v->vtype & VTYPE_VILL)) {
+		vector_illegal(c, instr);
+		return;
+	}
+	sew = vsew(v->vtype);
+	c->registers[instr->rd] =
+		(u32)vsext(vread(v, instr->rs2, 0, sew / 8), sew);
+	vector_done(c);
+}
+
+// vd[0] = x[rs1], unless vl is 0
+void exec_vmv_s_x(struct cpu *c, const Instruction *instr)
+{
+	struct vector_state *v = &c->vec;
+	u32 sew;
+
+	if (!vector_enabled(c) || (v->vtype & VTYPE_VILL)) {
+		vector_illegal(c, instr);
+		return;
+	}
+	sew = vsew(v->vtype);
+	if (v->vstart < v->vl)
+		vwrite(v, instr->rd, 0, sew / 8, c->registers[instr->rs1]);
+	vector_done(c);
+}
@@ -0,0 +1,60 @@
+#include "vmcall.h"
+#include "cpu.h"
+
+#include <string.h>
+
+enum vmcall_status vmcall(struct cpu *c, u32 func, const u32 *args,
+			  u32 nargs, u64 max_insns, u32 *ret)
+{
+	u32 saved[NREGS];
+	u32 pc = c->pc;
+	u32 next_pc = c->next_pc; // set when called from a syscall handler
+	u32 resume_pc = c->resume_pc;
+	u32 priv = c->priv;
+	u32 exit_code = c->exit_code;
+	u32 trap_cause = c->trap_cause;
+	u32 trap_tval = c->trap_tval;
+	u32 break_pc = c->break_pc;
+	enum cpu_state state = c->state;
+	enum cpu_stop stop = c->stop;
+	enum vmcall_status status;
+
+	if (nargs > VMCALL_MAX_ARGS || (func & 1))
+		return VMCALL_BAD_ARGS;
+
+	memcpy(saved, c->registers, sizeof(saved));
+	if (nargs)
+		memcpy(&c->registers[10], args, nargs * sizeof(*args));
+	c->registers[1] = VMCALL_RETURN;
+	c->pc = func;
+	c->state = CPU_STATE_RUNNING;
+
+	// The return address is never fetched: the call ends on reaching it
+	c->break_pc = VMCALL_RETURN;
+	switch (cpu_run_for(c, max_insns, NULL)) {
+	case CPU_STOP_BUDGET:
+		status = VMCALL_BUDGET;
+		break;
+	case CPU_STOP_BREAKPOINT:
+		status = c->pc == VMCALL_RETURN ? VMCALL_OK : VMCALL_HALTED;
+		break;
+	default:
+		status = VMCALL_HALTED;
+		break;
+	}
+	if (ret)
+		*ret = c->registers[10];
+
+	memcpy(c->registers, saved, sizeof(saved));
+	c->pc = pc;
+	c->next_pc = next_pc;
+	c->resume_pc = resume_pc;
+	cpu_set_priv(c, priv);
+	c->exit_code = exit_code;
+	c->trap_cause = trap_cause;
+	c->trap_tval = trap_tval;
+	c->break_pc = break_pc;
+	c->state = state;
+	c->stop = stop;
+	return status;
+}
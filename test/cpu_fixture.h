@@ -0,0 +1,50 @@
+#ifndef RV32I_TEST_CPU_FIXTURE_H
+#define RV32I_TEST_CPU_FIXTURE_H
+
+#include <gtest/gtest.h>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+}
+
+/*
+ * A fresh CPU with MEM_SIZE bytes of memory for every test. Fixtures with
+ * more state derive from it and call SetUp()/TearDown() through.
+ */
+class CpuTest : public ::testing::Test {
+    protected:
+	struct cpu *cpu = nullptr;
+
+	void SetUp() override
+	{
+		cpu = cpu_create(MEM_SIZE);
+		ASSERT_NE(cpu, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cpu_destroy(cpu);
+	}
+
+	// Store @program word by word from address 0
+	void load_program(struct cpu *c, const std::vector<u32> &program)
+	{
+		for (size_t i = 0; i < program.size(); ++i)
+			mem_store32(c->memory, i * 4, program[i]);
+	}
+
+	void load_program(const std::vector<u32> &program)
+	{
+		load_program(cpu, program);
+	}
+
+	void run_program(int instructions)
+	{
+		for (int i = 0; i < instructions; ++i)
+			cpu_step(cpu);
+	}
+};
+
+#endif /* RV32I_TEST_CPU_FIXTURE_H */
@@ -0,0 +1,285 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "csr.h"
+#include "memory.h"
+#include "mmu.h"
+#include "accel.h"
+#include "elf_file.h"
+}
+
+// With `make INSN_MIX=1` the guest routines always run, so the mix sees
+// each instruction: results still match, but no call is serviced
+#ifdef CONFIG_INSN_MIX
+#define SKIP_IF_INSN_MIX() GTEST_SKIP() << "no host routines with INSN_MIX=1"
+#else
+#define SKIP_IF_INSN_MIX() (void)0
+#endif
+
+// Callers at 0, 8 and 0x10 (jal ra, routine; ebreak) and plain byte-loop
+// versions of the routines for the guest to fall back on
+#define CALL_MEMCPY 0x00
+#define CALL_MEMSET 0x08
+#define CALL_STRLEN 0x10
+#define MEMCPY 0x100
+#define MEMSET 0x140
+#define STRLEN 0x180
+
+static const std::vector<std::pair<u32, std::vector<u32>>> routines = {
+	{ 0x000,
+	  {
+		  0x100000EF, // jal ra, memcpy
+		  0x00100073, // ebreak
+		  0x138000EF, // jal ra, memset
+		  0x00100073, // ebreak
+		  0x170000EF, // jal ra, strlen
+		  0x00100073, // ebreak
+	  } },
+	{ MEMCPY,
+	  {
+		  0x00050293, // mv t0, a0
+		  0x00060E63, // beqz a2, 2f
+		  0x0005C303, // 1: lbu t1, 0(a1)
+		  0x00628023, // sb t1, 0(t0)
+		  0x00158593, // addi a1, a1, 1
+		  0x00128293, // addi t0, t0, 1
+		  0xFFF60613, // addi a2, a2, -1
+		  0xFE0616E3, // bnez a2, 1b
+		  0x00008067, // 2: ret
+	  } },
+	{ MEMSET,
+	  {
+		  0x00050293, // mv t0, a0
+		  0x00060A63, // beqz a2, 2f
+		  0x00B28023, // 1: sb a1, 0(t0)
+		  0x00128293, // addi t0, t0, 1
+		  0xFFF60613, // addi a2, a2, -1
+		  0xFE061AE3, // bnez a2, 1b
+		  0x00008067, // 2: ret
+	  } },
+	{ STRLEN,
+	  {
+		  0x00050293, // mv t0, a0
+		  0x0002C303, // 1: lbu t1, 0(t0)
+		  0x00030663, // beqz t1, 2f
+		  0x00128293, // addi t0, t0, 1
+		  0xFF5FF06F, // j 1b
+		  0x40A28533, // 2: sub a0, t0, a0
+		  0x00008067, // ret
+	  } },
+};
+
+class AccelTest : public ::testing::Test {
+    protected:
+	struct cpu *plain;
+	struct cpu *fast;
+	struct accel *a;
+
+	void SetUp() override
+	{
+		plain = cpu_create(MEM_SIZE);
+		fast = cpu_create(MEM_SIZE);
+		a = accel_create();
+		ASSERT_NE(a, nullptr);
+		fast->accel = a;
+		for (const auto &r : routines) {
+			for (size_t i = 0; i < r.second.size(); ++i) {
+				mem_store32(plain->memory, r.first + i * 4,
+					    r.second[i]);
+				mem_store32(fast->memory, r.first + i * 4,
+					    r.second[i]);
+			}
+		}
+		accel_add(a, MEMCPY, ACCEL_MEMCPY);
+		accel_add(a, MEMSET, ACCEL_MEMSET);
+		accel_add(a, STRLEN, ACCEL_STRLEN);
+	}
+
+	void TearDown() override
+	{
+		cpu_destroy(plain);
+		cpu_destroy(fast);
+		accel_destroy(a);
+	}
+
+	void poke(u32 addr, const void *data, u32 len)
+	{
+		memcpy(plain->memory + addr, data, len);
+		memcpy(fast->memory + addr, data, len);
+	}
+
+	// Call through @entry on both CPUs with a0..a2 set
+	void call(u32 entry, u32 a0, u32 a1, u32 a2)
+	{
+		for (struct cpu *c : { plain, fast }) {
+			c->pc = entry;
+			c->state = CPU_STATE_RUNNING;
+			c->registers[10] = a0;
+			c->registers[11] = a1;
+			c->registers[12] = a2;
+			cpu_run(c);
+		}
+	}
+
+	// Everything a caller may rely on matches the guest routine
+	void expect_same_result()
+	{
+		EXPECT_EQ(fast->stop, plain->stop);
+		EXPECT_EQ(fast->pc, plain->pc);
+		EXPECT_EQ(fast->registers[10], plain->registers[10]);
+		EXPECT_EQ(fast->registers[1], plain->registers[1]);
+		EXPECT_EQ(fast->registers[2], plain->registers[2]);
+		EXPECT_EQ(fast->csr.mcause, plain->csr.mcause);
+		EXPECT_EQ(memcmp(fast->memory, plain->memory, plain->mem_size), 0);
+	}
+};
+
+TEST_F(AccelTest, Memcpy)
+{
+	char text[] = "accelerated copy across a page boundary";
+
+	poke(0x1FF0, text, sizeof(text));
+	call(CALL_MEMCPY, 0x5000, 0x1FF0, sizeof(text));
+	expect_same_result();
+	EXPECT_EQ(fast->registers[10], 0x5000u);
+	EXPECT_EQ(fast->pc, 4u);
+	SKIP_IF_INSN_MIX();
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMCPY], 1u);
+	EXPECT_EQ(a->stats.bytes[ACCEL_MEMCPY], sizeof(text));
+	// The jal, the modelled byte loop and the ebreak
+	EXPECT_EQ(fast->insn_count, 2 + ACCEL_CALL_INSNS + 5 * sizeof(text));
+}
+
+TEST_F(AccelTest, MemsetAndStrlen)
+{
+	call(CALL_MEMSET, 0x3000, 0x17A, 100);
+	expect_same_result();
+	EXPECT_EQ(fast->memory[0x3000 + 99], 0x7A);
+	EXPECT_EQ(fast->memory[0x3000 + 100], 0);
+
+	call(CALL_STRLEN, 0x3000, 0, 0);
+	expect_same_result();
+	EXPECT_EQ(fast->registers[10], 100u);
+	SKIP_IF_INSN_MIX();
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMSET], 1u);
+	EXPECT_EQ(a->stats.calls[ACCEL_STRLEN], 1u);
+	EXPECT_EQ(a->stats.declined, 0u);
+}
+
+TEST_F(AccelTest, ZeroLength)
+{
+	call(CALL_MEMCPY, 0x5000, 0xFFFFFFF0, 0);
+	expect_same_result();
+	SKIP_IF_INSN_MIX();
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMCPY], 1u);
+}
+
+// Overlapping memcpy is undefined; whatever the guest code does stands
+TEST_F(AccelTest, OverlappingMemcpyRunsGuestCode)
+{
+	poke(0x2000, "0123456789", 10);
+	call(CALL_MEMCPY, 0x2002, 0x2000, 8);
+	expect_same_result();
+	EXPECT_EQ(memcmp(fast->memory + 0x2000, "0101010101", 10), 0);
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMCPY], 0u);
+	EXPECT_EQ(a->stats.declined, 1u);
+}
+
+TEST_F(AccelTest, OverlappingMemmove)
+{
+	accel_add(a, MEMCPY, ACCEL_MEMMOVE);
+	poke(0x2000, "0123456789", 10);
+	call(CALL_MEMCPY, 0x2002, 0x2000, 8);
+	// The guest routine is a memcpy, standing in for memmove
+	SKIP_IF_INSN_MIX();
+	EXPECT_EQ(memcmp(fast->memory + 0x2000, "0101234567", 10), 0);
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMMOVE], 1u);
+}
+
+// Running off the end of memory must fault exactly where the guest does
+TEST_F(AccelTest, FaultsComeFromGuestCode)
+{
+	u32 ebreak = 0x00100073;
+
+	poke(0x400, &ebreak, 4);
+	plain->csr.mtvec = fast->csr.mtvec = 0x400;
+	call(CALL_MEMSET, MEM_SIZE - 16, 0, 32);
+	expect_same_result();
+	EXPECT_EQ(fast->csr.mcause, (u32)CAUSE_STORE_ACCESS);
+	EXPECT_EQ(fast->csr.mtval, (u32)MEM_SIZE);
+
+	// No terminator before the end of memory
+	memset(plain->memory + 0x8000, 'x', MEM_SIZE - 0x8000);
+	memset(fast->memory + 0x8000, 'x', MEM_SIZE - 0x8000);
+	call(CALL_STRLEN, 0x8000, 0, 0);
+	expect_same_result();
+	EXPECT_EQ(fast->csr.mcause, (u32)CAUSE_LOAD_ACCESS);
+	EXPECT_EQ(a->stats.declined, 2u);
+}
+
+// A store through a clean page must let the guest set the dirty bit
+TEST_F(AccelTest, CleanPageRunsGuestCode)
+{
+	u32 flags = PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D;
+
+	for (struct cpu *c : { plain, fast }) {
+		// Identity superpage for code, VA 0x400000 -> PA 0x3000, not dirty
+		mem_store32(c->memory, 0x8000, flags);
+		mem_store32(c->memory, 0x8004, (0x9000 >> 12) << 10 | PTE_V);
+		mem_store32(c->memory, 0x9000,
+			    (0x3000 >> 12) << 10 | PTE_V | PTE_R | PTE_W | PTE_A);
+		c->csr.satp = SATP_MODE | (0x8000 >> 12);
+		cpu_set_priv(c, PRV_S);
+	}
+	call(CALL_MEMSET, 0x400000, 0x55, 64);
+	expect_same_result();
+	EXPECT_EQ(fast->memory[0x3000 + 63], 0x55);
+	EXPECT_NE(mem_load32(fast->memory, 0x9000) & PTE_D, 0u);
+	EXPECT_EQ(a->stats.declined, 1u);
+
+	// Now dirty, so the next call is serviced
+	call(CALL_MEMSET, 0x400000, 0x66, 64);
+	expect_same_result();
+	SKIP_IF_INSN_MIX();
+	EXPECT_EQ(a->stats.calls[ACCEL_MEMSET], 1u);
+}
+
+// Never charge more than cpu_run_for() was given
+TEST_F(AccelTest, RespectsBudget)
+{
+	u64 retired;
+
+	fast->pc = CALL_MEMSET;
+	fast->registers[10] = 0x2000;
+	fast->registers[12] = 1000;
+	EXPECT_EQ(cpu_run_for(fast, 100, &retired), CPU_STOP_BUDGET);
+	EXPECT_EQ(retired, 100u);
+	EXPECT_EQ(a->stats.declined, 1u);
+}
+
+TEST_F(AccelTest, RoutinesFromSymbols)
+{
+	const struct symbol syms[] = {
+		{ 0x100, 36, "memcpy" },
+		{ 0x200, 16, "main" },
+		{ 0x300, 16, "memmove" },
+		{ 0x400, 16, "strlen" },
+	};
+	struct symtab tab;
+	struct accel *b = accel_create();
+	enum accel_kind kind;
+
+	ASSERT_TRUE(symtab_init(&tab, syms, 4));
+	EXPECT_EQ(accel_add_symbols(b, &tab), 3u);
+	EXPECT_EQ(b->nroutines, 3u);
+	EXPECT_EQ(b->routines[1].addr, 0x300u);
+	EXPECT_EQ(b->routines[1].kind, ACCEL_MEMMOVE);
+	EXPECT_TRUE(accel_kind_parse("memset", &kind));
+	EXPECT_EQ(kind, ACCEL_MEMSET);
+	EXPECT_FALSE(accel_kind_parse("strcpy", &kind));
+	symtab_free(&tab);
+	accel_destroy(b);
+}
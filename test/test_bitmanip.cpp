@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "insn.h"
+#include "disassembler.h"
+}
+
+struct zb_case {
+	u32 raw; // rd = a0, rs1 = a1, rs2 = a2
+	u32 a1;
+	u32 a2;
+	u32 expect;
+	const char *text;
+};
+
+// Expected values computed independently of the handlers
+static const std::vector<zb_case> cases = {
+	{ 0x20C5A533, 0x8000F010, 0x24, 0x0001E044, "sh1add a0, a1, a2" },
+	{ 0x20C5C533, 0x8000F010, 0x24, 0x0003C064, "sh2add a0, a1, a2" },
+	{ 0x20C5E533, 0x8000F010, 0x24, 0x000780A4, "sh3add a0, a1, a2" },
+	{ 0x40C5F533, 0x8000F010, 0x24, 0x8000F010, "andn a0, a1, a2" },
+	{ 0x40C5E533, 0x8000F010, 0x24, 0xFFFFFFDB, "orn a0, a1, a2" },
+	{ 0x40C5C533, 0x8000F010, 0x24, 0x7FFF0FCB, "xnor a0, a1, a2" },
+	{ 0x60059513, 0x00001000, 0, 19, "clz a0, a1" },
+	{ 0x60059513, 0, 0, 32, "clz a0, a1" },
+	{ 0x60159513, 0x8000F010, 0, 4, "ctz a0, a1" },
+	{ 0x60159513, 0, 0, 32, "ctz a0, a1" },
+	{ 0x60259513, 0x8000F010, 0, 6, "cpop a0, a1" },
+	{ 0x60459513, 0x8000F090, 0, 0xFFFFFF90, "sext.b a0, a1" },
+	{ 0x60559513, 0x8000F010, 0, 0xFFFFF010, "sext.h a0, a1" },
+	{ 0x0805C533, 0x8000F010, 0, 0x0000F010, "zext.h a0, a1" },
+	{ 0x0AC5C533, 0x8000F010, 0x24, 0x8000F010, "min a0, a1, a2" },
+	{ 0x0AC5D533, 0x8000F010, 0x24, 0x24, "minu a0, a1, a2" },
+	{ 0x0AC5E533, 0x8000F010, 0x24, 0x24, "max a0, a1, a2" },
+	{ 0x0AC5F533, 0x8000F010, 0x24, 0x8000F010, "maxu a0, a1, a2" },
+	{ 0x60C59533, 0x8000F010, 0x24, 0x000F0108, "rol a0, a1, a2" },
+	{ 0x60C5D533, 0x8000F010, 0x24, 0x08000F01, "ror a0, a1, a2" },
+	{ 0x60C5D533, 0x8000F010, 0x20, 0x8000F010, "ror a0, a1, a2" },
+	{ 0x6075D513, 0x8000F010, 0, 0x210001E0, "rori a0, a1, 7" },
+	{ 0x2875D513, 0x8000F010, 0, 0xFF00FFFF, "orc.b a0, a1" },
+	{ 0x6985D513, 0x8000F010, 0, 0x10F00080, "rev8 a0, a1" },
+	{ 0x48C59533, 0x8000F010, 0x24, 0x8000F000, "bclr a0, a1, a2" },
+	{ 0x49F59513, 0x8000F010, 0, 0x0000F010, "bclri a0, a1, 31" },
+	{ 0x48C5D533, 0x8000F010, 0x24, 1, "bext a0, a1, a2" },
+	{ 0x4845D513, 0x8000F010, 0, 1, "bexti a0, a1, 4" },
+	{ 0x68C59533, 0x8000F010, 0x24, 0x8000F000, "binv a0, a1, a2" },
+	{ 0x68359513, 0x8000F010, 0, 0x8000F018, "binvi a0, a1, 3" },
+	{ 0x28C59533, 0x8000F010, 0x24, 0x8000F010, "bset a0, a1, a2" },
+	{ 0x29E59513, 0x8000F010, 0, 0xC000F010, "bseti a0, a1, 30" },
+};
+
+class BitmanipTest : public CpuTest {};
+
+TEST_F(BitmanipTest, Results)
+{
+	for (const auto &tc : cases) {
+		cpu_reset(cpu);
+		mem_store32(cpu->memory, 0, tc.raw);
+		cpu->registers[11] = tc.a1;
+		cpu->registers[12] = tc.a2;
+		cpu_step(cpu);
+		EXPECT_EQ(cpu->registers[10], tc.expect) << tc.text;
+		EXPECT_EQ(cpu->pc, 4u) << tc.text;
+	}
+}
+
+TEST_F(BitmanipTest, Disassembly)
+{
+	char buf[64];
+
+	for (const auto &tc : cases) {
+		disassemble(tc.raw, buf, sizeof(buf));
+		EXPECT_STREQ(buf, tc.text);
+	}
+}
+
+// The unary ops share a table slot and are told apart by rs2
+TEST_F(BitmanipTest, UnaryEncodings)
+{
+	EXPECT_EQ(insn_lookup(0x60059513), INSN_CLZ);
+	EXPECT_EQ(insn_lookup(0x60559513), INSN_SEXT_H);
+	EXPECT_EQ(insn_lookup(0x60359513), INSN_ILLEGAL); // rs2 = 3
+	EXPECT_EQ(insn_lookup(0x08C5C533), INSN_ILLEGAL); // zext.h with rs2
+	EXPECT_EQ(insn_lookup(0x6995D513), INSN_ILLEGAL); // rev8, rs2 = 25
+	EXPECT_EQ(insn_lookup(0x2865D513), INSN_ILLEGAL); // orc.b, rs2 = 6
+}
+
+TEST_F(BitmanipTest, Misa)
+{
+	u32 misa;
+
+	ASSERT_TRUE(csr_read(cpu, CSR_MISA, &misa));
+	EXPECT_NE(misa & (1u << ('B' - 'A')), 0u);
+}
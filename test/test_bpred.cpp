@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "bpred.h"
+}
+
+class BPredTest : public CpuTest {
+    protected:
+	struct bpred *bp = nullptr;
+
+	void TearDown() override
+	{
+		bpred_destroy(bp);
+		CpuTest::TearDown();
+	}
+
+	struct bpred *create(const char *spec)
+	{
+		struct bpred_config cfg;
+
+		EXPECT_TRUE(bpred_config_parse(spec, &cfg)) << spec;
+		return bpred_create(&cfg);
+	}
+
+	// Mispredictions over the last half of @n outcomes of one branch
+	u64 train(struct bpred *p, u32 pc, int n, bool (*outcome)(int))
+	{
+		u64 before = 0;
+
+		for (int i = 0; i < n; ++i) {
+			if (i == n / 2)
+				before = p->stats.cond_mispredicts;
+			bpred_branch(p, pc, pc - 16, outcome(i));
+		}
+		return p->stats.cond_mispredicts - before;
+	}
+
+};
+
+TEST_F(BPredTest, ConfigParse)
+{
+	struct bpred_config cfg;
+
+	ASSERT_TRUE(bpred_config_parse("gshare:14", &cfg));
+	EXPECT_EQ(cfg.kind, BPRED_GSHARE);
+	EXPECT_EQ(cfg.table_bits, 14u);
+	ASSERT_TRUE(bpred_config_parse("tage", &cfg));
+	EXPECT_EQ(cfg.kind, BPRED_TAGE);
+
+	EXPECT_FALSE(bpred_config_parse("perceptron", &cfg));
+	EXPECT_FALSE(bpred_config_parse("bimodal:x", &cfg));
+	EXPECT_FALSE(bpred_config_parse("gshare:40", &cfg));
+}
+
+TEST_F(BPredTest, BimodalLearnsBiasedBranch)
+{
+	bp = create("bimodal:10");
+	ASSERT_NE(bp, nullptr);
+
+	EXPECT_EQ(train(bp, 0x100, 200, [](int) { return true; }), 0u);
+	// Warm-up costs at most the two steps out of weakly not-taken
+	EXPECT_LE(bp->stats.cond_mispredicts, 2u);
+}
+
+TEST_F(BPredTest, HistoryPredictorsLearnPatterns)
+{
+	auto alternate = [](int i) { return (i & 1) != 0; };
+	auto period5 = [](int i) { return i % 5 != 4; };
+	struct bpred *bimodal = create("bimodal:10");
+	struct bpred *gshare = create("gshare:10");
+	struct bpred *tage = create("tage:12");
+
+	// A 2-bit counter keeps missing an alternating branch
+	EXPECT_GE(train(bimodal, 0x200, 1000, alternate), 250u);
+	EXPECT_EQ(train(gshare, 0x200, 1000, alternate), 0u);
+	EXPECT_EQ(train(tage, 0x200, 2000, period5), 0u);
+
+	bpred_destroy(bimodal);
+	bpred_destroy(gshare);
+	bpred_destroy(tage);
+}
+
+TEST_F(BPredTest, ReturnStackAndSiteStats)
+{
+	load_program({
+		0x00800513, // addi a0, x0, 8
+		0x010000ef, // 0x04: jal ra, 0x14
+		0xfff50513, // addi a0, a0, -1
+		0xfe051ce3, // 0x0c: bne a0, x0, 0x04
+		0x0000006f, // 0x10: jal x0, 0x10
+		0x00158593, // 0x14: addi a1, a1, 1
+		0x00008067, // 0x18: ret
+	});
+	bp = create("gshare:10");
+	cpu->bpred = bp;
+	run_program(1 + 8 * 5);
+
+	EXPECT_EQ(cpu->registers[11], 8u);
+	EXPECT_EQ(cpu->pc, 0x10u);
+	EXPECT_EQ(bp->stats.jumps, 16u);
+	EXPECT_EQ(bp->stats.ras_pushes, 8u);
+	EXPECT_EQ(bp->stats.ras_pops, 8u);
+	EXPECT_EQ(bp->stats.ras_mispredicts, 0u);
+	EXPECT_EQ(bp->stats.target_mispredicts, 0u);
+
+	const struct bpred_site *call = bpred_site_find(bp, 0x04);
+	const struct bpred_site *ret = bpred_site_find(bp, 0x18);
+	const struct bpred_site *loop = bpred_site_find(bp, 0x0c);
+	ASSERT_NE(call, nullptr);
+	ASSERT_NE(ret, nullptr);
+	ASSERT_NE(loop, nullptr);
+	EXPECT_EQ(call->type, (u32)BRANCH_CALL);
+	EXPECT_EQ(ret->type, (u32)BRANCH_RET);
+	EXPECT_EQ(loop->type, (u32)BRANCH_COND);
+	EXPECT_EQ(loop->executed, 8u);
+	EXPECT_EQ(loop->taken, 7u);
+	EXPECT_EQ(bpred_site_find(bp, 0x08), nullptr);
+}
@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "cachesim.h"
+}
+
+class CacheSimTest : public CpuTest {
+    protected:
+	struct cachesim *sim = nullptr;
+
+	void TearDown() override
+	{
+		cachesim_destroy(sim);
+		CpuTest::TearDown();
+	}
+
+	struct cache_config parse(const char *spec)
+	{
+		struct cache_config cfg;
+
+		EXPECT_TRUE(cache_config_parse(spec, &cfg)) << spec;
+		return cfg;
+	}
+
+};
+
+TEST_F(CacheSimTest, ConfigParse)
+{
+	struct cache_config cfg = parse("32k:4:64:fifo");
+
+	EXPECT_EQ(cfg.size, 32768u);
+	EXPECT_EQ(cfg.ways, 4u);
+	EXPECT_EQ(cfg.line_size, 64u);
+	EXPECT_EQ(cfg.policy, CACHE_FIFO);
+
+	EXPECT_FALSE(cache_config_parse("3k:4:64", &cfg)); // 12 sets
+	EXPECT_FALSE(cache_config_parse("32k:4:48", &cfg)); // line not 2^n
+	EXPECT_FALSE(cache_config_parse("32k:4:64:plru", &cfg));
+	// ways * line_size wraps to 0 in 32 bits
+	EXPECT_FALSE(cache_config_parse("32k:0x80000000:2", &cfg));
+	EXPECT_FALSE(cache_config_parse("1k:2048:1", &cfg));
+}
+
+TEST_F(CacheSimTest, ReplacementPolicies)
+{
+	// One set of two ways: A, B, A, C, A
+	const u32 seq[] = { 0x000, 0x040, 0x000, 0x080, 0x000 };
+	struct cache_config lru = parse("128:2:64:lru");
+	struct cache_config fifo = parse("128:2:64:fifo");
+
+	sim = cachesim_create(&lru, &lru, NULL);
+	for (u32 addr : seq)
+		cachesim_access(sim, 0, addr, 4, MMU_LOAD);
+	// LRU evicts B for C, so the final A hits
+	EXPECT_EQ(sim->l1d.misses, 3u);
+	cachesim_destroy(sim);
+
+	sim = cachesim_create(&fifo, &fifo, NULL);
+	for (u32 addr : seq)
+		cachesim_access(sim, 0, addr, 4, MMU_LOAD);
+	// FIFO evicts A (filled first) for C, so the final A misses
+	EXPECT_EQ(sim->l1d.misses, 4u);
+}
+
+TEST_F(CacheSimTest, MissesReachL2AndRanges)
+{
+	struct cache_config l1 = parse("256:1:64");
+	struct cache_config l2 = parse("4k:4:64");
+
+	sim = cachesim_create(&l1, &l1, &l2);
+	cachesim_add_range(sim, 0x100, 0x200);
+
+	// 0x1000 and 0x1100 conflict in the direct-mapped L1D but both fit
+	// in the L2, so only the first touch of each misses there.
+	for (int i = 0; i < 3; i++) {
+		cachesim_access(sim, 0x100, 0x1000, 4, MMU_LOAD);
+		cachesim_access(sim, 0x104, 0x1100, 4, MMU_STORE);
+	}
+
+	EXPECT_EQ(sim->l1d.misses, 6u);
+	EXPECT_EQ(sim->l2.accesses, 6u);
+	EXPECT_EQ(sim->l2.misses, 2u);
+	EXPECT_EQ(sim->l1d.writebacks, 2u);
+	EXPECT_EQ(sim->ranges[0].data_accesses, 6u);
+	EXPECT_EQ(sim->ranges[0].data_misses, 6u);
+}
+
+TEST_F(CacheSimTest, GuestReadsMissCounters)
+{
+	struct cache_config l1 = parse("256:1:64");
+
+	sim = cachesim_create(&l1, &l1, NULL);
+	cachesim_attach(cpu, sim);
+	cpu->registers[1] = 0x1000;
+
+	std::vector<uint32_t> program = {
+		0x0000A183, // lw x3, 0(x1)
+		0x1000A183, // lw x3, 0x100(x1)  (same set: conflict miss)
+		0x0000A183, // lw x3, 0(x1)
+		0xC04022F3, // csrr x5, hpmcounter4  (L1D misses)
+		0xB0302373, // csrr x6, mhpmcounter3 (L1I misses)
+	};
+	load_program(program);
+	run_program(program.size());
+
+	EXPECT_EQ(cpu->registers[5], 3);
+	EXPECT_EQ(cpu->registers[6], 1); // all five instructions share a line
+	EXPECT_EQ(sim->l1i.accesses, 5u);
+
+	// Detaching restores the plain TLB fast path
+	cachesim_attach(cpu, NULL);
+	cpu->pc = 0;
+	run_program(1);
+	EXPECT_EQ(sim->l1d.accesses, 3u);
+}
+
+// One access is seen once, but charged to every line it touches
+TEST_F(CacheSimTest, StraddlingAccessChargesEveryLine)
+{
+	struct cache_config l1 = parse("4k:1:64");
+
+	sim = cachesim_create(&l1, &l1, NULL);
+	cachesim_add_range(sim, 0x100, 0x200);
+	cachesim_access(sim, 0x100, 0x103E, 4, MMU_LOAD);
+	EXPECT_EQ(sim->l1d.accesses, 2u);
+	EXPECT_EQ(sim->l1d.misses, 2u);
+	EXPECT_EQ(sim->ranges[0].data_accesses, 1u);
+	EXPECT_EQ(sim->ranges[0].data_misses, 1u);
+
+	// A hit only if every line hits
+	cachesim_access(sim, 0x100, 0x107E, 4, MMU_LOAD);
+	EXPECT_EQ(sim->l1d.misses, 3u);
+	EXPECT_EQ(sim->ranges[0].data_misses, 2u);
+	cachesim_access(sim, 0x100, 0x1070, 4, MMU_LOAD);
+	EXPECT_EQ(sim->ranges[0].data_accesses, 3u);
+	EXPECT_EQ(sim->ranges[0].data_misses, 2u);
+}
+
+// Misaligned guest accesses, within a page and across one, are one
+// access each to the range and one per line touched to the cache
+TEST_F(CacheSimTest, GuestMisalignedAccesses)
+{
+	struct cache_config l1 = parse("4k:1:64");
+
+	sim = cachesim_create(&l1, &l1, NULL);
+	cachesim_add_range(sim, 0, 0x100);
+	cachesim_attach(cpu, sim);
+	cpu->registers[1] = 0x1000;
+	cpu->registers[2] = 0x1800;
+	mem_store32(cpu->memory, 0x103C, 0xBBAA0000);
+	mem_store32(cpu->memory, 0x1040, 0x0000DDCC);
+	mem_store32(cpu->memory, 0x1FFC, 0x44332211);
+	mem_store32(cpu->memory, 0x2000, 0x88776655);
+
+	load_program({
+		0x03E0A183, // lw x3, 0x3E(x1): two lines
+		0x7FE12203, // lw x4, 0x7FE(x2): two pages
+		0x7E312F23, // sw x3, 0x7FE(x2)
+	});
+	run_program(3);
+	EXPECT_EQ(cpu->registers[3], 0xDDCCBBAAu);
+	EXPECT_EQ(cpu->registers[4], 0x66554433u);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x1FFC), 0xBBAA2211u);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x2000), 0x8877DDCCu);
+
+	EXPECT_EQ(sim->l1d.accesses, 6u);
+	EXPECT_EQ(sim->l1d.misses, 4u);
+	EXPECT_EQ(sim->ranges[0].data_accesses, 3u);
+	EXPECT_EQ(sim->ranges[0].data_misses, 2u);
+}
+
+// So are instructions straddling a line or a page
+TEST_F(CacheSimTest, StraddlingFetches)
+{
+	struct cache_config l1 = parse("4k:1:64");
+
+	sim = cachesim_create(&l1, &l1, NULL);
+	cachesim_add_range(sim, 0, 0x1000);
+	cachesim_attach(cpu, sim);
+	mem_store16(cpu->memory, 0x3C, 0x0001); // c.nop
+	mem_store16(cpu->memory, 0x3E, 0x8293); // addi x5, x5, 1
+	mem_store16(cpu->memory, 0x40, 0x0012);
+	mem_store16(cpu->memory, 0xFFE, 0x8293); // addi x5, x5, 1
+	mem_store16(cpu->memory, 0x1000, 0x0012);
+
+	cpu->pc = 0x3C;
+	run_program(2);
+	cpu->pc = 0xFFE;
+	run_program(1);
+	EXPECT_EQ(cpu->registers[5], 2u);
+	EXPECT_EQ(sim->l1i.accesses, 5u);
+	EXPECT_EQ(sim->l1i.misses, 4u);
+	EXPECT_EQ(sim->ranges[0].fetches, 3u);
+	EXPECT_EQ(sim->ranges[0].fetch_misses, 3u);
+}
@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "elf_file.h"
+#include "callgraph.h"
+#include "trace.h"
+}
+
+class CallgraphTest : public CpuTest {
+    protected:
+	struct symtab syms = {};
+	struct callgraph *cg = nullptr;
+
+	void SetUp() override
+	{
+		static const struct symbol s[] = {
+			{ 0x00, 0x20, "main" },
+			{ 0x20, 0x10, "helper" },
+			{ 0x30, 0x08, "leaf" },
+			{ 0x40, 0x20, "rec" },
+		};
+
+		CpuTest::SetUp();
+		ASSERT_TRUE(symtab_init(&syms, s, 4));
+	}
+
+	void TearDown() override
+	{
+		callgraph_destroy(cg);
+		symtab_free(&syms);
+		CpuTest::TearDown();
+	}
+
+	void profile(const struct symtab *tab)
+	{
+		cg = callgraph_create(tab);
+		ASSERT_NE(cg, nullptr);
+		ASSERT_TRUE(callgraph_start(cg, cpu));
+		cpu->callgraph = cg;
+		cpu_run(cpu);
+		ASSERT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+		callgraph_stop(cg, cpu);
+	}
+
+	const struct callgraph_fn *fn(const char *name)
+	{
+		for (u32 i = 0; i < cg->nfns; i++) {
+			if (cg->fns[i].name && !strcmp(cg->fns[i].name, name))
+				return &cg->fns[i];
+		}
+		return nullptr;
+	}
+
+	std::string callgrind()
+	{
+		char *buf = nullptr;
+		size_t len = 0;
+		FILE *out = open_memstream(&buf, &len);
+		std::string s;
+
+		EXPECT_TRUE(callgraph_write_callgrind(cg, out, "prog.bin"));
+		fclose(out);
+		s.assign(buf, len);
+		free(buf);
+		return s;
+	}
+};
+
+// main calls helper three times, which calls leaf through t0
+static const std::vector<u32> nested = {
+	0x00300413, // addi s0, zero, 3
+	0x01C000EF, // 1: jal ra, helper
+	0xFFF40413, // addi s0, s0, -1
+	0xFE041CE3, // bnez s0, 1b
+	0x00100073, // ebreak
+	0x00000013, // nop
+	0x00000013, // nop
+	0x00000013, // nop
+	0x00150513, // helper: addi a0, a0, 1
+	0x00C002EF, // jal t0, leaf
+	0x00008067, // ret
+	0x00000013, // nop
+	0x00158593, // leaf: addi a1, a1, 1
+	0x00028067, // jr t0
+};
+
+TEST_F(CallgraphTest, InclusiveAndExclusiveCounts)
+{
+	load_program(nested);
+	profile(&syms);
+
+	ASSERT_EQ(cg->nfns, 3u);
+	EXPECT_EQ(fn("main")->self, 11u);
+	EXPECT_EQ(fn("main")->inclusive, cpu->insn_count);
+	EXPECT_EQ(fn("helper")->self, 9u);
+	EXPECT_EQ(fn("helper")->inclusive, 15u);
+	EXPECT_EQ(fn("helper")->calls, 3u);
+	EXPECT_EQ(fn("leaf")->self, 6u);
+	EXPECT_EQ(fn("leaf")->inclusive, 6u);
+	EXPECT_EQ(cg->stats.calls, 6u);
+	EXPECT_EQ(cg->stats.returns, 6u);
+	EXPECT_EQ(cg->stats.unmatched, 0u);
+	EXPECT_EQ(cg->stats.max_depth, 3u);
+}
+
+// Traces would run the calls without telling the profiler
+TEST_F(CallgraphTest, SameWithTraces)
+{
+	struct trace_cache *tc = trace_cache_create();
+
+	ASSERT_NE(tc, nullptr);
+	cpu->traces = tc;
+	load_program(nested);
+	mem_store32(cpu->memory, 0, 0x3E800413); // addi s0, zero, 1000
+	profile(&syms);
+	EXPECT_EQ(fn("helper")->calls, 1000u);
+	EXPECT_EQ(fn("helper")->inclusive, 5000u);
+	EXPECT_EQ(fn("leaf")->self, 2000u);
+	cpu->traces = NULL;
+	trace_cache_destroy(tc);
+}
+
+TEST_F(CallgraphTest, CallgrindOutput)
+{
+	load_program(nested);
+	profile(&syms);
+
+	std::string out = callgrind();
+	EXPECT_EQ(out.rfind("# callgrind format\n", 0), 0u);
+	EXPECT_NE(out.find("cmd: prog.bin\n"), std::string::npos);
+	EXPECT_NE(out.find("positions: instr\nevents: Ir\nsummary: 26\n"),
+		  std::string::npos);
+	EXPECT_NE(out.find("fn=(1) main\n0x00000000 11\n"
+			   "cfn=(2) helper\ncalls=3 0x00000020\n0x00000004 15\n"),
+		  std::string::npos);
+	EXPECT_NE(out.find("fn=(2)\n0x00000020 9\n"
+			   "cfn=(3) leaf\ncalls=3 0x00000030\n0x00000024 6\n"),
+		  std::string::npos);
+	EXPECT_NE(out.find("fn=(3)\n0x00000030 6\n"), std::string::npos);
+}
+
+TEST_F(CallgraphTest, WithoutSymbolsFunctionsAreCallTargets)
+{
+	load_program(nested);
+	profile(nullptr);
+
+	ASSERT_EQ(cg->nfns, 3u);
+	EXPECT_EQ(cg->fns[1].addr, 0x20u);
+	EXPECT_EQ(cg->fns[1].name, nullptr);
+	EXPECT_NE(callgrind().find("cfn=(3) 0x00000030\n"), std::string::npos);
+}
+
+// rec(3) recurses down to rec(1); its time is counted once
+TEST_F(CallgraphTest, Recursion)
+{
+	std::vector<u32> program = {
+		0x00300513, // addi a0, zero, 3
+		0x03C000EF, // jal ra, rec
+		0x00100073, // ebreak
+	};
+
+	program.resize(16, 0x00000013);
+	program.insert(program.end(), {
+		0xFFF50513, // rec: addi a0, a0, -1
+		0x00050C63, // beqz a0, 1f
+		0xFFC10113, // addi sp, sp, -4
+		0x00112023, // sw ra, 0(sp)
+		0xFF1FF0EF, // jal ra, rec
+		0x00012083, // lw ra, 0(sp)
+		0x00410113, // addi sp, sp, 4
+		0x00008067, // 1: ret
+	});
+	load_program(program);
+	cpu->registers[2] = 0x8000;
+	profile(&syms);
+
+	EXPECT_EQ(fn("rec")->calls, 3u);
+	EXPECT_EQ(fn("rec")->inclusive, cpu->insn_count - fn("main")->self);
+	EXPECT_EQ(fn("rec")->inclusive, fn("rec")->self);
+	EXPECT_EQ(cg->stats.max_depth, 4u);
+	EXPECT_EQ(cg->nedges, 2u);
+}
+
+// leaf returns straight to main, past helper: both frames close
+TEST_F(CallgraphTest, ReturnsUnwindSkippedFrames)
+{
+	std::vector<u32> program = {
+		0x00000497, // auipc s1, 0
+		0x00C48493, // addi s1, s1, 12
+		0x018000EF, // jal ra, helper
+		0x00100073, // ebreak
+	};
+
+	program.resize(8, 0x00000013);
+	program.insert(program.end(), {
+		0x010000EF, // helper: jal ra, leaf
+		0x00008067, // ret
+		0x00000013, // nop
+		0x00000013, // nop
+		0x00048093, // leaf: mv ra, s1
+		0x00008067, // ret
+	});
+	load_program(program);
+	profile(&syms);
+
+	EXPECT_EQ(cg->stats.returns, 1u);
+	EXPECT_EQ(cg->stats.unmatched, 0u);
+	EXPECT_EQ(fn("helper")->self, 1u);
+	EXPECT_EQ(fn("helper")->inclusive, 3u);
+	EXPECT_EQ(fn("leaf")->inclusive, 2u);
+	EXPECT_EQ(fn("main")->self, 4u);
+}
+
+// A return to an address no frame expects is only a jump
+TEST_F(CallgraphTest, UnmatchedReturnIsAJump)
+{
+	load_program({
+		0x00000097, // auipc ra, 0
+		0x00C08093, // addi ra, ra, 12
+		0x00008067, // ret
+		0x00100073, // ebreak
+	});
+	profile(&syms);
+
+	EXPECT_EQ(cg->stats.unmatched, 1u);
+	EXPECT_EQ(cg->nfns, 1u);
+	EXPECT_EQ(fn("main")->self, 4u);
+}
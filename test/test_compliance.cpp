@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <elf.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+#include "elf_file.h"
+}
+
+// ISA conformance against the official riscv-tests (rv32ui, rv32um, rv32ua
+// in the bare "p" environment) and riscv-arch-test ELFs. Point RISCV_TESTS
+// at the built isa/ directory; `make compliance` shards the suite over all
+// host cores. Without the directory the suite is skipped.
+#define COMPLIANCE_MEM (4u << 20)
+#define COMPLIANCE_BUDGET 50000000ull
+#define COMPLIANCE_CHUNK 10000
+
+static bool is_compliance_test(const std::string &name)
+{
+	static const char *const prefixes[] = { "rv32ui-p-", "rv32um-p-",
+						"rv32ua-p-" };
+
+	if (name.size() > 4 && name.compare(name.size() - 4, 4, ".elf") == 0)
+		return true;
+	for (const char *p : prefixes) {
+		if (name.compare(0, strlen(p), p) == 0 &&
+		    name.find('.') == std::string::npos)
+			return true;
+	}
+	return false;
+}
+
+static std::vector<std::string> compliance_tests()
+{
+	std::vector<std::string> names;
+	const char *dir = getenv("RISCV_TESTS");
+	DIR *d = dir ? opendir(dir) : NULL;
+	struct dirent *e;
+
+	while (d && (e = readdir(d))) {
+		if (is_compliance_test(e->d_name))
+			names.push_back(e->d_name);
+	}
+	if (d)
+		closedir(d);
+	// Every shard must see the same list in the same order
+	std::sort(names.begin(), names.end());
+	if (names.empty())
+		names.push_back("none");
+	return names;
+}
+
+static void exit_syscall(struct cpu *c, void *opaque)
+{
+	*(bool *)opaque = true;
+	c->exit_code = c->registers[10];
+	cpu_halt(c, CPU_STOP_HALT);
+}
+
+/*
+ * Run one test to completion. It passes by writing 1 to `tohost` (the
+ * riscv-tests convention, failures write test_number << 1 | 1) or by
+ * exit(0) when it has no trap handler. Returns "" on a pass, otherwise
+ * why it failed.
+ */
+static std::string run_elf(const std::string &path)
+{
+	struct cpu *c = cpu_create(COMPLIANCE_MEM);
+	struct elf_image img;
+	struct symtab syms;
+	std::string why;
+	bool exited = false;
+	u32 tohost = ~0u;
+	u64 n;
+
+	if (!elf_load(path.c_str(), c->memory, c->mem_size, &img)) {
+		cpu_destroy(c);
+		return "cannot load " + path;
+	}
+	if (elf_read_symbols(path.c_str(), &syms)) {
+		for (u32 i = 0; i < syms.count; i++) {
+			if (!strcmp(syms.syms[i].name, "tohost") &&
+			    syms.syms[i].addr - img.base <= c->mem_size - 4)
+				tohost = syms.syms[i].addr - img.base;
+		}
+		symtab_free(&syms);
+	}
+	c->pc = img.entry;
+	cpu_register_syscall(c, 93, exit_syscall, &exited);
+
+	for (n = 0; n < COMPLIANCE_BUDGET && why.empty();
+	     n += COMPLIANCE_CHUNK) {
+		enum cpu_stop stop = cpu_run_for(c, COMPLIANCE_CHUNK, NULL);
+		u32 v = tohost != ~0u ? mem_load32(c->memory, tohost) : 0;
+
+		if (v == 1)
+			break;
+		if (v)
+			why = "failed test " + std::to_string(v >> 1);
+		else if (stop == CPU_STOP_HALT && exited && c->exit_code == 0)
+			break;
+		else if (stop == CPU_STOP_HALT && exited)
+			why = "exit(" + std::to_string(c->exit_code) + ")";
+		else if (stop != CPU_STOP_BUDGET) {
+			char pc[16];
+
+			snprintf(pc, sizeof(pc), "0x%08x", c->pc + img.base);
+			why = std::string("stopped without a result at pc ") + pc;
+		}
+	}
+	if (n >= COMPLIANCE_BUDGET)
+		why = "no result after " + std::to_string(n) + " instructions";
+	cpu_destroy(c);
+	return why;
+}
+
+class ComplianceTest : public ::testing::TestWithParam<std::string> {};
+
+TEST_P(ComplianceTest, Passes)
+{
+	if (GetParam() == "none")
+		GTEST_SKIP() << "set RISCV_TESTS to the riscv-tests isa directory";
+	std::string why =
+		run_elf(std::string(getenv("RISCV_TESTS")) + "/" + GetParam());
+
+	// `make compliance` greps the shard logs for this line
+	EXPECT_TRUE(why.empty()) << "compliance: " << GetParam() << ": " << why;
+}
+
+INSTANTIATE_TEST_SUITE_P(Compliance, ComplianceTest,
+			 ::testing::ValuesIn(compliance_tests()),
+			 [](const testing::TestParamInfo<std::string> &info) {
+				 std::string name = info.param;
+
+				 for (char &ch : name) {
+					 if (!isalnum((unsigned char)ch))
+						 ch = '_';
+				 }
+				 return name;
+			 });
+
+// A miniature riscv-tests program linked at 0x80000000: install a trap
+// vector, put the result in gp, ECALL; the handler stores gp to tohost.
+class ElfLoadTest : public ::testing::Test {
+    protected:
+	std::string path = testing::TempDir() + "compliance.elf";
+
+	void TearDown() override
+	{
+		remove(path.c_str());
+	}
+
+	void write_test(u32 gp_insn)
+	{
+		const u32 code[] = {
+			0x00000297, // auipc t0, 0
+			0x02028293, // addi t0, t0, 0x20
+			0x30529073, // csrw mtvec, t0
+			gp_insn, // addi gp, zero, result
+			0x00000073, // ecall
+			0x00000013, // nop
+			0x00000013, // nop
+			0x00000013, // nop
+			0x00000F17, // trap: auipc t5, 0
+			0x0E3F2023, // sw gp, 0xE0(t5) # tohost
+			0x0000006F, // j .
+		};
+		const char strtab[] = "\0tohost";
+		Elf32_Sym st[2] = {};
+		Elf32_Shdr sh[3] = {};
+		Elf32_Phdr ph = {};
+		Elf32_Ehdr eh = {};
+		u32 text = sizeof(eh) + sizeof(ph);
+		FILE *fp;
+
+		st[1].st_name = 1;
+		st[1].st_value = 0x80000100;
+		st[1].st_size = 8;
+		st[1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT);
+		st[1].st_shndx = 1;
+
+		memcpy(eh.e_ident, ELFMAG, SELFMAG);
+		eh.e_ident[EI_CLASS] = ELFCLASS32;
+		eh.e_ident[EI_DATA] = ELFDATA2LSB;
+		eh.e_machine = EM_RISCV;
+		eh.e_entry = 0x80000000;
+		eh.e_phoff = sizeof(eh);
+		eh.e_phentsize = sizeof(ph);
+		eh.e_phnum = 1;
+		eh.e_shentsize = sizeof(Elf32_Shdr);
+		eh.e_shnum = 3;
+		eh.e_shoff = text + sizeof(code) + sizeof(st) + sizeof(strtab);
+		// tohost lies in the zero-filled part of the segment
+		ph.p_type = PT_LOAD;
+		ph.p_offset = text;
+		ph.p_vaddr = ph.p_paddr = 0x80000000;
+		ph.p_filesz = sizeof(code);
+		ph.p_memsz = 0x108;
+		sh[1].sh_type = SHT_SYMTAB;
+		sh[1].sh_offset = text + sizeof(code);
+		sh[1].sh_size = sizeof(st);
+		sh[1].sh_link = 2;
+		sh[2].sh_type = SHT_STRTAB;
+		sh[2].sh_offset = text + sizeof(code) + sizeof(st);
+		sh[2].sh_size = sizeof(strtab);
+
+		fp = fopen(path.c_str(), "wb");
+		ASSERT_NE(fp, nullptr);
+		fwrite(&eh, sizeof(eh), 1, fp);
+		fwrite(&ph, sizeof(ph), 1, fp);
+		fwrite(code, sizeof(code), 1, fp);
+		fwrite(st, sizeof(st), 1, fp);
+		fwrite(strtab, sizeof(strtab), 1, fp);
+		fwrite(sh, sizeof(sh), 1, fp);
+		fclose(fp);
+	}
+};
+
+TEST_F(ElfLoadTest, LoadsSegmentsAtZero)
+{
+	struct elf_image img;
+	std::vector<u8> mem(0x1000, 0xAA);
+
+	write_test(0x00100193); // addi gp, zero, 1
+	ASSERT_TRUE(elf_load(path.c_str(), mem.data(), mem.size(), &img));
+	EXPECT_EQ(img.base, 0x80000000u);
+	EXPECT_EQ(img.entry, 0u);
+	EXPECT_EQ(img.size, 0x108u);
+	EXPECT_EQ(mem_load32(mem.data(), 0), 0x00000297u);
+	EXPECT_EQ(mem_load32(mem.data(), 0x100), 0u); // cleared
+	EXPECT_EQ(mem[0x108], 0xAA); // past the segment
+
+	EXPECT_FALSE(elf_load(path.c_str(), mem.data(), 0x100, &img));
+	EXPECT_FALSE(elf_load("no-such-file.elf", mem.data(), mem.size(), &img));
+}
+
+TEST_F(ElfLoadTest, ToHostPass)
+{
+	write_test(0x00100193); // addi gp, zero, 1
+	EXPECT_EQ(run_elf(path), "");
+}
+
+TEST_F(ElfLoadTest, ToHostFail)
+{
+	write_test(0x00700193); // addi gp, zero, 3 << 1 | 1
+	EXPECT_EQ(run_elf(path), "failed test 3");
+}
+
+TEST(ComplianceNames, Selection)
+{
+	EXPECT_TRUE(is_compliance_test("rv32ui-p-add"));
+	EXPECT_TRUE(is_compliance_test("rv32ua-p-amoadd_w"));
+	EXPECT_TRUE(is_compliance_test("add-01.elf"));
+	EXPECT_FALSE(is_compliance_test("rv32ui-p-add.dump"));
+	EXPECT_FALSE(is_compliance_test("rv32ui-v-add"));
+	EXPECT_FALSE(is_compliance_test("rv32uf-p-fadd"));
+}
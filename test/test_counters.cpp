@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "clint.h"
+#include "idle.h"
+#include "trace.h"
+#include "vmcall.h"
+}
+
+class CounterTest : public CpuTest {};
+
+TEST_F(CounterTest, InstretCountsRetiredInstructions)
+{
+	load_program(cpu, {
+		0xC0202573, // csrr a0, instret
+		0x00000013, // nop
+		0x00000013, // nop
+		0x00000013, // nop
+		0xC02025F3, // csrr a1, instret
+		0xC0002673, // csrr a2, cycle
+		0x00100073, // ebreak
+	});
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[10], 0u);
+	EXPECT_EQ(cpu->registers[11], 4u);
+	EXPECT_EQ(cpu->registers[12], 5u);
+}
+
+// Inside a block the count is rebuilt from instructions of both sizes
+TEST_F(CounterTest, ReadInsideBlockWithCompressedCode)
+{
+	load_program(cpu, {
+		0x00010001, // c.nop; c.nop
+		0x00000013, // nop
+		0x00010001, // c.nop; c.nop
+		0xC0202573, // csrr a0, instret
+		0x00100073, // ebreak
+	});
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->registers[10], 5u);
+	EXPECT_EQ(cpu->insn_count, 7u);
+}
+
+// Runs a three-instruction guest function from the middle of a block
+static void call_guest(struct cpu *c, void *opaque)
+{
+	EXPECT_EQ(vmcall(c, 0x40, NULL, 0, 100, NULL), VMCALL_OK);
+	(void)opaque;
+}
+
+TEST_F(CounterTest, NestedRunsCountOnce)
+{
+	std::vector<u32> program = {
+		0x1F400893, // addi a7, zero, 500
+		0x00000073, // ecall
+		0xC0202573, // csrr a0, instret
+		0x00100073, // ebreak
+	};
+
+	program.resize(16, 0x00000013);
+	program.insert(program.end(), {
+		0x00000013, // 0x40: nop
+		0x00000013, // nop
+		0x00008067, // ret
+	});
+	load_program(cpu, program);
+	ASSERT_TRUE(cpu_register_syscall(cpu, 500, call_guest, NULL));
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[10], 5u);
+	EXPECT_EQ(cpu->insn_count, 7u);
+}
+
+// The illegal csrw is stepped, and counts as a cycle, but does not retire
+TEST_F(CounterTest, ExceptionsDoNotRetire)
+{
+	std::vector<u32> program = {
+		0x00000297, // auipc t0, 0
+		0x04028293, // addi t0, t0, 0x40
+		0x30529073, // csrw mtvec, t0
+		0xC0202573, // csrr a0, instret
+		0xC0001073, // csrw cycle, zero (read-only)
+		0xC02025F3, // csrr a1, instret
+		0xC0002673, // csrr a2, cycle
+		0x00100073, // ebreak
+	};
+
+	program.resize(16, 0x00000013);
+	program.insert(program.end(), {
+		0x341022F3, // handler: csrr t0, mepc
+		0x00428293, // addi t0, t0, 4
+		0x34129073, // csrw mepc, t0
+		0x30200073, // mret
+	});
+	load_program(cpu, program);
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	EXPECT_EQ(cpu->registers[10], 3u);
+	EXPECT_EQ(cpu->registers[11], 8u);
+	EXPECT_EQ(cpu->registers[12], 10u);
+}
+
+TEST_F(CounterTest, TimeIsMtime)
+{
+	load_program(cpu, {
+		0xC0102573, // csrr a0, time
+		0xC81025F3, // csrr a1, timeh
+		0x00100073, // ebreak
+	});
+	cpu->clint.mtime_offset = (3ull << 32) - 1;
+	cpu_run(cpu);
+	// Read after one instruction: the low word has wrapped
+	EXPECT_EQ(cpu->registers[10], 0xFFFFFFFFu);
+	EXPECT_EQ(cpu->registers[11], 3u);
+}
+
+// Written values are what the next instruction reads
+TEST_F(CounterTest, MachineCountersAreWritable)
+{
+	load_program(cpu, {
+		0xB0251073, // csrw minstret, a0
+		0xB0202673, // csrr a2, minstret
+		0xB8059073, // csrw mcycleh, a1
+		0xB80026F3, // csrr a3, mcycleh
+		0xC0202573, // csrr a0, instret
+		0xC0002773, // csrr a4, cycle
+		0x00100073, // ebreak
+	});
+	cpu->registers[10] = 100;
+	cpu->registers[11] = 7;
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->registers[12], 100u);
+	EXPECT_EQ(cpu->registers[13], 7u);
+	EXPECT_EQ(cpu->registers[10], 103u);
+	EXPECT_EQ(cpu->registers[14], 5u);
+	EXPECT_EQ(cpu->csr.mcycle_offset >> 32, 7u);
+}
+
+TEST_F(CounterTest, CounterEnable)
+{
+	static const struct {
+		u32 priv, mcounteren, scounteren;
+		bool ok;
+	} cases[] = {
+		{ PRV_U, 0, 0, false },
+		{ PRV_U, 1, 0, false },
+		{ PRV_U, 1, 1, true },
+		{ PRV_S, 1, 0, true },
+		{ PRV_S, 2, 1, false }, // time only
+		{ PRV_M, 0, 0, true },
+	};
+
+	for (const auto &t : cases) {
+		cpu_reset(cpu);
+		load_program(cpu, {
+			0xC0002573, // csrr a0, cycle
+			0x00100073, // ebreak
+		});
+		mem_store32(cpu->memory, 0x40, 0x00100073); // ebreak
+		cpu->csr.mtvec = 0x40;
+		cpu->priv = t.priv;
+		cpu->csr.mcounteren = t.mcounteren;
+		cpu->csr.scounteren = t.scounteren;
+		cpu_run(cpu);
+		EXPECT_EQ(cpu->pc, t.ok ? 4u : 0x40u)
+			<< "priv " << t.priv << " mcounteren " << t.mcounteren
+			<< " scounteren " << t.scounteren;
+	}
+}
+
+// Traces add up whole runs of instructions; the count is still exact
+TEST_F(CounterTest, InstretExactWithTraces)
+{
+	struct trace_cache *tc = trace_cache_create();
+
+	ASSERT_NE(tc, nullptr);
+	cpu->traces = tc;
+	load_program(cpu, {
+		0x3E800293, // addi t0, zero, 1000
+		0xFFF28293, // loop: addi t0, t0, -1
+		0xFE029EE3, // bnez t0, loop
+		0xC0202573, // csrr a0, instret
+		0x00100073, // ebreak
+	});
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[10], 2001u);
+	cpu->traces = NULL;
+	trace_cache_destroy(tc);
+}
+
+// A loop polling rdtime or rdcycle is skipped like one polling mtime and
+// ends in the same state as one that ran
+TEST_F(CounterTest, PollingLoopsAreSkipped)
+{
+	for (u32 read : { 0xC01022F3u, 0xC00022F3u }) { // csrr t0, time/cycle
+		struct cpu *fast = cpu_create(MEM_SIZE);
+		struct idle *d = idle_create();
+
+		ASSERT_NE(d, nullptr);
+		fast->idle = d;
+		cpu_reset(cpu);
+		for (struct cpu *c : { cpu, fast }) {
+			load_program(c, {
+				read, // poll: csrr t0, counter
+				0xFEA2EEE3, // bltu t0, a0, poll
+				0x00100073, // ebreak
+			});
+			c->csr.mcycle_offset = 12345;
+			c->registers[10] = 100000;
+			cpu_run(c);
+			EXPECT_EQ(c->stop, CPU_STOP_BREAKPOINT);
+		}
+		EXPECT_EQ(fast->registers[5], cpu->registers[5]);
+		EXPECT_EQ(fast->insn_count, cpu->insn_count);
+		EXPECT_GE(fast->registers[5], 100000u);
+		EXPECT_EQ(d->stats.polls, 1u);
+		EXPECT_GT(d->stats.skipped, 40000u);
+		cpu_destroy(fast);
+		idle_destroy(d);
+	}
+}
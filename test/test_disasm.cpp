@@ -0,0 +1,194 @@
+#include <gtest/gtest.h>
+#include <elf.h>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "disassembler.h"
+#include "elf_file.h"
+#include "insn.h"
+}
+
+class DisasmTest : public ::testing::Test {
+    protected:
+	std::string range(const std::vector<u8> &image, u32 base,
+			  const struct symtab *syms, unsigned threads)
+	{
+		std::vector<char> arena(
+			disassemble_range_bound(image.size(), syms));
+		size_t n = disassemble_range(image.data(), base, image.size(),
+					     syms, arena.data(), arena.size(),
+					     threads);
+
+		EXPECT_EQ(strlen(arena.data()), n);
+		return std::string(arena.data(), n);
+	}
+
+	static void put32(std::vector<u8> &image, u32 raw)
+	{
+		for (int i = 0; i < 4; ++i)
+			image.push_back(raw >> (8 * i));
+	}
+
+	static void put16(std::vector<u8> &image, u32 raw)
+	{
+		image.push_back(raw);
+		image.push_back(raw >> 8);
+	}
+};
+
+TEST_F(DisasmTest, RangeWithSymbols)
+{
+	const struct symbol in[] = {
+		{ 0x1000, 10, "start" },
+		{ 0x100A, 2, "loop" },
+		{ 0x1000, 0, "_start" }, // alias, only the first gets a header
+	};
+	struct symtab syms;
+	std::vector<u8> image;
+
+	ASSERT_TRUE(symtab_init(&syms, in, 3));
+	put32(image, 0x00100513); // addi a0, zero, 1
+	put16(image, 0x4589); // c.li a1, 2
+	put32(image, 0xFFFFF06F); // jal zero, -2
+	put16(image, 0x0001); // c.nop
+	image.push_back(0x13); // half of an instruction
+
+	EXPECT_EQ(range(image, 0x1000, &syms, 1),
+		  "\n"
+		  "00001000 <start>:\n"
+		  "00001000:  00100513  addi a0, zero, 1\n"
+		  "00001004:  4589      c.li a1, 2\n"
+		  "00001006:  fffff06f  jal zero, -2 <start+0x4>\n"
+		  "\n"
+		  "0000100a <loop>:\n"
+		  "0000100a:  0001      c.nop\n"
+		  "0000100c:  .byte 0x13\n");
+	EXPECT_EQ(range(image, 0x1000, NULL, 1),
+		  "00001000:  00100513  addi a0, zero, 1\n"
+		  "00001004:  4589      c.li a1, 2\n"
+		  "00001006:  fffff06f  jal zero, -2\n"
+		  "0000100a:  0001      c.nop\n"
+		  "0000100c:  .byte 0x13\n");
+	symtab_free(&syms);
+}
+
+TEST_F(DisasmTest, ArenaTooSmall)
+{
+	std::vector<u8> image(16, 0);
+	char arena[16];
+
+	EXPECT_EQ(disassemble_range(image.data(), 0, image.size(), NULL,
+				    arena, sizeof(arena), 1),
+		  0u);
+}
+
+TEST_F(DisasmTest, ThreadsMatchSingleThread)
+{
+	std::mt19937 rng(7);
+	std::vector<struct symbol> in;
+	std::vector<std::string> names;
+	struct symtab syms;
+	std::vector<u8> image;
+
+	// Mixed 16- and 32-bit code, so chunk boundaries need realigning
+	while (image.size() < (1u << 20)) {
+		if (rng() % 3 == 0) {
+			put16(image, (rng() & 0xFFFC) | rng() % 3);
+		} else {
+			const struct insn_info *e =
+				&insn_info[1 + rng() % (INSN_COUNT - 1)];
+
+			put32(image, e->match | (rng() & ~e->mask));
+		}
+	}
+	for (int i = 0; i < 512; ++i)
+		names.push_back("sym" + std::to_string(i));
+	for (int i = 0; i < 512; ++i)
+		in.push_back({ (u32)(rng() % image.size()) & ~1u, 0,
+			       names[i].c_str() });
+	ASSERT_TRUE(symtab_init(&syms, in.data(), in.size()));
+
+	std::string one = range(image, 0x80000000, &syms, 1);
+	EXPECT_EQ(range(image, 0x80000000, &syms, 4), one);
+	EXPECT_EQ(range(image, 0x80000000, &syms, 7), one);
+	symtab_free(&syms);
+}
+
+TEST_F(DisasmTest, ReadElfSymbols)
+{
+	// ELF header, then .symtab, .strtab and the section headers
+	const char strtab[] = "\0main\0data\0$x\0undef";
+	Elf32_Sym st[5] = {};
+	Elf32_Shdr sh[3] = {};
+	Elf32_Ehdr eh = {};
+	std::string path = testing::TempDir() + "disasm_syms.elf";
+	struct symtab syms;
+	FILE *fp;
+
+	st[1].st_name = 1;
+	st[1].st_value = 0x100;
+	st[1].st_size = 8;
+	st[1].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+	st[1].st_shndx = 1;
+	st[2].st_name = 6;
+	st[2].st_value = 0x40;
+	st[2].st_info = ELF32_ST_INFO(STB_LOCAL, STT_OBJECT);
+	st[2].st_shndx = 1;
+	st[3].st_name = 11; // mapping symbol
+	st[3].st_value = 0x100;
+	st[3].st_shndx = 1;
+	st[4].st_name = 14; // undefined
+	st[4].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+
+	memcpy(eh.e_ident, ELFMAG, SELFMAG);
+	eh.e_ident[EI_CLASS] = ELFCLASS32;
+	eh.e_ident[EI_DATA] = ELFDATA2LSB;
+	eh.e_machine = EM_RISCV;
+	eh.e_shentsize = sizeof(Elf32_Shdr);
+	eh.e_shnum = 3;
+	eh.e_shoff = sizeof(eh) + sizeof(st) + sizeof(strtab);
+	sh[1].sh_type = SHT_SYMTAB;
+	sh[1].sh_offset = sizeof(eh);
+	sh[1].sh_size = sizeof(st);
+	sh[1].sh_link = 2;
+	sh[2].sh_type = SHT_STRTAB;
+	sh[2].sh_offset = sizeof(eh) + sizeof(st);
+	sh[2].sh_size = sizeof(strtab);
+
+	fp = fopen(path.c_str(), "wb");
+	ASSERT_NE(fp, nullptr);
+	fwrite(&eh, sizeof(eh), 1, fp);
+	fwrite(st, sizeof(st), 1, fp);
+	fwrite(strtab, sizeof(strtab), 1, fp);
+	fwrite(sh, sizeof(sh), 1, fp);
+	fclose(fp);
+
+	ASSERT_TRUE(elf_read_symbols(path.c_str(), &syms));
+	ASSERT_EQ(syms.count, 2u);
+	EXPECT_STREQ(syms.syms[0].name, "data");
+	EXPECT_STREQ(syms.syms[1].name, "main");
+	EXPECT_EQ(symtab_find(&syms, 0x104), &syms.syms[1]);
+	EXPECT_EQ(symtab_find(&syms, 0x80), &syms.syms[0]);
+	EXPECT_EQ(symtab_find(&syms, 0x10), nullptr);
+	symtab_free(&syms);
+
+	// Not an RV32 ELF
+	eh.e_machine = EM_X86_64;
+	fp = fopen(path.c_str(), "r+b");
+	ASSERT_NE(fp, nullptr);
+	fwrite(&eh, sizeof(eh), 1, fp);
+	fclose(fp);
+	EXPECT_FALSE(elf_read_symbols(path.c_str(), &syms));
+	remove(path.c_str());
+}
+
+TEST_F(DisasmTest, RegisterNames)
+{
+	EXPECT_STREQ(reg_abi_name(0), "zero");
+	EXPECT_STREQ(reg_abi_name(31), "t6");
+	EXPECT_STREQ(reg_abi_name(32), "inv");
+}
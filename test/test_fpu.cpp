@@ -0,0 +1,563 @@
+#include <gtest/gtest.h>
+#include <cfenv>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "insn.h"
+#include "fpu.h"
+#include "disassembler.h"
+}
+
+// Encodings and text from the LLVM assembler
+static const struct {
+	u32 raw;
+	const char *text;
+} disasm_cases[] = {
+	{ 0x00812507, "flw fa0, 8(sp)" },
+	{ 0xFEA5AE27, "fsw fa0, -4(a1)" },
+	{ 0x01053407, "fld fs0, 16(a0)" },
+	{ 0xFFB53C27, "fsd fs11, -8(a0)" },
+	{ 0x68C5F543, "fmadd.s fa0, fa1, fa2, fa3, dyn" },
+	{ 0x18208047, "fmsub.s ft0, ft1, ft2, ft3, rne" },
+	{ 0xFAC5A54B, "fnmsub.d fa0, fa1, fa2, ft11, rdn" },
+	{ 0xAB49C94F, "fnmadd.d fs2, fs3, fs4, fs5, rmm" },
+	{ 0x00C5F553, "fadd.s fa0, fa1, fa2, dyn" },
+	{ 0x0AC59553, "fsub.d fa0, fa1, fa2, rtz" },
+	{ 0x11EEBE53, "fmul.s ft8, ft9, ft10, rup" },
+	{ 0x1AC5F553, "fdiv.d fa0, fa1, fa2, dyn" },
+	{ 0x5800F053, "fsqrt.s ft0, ft1, dyn" },
+	{ 0x5A008053, "fsqrt.d ft0, ft1, rne" },
+	{ 0x20C58553, "fsgnj.s fa0, fa1, fa2" },
+	{ 0x22C59553, "fsgnjn.d fa0, fa1, fa2" },
+	{ 0x20B5A553, "fsgnjx.s fa0, fa1, fa1" },
+	{ 0x28C58553, "fmin.s fa0, fa1, fa2" },
+	{ 0x2AC59553, "fmax.d fa0, fa1, fa2" },
+	{ 0xC0051553, "fcvt.w.s a0, fa0, rtz" },
+	{ 0xC0157553, "fcvt.wu.s a0, fa0, dyn" },
+	{ 0xC20442D3, "fcvt.w.d t0, fs0, rmm" },
+	{ 0xC2157553, "fcvt.wu.d a0, fa0, dyn" },
+	{ 0xD0057553, "fcvt.s.w fa0, a0, dyn" },
+	{ 0xD0151553, "fcvt.s.wu fa0, a0, rtz" },
+	{ 0xD2050553, "fcvt.d.w fa0, a0" },
+	{ 0xD2148553, "fcvt.d.wu fa0, s1" },
+	{ 0x4015F553, "fcvt.s.d fa0, fa1, dyn" },
+	{ 0x42058553, "fcvt.d.s fa0, fa1" },
+	{ 0xE0050553, "fmv.x.w a0, fa0" },
+	{ 0xF0000553, "fmv.w.x fa0, zero" },
+	{ 0xA0B52553, "feq.s a0, fa0, fa1" },
+	{ 0xA0B51553, "flt.s a0, fa0, fa1" },
+	{ 0xA2B50553, "fle.d a0, fa0, fa1" },
+	{ 0xA2B52553, "feq.d a0, fa0, fa1" },
+	{ 0xE00F9553, "fclass.s a0, ft11" },
+	{ 0xE2051553, "fclass.d a0, fa0" },
+	{ 0x6522, "c.flwsp fa0, 8(sp)" },
+	{ 0x61C8, "c.flw fa0, 4(a1)" },
+	{ 0xE1C8, "c.fsw fa0, 4(a1)" },
+	{ 0xE422, "c.fswsp fs0, 8(sp)" },
+	{ 0x2588, "c.fld fa0, 8(a1)" },
+	{ 0xA588, "c.fsd fa0, 8(a1)" },
+	{ 0x2422, "c.fldsp fs0, 8(sp)" },
+	{ 0xA422, "c.fsdsp fs0, 8(sp)" },
+};
+
+#define FA0 10
+#define FA1 11
+#define FA2 12
+#define FA3 13
+#define A0 10
+#define A1 11
+
+// OP-FP: funct7 selects the op and format, rs2 may extend it
+static u32 op_fp(u32 funct7, u32 rd, u32 rs1, u32 rs2, u32 rm)
+{
+	return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (rm << 12) |
+	       (rd << 7) | 0x53;
+}
+
+#define FADD_S 0x00
+#define FADD_D 0x01
+#define FMUL_D 0x09
+#define FDIV_S 0x0C
+#define FSQRT_D 0x2D
+#define FSGNJ_S 0x10
+#define FMIN_S 0x14
+#define FMIN_D 0x15
+#define FCVT_S_D 0x20
+#define FCMP_S 0x50
+#define FCVT_W_S 0x60
+#define FCVT_W_D 0x61
+#define FCVT_S_W 0x68
+#define FCLASS_S 0x70
+#define FMV_W_X 0x78
+
+class FpuTest : public CpuTest {
+    protected:
+	void SetUp() override
+	{
+		CpuTest::SetUp();
+		cpu->csr.mtvec = 0x100;
+	}
+
+	void run(u32 raw)
+	{
+		cpu->state = CPU_STATE_RUNNING;
+		cpu->csr.mcause = 0;
+		cpu->pc = 0;
+		mem_store32(cpu->memory, 0, raw);
+		cpu_step(cpu);
+	}
+
+	void set_s(u32 r, float x)
+	{
+		u32 b;
+
+		memcpy(&b, &x, 4);
+		cpu->fpu.f[r] = F32_BOX | b;
+	}
+
+	void set_d(u32 r, double x)
+	{
+		memcpy(&cpu->fpu.f[r], &x, 8);
+	}
+
+	u32 bits_s(u32 r)
+	{
+		EXPECT_EQ(cpu->fpu.f[r] & F32_BOX, F32_BOX) << "not NaN-boxed";
+		return (u32)cpu->fpu.f[r];
+	}
+
+	float get_s(u32 r)
+	{
+		u32 b = bits_s(r);
+		float x;
+
+		memcpy(&x, &b, 4);
+		return x;
+	}
+
+	double get_d(u32 r)
+	{
+		double x;
+
+		memcpy(&x, &cpu->fpu.f[r], 8);
+		return x;
+	}
+
+	// Read and clear fflags
+	u32 take_fflags()
+	{
+		u32 v = 0;
+
+		EXPECT_TRUE(csr_read(cpu, CSR_FFLAGS, &v));
+		EXPECT_TRUE(csr_write(cpu, CSR_FFLAGS, 0));
+		return v;
+	}
+};
+
+TEST_F(FpuTest, Disassembly)
+{
+	char buf[64];
+
+	for (const auto &tc : disasm_cases) {
+		disassemble(tc.raw, buf, sizeof(buf));
+		EXPECT_STREQ(buf, tc.text);
+	}
+}
+
+TEST_F(FpuTest, Arithmetic)
+{
+	set_s(FA1, 1.5f);
+	set_s(FA2, 2.25f);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(get_s(FA0), 3.75f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_RNE));
+	EXPECT_EQ(get_s(FA0), 1.5f / 2.25f);
+
+	set_d(FA1, 3.0);
+	set_d(FA2, -0.5);
+	run(op_fp(FMUL_D, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(get_d(FA0), -1.5);
+	set_d(FA1, 2.0);
+	run(op_fp(FSQRT_D, FA0, FA1, 0, FRM_DYN));
+	EXPECT_EQ(get_d(FA0), std::sqrt(2.0));
+
+	// fnmsub.d fa0, fa1, fa2, fa3: -(fa1 * fa2) + fa3
+	set_d(FA1, 3.0);
+	set_d(FA2, 4.0);
+	set_d(FA3, 100.0);
+	run(0x6AC5F54B);
+	EXPECT_EQ(get_d(FA0), 88.0);
+
+	// fcvt.s.w and fcvt.d.s
+	cpu->registers[A1] = (u32)-7;
+	run(op_fp(FCVT_S_W, FA0, A1, 0, FRM_DYN));
+	EXPECT_EQ(get_s(FA0), -7.0f);
+	run(0x42050553); // fcvt.d.s fa0, fa0
+	EXPECT_EQ(get_d(FA0), -7.0);
+	// The division and square root were inexact
+	EXPECT_EQ(take_fflags(), FFLAG_NX);
+}
+
+TEST_F(FpuTest, NanBoxing)
+{
+	// fmv.w.x boxes, fmv.x.w reads the low half whatever the box
+	cpu->registers[A1] = 0x3F800000;
+	run(op_fp(FMV_W_X, FA0, A1, 0, 0));
+	EXPECT_EQ(cpu->fpu.f[FA0], F32_BOX | 0x3F800000);
+	cpu->fpu.f[FA1] = 0x123456783F800000ull;
+	run(0xE0058553); // fmv.x.w a0, fa1
+	EXPECT_EQ(cpu->registers[A0], 0x3F800000u);
+
+	// An unboxed single is the canonical NaN to arithmetic and fsgnj
+	set_s(FA2, 1.0f);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(bits_s(FA0), F32_QNAN);
+	run(op_fp(FSGNJ_S, FA0, FA1, FA2, 0));
+	EXPECT_EQ(bits_s(FA0), F32_QNAN);
+	run(op_fp(FCLASS_S, A0, FA1, 0, 1));
+	EXPECT_EQ(cpu->registers[A0], 1u << 9);
+
+	// NaN results are canonical, sign injection keeps payloads
+	cpu->fpu.f[FA1] = F32_BOX | 0xFFC01234;
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(bits_s(FA0), F32_QNAN);
+	run(op_fp(FSGNJ_S, FA0, FA1, FA2, 0));
+	EXPECT_EQ(bits_s(FA0), 0x7FC01234u);
+	set_d(FA1, NAN);
+	cpu->fpu.f[FA1] |= 0x1234;
+	set_d(FA2, 1.0);
+	run(op_fp(FADD_D, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(cpu->fpu.f[FA0], F64_QNAN);
+}
+
+TEST_F(FpuTest, RoundingModes)
+{
+	const float up = 1.0f + FLT_EPSILON;
+	const struct {
+		u32 rm;
+		float pos, neg; // 1 + 2^-24, a tie, and its negation
+	} cases[] = {
+		{ FRM_RNE, 1.0f, -1.0f }, { FRM_RTZ, 1.0f, -1.0f },
+		{ FRM_RDN, 1.0f, -up },	  { FRM_RUP, up, -1.0f },
+		{ FRM_RMM, up, -up },
+	};
+
+	for (const auto &tc : cases) {
+		SCOPED_TRACE(tc.rm);
+		set_s(FA1, 1.0f);
+		set_s(FA2, FLT_EPSILON / 2);
+		run(op_fp(FADD_S, FA0, FA1, FA2, tc.rm));
+		EXPECT_EQ(get_s(FA0), tc.pos);
+
+		// The same through frm
+		csr_write(cpu, CSR_FRM, tc.rm);
+		set_s(FA1, -1.0f);
+		set_s(FA2, -FLT_EPSILON / 2);
+		run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+		EXPECT_EQ(get_s(FA0), tc.neg);
+		csr_write(cpu, CSR_FRM, FRM_RNE);
+		EXPECT_EQ(take_fflags(), FFLAG_NX);
+	}
+
+	// RMM ties from a product, an integer and a narrowing conversion,
+	// where nearest-even rounds down
+	set_d(FA1, 1.0 + 3 * DBL_EPSILON);
+	set_d(FA2, 1.5);
+	run(op_fp(FMUL_D, FA0, FA1, FA2, FRM_RNE));
+	EXPECT_EQ(get_d(FA0), 1.5 + 4 * DBL_EPSILON);
+	run(op_fp(FMUL_D, FA0, FA1, FA2, FRM_RMM));
+	EXPECT_EQ(get_d(FA0), 1.5 + 5 * DBL_EPSILON);
+
+	cpu->registers[A1] = (1u << 24) + 1;
+	run(op_fp(FCVT_S_W, FA0, A1, 0, FRM_RNE));
+	EXPECT_EQ(get_s(FA0), 16777216.0f);
+	run(op_fp(FCVT_S_W, FA0, A1, 0, FRM_RMM));
+	EXPECT_EQ(get_s(FA0), 16777218.0f);
+	run(op_fp(FCVT_S_W, FA0, A1, 0, FRM_RUP));
+	EXPECT_EQ(get_s(FA0), 16777218.0f);
+
+	set_d(FA1, 1.0 + FLT_EPSILON / 2);
+	run(op_fp(FCVT_S_D, FA0, FA1, 1, FRM_RMM));
+	EXPECT_EQ(get_s(FA0), up);
+	run(op_fp(FCVT_S_D, FA0, FA1, 1, FRM_RNE));
+	EXPECT_EQ(get_s(FA0), 1.0f);
+
+	// A directed mode is left behind neither in the host nor for RNE
+	set_s(FA1, 1.0f);
+	set_s(FA2, 3.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_RDN));
+	run(op_fp(FDIV_S, FA3, FA1, FA2, FRM_RNE));
+	EXPECT_LT(get_s(FA0), get_s(FA3));
+	EXPECT_EQ(std::fegetround(), FE_TONEAREST);
+	take_fflags();
+
+	// Reserved modes trap, directly or through frm
+	run(op_fp(FADD_S, FA0, FA1, FA2, 5));
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	csr_write(cpu, CSR_FRM, 6);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_RNE));
+	EXPECT_EQ(cpu->csr.mcause, 0u);
+}
+
+TEST_F(FpuTest, Flags)
+{
+	u32 fcsr;
+
+	set_s(FA1, 1.0f);
+	set_s(FA2, 0.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(get_s(FA0), INFINITY);
+	EXPECT_EQ(take_fflags(), FFLAG_DZ);
+
+	set_s(FA1, 0.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(bits_s(FA0), F32_QNAN);
+	EXPECT_EQ(take_fflags(), FFLAG_NV);
+
+	set_s(FA1, FLT_MAX);
+	set_s(FA2, FLT_MAX);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(take_fflags(), FFLAG_OF | FFLAG_NX);
+
+	set_s(FA1, FLT_MIN);
+	set_s(FA2, 3.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(take_fflags(), FFLAG_UF | FFLAG_NX);
+
+	// Flags accrue, and fcsr holds frm above them
+	set_s(FA1, 1.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	set_s(FA2, 0.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	csr_write(cpu, CSR_FRM, FRM_RUP);
+	ASSERT_TRUE(csr_read(cpu, CSR_FCSR, &fcsr));
+	EXPECT_EQ(fcsr, (FRM_RUP << 5) | FFLAG_DZ | FFLAG_NX);
+
+	// Writing fflags discards the pending ones too
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	csr_write(cpu, CSR_FCSR, 0);
+	EXPECT_EQ(take_fflags(), 0u);
+}
+
+// The host holds one set of flags: each CPU only sees its own
+TEST_F(FpuTest, FlagsStayWithTheirCpu)
+{
+	struct cpu *other = cpu_create(MEM_SIZE);
+	u32 flags = 0;
+
+	set_s(FA1, 1.0f);
+	set_s(FA2, 0.0f);
+	run(op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+
+	mem_store32(other->memory, 0, op_fp(FDIV_S, FA0, FA1, FA2, FRM_DYN));
+	other->fpu.f[FA1] = F32_BOX | 0x3F800000; // 1.0
+	other->fpu.f[FA2] = F32_BOX | 0x40400000; // 3.0
+	cpu_step(other);
+
+	EXPECT_EQ(take_fflags(), FFLAG_DZ);
+	ASSERT_TRUE(csr_read(other, CSR_FFLAGS, &flags));
+	EXPECT_EQ(flags, FFLAG_NX);
+	cpu_destroy(other);
+}
+
+// Host code sharing the thread does inexact FP work of its own
+static void host_divide(struct cpu *c, void *opaque)
+{
+	volatile double x = 1.0;
+
+	x /= 3.0;
+	(void)c;
+	(void)opaque;
+}
+
+TEST_F(FpuTest, HostFlagsStayWithTheHost)
+{
+	const u32 fadd = op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN); // exact
+	const u32 program[] = {
+		fadd,
+		0x1F400893, // addi a7, zero, 500
+		0x00000073, // ecall
+		fadd,
+		0x00102573, // csrr a0, fflags
+		0x00100073, // ebreak
+		fadd,
+		0x001025F3, // csrr a1, fflags
+		0x00100073, // ebreak
+	};
+
+	for (u32 i = 0; i < sizeof(program) / 4; i++)
+		mem_store32(cpu->memory, i * 4, program[i]);
+	set_s(FA1, 1.0f);
+	set_s(FA2, 2.0f);
+	cpu->csr.mtvec = 0; // the emulator services the ECALL
+	ASSERT_TRUE(cpu_register_syscall(cpu, 500, host_divide, NULL));
+	cpu_run(cpu);
+	ASSERT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[A0], 0u);
+
+	// And between runs
+	host_divide(cpu, NULL);
+	cpu_resume(cpu);
+	cpu_run(cpu);
+	ASSERT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[A1], 0u);
+	EXPECT_EQ(take_fflags(), 0u);
+}
+
+TEST_F(FpuTest, ConvertToInt)
+{
+	const struct {
+		double x;
+		u32 rm;
+		u32 w, wu, flags_w, flags_wu;
+	} cases[] = {
+		{ 2.5, FRM_RNE, 2, 2, FFLAG_NX, FFLAG_NX },
+		{ 2.5, FRM_RMM, 3, 3, FFLAG_NX, FFLAG_NX },
+		{ 2.5, FRM_RTZ, 2, 2, FFLAG_NX, FFLAG_NX },
+		{ 2.5, FRM_RUP, 3, 3, FFLAG_NX, FFLAG_NX },
+		{ -2.5, FRM_RDN, (u32)-3, 0, FFLAG_NX, FFLAG_NV },
+		{ -0.5, FRM_RTZ, 0, 0, FFLAG_NX, FFLAG_NX },
+		{ 7.0, FRM_RNE, 7, 7, 0, 0 },
+		{ 3e9, FRM_RTZ, 0x7FFFFFFF, 3000000000u, FFLAG_NV, 0 },
+		{ -3e9, FRM_RTZ, 0x80000000, 0, FFLAG_NV, FFLAG_NV },
+		{ 5e9, FRM_RTZ, 0x7FFFFFFF, 0xFFFFFFFF, FFLAG_NV, FFLAG_NV },
+		{ -INFINITY, FRM_RTZ, 0x80000000, 0, FFLAG_NV, FFLAG_NV },
+		{ NAN, FRM_RTZ, 0x7FFFFFFF, 0xFFFFFFFF, FFLAG_NV, FFLAG_NV },
+	};
+
+	for (const auto &tc : cases) {
+		SCOPED_TRACE(tc.x);
+		set_s(FA1, (float)tc.x);
+		set_d(FA2, tc.x);
+		run(op_fp(FCVT_W_S, A0, FA1, 0, tc.rm));
+		EXPECT_EQ(cpu->registers[A0], tc.w);
+		EXPECT_EQ(take_fflags(), tc.flags_w);
+		run(op_fp(FCVT_W_D, A0, FA2, 1, tc.rm));
+		EXPECT_EQ(cpu->registers[A0], tc.wu);
+		EXPECT_EQ(take_fflags(), tc.flags_wu);
+	}
+}
+
+TEST_F(FpuTest, MinMaxCompareClass)
+{
+	const u32 snan = 0x7F800001;
+
+	set_s(FA1, -0.0f);
+	set_s(FA2, 0.0f);
+	run(op_fp(FMIN_S, FA0, FA1, FA2, 0));
+	EXPECT_EQ(bits_s(FA0), 0x80000000u);
+	run(op_fp(FMIN_S, FA0, FA2, FA1, 1)); // fmax
+	EXPECT_EQ(bits_s(FA0), 0u);
+
+	// A NaN gives way; only a signaling one raises NV
+	set_s(FA1, NAN);
+	set_s(FA2, 2.0f);
+	run(op_fp(FMIN_S, FA0, FA1, FA2, 0));
+	EXPECT_EQ(get_s(FA0), 2.0f);
+	EXPECT_EQ(take_fflags(), 0u);
+	cpu->fpu.f[FA1] = F32_BOX | snan;
+	run(op_fp(FMIN_S, FA0, FA1, FA2, 0));
+	EXPECT_EQ(get_s(FA0), 2.0f);
+	EXPECT_EQ(take_fflags(), FFLAG_NV);
+	set_d(FA1, NAN);
+	set_d(FA2, NAN);
+	run(op_fp(FMIN_D, FA0, FA1, FA2, 1));
+	EXPECT_EQ(cpu->fpu.f[FA0], F64_QNAN);
+
+	// feq is quiet, flt and fle signal
+	set_s(FA1, NAN);
+	set_s(FA2, 2.0f);
+	run(op_fp(FCMP_S, A0, FA1, FA2, 2));
+	EXPECT_EQ(cpu->registers[A0], 0u);
+	EXPECT_EQ(take_fflags(), 0u);
+	run(op_fp(FCMP_S, A0, FA1, FA2, 1));
+	EXPECT_EQ(take_fflags(), FFLAG_NV);
+	cpu->fpu.f[FA1] = F32_BOX | snan;
+	run(op_fp(FCMP_S, A0, FA1, FA2, 2));
+	EXPECT_EQ(take_fflags(), FFLAG_NV);
+	set_s(FA1, 2.0f);
+	run(op_fp(FCMP_S, A0, FA1, FA2, 0)); // fle
+	EXPECT_EQ(cpu->registers[A0], 1u);
+	run(op_fp(FCMP_S, A0, FA1, FA2, 1)); // flt
+	EXPECT_EQ(cpu->registers[A0], 0u);
+
+	const struct {
+		u32 bits, cls;
+	} classes[] = {
+		{ 0xFF800000, 1u << 0 }, { 0xBF800000, 1u << 1 },
+		{ 0x80000001, 1u << 2 }, { 0x80000000, 1u << 3 },
+		{ 0x00000000, 1u << 4 }, { 0x00000001, 1u << 5 },
+		{ 0x3F800000, 1u << 6 }, { 0x7F800000, 1u << 7 },
+		{ snan, 1u << 8 },	 { F32_QNAN, 1u << 9 },
+	};
+	for (const auto &tc : classes) {
+		cpu->fpu.f[FA1] = F32_BOX | tc.bits;
+		run(op_fp(FCLASS_S, A0, FA1, 0, 1));
+		EXPECT_EQ(cpu->registers[A0], tc.cls) << std::hex << tc.bits;
+	}
+	EXPECT_EQ(take_fflags(), 0u);
+}
+
+TEST_F(FpuTest, LoadsAndStores)
+{
+	cpu->registers[A1] = 0x1000;
+	mem_store32(cpu->memory, 0x1008, 0x40490FDB);
+	mem_store32(cpu->memory, 0x1010, 0x54442D18);
+	mem_store32(cpu->memory, 0x1014, 0x400921FB);
+
+	run(0x0085A507); // flw fa0, 8(a1)
+	EXPECT_EQ(cpu->fpu.f[FA0], F32_BOX | 0x40490FDB);
+	run(0x0105B587); // fld fa1, 16(a1)
+	EXPECT_EQ(get_d(FA1), M_PI);
+
+	run(0x00B5AC27); // fsw fa1, 24(a1): the low half, boxed or not
+	EXPECT_EQ(mem_load32(cpu->memory, 0x1018), 0x54442D18u);
+	run(0x02A5B027); // fsd fa0, 32(a1)
+	EXPECT_EQ(mem_load32(cpu->memory, 0x1020), 0x40490FDBu);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x1024), 0xFFFFFFFFu);
+
+	// Compressed: c.fld fa0, 8(a1) and c.fsdsp fa0, 8(sp)
+	cpu->registers[2] = 0x2000;
+	run(0x2588);
+	EXPECT_EQ(cpu->pc, 2u);
+	EXPECT_EQ(cpu->fpu.f[FA0], 0x40490FDBull);
+	run(0xA42A);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x2008), 0x40490FDBu);
+
+	// A faulting access leaves the register alone
+	cpu->registers[A1] = MEM_SIZE - 4;
+	run(0x0005B587); // fld fa1, 0(a1)
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_LOAD_ACCESS);
+	EXPECT_EQ(get_d(FA1), M_PI);
+}
+
+TEST_F(FpuTest, StatusFs)
+{
+	u32 mstatus;
+
+	// Reset leaves FS initial: clean state, SD clear
+	ASSERT_TRUE(csr_read(cpu, CSR_MSTATUS, &mstatus));
+	EXPECT_EQ(mstatus & MSTATUS_FS, MSTATUS_FS_INITIAL);
+	EXPECT_FALSE(mstatus & MSTATUS_SD);
+
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	ASSERT_TRUE(csr_read(cpu, CSR_MSTATUS, &mstatus));
+	EXPECT_EQ(mstatus & MSTATUS_FS, MSTATUS_FS_DIRTY);
+	EXPECT_TRUE(mstatus & MSTATUS_SD);
+
+	// With FS off, instructions and CSRs are illegal
+	cpu->csr.mstatus &= ~MSTATUS_FS;
+	set_s(FA0, 5.0f);
+	run(op_fp(FADD_S, FA0, FA1, FA2, FRM_DYN));
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	EXPECT_EQ(get_s(FA0), 5.0f);
+	EXPECT_FALSE(csr_read(cpu, CSR_FCSR, &mstatus));
+	EXPECT_FALSE(csr_write(cpu, CSR_FRM, 0));
+}
@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "fuzz.h"
+}
+
+class FuzzTest : public CpuTest {
+    protected:
+	struct fuzz *fuzz = nullptr;
+
+	void TearDown() override
+	{
+		fuzz_destroy(fuzz);
+		CpuTest::TearDown();
+	}
+
+	// A toy parser of the test case in memory (a0 = addr, a1 = length):
+	// "F..." crashes, "L..." hangs, anything else stores the length and
+	// exits cleanly.
+	void load_parser()
+	{
+		load_program({
+			0x00058C63, // beqz a1, out
+			0x00054283, // lbu t0, 0(a0)
+			0x04600313, // addi t1, zero, 'F'
+			0x00628E63, // beq t0, t1, crash
+			0x04C00313, // addi t1, zero, 'L'
+			0x00628C63, // beq t0, t1, hang
+			0x70B02023, // out: sw a1, 0x700(zero)
+			0x00000513, // addi a0, zero, 0
+			0x05D00893, // addi a7, zero, 93
+			0x00000073, // ecall
+			0x00100073, // crash: ebreak
+			0x0000006F, // hang: j hang
+		});
+		struct fuzz_config cfg = { 0x8000, 256, 10000 };
+		fuzz = fuzz_create(cpu, &cfg);
+		ASSERT_NE(fuzz, nullptr);
+	}
+
+	enum fuzz_result run(const std::string &input)
+	{
+		return fuzz_run(fuzz, (const u8 *)input.data(), input.size());
+	}
+
+	std::vector<u8> bitmap()
+	{
+		return std::vector<u8>(fuzz->map, fuzz->map + FUZZ_MAP_SIZE);
+	}
+};
+
+TEST_F(FuzzTest, ClassifiesRuns)
+{
+	load_parser();
+	EXPECT_EQ(run("hello"), FUZZ_OK);
+	EXPECT_EQ(run("F"), FUZZ_CRASH);
+	EXPECT_EQ(run("L"), FUZZ_TIMEOUT);
+	EXPECT_EQ(run(""), FUZZ_OK);
+	EXPECT_EQ(fuzz->execs, 4u);
+}
+
+TEST_F(FuzzTest, EdgesDependOnInput)
+{
+	std::vector<u8> ok, crash;
+
+	load_parser();
+	run("hello");
+	ok = bitmap();
+	memset(fuzz->map, 0, FUZZ_MAP_SIZE);
+	run("F");
+	crash = bitmap();
+
+	EXPECT_NE(ok, std::vector<u8>(FUZZ_MAP_SIZE));
+	EXPECT_NE(ok, crash);
+
+	// The same input takes the same edges again
+	memset(fuzz->map, 0, FUZZ_MAP_SIZE);
+	run("hello");
+	EXPECT_EQ(bitmap(), ok);
+}
+
+TEST_F(FuzzTest, RestoresDirtyPages)
+{
+	std::vector<u8> before;
+
+	load_parser();
+	before.assign(cpu->memory, cpu->memory + cpu->mem_size);
+	run("a long test case");
+	EXPECT_EQ(mem_load32(cpu->memory, 0x700), 16u);
+	// The input page and the page the guest wrote
+	EXPECT_EQ(fuzz->ndirty, 2u);
+
+	run("F");
+	EXPECT_EQ(mem_load32(cpu->memory, 0x700), 0u);
+	EXPECT_EQ(cpu->memory[0x8001], 0);
+	EXPECT_EQ(cpu->registers[11], 1u);
+
+	// Restoring after the crash brings back the snapshot exactly
+	run("");
+	EXPECT_EQ(std::vector<u8>(cpu->memory, cpu->memory + cpu->mem_size),
+		  before);
+}
+
+TEST_F(FuzzTest, InputThroughRead)
+{
+	load_program({
+		0x00000513, // addi a0, zero, 0
+		0x60000593, // addi a1, zero, 0x600
+		0x01000613, // addi a2, zero, 16
+		0x03F00893, // addi a7, zero, 63
+		0x00000073, // ecall
+		0x60004503, // lbu a0, 0x600(zero)
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	struct fuzz_config cfg = { 0, 0, 1000 };
+	fuzz = fuzz_create(cpu, &cfg);
+	ASSERT_NE(fuzz, nullptr);
+
+	EXPECT_EQ(run("xyz"), FUZZ_OK);
+	EXPECT_EQ(cpu->exit_code, (u32)'x');
+	EXPECT_EQ(fuzz->input_pos, 3u);
+	EXPECT_EQ(run(""), FUZZ_OK);
+	EXPECT_EQ(cpu->exit_code, 0u);
+}
+
+TEST_F(FuzzTest, RejectsBadRegion)
+{
+	struct fuzz_config cfg = { MEM_SIZE - 16, 32, 1000 };
+
+	EXPECT_EQ(fuzz_create(cpu, &cfg), nullptr);
+	EXPECT_EQ(cpu->fuzz, nullptr);
+}
+
+TEST_F(FuzzTest, DetachesOnDestroy)
+{
+	load_parser();
+	fuzz_destroy(fuzz);
+	fuzz = nullptr;
+	EXPECT_EQ(cpu->fuzz, nullptr);
+	EXPECT_EQ(cpu->nhost_syscalls, 0u);
+}
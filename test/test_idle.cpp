@@ -0,0 +1,280 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "csr.h"
+#include "clint.h"
+#include "memory.h"
+#include "idle.h"
+#include "trace.h"
+}
+
+// Spins on a flag in RAM until the timer interrupt at mtime 300; the
+// handler records mcause and mepc, sets the flag and disarms the timer
+static const std::vector<u32> timer = {
+	0x00000297, // auipc t0, 0
+	0x03828293, // addi t0, t0, 56
+	0x30529073, // csrw mtvec, t0
+	0x02004337, // lui t1, 0x2004 (mtimecmp)
+	0x12C00393, // addi t2, zero, 300
+	0x00732023, // sw t2, 0(t1)
+	0x00032223, // sw zero, 4(t1)
+	0x08000293, // addi t0, zero, 0x80
+	0x30429073, // csrw mie, t0
+	0x30046073, // csrsi mstatus, 8
+	0x00002437, // lui s0, 2
+	0x00042283, // spin: lw t0, 0(s0)
+	0xFE028EE3, // beqz t0, spin
+	0x00100073, // ebreak
+	0x34202573, // handler: csrr a0, mcause
+	0x341025F3, // csrr a1, mepc
+	0x00100293, // addi t0, zero, 1
+	0x00542023, // sw t0, 0(s0)
+	0xFFF00293, // addi t0, zero, -1
+	0x00532223, // sw t0, 4(t1)
+	0x30200073, // mret
+};
+
+// Waits for the low word of mtime to reach a0, then for the high word to
+// pass 1, compared the other way round
+static const std::vector<u32> poll = {
+	0x0200C337, // lui t1, 0x200c
+	0xFF832283, // poll: lw t0, -8(t1) (mtime)
+	0xFEA2EEE3, // bltu t0, a0, poll
+	0x00100593, // addi a1, zero, 1
+	0xFFC32383, // poll_hi: lw t2, -4(t1)
+	0xFE75FEE3, // bgeu a1, t2, poll_hi
+	0x00100073, // ebreak
+};
+
+// Arms the timer at a0 with mie = a1, waits, and reads mip into a2
+static const std::vector<u32> wfi = {
+	0x02004337, // lui t1, 0x2004
+	0x00A32023, // sw a0, 0(t1)
+	0x00032223, // sw zero, 4(t1)
+	0x30459073, // csrw mie, a1
+	0x10500073, // wfi
+	0x34402673, // csrr a2, mip
+	0x00100073, // ebreak
+};
+
+// A hot loop summing mtime
+static const std::vector<u32> summing = {
+	0x0200C337, // lui t1, 0x200c
+	0x06400393, // addi t2, zero, 100
+	0x00358593, // loop: addi a1, a1, 3
+	0xFF832283, // lw t0, -8(t1)
+	0x00550533, // add a0, a0, t0
+	0xFFF38393, // addi t2, t2, -1
+	0xFE0398E3, // bnez t2, loop
+	0x00100073, // ebreak
+};
+
+class IdleTest : public ::testing::Test {
+    protected:
+	struct cpu *plain;
+	struct cpu *fast;
+	struct idle *d;
+
+	void SetUp() override
+	{
+		plain = cpu_create(MEM_SIZE);
+		fast = cpu_create(MEM_SIZE);
+		d = idle_create();
+		ASSERT_NE(d, nullptr);
+		fast->idle = d;
+	}
+
+	void TearDown() override
+	{
+		cpu_destroy(plain);
+		cpu_destroy(fast);
+		idle_destroy(d);
+	}
+
+	void load_program(const std::vector<u32> &program)
+	{
+		for (size_t i = 0; i < program.size(); ++i) {
+			mem_store32(plain->memory, i * 4, program[i]);
+			mem_store32(fast->memory, i * 4, program[i]);
+		}
+	}
+
+	void expect_same_state()
+	{
+		for (int r = 0; r < NREGS; ++r)
+			EXPECT_EQ(fast->registers[r], plain->registers[r])
+				<< "x" << r << " at insn " << plain->insn_count;
+		EXPECT_EQ(fast->pc, plain->pc);
+		EXPECT_EQ(fast->insn_count, plain->insn_count);
+		EXPECT_EQ(fast->state, plain->state);
+		EXPECT_EQ(fast->csr.mepc, plain->csr.mepc);
+	}
+
+	// Run both CPUs in slices of varying size and compare after each
+	void run_both()
+	{
+		u64 slice = 1;
+
+		while (plain->state == CPU_STATE_RUNNING) {
+			enum cpu_stop a = cpu_run_for(plain, slice, NULL);
+			enum cpu_stop b = cpu_run_for(fast, slice, NULL);
+
+			ASSERT_EQ(a, b);
+			expect_same_state();
+			if (HasFailure())
+				return;
+			slice = slice * 7 % 1001 + 1;
+		}
+	}
+};
+
+TEST_F(IdleTest, ClintRegisters)
+{
+	u32 val;
+
+	fast->insn_count = 1000;
+	ASSERT_TRUE(clint_load(fast, CLINT_MTIME, 4, &val));
+	EXPECT_EQ(val, 1000u);
+	ASSERT_TRUE(clint_store(fast, CLINT_MTIME + 4, 4, 2));
+	EXPECT_EQ(clint_mtime(fast), (2ull << 32) + 1000);
+	fast->insn_count += 5;
+	ASSERT_TRUE(clint_load(fast, CLINT_MTIME, 4, &val));
+	EXPECT_EQ(val, 1005u);
+
+	ASSERT_TRUE(clint_load(fast, CLINT_MTIMECMP + 4, 4, &val));
+	EXPECT_EQ(val, 0xFFFFFFFFu);
+	EXPECT_TRUE(clint_store(fast, CLINT_MSIP, 4, 3));
+	EXPECT_EQ(fast->clint.msip, 1u);
+	EXPECT_EQ(fast->csr.mip, MIP_MSIP);
+	EXPECT_TRUE(clint_store(fast, CLINT_MTIMECMP + 4, 4, 0));
+	EXPECT_EQ(fast->csr.mip, MIP_MSIP | MIP_MTIP);
+
+	// Only aligned words
+	EXPECT_FALSE(clint_load(fast, CLINT_MTIME, 2, &val));
+	EXPECT_FALSE(clint_load(fast, CLINT_MTIME + 2, 4, &val));
+	EXPECT_FALSE(clint_store(fast, 0x100, 4, 0));
+}
+
+// Machine software before timer, at base + 4 * cause when vectored
+TEST_F(IdleTest, InterruptPriorityAndVector)
+{
+	fast->pc = 0x40;
+	fast->csr.mtvec = 0x101;
+	fast->csr.mie = MIP_MSIP | MIP_MTIP;
+	fast->csr.mstatus = MSTATUS_MIE;
+	fast->clint.msip = 1;
+	fast->clint.mtimecmp = 0;
+
+	ASSERT_TRUE(cpu_interrupt(fast));
+	EXPECT_EQ(fast->pc, 0x100u + 4 * 3);
+	EXPECT_EQ(fast->csr.mcause, CAUSE_INTERRUPT | 3);
+	EXPECT_EQ(fast->csr.mepc, 0x40u);
+	EXPECT_EQ(fast->csr.mstatus & (MSTATUS_MIE | MSTATUS_MPIE),
+		  MSTATUS_MPIE);
+	// Disabled in the handler
+	EXPECT_FALSE(cpu_interrupt(fast));
+}
+
+TEST_F(IdleTest, TimerInterruptWhileSpinning)
+{
+	load_program(timer);
+	run_both();
+	EXPECT_EQ(fast->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(fast->registers[10], CAUSE_INTERRUPT | 7);
+	// Taken in the spin loop
+	EXPECT_GE(fast->registers[11], 0x2Cu);
+	EXPECT_LE(fast->registers[11], 0x30u);
+	EXPECT_GT(d->stats.spins, 0u);
+	EXPECT_GT(d->stats.skipped, 200u);
+}
+
+TEST_F(IdleTest, PollSkipIsExact)
+{
+	load_program(poll);
+	for (struct cpu *c : { plain, fast }) {
+		c->clint.mtime_offset = (2ull << 32) - 8000;
+		c->registers[10] = 0xFFFFFFFF - 3000;
+	}
+	run_both();
+	EXPECT_EQ(fast->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_GE(clint_mtime(fast), 2ull << 32);
+	EXPECT_GT(d->stats.polls, 1u);
+	EXPECT_GT(d->stats.skipped, 7000u);
+}
+
+TEST_F(IdleTest, WfiSkipsToDeadline)
+{
+	load_program(wfi);
+	fast->registers[10] = 100000;
+	fast->registers[11] = MIP_MTIP;
+	cpu_run(fast);
+	EXPECT_EQ(fast->stop, CPU_STOP_BREAKPOINT);
+	// Not taken with mstatus.MIE clear, but pending
+	EXPECT_EQ(fast->registers[12], MIP_MTIP);
+	EXPECT_EQ(fast->insn_count, 7u);
+	EXPECT_GE(clint_mtime(fast), 100000u);
+	EXPECT_EQ(fast->clint.stats.wfis, 1u);
+}
+
+TEST_F(IdleTest, WfiWithNothingToWakeStops)
+{
+	load_program(wfi);
+	fast->registers[10] = 100000;
+	EXPECT_EQ(cpu_run_for(fast, 1000, NULL), CPU_STOP_IDLE);
+	EXPECT_EQ(fast->pc, 0x10u);
+
+	// An embedder raises an external interrupt and carries on
+	cpu_set_irq(fast, MIP_MEIP, true);
+	cpu_resume(fast);
+	cpu_run(fast);
+	EXPECT_EQ(fast->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(fast->registers[12], MIP_MEIP);
+}
+
+TEST_F(IdleTest, SpinWithNothingToWakeStops)
+{
+	u64 retired;
+
+	mem_store32(fast->memory, 0, 0x0000006F); // j .
+	EXPECT_EQ(cpu_run_for(fast, 1000000, &retired), CPU_STOP_IDLE);
+	EXPECT_LT(retired, 100u);
+	EXPECT_EQ(fast->pc, 0u);
+	EXPECT_EQ(d->stats.stops, 1u);
+}
+
+// A counting loop carries a register round; it is never skipped
+TEST_F(IdleTest, CountingLoopRuns)
+{
+	static const std::vector<u32> count = {
+		0x3E800293, // addi t0, zero, 1000
+		0xFFF28293, // loop: addi t0, t0, -1
+		0xFE029EE3, // bnez t0, loop
+		0x00100073, // ebreak
+	};
+
+	load_program(count);
+	run_both();
+	EXPECT_EQ(d->stats.skipped, 0u);
+}
+
+// mtime read inside a trace comes from the interpreter, at the exact count
+TEST_F(IdleTest, TraceLeavesForDeviceAccess)
+{
+	struct trace_cache *tc = trace_cache_create();
+
+	ASSERT_NE(tc, nullptr);
+	fast->idle = NULL;
+	fast->traces = tc;
+	load_program(summing);
+	run_both();
+	EXPECT_EQ(fast->stop, CPU_STOP_BREAKPOINT);
+#ifndef CONFIG_INSN_MIX
+	// `make INSN_MIX=1` never runs traces
+	EXPECT_EQ(tc->stats.device_exits, 1u);
+#endif
+	fast->traces = NULL;
+	trace_cache_destroy(tc);
+}
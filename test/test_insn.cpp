@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "instr.h"
+#include "insn.h"
+#include "disassembler.h"
+}
+
+class InsnTableTest : public CpuTest {};
+
+TEST_F(InsnTableTest, EveryEntryDecodesToItself)
+{
+	for (u32 id = INSN_ILLEGAL + 1; id < INSN_COUNT; ++id) {
+		const struct insn_info *e = &insn_info[id];
+		// Set every don't-care bit as well as none of them
+		u32 encodings[] = { e->match, e->match | ~e->mask };
+
+		for (u32 raw : encodings) {
+			Instruction instr;
+			char buf[64];
+
+			if (insn_lookup(raw) != id)
+				ADD_FAILURE() << e->name << " 0x" << std::hex << raw;
+			instr_decode(&instr, raw);
+			EXPECT_EQ(instr.id, id) << e->name;
+
+			disassemble(raw, buf, sizeof(buf));
+			EXPECT_EQ(std::string(buf).rfind(e->name, 0), 0u)
+				<< buf << " vs " << e->name;
+		}
+	}
+}
+
+TEST_F(InsnTableTest, SharedKeysAndIllegalEncodings)
+{
+	// ECALL, EBREAK share a key and differ only in rs2
+	EXPECT_EQ(insn_lookup(0x00000073), INSN_ECALL);
+	EXPECT_EQ(insn_lookup(0x00100073), INSN_EBREAK);
+	EXPECT_EQ(insn_lookup(0x10200073), INSN_SRET);
+	EXPECT_EQ(insn_lookup(0x30200073), INSN_MRET);
+	EXPECT_EQ(insn_lookup(0x12050073), INSN_SFENCE_VMA);
+
+	EXPECT_EQ(insn_lookup(0x00000573), INSN_ILLEGAL); // ecall with rd
+	EXPECT_EQ(insn_lookup(0x00004073), INSN_ILLEGAL); // SYSTEM funct3=4
+	EXPECT_EQ(insn_lookup(0xFE000033), INSN_ILLEGAL); // OP funct7=0x7f
+	EXPECT_EQ(insn_lookup(0x0000007F), INSN_ILLEGAL); // no such opcode
+	EXPECT_EQ(insn_lookup(0x1010202F), INSN_ILLEGAL); // lr.w with rs2
+}
+
+TEST_F(InsnTableTest, IllegalEncodingTraps)
+{
+	load_program({ 0xFE000033 });
+	cpu->csr.mtvec = 0x100;
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->pc, 0x100u);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	EXPECT_EQ(cpu->csr.mtval, 0xFE000033u);
+}
+
+TEST_F(InsnTableTest, SignedDivisionOverflow)
+{
+	load_program({
+		0x0220C1B3, // div x3, x1, x2
+		0x0220E233, // rem x4, x1, x2
+	});
+	cpu->registers[1] = 0x80000000;
+	cpu->registers[2] = 0xFFFFFFFF;
+	cpu_step(cpu);
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->registers[3], 0x80000000u);
+	EXPECT_EQ(cpu->registers[4], 0u);
+}
+
+TEST_F(InsnTableTest, DisassembleFormats)
+{
+	const std::vector<std::pair<u32, const char *> > cases = {
+		{ 0x00C58533, "add a0, a1, a2" },
+		{ 0x4035D513, "srai a0, a1, 3" },
+		{ 0x00A12423, "sw a0, 8(sp)" },
+		{ 0x12345537, "lui a0, 0x12345" },
+		{ 0x30059573, "csrrw a0, 0x300, a1" },
+		{ 0x30446573, "csrrsi a0, 0x304, 8" },
+		{ 0x1005A52F, "lr.w a0, (a1)" },
+		{ 0x00C5A52F, "amoadd.w a0, a2, (a1)" },
+		{ 0x12050073, "sfence.vma a0, zero" },
+		{ 0x30200073, "mret" },
+		{ 0x0000007F, "unknown opcode 0x7f" },
+	};
+	char buf[64];
+
+	for (const auto &tc : cases) {
+		disassemble(tc.first, buf, sizeof(buf));
+		EXPECT_STREQ(buf, tc.second);
+	}
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "insn_mix.h"
+#include "idle.h"
+}
+
+TEST(InsnClassTest, ClassesFollowTheOpcode)
+{
+	EXPECT_EQ(insn_class(INSN_ADDI), INSN_CLASS_ALU);
+	EXPECT_EQ(insn_class(INSN_SRA), INSN_CLASS_ALU);
+	EXPECT_EQ(insn_class(INSN_LUI), INSN_CLASS_ALU);
+	EXPECT_EQ(insn_class(INSN_MULHU), INSN_CLASS_MULDIV);
+	EXPECT_EQ(insn_class(INSN_REMU), INSN_CLASS_MULDIV);
+	EXPECT_EQ(insn_class(INSN_LBU), INSN_CLASS_LOAD);
+	EXPECT_EQ(insn_class(INSN_SW), INSN_CLASS_STORE);
+	EXPECT_EQ(insn_class(INSN_BGEU), INSN_CLASS_BRANCH);
+	EXPECT_EQ(insn_class(INSN_JAL), INSN_CLASS_JUMP);
+	EXPECT_EQ(insn_class(INSN_JALR), INSN_CLASS_JUMP);
+	EXPECT_EQ(insn_class(INSN_LR_W), INSN_CLASS_AMO);
+	EXPECT_EQ(insn_class(INSN_AMOMAXU_W), INSN_CLASS_AMO);
+	EXPECT_EQ(insn_class(INSN_FLW), INSN_CLASS_LOAD);
+	EXPECT_EQ(insn_class(INSN_FSD), INSN_CLASS_STORE);
+	EXPECT_EQ(insn_class(INSN_FMADD_S), INSN_CLASS_FP);
+	EXPECT_EQ(insn_class(INSN_FADD_S), INSN_CLASS_FP);
+	EXPECT_EQ(insn_class(INSN_FMV_X_W), INSN_CLASS_FP);
+	EXPECT_EQ(insn_class(INSN_VLE32_V), INSN_CLASS_LOAD);
+	EXPECT_EQ(insn_class(INSN_VSSE8_V), INSN_CLASS_STORE);
+	EXPECT_EQ(insn_class(INSN_VADD_VV), INSN_CLASS_VECTOR);
+	EXPECT_EQ(insn_class(INSN_VSETVLI), INSN_CLASS_VECTOR);
+	EXPECT_EQ(insn_class(INSN_FENCE_I), INSN_CLASS_SYSTEM);
+	EXPECT_EQ(insn_class(INSN_CSRRCI), INSN_CLASS_SYSTEM);
+	EXPECT_EQ(insn_class(INSN_SFENCE_VMA), INSN_CLASS_SYSTEM);
+	EXPECT_STREQ(insn_class_name(INSN_CLASS_MULDIV), "muldiv");
+}
+
+#ifdef CONFIG_INSN_MIX
+class InsnMixTest : public CpuTest {};
+
+TEST_F(InsnMixTest, CountsRetiredInstructions)
+{
+	load_program({
+		0x00300293, // addi t0, zero, 3
+		0x02528333, // mul t1, t0, t0
+		0x10602023, // sw t1, 256(zero)
+		0x10002383, // lw t2, 256(zero)
+		0xFFF28293, // addi t0, t0, -1
+		0xFE029EE3, // bnez t0, -4
+		0x0080006F, // j +8
+		0x00000013, // nop, skipped
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	cpu_run(cpu);
+
+	const struct insn_mix *m = &cpu->mix;
+	EXPECT_EQ(m->count[INSN_ADDI], 5u);
+	EXPECT_EQ(m->count[INSN_MUL], 1u);
+	EXPECT_EQ(m->count[INSN_SW], 1u);
+	EXPECT_EQ(m->count[INSN_LW], 1u);
+	EXPECT_EQ(m->count[INSN_BNE], 3u);
+	EXPECT_EQ(m->branch_taken, 2u);
+	EXPECT_EQ(m->count[INSN_JAL], 1u);
+	EXPECT_EQ(m->count[INSN_ECALL], 1u);
+	EXPECT_EQ(m->traps, 0u);
+}
+
+TEST_F(InsnMixTest, TrapsDoNotRetire)
+{
+	load_program({
+		0x20000293, // addi t0, zero, 0x200
+		0x30529073, // csrw mtvec, t0
+		0x1000A32F, // lr.w t1, (ra): misaligned, ra = 2
+	});
+	// The handler hands ECALL back to the emulator and exits
+	mem_store32(cpu->memory, 0x200, 0x30501073); // csrw mtvec, zero
+	mem_store32(cpu->memory, 0x204, 0x05D00893); // addi a7, zero, 93
+	mem_store32(cpu->memory, 0x208, 0x00000073); // ecall
+	cpu->registers[1] = 2;
+	cpu_run(cpu);
+
+	EXPECT_EQ(cpu->mix.count[INSN_LR_W], 0u);
+	EXPECT_EQ(cpu->mix.traps, 1u);
+	EXPECT_EQ(cpu->mix.count[INSN_CSRRW], 2u);
+	EXPECT_EQ(cpu->mix.count[INSN_ADDI], 2u);
+	EXPECT_EQ(cpu->mix.count[INSN_ECALL], 1u);
+}
+
+TEST_F(InsnMixTest, DumpsJson)
+{
+	std::string out(4096, '\0');
+	FILE *fp;
+
+	load_program({
+		0x00100293, // addi t0, zero, 1
+		0x00029463, // bnez t0, +8
+		0x00000013, // nop, skipped
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	cpu_run(cpu);
+	fp = fmemopen(&out[0], out.size(), "w");
+	ASSERT_NE(fp, nullptr);
+	insn_mix_dump_json(&cpu->mix, fp);
+	fclose(fp);
+	out.resize(out.find('\0'));
+
+	EXPECT_NE(out.find("\"retired\": 4,"), std::string::npos);
+	EXPECT_NE(out.find("\"alu\": 2,"), std::string::npos);
+	EXPECT_NE(out.find("\"branch_taken\": 1,"), std::string::npos);
+	EXPECT_NE(out.find("\"branch_not_taken\": 0,"), std::string::npos);
+	EXPECT_NE(out.find("\"system\": 1\n"), std::string::npos);
+	// Most frequent mnemonic first
+	EXPECT_LT(out.find("\"addi\": 2"), out.find("\"bne\": 1"));
+	EXPECT_EQ(out.find("\"lw\""), std::string::npos);
+}
+
+// Rounds of a polling loop skipped by --idle still count as retired
+TEST_F(InsnMixTest, SkippedLoopsCount)
+{
+	struct cpu *fast = cpu_create(MEM_SIZE);
+	struct idle *d = idle_create();
+
+	ASSERT_NE(fast, nullptr);
+	ASSERT_NE(d, nullptr);
+	fast->idle = d;
+	for (struct cpu *c : { cpu, fast }) {
+		load_program(c, {
+			0xC01022F3, // 1: csrr t0, time
+			0xFE62EEE3, // bltu t0, t1, 1b
+			0x00100073, // ebreak
+		});
+		c->registers[6] = 1000;
+		cpu_run(c);
+	}
+	EXPECT_GT(d->stats.skipped, 0u);
+	EXPECT_EQ(fast->insn_count, cpu->insn_count);
+	EXPECT_EQ(memcmp(fast->mix.count, cpu->mix.count,
+			 sizeof(cpu->mix.count)), 0);
+	EXPECT_EQ(fast->mix.branch_taken, cpu->mix.branch_taken);
+	cpu_destroy(fast);
+	idle_destroy(d);
+}
+#endif
@@ -0,0 +1,156 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "mmu.h"
+}
+
+// Physical layout used by the Sv32 tests
+#define ROOT_PT 0x8000 /* level-1 page table */
+#define LEAF_PT 0x9000 /* level-0 page table for VA 0x00400000 */
+#define DATA_PA 0x3000
+#define DATA_VA 0x00400000
+
+class MMUTest : public CpuTest {
+    protected:
+	// Identity-map the first 4 MiB as a superpage and point DATA_VA at
+	// DATA_PA, then enter S-mode with translation enabled.
+	void enable_sv32(uint32_t data_flags)
+	{
+		uint32_t flags = PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D;
+
+		mem_store32(cpu->memory, ROOT_PT + 0 * 4, flags);
+		mem_store32(cpu->memory, ROOT_PT + 1 * 4,
+			    ((LEAF_PT >> 12) << 10) | PTE_V);
+		map_data(DATA_PA, data_flags);
+
+		cpu->csr.satp = SATP_MODE | (ROOT_PT >> 12);
+		cpu_set_priv(cpu, PRV_S);
+	}
+
+	void map_data(uint32_t pa, uint32_t flags)
+	{
+		mem_store32(cpu->memory, LEAF_PT, ((pa >> 12) << 10) | flags);
+	}
+};
+
+TEST_F(MMUTest, CsrReadWrite)
+{
+	cpu->registers[1] = 0x1234;
+	std::vector<uint32_t> program = {
+		0x34009073, // csrrw x0, mscratch, x1
+		0x34002173, // csrrs x2, mscratch, x0  (csrr)
+		0x340261F3, // csrrsi x3, mscratch, 4
+	};
+	load_program(program);
+	run_program(program.size());
+
+	EXPECT_EQ(cpu->registers[2], 0x1234);
+	EXPECT_EQ(cpu->registers[3], 0x1234);
+	EXPECT_EQ(cpu->csr.mscratch, 0x1234u | 4);
+}
+
+TEST_F(MMUTest, MretEntersPreviousMode)
+{
+	cpu->csr.mepc = 0x40;
+	cpu->csr.mstatus = PRV_S << 11; // MPP = S
+	load_program({ 0x30200073 }); // mret
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->pc, 0x40);
+	EXPECT_EQ(cpu->priv, (uint32_t)PRV_S);
+}
+
+TEST_F(MMUTest, Sv32Translation)
+{
+	mem_store32(cpu->memory, DATA_PA + 0x10, 0xCAFEF00D);
+	enable_sv32(PTE_V | PTE_R | PTE_W | PTE_A | PTE_D);
+	cpu->registers[1] = DATA_VA;
+
+	std::vector<uint32_t> program = {
+		0x0100A103, // lw x2, 0x10(x1)
+		0x0100A183, // lw x3, 0x10(x1)
+	};
+	load_program(program);
+	run_program(program.size());
+
+	EXPECT_EQ(cpu->registers[2], 0xCAFEF00D);
+	EXPECT_EQ(cpu->registers[3], 0xCAFEF00D);
+	// One walk for the code superpage, one for the data page; the
+	// second load hits the TLB.
+	EXPECT_EQ(cpu->mmu_stats.walks, 2u);
+	EXPECT_EQ(cpu->mmu_stats.misses[MMU_LOAD], 1u);
+	EXPECT_EQ(cpu->mmu_stats.hits[MMU_LOAD], 1u);
+}
+
+TEST_F(MMUTest, StoreToReadOnlyPageFaults)
+{
+	enable_sv32(PTE_V | PTE_R | PTE_A);
+	cpu->csr.mtvec = 0x200;
+	cpu->registers[1] = DATA_VA;
+	cpu->registers[2] = 0xDEADBEEF;
+
+	load_program({ 0x0020A023 }); // sw x2, 0(x1)
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->csr.mcause, (uint32_t)CAUSE_STORE_PAGE_FAULT);
+	EXPECT_EQ(cpu->csr.mtval, (uint32_t)DATA_VA);
+	EXPECT_EQ(cpu->csr.mepc, 0u);
+	EXPECT_EQ(cpu->pc, 0x200);
+	EXPECT_EQ(cpu->priv, (uint32_t)PRV_M);
+	EXPECT_EQ(mem_load32(cpu->memory, DATA_PA), 0u);
+}
+
+TEST_F(MMUTest, SfenceVmaDropsStaleTranslation)
+{
+	mem_store32(cpu->memory, DATA_PA, 111);
+	mem_store32(cpu->memory, DATA_PA + 0x1000, 222);
+	enable_sv32(PTE_V | PTE_R | PTE_A);
+	cpu->registers[1] = DATA_VA;
+
+	std::vector<uint32_t> program = {
+		0x0000A103, // lw x2, 0(x1)
+		0x0000A183, // lw x3, 0(x1)  (stale TLB entry)
+		0x12000073, // sfence.vma
+		0x0000A203, // lw x4, 0(x1)
+	};
+	load_program(program);
+
+	cpu_step(cpu);
+	map_data(DATA_PA + 0x1000, PTE_V | PTE_R | PTE_A);
+	run_program(3);
+
+	EXPECT_EQ(cpu->registers[2], 111);
+	EXPECT_EQ(cpu->registers[3], 111);
+	EXPECT_EQ(cpu->registers[4], 222);
+}
+
+TEST_F(MMUTest, OutOfRangeAccessHalts)
+{
+	cpu->registers[1] = 0x00100000; // beyond the 64KB of RAM
+	load_program({ 0x0000A103 }); // lw x2, 0(x1)
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->state, CPU_STATE_HALTED);
+	EXPECT_EQ(cpu->pc, 0);
+	EXPECT_EQ(cpu->registers[2], 0);
+}
+
+TEST_F(MMUTest, PeekHasNoSideEffects)
+{
+	enable_sv32(PTE_V | PTE_R | PTE_W | PTE_A);
+
+	// Loads are fine, a store would have to set D first
+	EXPECT_EQ(mmu_peek(cpu, DATA_VA + 8, MMU_LOAD),
+		  cpu->memory + DATA_PA + 8);
+	EXPECT_EQ(mmu_peek(cpu, DATA_VA, MMU_STORE), nullptr);
+	EXPECT_EQ(mmu_peek(cpu, DATA_VA + 0x1000, MMU_LOAD), nullptr);
+	EXPECT_EQ(mem_load32(cpu->memory, LEAF_PT) & PTE_D, 0u);
+	EXPECT_EQ(cpu->mmu_stats.misses[MMU_LOAD], 0u);
+	EXPECT_EQ(cpu->csr.mcause, 0u);
+
+	map_data(DATA_PA, PTE_V | PTE_R | PTE_W | PTE_A | PTE_D);
+	EXPECT_EQ(mmu_peek(cpu, DATA_VA, MMU_STORE), cpu->memory + DATA_PA);
+}
@@ -0,0 +1,134 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "elf_file.h"
+#include "perfmap.h"
+}
+
+#if defined(__x86_64__) || defined(__aarch64__)
+class PerfmapTest : public CpuTest {
+    protected:
+	struct symtab syms = {};
+	std::string dir = testing::TempDir();
+	std::string map_path =
+		dir + "/perf-" + std::to_string(getpid()) + ".map";
+	std::string dump_path =
+		dir + "/jit-" + std::to_string(getpid()) + ".dump";
+
+	void SetUp() override
+	{
+		static const struct symbol s[] = {
+			{ 0x00, 0x10, "main" },
+			{ 0x20, 0x08, "helper" },
+		};
+
+		CpuTest::SetUp();
+		ASSERT_TRUE(symtab_init(&syms, s, 2));
+		load_program({
+			0x00300413, // addi s0, zero, 3
+			0x01C000EF, // jal ra, helper
+			0xFFF40413, // addi s0, s0, -1
+			0xFE041CE3, // bnez s0, -8
+			0x0180006F, // j +24, to code outside any symbol
+			0x00000013, // nop
+			0x00000013, // nop
+			0x00000013, // nop
+			0x00150513, // helper: addi a0, a0, 1
+			0x00008067, // ret
+			0x05D00893, // addi a7, zero, 93
+			0x00000073, // ecall
+		});
+	}
+
+	void TearDown() override
+	{
+		symtab_free(&syms);
+		remove(map_path.c_str());
+		remove(dump_path.c_str());
+		CpuTest::TearDown();
+	}
+
+	static std::string slurp(const std::string &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		std::stringstream ss;
+
+		ss << in.rdbuf();
+		return ss.str();
+	}
+};
+
+TEST_F(PerfmapTest, NamesGuestFunctions)
+{
+	struct perfmap *pm = perfmap_create(&syms, dir.c_str(), PERFMAP_MAP);
+
+	ASSERT_NE(pm, nullptr);
+	cpu->perfmap = pm;
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->registers[10], 3u);
+	EXPECT_EQ(cpu->registers[8], 0u);
+	// main, helper and the unnamed tail at 0x28
+	EXPECT_EQ(pm->ntramps, 3u);
+	perfmap_destroy(pm);
+
+	std::string map = slurp(map_path);
+	EXPECT_NE(map.find(" rv32i:main@0x00000000\n"), std::string::npos);
+	EXPECT_NE(map.find(" rv32i:helper@0x00000020\n"), std::string::npos);
+	EXPECT_NE(map.find(" rv32i:0x00000028\n"), std::string::npos);
+}
+
+TEST_F(PerfmapTest, BudgetStaysExact)
+{
+	struct perfmap *pm = perfmap_create(NULL, dir.c_str(), 0);
+	u64 retired = 0;
+
+	ASSERT_NE(pm, nullptr);
+	cpu->perfmap = pm;
+	EXPECT_EQ(cpu_run_for(cpu, 5, &retired), CPU_STOP_BUDGET);
+	EXPECT_EQ(retired, 5u);
+	EXPECT_EQ(cpu->pc, 0xCu); // through helper and back
+	EXPECT_EQ(cpu_run_for(cpu, 100, &retired), CPU_STOP_HALT);
+	EXPECT_EQ(cpu->registers[10], 3u);
+	perfmap_destroy(pm);
+}
+
+TEST_F(PerfmapTest, WritesJitdump)
+{
+	struct perfmap *pm = perfmap_create(&syms, dir.c_str(),
+					    PERFMAP_JITDUMP);
+	u32 header[6];
+
+	ASSERT_NE(pm, nullptr);
+	cpu->perfmap = pm;
+	cpu_run(cpu);
+	perfmap_destroy(pm);
+
+	std::string dump = slurp(dump_path);
+	ASSERT_GE(dump.size(), sizeof(header));
+	memcpy(header, dump.data(), sizeof(header));
+	EXPECT_EQ(header[0], 0x4A695444u); // "JiTD"
+	EXPECT_EQ(header[1], 1u);
+	EXPECT_EQ(header[5], (u32)getpid());
+
+	// Walk the code load records
+	size_t off = header[2], records = 0;
+	while (off + 8 <= dump.size()) {
+		u32 rec[2];
+
+		memcpy(rec, dump.data() + off, sizeof(rec));
+		EXPECT_EQ(rec[0], 0u);
+		off += rec[1];
+		records++;
+	}
+	EXPECT_EQ(off, dump.size());
+	EXPECT_EQ(records, 3u);
+	EXPECT_NE(dump.find("rv32i:helper@0x00000020"), std::string::npos);
+}
+#endif
@@ -0,0 +1,249 @@
+#include <gtest/gtest.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "replay.h"
+}
+
+class ReplayTest : public CpuTest {
+    protected:
+	std::string log = testing::TempDir() + "replay_test.log";
+	int saved_stdin = -1;
+
+	void TearDown() override
+	{
+		replay_close(cpu->replay);
+		if (saved_stdin >= 0) {
+			dup2(saved_stdin, STDIN_FILENO);
+			close(saved_stdin);
+		}
+		remove(log.c_str());
+		CpuTest::TearDown();
+	}
+
+	// clock_gettime(CLOCK_MONOTONIC, 0x400), read(0, 0x500, 16), exit
+	void load_clock_and_read()
+	{
+		load_program({
+			0x00100513, // addi a0, zero, 1
+			0x40000593, // addi a1, zero, 0x400
+			0x07100893, // addi a7, zero, 113
+			0x00000073, // ecall
+			0x00000513, // addi a0, zero, 0
+			0x50000593, // addi a1, zero, 0x500
+			0x01000613, // addi a2, zero, 16
+			0x03F00893, // addi a7, zero, 63
+			0x00000073, // ecall
+			0x05D00893, // addi a7, zero, 93
+			0x00000073, // ecall
+		});
+	}
+
+	// Point the host's stdin at a pipe holding @data
+	void set_stdin(const char *data)
+	{
+		int fds[2];
+
+		ASSERT_EQ(pipe(fds), 0);
+		ASSERT_EQ(write(fds[1], data, strlen(data)),
+			  (ssize_t)strlen(data));
+		close(fds[1]);
+		if (saved_stdin < 0)
+			saved_stdin = dup(STDIN_FILENO);
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+	}
+
+	void run(enum replay_mode mode)
+	{
+		cpu->replay = replay_open(log.c_str(), mode);
+		ASSERT_NE(cpu->replay, nullptr);
+		cpu_run(cpu);
+	}
+};
+
+TEST_F(ReplayTest, ReplayIsIdentical)
+{
+	u8 recorded[0x120];
+	u32 a0;
+
+	load_clock_and_read();
+	set_stdin("hello");
+	run(REPLAY_RECORD);
+	EXPECT_EQ(cpu->replay->events, 2u);
+	EXPECT_TRUE(replay_close(cpu->replay));
+	cpu->replay = nullptr;
+	a0 = cpu->registers[10];
+	memcpy(recorded, cpu->memory + 0x400, sizeof(recorded));
+	EXPECT_EQ(memcmp(cpu->memory + 0x500, "hello", 5), 0);
+
+	// Magic, plus about a dozen bytes per event
+	FILE *fp = fopen(log.c_str(), "rb");
+	ASSERT_NE(fp, nullptr);
+	fseek(fp, 0, SEEK_END);
+	EXPECT_LT(ftell(fp), 48);
+	fclose(fp);
+
+	// Different console input and a later clock must not matter
+	cpu_reset(cpu);
+	load_clock_and_read();
+	set_stdin("other input");
+	usleep(1000);
+	run(REPLAY_REPLAY);
+	EXPECT_FALSE(cpu->replay->diverged);
+	EXPECT_EQ(cpu->replay->events, 2u);
+	EXPECT_EQ(cpu->registers[10], a0);
+	EXPECT_EQ(memcmp(cpu->memory + 0x400, recorded, sizeof(recorded)), 0);
+}
+
+TEST_F(ReplayTest, DivergenceHalts)
+{
+	load_clock_and_read();
+	set_stdin("x");
+	run(REPLAY_RECORD);
+	replay_close(cpu->replay);
+	cpu->replay = nullptr;
+
+	// The guest now reads before it reads the clock
+	cpu_reset(cpu);
+	load_clock_and_read();
+	mem_store32(cpu->memory, 0x08, 0x03F00893); // addi a7, zero, 63
+	mem_store32(cpu->memory, 0x00, 0x00000513); // addi a0, zero, 0
+	run(REPLAY_REPLAY);
+
+	EXPECT_TRUE(cpu->replay->diverged);
+	EXPECT_STREQ(cpu->replay->why, "different event");
+	EXPECT_EQ(cpu->replay->diverged_event, REPLAY_EV_READ);
+	EXPECT_EQ(cpu->replay->diverged_at, 3u);
+	EXPECT_EQ(cpu->state, CPU_STATE_HALTED);
+	EXPECT_EQ(cpu->pc, 0x0Cu); // stopped on the first ecall
+	EXPECT_EQ(cpu->replay->events, 0u);
+}
+
+TEST_F(ReplayTest, DeterministicErrorsAreNotLogged)
+{
+	load_program({
+		0x00500513, // addi a0, zero, 5
+		0x03F00893, // addi a7, zero, 63
+		0x00000073, // ecall
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	run(REPLAY_RECORD);
+
+	EXPECT_EQ((s32)cpu->registers[10], -EBADF);
+	EXPECT_EQ(cpu->replay->events, 0u);
+}
+
+// Counts a0 up in straight runs longer than a block until the external
+// interrupt handler copies it to a1
+static std::vector<uint32_t> count_until_irq()
+{
+	std::vector<uint32_t> program = {
+		0x40000293, // addi t0, zero, 0x400
+		0x30529073, // csrw mtvec, t0
+		0x000012B7, // lui t0, 1
+		0x80028293, // addi t0, t0, -2048 (MEIE)
+		0x30429073, // csrw mie, t0
+		0x30046073, // csrsi mstatus, MIE
+	};
+
+	program.insert(program.end(), 100, 0x00150513); // addi a0, a0, 1
+	program.push_back(0xE60588E3); // beqz a1, back to the first addi
+	program.push_back(0x00100073); // ebreak
+	program.resize(0x100, 0x00000013);
+	program.insert(program.end(), {
+		0x00050593, // mv a1, a0
+		0x30401073, // csrw mie, zero
+		0x30200073, // mret
+	});
+	return program;
+}
+
+// The interrupt arrives at the same instruction, whatever the host does
+TEST_F(ReplayTest, InterruptLines)
+{
+	u32 a1;
+	u64 count;
+
+	load_program(count_until_irq());
+	cpu->replay = replay_open(log.c_str(), REPLAY_RECORD);
+	ASSERT_NE(cpu->replay, nullptr);
+	EXPECT_EQ(cpu_run_for(cpu, 50, NULL), CPU_STOP_BUDGET);
+	cpu_set_irq(cpu, MIP_MEIP, true);
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[11], 44u);
+	EXPECT_EQ(cpu->replay->events, 1u);
+	EXPECT_TRUE(replay_close(cpu->replay));
+	cpu->replay = nullptr;
+	a1 = cpu->registers[11];
+	count = cpu->insn_count;
+
+	// Raised at 50 even when the run does not stop there, and the
+	// host's own calls are ignored
+	cpu_reset(cpu);
+	load_program(count_until_irq());
+	cpu->replay = replay_open(log.c_str(), REPLAY_REPLAY);
+	ASSERT_NE(cpu->replay, nullptr);
+	cpu_set_irq(cpu, MIP_MEIP, true);
+	EXPECT_EQ(cpu->csr.mip & MIP_MEIP, 0u);
+	cpu_run(cpu);
+	EXPECT_FALSE(cpu->replay->diverged);
+	EXPECT_EQ(cpu->replay->events, 1u);
+	EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(cpu->registers[11], a1);
+	EXPECT_EQ(cpu->insn_count, count);
+}
+
+static void raise_meip(struct cpu *c, void *opaque)
+{
+	cpu_set_irq(c, MIP_MEIP, true);
+	(void)opaque;
+}
+
+// A line raised by a syscall handler in mid-block shows from the next
+// block on, in the recording as in the replay
+TEST_F(ReplayTest, LinesFromSyscallHandlers)
+{
+	for (enum replay_mode mode : { REPLAY_RECORD, REPLAY_REPLAY }) {
+		cpu_reset(cpu);
+		load_program({
+			0x1F400893, // addi a7, zero, 500
+			0x00000073, // ecall
+			0x344025F3, // csrr a1, mip
+			0x0080006F, // j +8
+			0x00000013, // nop, skipped
+			0x34402673, // csrr a2, mip
+			0x00100073, // ebreak
+		});
+		ASSERT_TRUE(cpu_register_syscall(cpu, 500, raise_meip, NULL));
+		cpu->replay = replay_open(log.c_str(), mode);
+		ASSERT_NE(cpu->replay, nullptr);
+		cpu_run(cpu);
+		EXPECT_EQ(cpu->stop, CPU_STOP_BREAKPOINT);
+		EXPECT_FALSE(cpu->replay->diverged);
+		EXPECT_EQ(cpu->replay->events, 1u);
+		EXPECT_EQ(cpu->registers[11], 0u);
+		EXPECT_EQ(cpu->registers[12], (u32)MIP_MEIP);
+		EXPECT_TRUE(replay_close(cpu->replay));
+		cpu->replay = nullptr;
+	}
+}
+
+TEST_F(ReplayTest, RejectsOtherFiles)
+{
+	FILE *fp = fopen(log.c_str(), "wb");
+
+	ASSERT_NE(fp, nullptr);
+	fputs("not a log", fp);
+	fclose(fp);
+	EXPECT_EQ(replay_open(log.c_str(), REPLAY_REPLAY), nullptr);
+}
@@ -0,0 +1,163 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "trace.h"
+}
+
+class RunForTest : public CpuTest {
+    protected:
+	// 100 increments of t0 and a jump back: longer than CPU_BLOCK_MAX
+	void load_spin(struct cpu *c)
+	{
+		std::vector<uint32_t> program(100, 0x00128293); // addi t0, t0, 1
+
+		program.push_back(0xE71FF06F); // jal zero, -400
+		load_program(c, program);
+	}
+};
+
+TEST_F(RunForTest, BudgetIsExact)
+{
+	u64 retired = 0;
+
+	load_spin(cpu);
+	EXPECT_EQ(cpu_run_for(cpu, 37, &retired), CPU_STOP_BUDGET);
+	EXPECT_EQ(retired, 37u);
+	EXPECT_EQ(cpu->registers[5], 37u);
+	EXPECT_EQ(cpu->pc, 37u * 4);
+
+	EXPECT_EQ(cpu_run_for(cpu, 1000, &retired), CPU_STOP_BUDGET);
+	EXPECT_EQ(retired, 1000u);
+	EXPECT_EQ(cpu->insn_count, 1037u);
+	// 1037 = 10 * 101 + 27: ten jumps back, 27 + 10 * 100 increments
+	EXPECT_EQ(cpu->registers[5], 1027u);
+
+	EXPECT_EQ(cpu_run_for(cpu, 0, &retired), CPU_STOP_BUDGET);
+	EXPECT_EQ(retired, 0u);
+}
+
+TEST_F(RunForTest, GuestsShareOneThread)
+{
+	struct cpu *other = cpu_create(MEM_SIZE);
+
+	load_spin(cpu);
+	load_spin(other);
+	for (int slice = 0; slice < 50; ++slice) {
+		cpu_run_for(cpu, 97, NULL);
+		cpu_run_for(other, 97, NULL);
+	}
+	EXPECT_EQ(cpu->insn_count, 50u * 97);
+	EXPECT_EQ(other->insn_count, cpu->insn_count);
+	EXPECT_EQ(other->registers[5], cpu->registers[5]);
+	cpu_destroy(other);
+}
+
+TEST_F(RunForTest, BreakpointAndResume)
+{
+	u64 retired = 0;
+
+	load_program(cpu, {
+		0x00500513, // addi a0, zero, 5
+		0x00100073, // ebreak
+		0x00150513, // addi a0, a0, 1
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	EXPECT_EQ(cpu_run_for(cpu, 100, &retired), CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(retired, 2u);
+	EXPECT_EQ(cpu->pc, 4u);
+
+	cpu_resume(cpu);
+	EXPECT_EQ(cpu_run_for(cpu, 100, &retired), CPU_STOP_HALT);
+	EXPECT_EQ(retired, 3u);
+	EXPECT_EQ(cpu->registers[10], 6u);
+	EXPECT_EQ(cpu->pc, 16u); // on the exit ECALL
+
+	// A halt is final
+	cpu_resume(cpu);
+	EXPECT_EQ(cpu_run_for(cpu, 100, &retired), CPU_STOP_HALT);
+	EXPECT_EQ(retired, 0u);
+}
+
+// break_pc stops the run in the middle of a block, and of a hot trace
+TEST_F(RunForTest, BreakPcInsideBlock)
+{
+	struct trace_cache *tc = trace_cache_create();
+	u64 retired = 0;
+
+	ASSERT_NE(tc, nullptr);
+	load_spin(cpu);
+	cpu->break_pc = 0x20;
+	EXPECT_EQ(cpu_run_for(cpu, 1000, &retired), CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(retired, 8u);
+	EXPECT_EQ(cpu->pc, 0x20u);
+
+	cpu_reset(cpu);
+	load_spin(cpu);
+	cpu->break_pc = CPU_NO_BREAK;
+	cpu->traces = tc;
+	EXPECT_EQ(cpu_run_for(cpu, 101 * 50, NULL), CPU_STOP_BUDGET);
+	cpu->break_pc = 0x20;
+	EXPECT_EQ(cpu_run_for(cpu, 1000, &retired), CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(retired, 8u);
+	EXPECT_EQ(cpu->registers[5], 50u * 100 + 8);
+#ifndef CONFIG_INSN_MIX
+	EXPECT_GT(tc->stats.runs, 0u);
+#endif
+	cpu->traces = NULL;
+	trace_cache_destroy(tc);
+}
+
+TEST_F(RunForTest, UnknownSyscallGoesToHost)
+{
+	load_program(cpu, {
+		0x4D200893, // addi a7, zero, 1234
+		0x00000073, // ecall
+		0x00150513, // addi a0, a0, 1
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	ASSERT_EQ(cpu_run_for(cpu, 100, NULL), CPU_STOP_SYSCALL);
+	EXPECT_EQ(cpu->registers[17], 1234u);
+	EXPECT_EQ(cpu->pc, 4u);
+
+	cpu->registers[10] = 41;
+	cpu_resume(cpu);
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_HALT);
+	EXPECT_EQ(cpu->registers[10], 42u);
+}
+
+TEST_F(RunForTest, ExitCodeIsKept)
+{
+	load_program(cpu, {
+		0xFFF00513, // addi a0, zero, -1
+		0x05D00893, // addi a7, zero, 93
+		0x00000073, // ecall
+	});
+	EXPECT_EQ(cpu->exit_code, 0u);
+	cpu_run(cpu);
+	EXPECT_EQ(cpu->stop, CPU_STOP_HALT);
+	EXPECT_EQ(cpu->exit_code, 0xFFFFFFFFu);
+	cpu_reset(cpu);
+	EXPECT_EQ(cpu->exit_code, 0u);
+}
+
+// The library prints nothing; the host reads the cause off the cpu
+TEST_F(RunForTest, UnhandledTrapGoesToHost)
+{
+	load_program(cpu, {
+		0x00500513, // addi a0, zero, 5
+		0x00000000, // illegal
+	});
+	EXPECT_EQ(cpu->trap_cause, CPU_NO_TRAP);
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(cpu_run_for(cpu, 100, NULL), CPU_STOP_HALT);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+	EXPECT_EQ(cpu->trap_cause, (u32)CAUSE_ILLEGAL_INSN);
+	EXPECT_EQ(cpu->pc, 4u);
+	cpu_reset(cpu);
+	EXPECT_EQ(cpu->trap_cause, CPU_NO_TRAP);
+}
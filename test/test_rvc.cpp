@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "disassembler.h"
+}
+
+class RVCTest : public CpuTest {
+    protected:
+	// Compressed code is a stream of 16-bit parcels; 32-bit instructions
+	// are written as two parcels, low half first.
+	void load_parcels(const std::vector<uint16_t> &program, uint32_t at = 0)
+	{
+		for (size_t i = 0; i < program.size(); ++i) {
+			mem_store16(cpu->memory, at + i * 2, program[i]);
+		}
+	}
+
+};
+
+TEST_F(RVCTest, Arithmetic)
+{
+	load_parcels({
+		0x4515, // c.li a0, 5
+		0x157D, // c.addi a0, -1
+		0x85AA, // c.mv a1, a0
+		0x95AA, // c.add a1, a0
+	});
+	run_program(4);
+
+	EXPECT_EQ(cpu->registers[10], 4);
+	EXPECT_EQ(cpu->registers[11], 8);
+	EXPECT_EQ(cpu->pc, 8);
+}
+
+TEST_F(RVCTest, MixedWidthStream)
+{
+	load_parcels({
+		0x4515, // 0x0: c.li a0, 5
+		0x0113, 0x00A0, // 0x2: addi x2, x0, 10
+		0x0001, // 0x6: c.nop
+	});
+	run_program(3);
+
+	EXPECT_EQ(cpu->registers[10], 5);
+	EXPECT_EQ(cpu->registers[2], 10);
+	EXPECT_EQ(cpu->pc, 8);
+}
+
+TEST_F(RVCTest, JumpLinksToNextParcel)
+{
+	cpu->pc = 0x10;
+	load_parcels({ 0x3FF5 }, 0x10); // c.jal -4
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->pc, 0x0C);
+	EXPECT_EQ(cpu->registers[1], 0x12);
+
+	cpu->registers[15] = 0x40;
+	load_parcels({ 0x9782 }, 0x0C); // c.jalr a5
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->pc, 0x40);
+	EXPECT_EQ(cpu->registers[1], 0x0E);
+}
+
+TEST_F(RVCTest, Branches)
+{
+	load_parcels({
+		0xC119, // 0x0: c.beqz a0, 6 (taken, a0 == 0)
+		0x4505, // 0x2: c.li a0, 1 (skipped)
+		0x0001, // 0x4: c.nop (skipped)
+		0xFC7D, // 0x6: c.bnez s0, -2 (not taken, s0 == 0)
+	});
+	run_program(2);
+
+	EXPECT_EQ(cpu->registers[10], 0);
+	EXPECT_EQ(cpu->pc, 8);
+}
+
+TEST_F(RVCTest, LoadsAndStores)
+{
+	cpu->registers[11] = 0x100; // a1
+	cpu->registers[2] = 0x200; // sp
+	mem_store32(cpu->memory, 0x104, 0x12345678);
+
+	load_parcels({
+		0x41C8, // c.lw a0, 4(a1)
+		0xC1A8, // c.sw a0, 64(a1)
+		0xC306, // c.swsp ra, 132(sp)
+		0x4532, // c.lwsp a0, 12(sp)
+	});
+	cpu->registers[1] = 0xCAFE;
+	mem_store32(cpu->memory, 0x20C, 0xBEEF);
+	run_program(4);
+
+	EXPECT_EQ(mem_load32(cpu->memory, 0x140), 0x12345678u);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x284), 0xCAFEu);
+	EXPECT_EQ(cpu->registers[10], 0xBEEF);
+}
+
+TEST_F(RVCTest, StackAdjust)
+{
+	cpu->registers[2] = 0x1000;
+	load_parcels({
+		0x0800, // c.addi4spn s0, sp, 16
+		0x713D, // c.addi16sp sp, -32
+		0x667D, // c.lui a2, 0x1f
+	});
+	run_program(3);
+
+	EXPECT_EQ(cpu->registers[8], 0x1010);
+	EXPECT_EQ(cpu->registers[2], 0x0FE0);
+	EXPECT_EQ(cpu->registers[12], 0x1F000);
+}
+
+TEST_F(RVCTest, ModifiedCodeIsRedecoded)
+{
+	load_parcels({ 0x4515 }); // c.li a0, 5
+	cpu_step(cpu);
+	EXPECT_EQ(cpu->registers[10], 5);
+
+	// Same pc, new encoding: the cached decode must not be reused
+	cpu->pc = 0;
+	load_parcels({ 0x451D }); // c.li a0, 7
+	cpu_step(cpu);
+	EXPECT_EQ(cpu->registers[10], 7);
+}
+
+TEST_F(RVCTest, IllegalParcelHalts)
+{
+	load_parcels({ 0x0000 }); // defined illegal instruction
+	cpu_step(cpu);
+
+	EXPECT_EQ(cpu->state, CPU_STATE_HALTED);
+	EXPECT_EQ(cpu->pc, 0);
+}
+
+TEST_F(RVCTest, Disassemble)
+{
+	const std::vector<std::pair<uint16_t, std::string> > cases = {
+		{ 0x4515, "c.li a0, 5" },
+		{ 0x157D, "c.addi a0, -1" },
+		{ 0x85AA, "c.mv a1, a0" },
+		{ 0x95AA, "c.add a1, a0" },
+		{ 0xA019, "c.j 6" },
+		{ 0x3FF5, "c.jal -4" },
+		{ 0xC119, "c.beqz a0, 6" },
+		{ 0xFC7D, "c.bnez s0, -2" },
+		{ 0x41C8, "c.lw a0, 4(a1)" },
+		{ 0xC1A8, "c.sw a0, 64(a1)" },
+		{ 0x4532, "c.lwsp a0, 12(sp)" },
+		{ 0xC306, "c.swsp ra, 132(sp)" },
+		{ 0x0800, "c.addi4spn s0, sp, 16" },
+		{ 0x713D, "c.addi16sp sp, -32" },
+		{ 0x667D, "c.lui a2, 0x1f" },
+		{ 0x850D, "c.srai a0, 3" },
+		{ 0x8D0D, "c.sub a0, a1" },
+		{ 0x8082, "c.jr ra" },
+		{ 0x9782, "c.jalr a5" },
+		{ 0x050A, "c.slli a0, 2" },
+		{ 0x0001, "c.nop" },
+		{ 0x9002, "c.ebreak" },
+	};
+	char buf[64];
+
+	for (const auto &tc : cases) {
+		disassemble(tc.first, buf, sizeof(buf));
+		EXPECT_EQ(std::string(buf), tc.second);
+	}
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "cachesim.h"
+#include "bpred.h"
+#include "sample.h"
+}
+
+// 40960 iterations of a load and a loop branch, then exit
+static const u64 kInsns = 1 + 40960 * 5 + 2;
+
+class SampleTest : public CpuTest {
+    protected:
+	struct cachesim *sim = nullptr;
+	struct bpred *bp = nullptr;
+	struct sampler *s = nullptr;
+
+	void SetUp() override
+	{
+		const struct cache_config l1 = { 1 << 10, 2, 64, CACHE_LRU };
+		struct bpred_config cfg;
+
+		CpuTest::SetUp();
+		load_program({
+			0x0000A2B7, // lui t0, 10
+			0x00032383, // lw t2, 0(t1)
+			0x00430313, // addi t1, t1, 4
+			0x3FF37313, // andi t1, t1, 0x3ff
+			0xFFF28293, // addi t0, t0, -1
+			0xFE0298E3, // bne t0, zero, -16
+			0x05D00893, // addi a7, zero, 93
+			0x00000073, // ecall
+		});
+		sim = cachesim_create(&l1, &l1, NULL);
+		ASSERT_TRUE(bpred_config_parse("gshare", &cfg));
+		bp = bpred_create(&cfg);
+	}
+
+	void TearDown() override
+	{
+		sample_destroy(s);
+		cachesim_destroy(sim);
+		bpred_destroy(bp);
+		CpuTest::TearDown();
+	}
+
+	void run_sampled(const char *spec)
+	{
+		struct sample_config cfg;
+
+		ASSERT_TRUE(sample_config_parse(spec, &cfg)) << spec;
+		s = sample_create(&cfg, sim, bp);
+		ASSERT_NE(s, nullptr);
+		sample_run(s, cpu);
+	}
+};
+
+TEST_F(SampleTest, ConfigParse)
+{
+	struct sample_config cfg;
+
+	ASSERT_TRUE(sample_config_parse("1m:100k:10k:2k", &cfg));
+	EXPECT_EQ(cfg.start, 1000000u);
+	EXPECT_EQ(cfg.interval, 100000u);
+	EXPECT_EQ(cfg.window, 10000u);
+	EXPECT_EQ(cfg.warmup, 2000u);
+	ASSERT_TRUE(sample_config_parse("2g:0:1000", &cfg));
+	EXPECT_EQ(cfg.start, 2000000000u);
+	EXPECT_EQ(cfg.warmup, 0u);
+
+	EXPECT_FALSE(sample_config_parse("0:100:0", &cfg)); // empty window
+	EXPECT_FALSE(sample_config_parse("0:100:80:30", &cfg)); // overlap
+	EXPECT_FALSE(sample_config_parse("0:100", &cfg));
+	EXPECT_FALSE(sample_config_parse("0:100:10x", &cfg));
+}
+
+TEST_F(SampleTest, WindowSchedule)
+{
+	run_sampled("3500:20000:2000:500");
+
+	EXPECT_EQ(cpu->state, CPU_STATE_HALTED);
+	EXPECT_EQ(s->total_insns, kInsns);
+	// 3500, 23500, ..., 203500; the last one is cut short
+	ASSERT_EQ(s->nwindows, 11u);
+	for (u32 i = 0; i < s->nwindows; ++i)
+		EXPECT_EQ(s->windows[i].begin, 3500 + i * 20000u);
+	EXPECT_EQ(s->windows[0].ev[SAMPLE_EV_INSNS], 2000u);
+	EXPECT_EQ(s->windows[10].ev[SAMPLE_EV_INSNS], kInsns - 203500);
+
+	// Models are detached outside the windows
+	EXPECT_EQ(cpu->cachesim, nullptr);
+	EXPECT_EQ(cpu->bpred, nullptr);
+	EXPECT_LT(bp->stats.cond, 40960u / 5);
+}
+
+TEST_F(SampleTest, EstimatesMatchFullRun)
+{
+	double total, ci;
+
+	run_sampled("1000:20000:2000:500");
+
+	// One branch and one load per five instructions
+	ASSERT_TRUE(sample_estimate(s, SAMPLE_EV_BRANCH, &total, &ci));
+	EXPECT_NEAR(total, 40960, 40960 * 0.01);
+	ASSERT_TRUE(sample_estimate(s, SAMPLE_EV_L1D_ACCESS, &total, &ci));
+	EXPECT_NEAR(total, 40960, 40960 * 0.01);
+	ASSERT_TRUE(sample_estimate(s, SAMPLE_EV_INSNS, &total, &ci));
+	EXPECT_DOUBLE_EQ(total, kInsns);
+
+	// The 1k array fits in the L1D and stays there between windows
+	ASSERT_TRUE(sample_estimate(s, SAMPLE_EV_L1D_MISS, &total, &ci));
+	EXPECT_LT(total, 100);
+}
+
+TEST_F(SampleTest, ProgramEndsBeforeFirstWindow)
+{
+	double total, ci;
+
+	run_sampled("1g:0:1000");
+
+	EXPECT_EQ(s->total_insns, kInsns);
+	EXPECT_EQ(s->nwindows, 0u);
+	EXPECT_FALSE(sample_estimate(s, SAMPLE_EV_BRANCH, &total, &ci));
+	EXPECT_EQ(sim->l1i.accesses, 0u);
+}
@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+extern "C" {
+#include "cpu.h"
+#include "server.h"
+}
+
+// Reads up to 16 bytes of input to 0x2000, prints them back and exits with
+// the number read
+static const std::vector<u32> echo = {
+	0x00000513, // addi a0, zero, 0
+	0x000025B7, // lui a1, 2
+	0x01000613, // addi a2, zero, 16
+	0x03F00893, // addi a7, zero, 63
+	0x00000073, // ecall
+	0x00050413, // mv s0, a0
+	0x000024B7, // lui s1, 2
+	0x00848933, // add s2, s1, s0
+	0x01248C63, // loop: beq s1, s2, done
+	0x0004C503, // lbu a0, 0(s1)
+	0x00100893, // addi a7, zero, 1
+	0x00000073, // ecall
+	0x00148493, // addi s1, s1, 1
+	0xFEDFF06F, // j loop
+	0x00040513, // done: mv a0, s0
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+};
+
+class ServerTest : public ::testing::Test {
+    protected:
+	std::string path;
+	struct server *s;
+	std::thread thread;
+	int fd;
+	struct server_reply reply;
+	char output[OUTPUT_BUFFER_SIZE];
+
+	void SetUp() override
+	{
+		struct server_config cfg = {};
+
+		path = "/tmp/rv32i-test-" + std::to_string(getpid()) + ".sock";
+		cfg.path = path.c_str();
+		cfg.pool_size = 2;
+		cfg.mem_size = MEM_SIZE;
+		s = server_create(&cfg);
+		ASSERT_NE(s, nullptr);
+		thread = std::thread(server_run, s);
+		fd = server_connect(path.c_str());
+		ASSERT_GE(fd, 0);
+	}
+
+	void TearDown() override
+	{
+		if (fd >= 0)
+			close(fd);
+		if (s) {
+			server_stop(s);
+			thread.join();
+			server_destroy(s);
+		}
+		EXPECT_NE(access(path.c_str(), F_OK), 0);
+	}
+
+	bool run(const std::vector<u32> &image, const char *input,
+		 bool by_hash = false, u64 budget = 0)
+	{
+		struct server_job job = {};
+
+		job.image = image.data();
+		job.image_len = image.size() * 4;
+		job.input = input;
+		job.input_len = strlen(input);
+		job.budget = budget;
+		job.by_hash = by_hash;
+		return server_submit(fd, &job, &reply, output);
+	}
+};
+
+TEST_F(ServerTest, RunsJob)
+{
+	ASSERT_TRUE(run(echo, "hello"));
+	EXPECT_EQ(reply.status, (u32)SERVER_OK);
+	EXPECT_EQ(reply.stop, (u32)CPU_STOP_HALT);
+	EXPECT_EQ(reply.exit_code, 5u);
+	EXPECT_STREQ(output, "hello");
+	EXPECT_EQ(reply.output_len, 5u);
+	EXPECT_EQ(reply.pool_hit, 0u);
+	EXPECT_GT(reply.insns, 0u);
+}
+
+// The instance is reset between jobs: no output or input carries over
+TEST_F(ServerTest, PooledInstanceStartsClean)
+{
+	ASSERT_TRUE(run(echo, "first job"));
+	ASSERT_TRUE(run(echo, "two", true));
+	EXPECT_EQ(reply.pool_hit, 1u);
+	EXPECT_EQ(reply.exit_code, 3u);
+	EXPECT_STREQ(output, "two");
+}
+
+// By hash before the server has the image: it is sent after all
+TEST_F(ServerTest, UnknownHashSendsImage)
+{
+	ASSERT_TRUE(run(echo, "x", true));
+	EXPECT_EQ(reply.status, (u32)SERVER_OK);
+	EXPECT_EQ(reply.pool_hit, 0u);
+	EXPECT_STREQ(output, "x");
+}
+
+// Three images through a pool of two: the least recently used goes
+TEST_F(ServerTest, EvictsLeastRecentlyUsed)
+{
+	std::vector<u32> a = echo, b = echo, c = echo;
+
+	b.push_back(1);
+	c.push_back(2);
+	ASSERT_TRUE(run(a, "a"));
+	ASSERT_TRUE(run(b, "b"));
+	ASSERT_TRUE(run(a, "a"));
+	EXPECT_EQ(reply.pool_hit, 1u);
+	ASSERT_TRUE(run(c, "c"));
+	EXPECT_EQ(reply.pool_hit, 0u);
+	ASSERT_TRUE(run(a, "a"));
+	EXPECT_EQ(reply.pool_hit, 1u);
+	ASSERT_TRUE(run(b, "b"));
+	EXPECT_EQ(reply.pool_hit, 0u);
+}
+
+TEST_F(ServerTest, Budget)
+{
+	ASSERT_TRUE(run(echo, "hello", false, 10));
+	EXPECT_EQ(reply.stop, (u32)CPU_STOP_BUDGET);
+	EXPECT_EQ(reply.insns, 10u);
+
+	// The next job gets a fresh run
+	ASSERT_TRUE(run(echo, "hello", true));
+	EXPECT_EQ(reply.stop, (u32)CPU_STOP_HALT);
+	EXPECT_STREQ(output, "hello");
+}
+
+TEST_F(ServerTest, BadRequest)
+{
+	struct server_request req = {};
+
+	req.magic = 0x12345678;
+	ASSERT_EQ(write(fd, &req, sizeof(req)), (ssize_t)sizeof(req));
+	ASSERT_EQ(read(fd, &reply, sizeof(reply)), (ssize_t)sizeof(reply));
+	EXPECT_EQ(reply.status, (u32)SERVER_BAD_REQUEST);
+	// And the connection is closed
+	EXPECT_EQ(read(fd, &reply, sizeof(reply)), 0);
+
+	// The server carries on
+	close(fd);
+	fd = server_connect(path.c_str());
+	ASSERT_GE(fd, 0);
+	ASSERT_TRUE(run(echo, "ok"));
+	EXPECT_EQ(reply.exit_code, 2u);
+}
+
+// A client that stops halfway through its request holds up no one else
+TEST_F(ServerTest, StalledClientDoesNotBlockOthers)
+{
+	struct server_request req = {};
+	struct timeval tv = { 5, 0 };
+	int stalled = fd;
+
+	req.magic = SERVER_MAGIC;
+	req.image_len = echo.size() * 4;
+	ASSERT_EQ(write(stalled, &req, sizeof(req)), (ssize_t)sizeof(req));
+	ASSERT_EQ(write(stalled, echo.data(), 8), 8);
+
+	// Fail rather than hang if the server is stuck on the other client
+	fd = server_connect(path.c_str());
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)), 0);
+	ASSERT_TRUE(run(echo, "ok"));
+	EXPECT_STREQ(output, "ok");
+
+	// The stalled request still completes once the rest arrives
+	ASSERT_EQ(write(stalled, (const u8 *)echo.data() + 8, req.image_len - 8),
+		  (ssize_t)req.image_len - 8);
+	ASSERT_EQ(setsockopt(stalled, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)),
+		  0);
+	ASSERT_EQ(read(stalled, &reply, sizeof(reply)), (ssize_t)sizeof(reply));
+	EXPECT_EQ(reply.status, (u32)SERVER_OK);
+	EXPECT_EQ(reply.pool_hit, 1u);
+	EXPECT_EQ(reply.exit_code, 0u);
+	close(stalled);
+}
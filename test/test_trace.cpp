@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include <glob.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+#include "memory.h"
+#include "trace.h"
+}
+
+// With `make INSN_MIX=1` every block runs in the interpreter, so the mix
+// sees each instruction: results still match, but no trace ever runs
+#ifdef CONFIG_INSN_MIX
+#define SKIP_IF_INSN_MIX() GTEST_SKIP() << "no traces with INSN_MIX=1"
+#else
+#define SKIP_IF_INSN_MIX() (void)0
+#endif
+
+// Loads, a reused load, a dead write, store-to-load forwarding and a
+// branch that sometimes leaves the trace, 50 times round
+static const std::vector<uint32_t> mixed = {
+	0x00002437, // lui s0, 2
+	0x01040413, // addi s0, s0, 16
+	0x03200293, // addi t0, zero, 50
+	0x00042303, // loop: lw t1, 0(s0)
+	0x00042383, // lw t2, 0(s0)
+	0x00730333, // add t1, t1, t2
+	0x00130E13, // addi t3, t1, 1
+	0x00230E13, // addi t3, t1, 2
+	0x01C42023, // sw t3, 0(s0)
+	0x00042E83, // lw t4, 0(s0)
+	0x01D54533, // xor a0, a0, t4
+	0x00351F13, // slli t5, a0, 3
+	0x008F7F13, // andi t5, t5, 8
+	0x000F0463, // beqz t5, skip
+	0x00158593, // addi a1, a1, 1
+	0xFFF28293, // skip: addi t0, t0, -1
+	0xFC0296E3, // bnez t0, loop
+	0x05D00893, // addi a7, zero, 93
+	0x00000073, // ecall
+};
+
+// Walks a load off the end of memory in the middle of a trace; the
+// handler records mepc and mcause and stops
+static const std::vector<uint32_t> faulting = {
+	0x00000297, // auipc t0, 0
+	0x02C28293, // addi t0, t0, 44
+	0x30529073, // csrw mtvec, t0
+	0x000084B7, // lui s1, 8
+	0x00360613, // loop: addi a2, a2, 3
+	0x0004A683, // lw a3, 0(s1)
+	0x00D70733, // add a4, a4, a3
+	0x10000393, // addi t2, zero, 256
+	0x007484B3, // add s1, s1, t2
+	0x00130313, // addi t1, t1, 1
+	0xFE9FF06F, // j loop
+	0x341027F3, // handler: csrr a5, mepc
+	0x34202873, // csrr a6, mcause
+	0x00100073, // ebreak
+};
+
+// Patches its own loop body halfway through (addi a0, a0, 1 -> 2)
+static const std::vector<uint32_t> patching = {
+	0x02800293, // addi t0, zero, 40
+	0x00000417, // auipc s0, 0
+	0x00840413, // addi s0, s0, 8
+	0x00150513, // loop: addi a0, a0, 1
+	0xFFF28293, // addi t0, t0, -1
+	0x01400313, // addi t1, zero, 20
+	0x00629863, // bne t0, t1, cont
+	0x02842383, // lw t2, 40(s0)
+	0x00742023, // sw t2, 0(s0)
+	0x0000100F, // fence.i
+	0xFE0292E3, // cont: bnez t0, loop
+	0x00100073, // ebreak
+	0x00000013, // nop
+	0x00250513, // addi a0, a0, 2
+};
+
+// A hash-style loop built from Zba/Zbb/Zbs ops, 100 times round
+static const std::vector<uint32_t> bitmanip = {
+	0x06400293, // addi t0, zero, 100
+	0x12345537, // lui a0, 0x12345
+	0x67850513, // addi a0, a0, 0x678
+	0x60D55593, // loop: rori a1, a0, 13
+	0x40B54533, // xnor a0, a0, a1
+	0x20554533, // sh2add a0, a0, t0
+	0x60251613, // cpop a2, a0
+	0x00C686B3, // add a3, a3, a2
+	0x69855513, // rev8 a0, a0
+	0x0AB55733, // minu a4, a0, a1
+	0x28371713, // bseti a4, a4, 3
+	0x40A777B3, // andn a5, a4, a0
+	0x60079813, // clz a6, a5
+	0x010686B3, // add a3, a3, a6
+	0xFFF28293, // addi t0, t0, -1
+	0xFC0298E3, // bnez t0, loop
+	0x00100073, // ebreak
+};
+
+class TraceTest : public ::testing::Test {
+    protected:
+	struct cpu *plain;
+	struct cpu *traced;
+	struct trace_cache *tc;
+
+	void SetUp() override
+	{
+		plain = cpu_create(MEM_SIZE);
+		traced = cpu_create(MEM_SIZE);
+		tc = trace_cache_create();
+		ASSERT_NE(tc, nullptr);
+		traced->traces = tc;
+	}
+
+	void TearDown() override
+	{
+		cpu_destroy(plain);
+		cpu_destroy(traced);
+		trace_cache_destroy(tc);
+	}
+
+	void load_program(const std::vector<uint32_t> &program)
+	{
+		for (size_t i = 0; i < program.size(); ++i) {
+			mem_store32(plain->memory, i * 4, program[i]);
+			mem_store32(traced->memory, i * 4, program[i]);
+		}
+	}
+
+	void expect_same_state()
+	{
+		for (int r = 0; r < NREGS; ++r)
+			EXPECT_EQ(traced->registers[r], plain->registers[r])
+				<< "x" << r << " at insn " << plain->insn_count;
+		EXPECT_EQ(traced->pc, plain->pc);
+		EXPECT_EQ(traced->insn_count, plain->insn_count);
+		EXPECT_EQ(traced->state, plain->state);
+		EXPECT_EQ(traced->csr.mepc, plain->csr.mepc);
+	}
+
+	// Run both CPUs in slices of varying size and compare after each
+	void run_both(u64 limit = 1000000)
+	{
+		u64 slice = 1;
+
+		while (plain->state == CPU_STATE_RUNNING &&
+		       plain->insn_count < limit) {
+			enum cpu_stop a = cpu_run_for(plain, slice, NULL);
+			enum cpu_stop b = cpu_run_for(traced, slice, NULL);
+
+			ASSERT_EQ(a, b);
+			expect_same_state();
+			if (HasFailure())
+				return;
+			slice = slice * 7 % 101 + 1;
+		}
+		EXPECT_EQ(memcmp(plain->memory, traced->memory, plain->mem_size), 0);
+	}
+};
+
+TEST_F(TraceTest, MatchesInterpreter)
+{
+	load_program(mixed);
+	mem_store32(plain->memory, 0x2010, 0x1234567);
+	mem_store32(traced->memory, 0x2010, 0x1234567);
+	run_both();
+	EXPECT_EQ(traced->stop, CPU_STOP_HALT);
+	SKIP_IF_INSN_MIX();
+	EXPECT_GT(tc->stats.runs, 0u);
+	EXPECT_GT(tc->stats.loads_reused, 0u);
+	EXPECT_GT(tc->stats.writes_elided, 0u);
+}
+
+TEST_F(TraceTest, FaultInsideTraceIsExact)
+{
+	load_program(faulting);
+	run_both();
+	EXPECT_EQ(traced->stop, CPU_STOP_BREAKPOINT);
+	EXPECT_EQ(traced->registers[15], 0x14u); // mepc: the lw
+	EXPECT_EQ(traced->registers[16], (u32)CAUSE_LOAD_ACCESS);
+	SKIP_IF_INSN_MIX();
+	EXPECT_GT(tc->stats.runs, 0u);
+}
+
+TEST_F(TraceTest, SelfModifyingCode)
+{
+	load_program(patching);
+	run_both();
+	EXPECT_EQ(traced->registers[10], 20u + 2 * 20);
+}
+
+TEST_F(TraceTest, FoldsAddressMaterialization)
+{
+	// lui/addi to a constant, then a load through it and a dead write
+	static const u32 code[] = {
+		0x00002437, // lui s0, 2
+		0x01040413, // addi s0, s0, 16
+		0x00042303, // lw t1, 0(s0)
+		0x00130E13, // addi t3, t1, 1
+		0x00230E13, // addi t3, t1, 2
+		0x00008067, // ret
+	};
+	struct trace *t =
+		trace_translate(tc, 0, (const u8 *)code, sizeof(code));
+
+	ASSERT_NE(t, nullptr);
+	EXPECT_EQ(t->ninsns, 6u);
+	EXPECT_GT(tc->stats.folded, 0u);
+	EXPECT_GT(tc->stats.dead, 0u);
+	// The constant address feeds the load directly
+	for (u32 i = 0; i < t->nops; ++i) {
+		if (t->ops[i].kind == IR_LW) {
+			EXPECT_EQ(t->exits[t->ops[i].exit].count, 1u);
+			EXPECT_EQ(t->ops[t->ops[i].a].kind, IR_CONST);
+			EXPECT_EQ(t->ops[t->ops[i].a].imm + t->ops[i].imm,
+				  0x2010u);
+		}
+	}
+	// The load's exit writes back s0 only, the final one s0, t1 and t3
+	EXPECT_EQ(t->exits[t->nexits - 1].count, 3u);
+	trace_free(t);
+}
+
+TEST_F(TraceTest, LiftsBitmanip)
+{
+	load_program(bitmanip);
+	run_both();
+	EXPECT_EQ(traced->stop, CPU_STOP_BREAKPOINT);
+	SKIP_IF_INSN_MIX();
+	EXPECT_GT(tc->stats.runs, 0u);
+	// The loop body lifts whole
+	EXPECT_EQ(tc->stats.translated, 1u);
+}
+
+TEST_F(TraceTest, StopsAtUnsupported)
+{
+	static const u32 code[] = {
+		0x00150513, // addi a0, a0, 1
+		0x34002673, // csrr a2, mscratch
+	};
+	static const u32 csr_first[] = {
+		0x34002673, // csrr a2, mscratch
+	};
+	struct trace *t =
+		trace_translate(tc, 0, (const u8 *)code, sizeof(code));
+
+	ASSERT_NE(t, nullptr);
+	EXPECT_EQ(t->ninsns, 1u);
+	EXPECT_EQ(t->bytes, 4u);
+	trace_free(t);
+	EXPECT_EQ(trace_translate(tc, 0, (const u8 *)csr_first, 4), nullptr);
+}
+
+TEST_F(TraceTest, EvalMatchesHandlers)
+{
+	EXPECT_EQ(trace_eval(IR_DIV, 0x80000000, 0xFFFFFFFF), 0x80000000u);
+	EXPECT_EQ(trace_eval(IR_REM, 7, 0), 7u);
+	EXPECT_EQ(trace_eval(IR_SRA, 0x80000000, 33), 0xC0000000u);
+	EXPECT_EQ(trace_eval(IR_MULHSU, 0xFFFFFFFF, 2), 0xFFFFFFFFu);
+	EXPECT_EQ(trace_eval(IR_SLTU, 1, 0xFFFFFFFF), 1u);
+	EXPECT_EQ(trace_eval(IR_CLZ, 0, 0), 32u);
+	EXPECT_EQ(trace_eval(IR_ROL, 0x80000001, 33), 3u);
+	EXPECT_EQ(trace_eval(IR_ORC_B, 0x00010080, 0), 0x00FF00FFu);
+}
+
+// The assembled corpus, when `make workloads` has built it
+TEST_F(TraceTest, WorkloadsMatch)
+{
+	glob_t g;
+
+	if (glob("build/workloads/*.bin", 0, NULL, &g))
+		GTEST_SKIP() << "workloads not built";
+	for (size_t i = 0; i < g.gl_pathc; ++i) {
+		FILE *fp = fopen(g.gl_pathv[i], "rb");
+
+		ASSERT_NE(fp, nullptr);
+		cpu_reset(plain);
+		cpu_reset(traced);
+		fread(plain->memory, 1, plain->mem_size, fp);
+		fclose(fp);
+		memcpy(traced->memory, plain->memory, plain->mem_size);
+		cpu_run(plain);
+		cpu_run(traced);
+		SCOPED_TRACE(g.gl_pathv[i]);
+		expect_same_state();
+		EXPECT_EQ(traced->exit_code, plain->exit_code);
+		EXPECT_EQ(memcmp(plain->memory, traced->memory,
+				 plain->mem_size),
+			  0);
+	}
+	globfree(&g);
+	EXPECT_GT(tc->stats.runs, 0u);
+}
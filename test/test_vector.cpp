@@ -0,0 +1,355 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "csr.h"
+#include "insn.h"
+#include "vector.h"
+#include "disassembler.h"
+}
+
+// Encodings and text from the LLVM assembler
+static const struct {
+	u32 raw;
+	const char *text;
+} disasm_cases[] = {
+	{ 0x0D0572D7, "vsetvli t0, a0, e32, m1, ta, ma" },
+	{ 0xC073F057, "vsetivli zero, 7, e8, mf2, tu, mu" },
+	{ 0x80D675D7, "vsetvl a1, a2, a3" },
+	{ 0x02056087, "vle32.v v1, (a0)" },
+	{ 0x00058107, "vle8.v v2, (a1), v0.t" },
+	{ 0x0AD65207, "vlse16.v v4, (a2), a3" },
+	{ 0x02B50007, "vlm.v v0, (a0)" },
+	{ 0x020560A7, "vse32.v v1, (a0)" },
+	{ 0x0A6560A7, "vsse32.v v1, (a0), t1" },
+	{ 0x02B701A7, "vsm.v v3, (a4)" },
+	{ 0x022180D7, "vadd.vv v1, v2, v3" },
+	{ 0x002540D7, "vadd.vx v1, v2, a0, v0.t" },
+	{ 0x022830D7, "vadd.vi v1, v2, -16" },
+	{ 0x0E27B0D7, "vrsub.vi v1, v2, 15" },
+	{ 0x962FB0D7, "vsll.vi v1, v2, 31" },
+	{ 0xB63120D7, "vmacc.vv v1, v2, v3" },
+	{ 0xB63560D7, "vmacc.vx v1, a0, v3" },
+	{ 0x5E0100D7, "vmv.v.v v1, v2" },
+	{ 0x5E0540D7, "vmv.v.x v1, a0" },
+	{ 0x5E0FB0D7, "vmv.v.i v1, -1" },
+	{ 0x5C2180D7, "vmerge.vvm v1, v2, v3, v0" },
+	{ 0x5C2540D7, "vmerge.vxm v1, v2, a0, v0" },
+	{ 0x5C22B0D7, "vmerge.vim v1, v2, 5, v0" },
+	{ 0x6221B057, "vmseq.vi v0, v2, 3" },
+	{ 0x7A25C057, "vmsgtu.vx v0, v2, a1" },
+	{ 0x0221A0D7, "vredsum.vs v1, v2, v3" },
+	{ 0x1C21A0D7, "vredmax.vs v1, v2, v3, v0.t" },
+	{ 0x42202557, "vmv.x.s a0, v2" },
+	{ 0x42056157, "vmv.s.x v2, a0" },
+	{ 0x822180D7, "vsaddu.vv v1, v2, v3" },
+	{ 0x9A866257, "vmulhsu.vx v4, v8, a2" },
+	{ 0x8621A0D7, "vdiv.vv v1, v2, v3" },
+	{ 0xAE25E0D7, "vnmsub.vx v1, a1, v2" },
+};
+
+// vtype immediates
+#define E8 (0u << 3)
+#define E16 (1u << 3)
+#define E32 (2u << 3)
+#define M1 0u
+#define M2 1u
+#define M8 3u
+#define MF2 7u
+
+class VectorTest : public CpuTest {
+    protected:
+	void SetUp() override
+	{
+		CpuTest::SetUp();
+		cpu->csr.mtvec = 0x100;
+	}
+
+	// Run one instruction at 0 with the given vtype and vl
+	void run(u32 raw, u32 vtype, u32 vl)
+	{
+		cpu->state = CPU_STATE_RUNNING;
+		cpu->csr.mcause = 0;
+		cpu->vec.vtype = vtype;
+		cpu->vec.vl = vl;
+		cpu->pc = 0;
+		mem_store32(cpu->memory, 0, raw);
+		cpu_step(cpu);
+	}
+
+	u32 elem32(u32 reg, u32 i)
+	{
+		u32 x;
+
+		memcpy(&x, &cpu->vec.v[reg][0] + i * 4, 4);
+		return x;
+	}
+};
+
+TEST_F(VectorTest, Disassembly)
+{
+	char buf[64];
+
+	for (const auto &tc : disasm_cases) {
+		disassemble(tc.raw, buf, sizeof(buf));
+		EXPECT_STREQ(buf, tc.text);
+	}
+}
+
+TEST_F(VectorTest, Vsetvl)
+{
+	// vsetvli t0, a0, e32, m1, ta, ma
+	cpu->registers[10] = 100;
+	run(0x0D0572D7, VTYPE_VILL, 0);
+	EXPECT_EQ(cpu->registers[5], 4u);
+	EXPECT_EQ(cpu->vec.vl, 4u);
+	EXPECT_EQ(cpu->vec.vtype, 0xD0u);
+
+	cpu->registers[10] = 3;
+	run(0x0D0572D7, VTYPE_VILL, 0);
+	EXPECT_EQ(cpu->registers[5], 3u);
+
+	// vsetivli zero, 7, e8, mf2, tu, mu: VLMAX is 8
+	run(0xC073F057, 0, 0);
+	EXPECT_EQ(cpu->vec.vl, 7u);
+	EXPECT_EQ(cpu->vec.vtype, E8 | MF2);
+
+	// vsetvl a1, a2, a3 with rs1 = a2 = 0 and rd set: VLMAX
+	cpu->registers[12] = 0;
+	cpu->registers[13] = E16 | M8;
+	mem_store32(cpu->memory, 0, 0x80D075D7); // vsetvl a1, zero, a3
+	cpu->pc = 0;
+	cpu_step(cpu);
+	EXPECT_EQ(cpu->registers[11], 64u);
+
+	// e64 is past ELEN, and so is e32 at mf2
+	for (u32 vtype : { 3u << 3, E32 | MF2, 4u, 1u << 8 }) {
+		cpu->registers[13] = vtype;
+		cpu->registers[12] = 5;
+		run(0x80D675D7, 0, 0);
+		EXPECT_EQ(cpu->vec.vtype, VTYPE_VILL) << vtype;
+		EXPECT_EQ(cpu->registers[11], 0u) << vtype;
+	}
+
+	// Anything but vsetvl traps with vill set
+	run(0x022180D7, VTYPE_VILL, 0);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+}
+
+TEST_F(VectorTest, Csrs)
+{
+	u32 val;
+
+	EXPECT_EQ(cpu->csr.mstatus & MSTATUS_VS, MSTATUS_VS_INITIAL);
+	ASSERT_TRUE(csr_read(cpu, CSR_VLENB, &val));
+	EXPECT_EQ(val, (u32)VLENB);
+	ASSERT_TRUE(csr_read(cpu, CSR_VTYPE, &val));
+	EXPECT_EQ(val, VTYPE_VILL);
+	EXPECT_FALSE(csr_write(cpu, CSR_VL, 1));
+
+	ASSERT_TRUE(csr_write(cpu, CSR_VCSR, 7));
+	ASSERT_TRUE(csr_read(cpu, CSR_VXRM, &val));
+	EXPECT_EQ(val, 3u);
+	ASSERT_TRUE(csr_read(cpu, CSR_VXSAT, &val));
+	EXPECT_EQ(val, 1u);
+	// Dirty vector state shows in SD
+	ASSERT_TRUE(csr_read(cpu, CSR_MSTATUS, &val));
+	EXPECT_EQ(val & (MSTATUS_SD | MSTATUS_VS), MSTATUS_SD | MSTATUS_VS);
+	ASSERT_TRUE(csr_read(cpu, CSR_SSTATUS, &val));
+	EXPECT_NE(val & MSTATUS_SD, 0u);
+
+	// Off: the CSRs and instructions trap
+	ASSERT_TRUE(csr_write(cpu, CSR_MSTATUS, 0));
+	EXPECT_FALSE(csr_read(cpu, CSR_VLENB, &val));
+	run(0x0D0572D7, 0, 0);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+}
+
+// Expected values worked out by hand
+TEST_F(VectorTest, Arithmetic)
+{
+	u8 *v1 = cpu->vec.v[1], *v2 = cpu->vec.v[2], *v3 = cpu->vec.v[3];
+
+	for (int i = 0; i < VLENB; ++i) {
+		v2[i] = 0xF0 + i;
+		v3[i] = 0x20;
+	}
+
+	// vadd.vv at e8 wraps
+	run(0x022180D7, E8, 16);
+	EXPECT_EQ(v1[0], 0x10);
+	EXPECT_EQ(v1[15], 0x1F);
+
+	// vsaddu.vv saturates and sets vxsat
+	run(0x822180D7, E8, 16);
+	EXPECT_EQ(v1[0], 0xFF);
+	EXPECT_EQ(cpu->vec.vxsat, 1u);
+
+	// vdiv.vv by zero is all ones, at e32
+	memset(v3, 0, VLENB);
+	run(0x8621A0D7, E32, 4);
+	EXPECT_EQ(elem32(1, 0), 0xFFFFFFFFu);
+
+	// vmulhsu.vx v4, v8, a2: -2 * 0x80000000 >> 32
+	memset(cpu->vec.v[8], 0xFF, VLENB);
+	cpu->vec.v[8][0] = 0xFE;
+	cpu->registers[12] = 0x80000000;
+	run(0x9A866257, E32, 4);
+	EXPECT_EQ(elem32(4, 0), 0xFFFFFFFFu);
+	EXPECT_EQ(elem32(4, 1), 0xFFFFFFFFu);
+
+	// vredsum.vs v1, v2, v3: 0xF1F0 + 0xF3F2 + ... + 0xFFFE at e16
+	run(0x0221A0D7, E16, 8);
+	EXPECT_EQ(v1[0] | v1[1] << 8, 0xC7B8);
+
+	// vmseq.vi v0, v2, 3 compares to the sign-extended immediate
+	v2[5] = 3;
+	run(0x6221B057, E8, 16);
+	EXPECT_EQ(cpu->vec.v[0][0], 1 << 5);
+	EXPECT_EQ(cpu->vec.v[0][1], 0);
+
+	// vmv.x.s a0, v2 sign-extends
+	run(0x42202557, E16, 0);
+	EXPECT_EQ(cpu->registers[10], 0xFFFFF1F0u);
+}
+
+// Masked-off and tail elements are left alone
+TEST_F(VectorTest, MaskAndTail)
+{
+	u8 *v1 = cpu->vec.v[1];
+
+	memset(v1, 0xAA, VLENB);
+	memset(cpu->vec.v[2], 1, VLENB);
+	cpu->vec.v[0][0] = 0x05;
+	cpu->registers[10] = 2;
+	// vadd.vx v1, v2, a0, v0.t over 6 elements
+	run(0x002540D7, E8, 6);
+	EXPECT_EQ(v1[0], 3);
+	EXPECT_EQ(v1[1], 0xAA);
+	EXPECT_EQ(v1[2], 3);
+	EXPECT_EQ(v1[3], 0xAA);
+	EXPECT_EQ(v1[6], 0xAA);
+
+	// A masked op may not write v0
+	run(0x00254057, E8, 6);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+	// Nor may a group of two start at an odd register
+	run(0x022180D7, E8 | M2, 32);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_ILLEGAL_INSN);
+}
+
+TEST_F(VectorTest, LoadsAndStores)
+{
+	for (u32 i = 0; i < 64; ++i)
+		mem_store8(cpu->memory, 0x1000 + i, i);
+
+	// vle32.v v1, (a0)
+	cpu->registers[10] = 0x1000;
+	run(0x02056087, E32, 4);
+	EXPECT_EQ(elem32(1, 0), 0x03020100u);
+	EXPECT_EQ(elem32(1, 3), 0x0F0E0D0Cu);
+
+	// vlse16.v v4, (a2), a3 with a stride of 6
+	cpu->registers[12] = 0x1000;
+	cpu->registers[13] = 6;
+	run(0x0AD65207, E16, 3);
+	EXPECT_EQ(cpu->vec.v[4][2], 6);
+	EXPECT_EQ(cpu->vec.v[4][4], 12);
+
+	// vsse32.v v1, (a0), t1 with a negative stride
+	cpu->registers[10] = 0x2010;
+	cpu->registers[6] = (u32)-8;
+	run(0x0A6560A7, E32, 3);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x2010), 0x03020100u);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x2008), 0x07060504u);
+	EXPECT_EQ(mem_load32(cpu->memory, 0x2000), 0x0B0A0908u);
+
+	// vlm.v v0, (a0) loads ceil(vl / 8) bytes
+	cpu->registers[10] = 0x1001;
+	memset(cpu->vec.v[0], 0xEE, VLENB);
+	run(0x02B50007, E8, 9);
+	EXPECT_EQ(cpu->vec.v[0][0], 1);
+	EXPECT_EQ(cpu->vec.v[0][1], 2);
+	EXPECT_EQ(cpu->vec.v[0][2], 0xEE);
+}
+
+// A fault leaves vstart at the element and the earlier ones loaded
+TEST_F(VectorTest, FaultSetsVstart)
+{
+	cpu->registers[10] = MEM_SIZE - 8;
+	mem_store32(cpu->memory, MEM_SIZE - 8, 0x11111111);
+	mem_store32(cpu->memory, MEM_SIZE - 4, 0x22222222);
+	run(0x02056087, E32, 4);
+	EXPECT_EQ(cpu->pc, 0x100u);
+	EXPECT_EQ(cpu->csr.mcause, (u32)CAUSE_LOAD_ACCESS);
+	EXPECT_EQ(cpu->csr.mtval, (u32)MEM_SIZE);
+	EXPECT_EQ(cpu->vec.vstart, 2u);
+	EXPECT_EQ(elem32(1, 1), 0x22222222u);
+}
+
+/*
+ * Every arithmetic entry with random operands, vtype and mask, against the
+ * element-at-a-time reference. Illegal combinations must trap in both.
+ */
+TEST_F(VectorTest, HostKernelsMatchReference)
+{
+	// With their VLMAX
+	static const u32 vtypes[][2] = { { E8 | M1, 16 },  { E16 | M1, 8 },
+					 { E32 | M1, 4 },  { E8 | M2, 32 },
+					 { E16 | M8, 64 }, { E32 | M2, 8 },
+					 { E8 | MF2, 8 } };
+	struct cpu *ref = cpu_create(MEM_SIZE);
+	std::mt19937 rng(47);
+	int checked = 0;
+
+	ASSERT_NE(ref, nullptr);
+	ref->vec.reference = true;
+	for (u32 id = INSN_ILLEGAL + 1; id < INSN_COUNT; ++id) {
+		const struct insn_info *e = &insn_info[id];
+
+		if (e->format < FMT_VV || e->format > FMT_VMV_XS)
+			continue;
+		for (int round = 0; round < 40; ++round) {
+			u32 raw = e->match | (rng() & ~e->mask);
+			u32 t = rng() % 7, vtype = vtypes[t][0];
+			u32 vl = rng() % (vtypes[t][1] + 1);
+
+			cpu_reset(cpu);
+			cpu->csr.mtvec = 0x100;
+			for (int r = 1; r < NREGS; ++r)
+				cpu->registers[r] = rng() % 4 ? rng() : rng() % 3;
+			for (int r = 0; r < NVREGS; ++r)
+				for (int b = 0; b < VLENB; ++b)
+					cpu->vec.v[r][b] = rng() % 5 ? rng() : 0x80;
+			cpu->vec.vtype = vtype;
+			cpu->vec.vl = vl;
+			cpu->vec.vstart = rng() % 8 ? 0 : rng() % 4;
+			mem_store32(cpu->memory, 0, raw);
+			ref->csr = cpu->csr;
+			memcpy(ref->registers, cpu->registers, sizeof(cpu->registers));
+			ref->vec = cpu->vec;
+			ref->vec.reference = true;
+			ref->pc = 0;
+			mem_store32(ref->memory, 0, raw);
+
+			cpu_step(cpu);
+			cpu_step(ref);
+			ASSERT_EQ(memcmp(cpu->vec.v, ref->vec.v, sizeof(cpu->vec.v)), 0)
+				<< e->name << " 0x" << std::hex << raw
+				<< " vtype 0x" << vtype;
+			ASSERT_EQ(memcmp(cpu->registers, ref->registers,
+					 sizeof(cpu->registers)),
+				  0)
+				<< e->name;
+			ASSERT_EQ(cpu->vec.vxsat, ref->vec.vxsat) << e->name;
+			ASSERT_EQ(cpu->pc, ref->pc) << e->name;
+			checked++;
+		}
+	}
+	EXPECT_GT(checked, 4000);
+	cpu_destroy(ref);
+}
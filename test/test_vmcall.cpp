@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+
+#include "cpu_fixture.h"
+
+extern "C" {
+#include "rv32i.h"
+}
+
+// Guest functions used by the tests
+#define ADD3 0x100u // a0 + a1 + a2
+#define DOUBLE_PLUS_HOST 0x200u // host syscall 500 on 2 * a0
+#define NESTED 0x300u // host syscall 501, then + 1
+#define EXITS 0x400u // exit() instead of returning
+#define LOOPS 0x500u // never returns
+#define FAULTS 0x600u // illegal instruction, with no handler
+
+#define BUDGET 100000
+
+class VmcallTest : public CpuTest {
+    protected:
+	void SetUp() override
+	{
+		CpuTest::SetUp();
+		store(ADD3, {
+			0x00B50533, // add a0, a0, a1
+			0x00C50533, // add a0, a0, a2
+			0x00008067, // ret
+		});
+		store(DOUBLE_PLUS_HOST, {
+			0x00151513, // slli a0, a0, 1
+			0x1F400893, // addi a7, zero, 500
+			0x00000073, // ecall
+			0x00008067, // ret
+		});
+		store(NESTED, {
+			0x1F500893, // addi a7, zero, 501
+			0x00000073, // ecall
+			0x00150513, // addi a0, a0, 1
+			0x00008067, // ret
+		});
+		store(EXITS, {
+			0x05D00893, // addi a7, zero, 93
+			0x00000073, // ecall
+		});
+		store(LOOPS, {
+			0x00150513, // 1: addi a0, a0, 1
+			0xFFDFF06F, // j 1b
+		});
+		store(FAULTS, {
+			0x00000000, // illegal
+		});
+		cpu->registers[2] = 0x8000; // sp
+	}
+
+	void store(u32 addr, const std::vector<uint32_t> &code)
+	{
+		for (size_t i = 0; i < code.size(); ++i)
+			mem_store32(cpu->memory, addr + i * 4, code[i]);
+	}
+
+	static void plus_one(struct cpu *c, void *opaque)
+	{
+		++*(int *)opaque;
+		c->registers[10] += 1;
+	}
+
+	// Calls back into the guest while servicing its syscall
+	static void call_add3(struct cpu *c, void *opaque)
+	{
+		const u32 args[] = { c->registers[10], 10, 20 };
+		u32 ret = 0;
+
+		EXPECT_EQ(vmcall(c, ADD3, args, 3, BUDGET, &ret), VMCALL_OK);
+		(void)opaque;
+		c->registers[10] = ret;
+	}
+};
+
+TEST_F(VmcallTest, ReturnsA0AndRestoresState)
+{
+	const u32 args[] = { 1, 2, 3 };
+	u32 ret = 0;
+
+	cpu->pc = 0x40;
+	cpu->registers[10] = 0xAAAA;
+	cpu->registers[1] = 0x1234;
+	ASSERT_EQ(vmcall(cpu, ADD3, args, 3, BUDGET, &ret), VMCALL_OK);
+	EXPECT_EQ(ret, 6u);
+
+	EXPECT_EQ(cpu->pc, 0x40u);
+	EXPECT_EQ(cpu->registers[10], 0xAAAAu);
+	EXPECT_EQ(cpu->registers[1], 0x1234u);
+	EXPECT_EQ(cpu->state, CPU_STATE_RUNNING);
+}
+
+TEST_F(VmcallTest, HostSyscalls)
+{
+	const u32 args[] = { 20 };
+	int calls = 0;
+	u32 ret = 0;
+
+	ASSERT_TRUE(cpu_register_syscall(cpu, 500, plus_one, &calls));
+	ASSERT_EQ(vmcall(cpu, DOUBLE_PLUS_HOST, args, 1, BUDGET, &ret),
+		  VMCALL_OK);
+	EXPECT_EQ(ret, 41u);
+	EXPECT_EQ(calls, 1);
+
+	// Overriding a built-in (exit) and unregistering again
+	ASSERT_TRUE(cpu_register_syscall(cpu, 93, plus_one, &calls));
+	EXPECT_EQ(vmcall(cpu, EXITS, NULL, 0, BUDGET, &ret), VMCALL_HALTED);
+	EXPECT_EQ(calls, 2);
+	ASSERT_TRUE(cpu_register_syscall(cpu, 93, NULL, NULL));
+	EXPECT_EQ(cpu->nhost_syscalls, 1u);
+}
+
+TEST_F(VmcallTest, ReentersFromSyscallHandler)
+{
+	const u32 args[] = { 5 };
+	u32 ret = 0;
+
+	ASSERT_TRUE(cpu_register_syscall(cpu, 501, call_add3, NULL));
+	ASSERT_EQ(vmcall(cpu, NESTED, args, 1, BUDGET, &ret), VMCALL_OK);
+	EXPECT_EQ(ret, 5u + 10 + 20 + 1);
+}
+
+TEST_F(VmcallTest, GuestExitAndBadArguments)
+{
+	const u32 args[VMCALL_MAX_ARGS + 1] = {};
+	u32 ret = 0;
+
+	// A halted guest can still be called into
+	cpu->state = CPU_STATE_HALTED;
+	EXPECT_EQ(vmcall(cpu, EXITS, NULL, 0, BUDGET, &ret), VMCALL_HALTED);
+	EXPECT_EQ(vmcall(cpu, ADD3, args, 3, BUDGET, &ret), VMCALL_OK);
+	EXPECT_EQ(cpu->state, CPU_STATE_HALTED);
+
+	EXPECT_EQ(vmcall(cpu, ADD3, args, VMCALL_MAX_ARGS + 1, BUDGET, &ret),
+		  VMCALL_BAD_ARGS);
+	EXPECT_EQ(vmcall(cpu, ADD3 + 1, args, 0, BUDGET, &ret), VMCALL_BAD_ARGS);
+}
+
+// A guest that never returns is stopped, and left as it was
+TEST_F(VmcallTest, BudgetBoundsTheCall)
+{
+	const u32 args[] = { 0 };
+	u32 ret = 0;
+
+	cpu->pc = 0x40;
+	cpu->stop = CPU_STOP_SYSCALL;
+	cpu->resume_pc = 0x44;
+	cpu_set_priv(cpu, PRV_U);
+	ASSERT_EQ(vmcall(cpu, LOOPS, args, 1, 1000, &ret), VMCALL_BUDGET);
+	EXPECT_EQ(ret, 500u); // 1000 instructions, half of them increments
+
+	EXPECT_EQ(cpu->pc, 0x40u);
+	EXPECT_EQ(cpu->stop, CPU_STOP_SYSCALL);
+	EXPECT_EQ(cpu->resume_pc, 0x44u);
+	EXPECT_EQ(cpu->priv, (u32)PRV_U);
+	EXPECT_EQ(cpu->state, CPU_STATE_RUNNING);
+	EXPECT_EQ(cpu->break_pc, CPU_NO_BREAK);
+}
+
+TEST_F(VmcallTest, UnhandledTrapHalts)
+{
+	u32 ret = 0;
+
+	testing::internal::CaptureStdout();
+	EXPECT_EQ(vmcall(cpu, FAULTS, NULL, 0, BUDGET, &ret), VMCALL_HALTED);
+	EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+	EXPECT_EQ(cpu->trap_cause, CPU_NO_TRAP);
+	EXPECT_EQ(cpu->stop, CPU_STOP_HALT);
+	EXPECT_EQ(vmcall(cpu, ADD3, NULL, 0, BUDGET, &ret), VMCALL_OK);
+}
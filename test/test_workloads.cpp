@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <glob.h>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "cpu.h"
+}
+
+// The corpus is built by `make workloads` (it needs the RISC-V toolchain);
+// tests for images that were not built are skipped. Run from the top of
+// the tree, like `make test` does.
+static std::vector<std::string> workload_names()
+{
+	std::vector<std::string> names;
+	glob_t g;
+
+	if (glob("workloads/*.s", 0, NULL, &g) == 0) {
+		for (size_t i = 0; i < g.gl_pathc; ++i) {
+			std::string path = g.gl_pathv[i];
+
+			names.push_back(path.substr(10, path.size() - 12));
+		}
+		globfree(&g);
+	}
+	if (names.empty())
+		names.push_back("none");
+	return names;
+}
+
+// The checksum from the "# expect: 0x..." line of the source
+static bool expected_exit(const std::string &name, u32 *code)
+{
+	FILE *fp = fopen(("workloads/" + name + ".s").c_str(), "r");
+	char line[256];
+	bool found = false;
+
+	if (!fp)
+		return false;
+	while (!found && fgets(line, sizeof(line), fp)) {
+		const char *p = strstr(line, "# expect: ");
+
+		if (p) {
+			*code = strtoul(p + 10, NULL, 0);
+			found = true;
+		}
+	}
+	fclose(fp);
+	return found;
+}
+
+class WorkloadTest : public ::testing::TestWithParam<std::string> {};
+
+TEST_P(WorkloadTest, ExitsWithChecksum)
+{
+	std::string bin = "build/workloads/" + GetParam() + ".bin";
+	FILE *fp = fopen(bin.c_str(), "rb");
+	struct cpu *cpu;
+	u32 expect = 0;
+
+	if (!fp)
+		GTEST_SKIP() << bin << " not built";
+	ASSERT_TRUE(expected_exit(GetParam(), &expect));
+	cpu = cpu_create(MEM_SIZE);
+	ASSERT_NE(cpu, nullptr);
+	fread(cpu->memory, 1, cpu->mem_size, fp);
+	fclose(fp);
+
+	EXPECT_EQ(cpu_run_for(cpu, 100000000, NULL), CPU_STOP_HALT);
+	EXPECT_EQ(cpu->exit_code, expect)
+		<< std::hex << "got 0x" << cpu->exit_code;
+	cpu_destroy(cpu);
+}
+
+INSTANTIATE_TEST_SUITE_P(Corpus, WorkloadTest,
+			 ::testing::ValuesIn(workload_names()),
+			 [](const testing::TestParamInfo<std::string> &info) {
+				 return info.param;
+			 });
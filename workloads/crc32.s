@@ -0,0 +1,70 @@
+# crc32.s - table-driven CRC-32 (the zlib polynomial, reflected) over a
+# 16 KiB buffer of random bytes, taken four times in a row. The table is
+# built first, bit by bit. Exits with zlib.crc32() of the buffer repeated
+# four times.
+# expect: 0xa687efa0
+
+	.equ LEN, 16384
+	.equ PASSES, 4
+	.equ TABLE, 0x4000		# 256 words
+	.equ BUF, 0x5000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+
+	# table[n] = n shifted out 8 times through the polynomial
+	li	t0, TABLE
+	li	t1, 0
+	li	t2, 256
+	li	t3, 0xedb88320
+1:	mv	a0, t1
+	li	a1, 8
+2:	andi	a2, a0, 1
+	srli	a0, a0, 1
+	beqz	a2, 3f
+	xor	a0, a0, t3
+3:	addi	a1, a1, -1
+	bnez	a1, 2b
+	sw	a0, 0(t0)
+	addi	t0, t0, 4
+	addi	t1, t1, 1
+	blt	t1, t2, 1b
+
+	# Random bytes from an LCG
+	li	s0, 11
+	li	s1, 1103515245
+	li	s2, 12345
+	li	t0, BUF
+	li	t1, LEN
+4:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srli	a0, s0, 16
+	sb	a0, 0(t0)
+	addi	t0, t0, 1
+	addi	t1, t1, -1
+	bnez	t1, 4b
+
+	li	a0, -1			# crc
+	li	s3, TABLE
+	li	s4, PASSES
+pass:
+	li	t0, BUF
+	li	t1, BUF + LEN
+5:	lbu	a1, 0(t0)
+	xor	a1, a1, a0
+	andi	a1, a1, 0xff
+	slli	a1, a1, 2
+	add	a1, a1, s3
+	lw	a1, 0(a1)
+	srli	a0, a0, 8
+	xor	a0, a0, a1
+	addi	t0, t0, 1
+	bltu	t0, t1, 5b
+	addi	s4, s4, -1
+	bnez	s4, pass
+
+	not	a0, a0
+	li	a7, 93
+	ecall
@@ -0,0 +1,87 @@
+# dsp.s - integer DSP kernel: a 16-tap Q15 FIR filter with saturation,
+# run over 1024 samples of noise, ping-ponging between two buffers for
+# 16 passes. Exits with a checksum of every output sample.
+# expect: 0xf46e2694
+
+	.equ NSAMP, 1024
+	.equ NTAPS, 16
+	.equ PASSES, 16
+	.equ BUF_A, 0x8000		# NSAMP halfwords each
+	.equ BUF_B, 0x9000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+
+	# Fill the first buffer with 16-bit noise from an LCG
+	li	t0, BUF_A
+	li	t1, NSAMP
+	li	s0, 1
+	li	s1, 1103515245
+	li	s2, 12345
+1:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srai	t2, s0, 16
+	sh	t2, 0(t0)
+	addi	t0, t0, 2
+	addi	t1, t1, -1
+	bnez	t1, 1b
+
+	li	s3, 0			# checksum
+	li	s4, PASSES
+	li	s6, BUF_A		# input
+	li	s7, BUF_B		# output
+	li	s8, 32767
+	li	s9, -32768
+pass:
+	# y[n] = sat16(sum(h[k] * x[n - k]) >> 15) for n >= NTAPS - 1
+	li	s5, NTAPS - 1
+fir:
+	slli	t0, s5, 1
+	add	t0, t0, s6		# &x[n]
+	la	t1, coeffs
+	li	t2, NTAPS
+	li	a0, 0
+tap:
+	lh	a1, 0(t0)
+	lh	a2, 0(t1)
+	mul	a1, a1, a2
+	add	a0, a0, a1
+	addi	t0, t0, -2
+	addi	t1, t1, 2
+	addi	t2, t2, -1
+	bnez	t2, tap
+	srai	a0, a0, 15
+	ble	a0, s8, 2f
+	mv	a0, s8
+2:	bge	a0, s9, 3f
+	mv	a0, s9
+3:	slli	t0, s5, 1
+	add	t0, t0, s7
+	sh	a0, 0(t0)
+	# checksum = rotl(checksum, 5) ^ y
+	slli	a1, s3, 5
+	srli	a2, s3, 27
+	or	s3, a1, a2
+	xor	s3, s3, a0
+	addi	s5, s5, 1
+	li	t0, NSAMP
+	blt	s5, t0, fir
+
+	# The output feeds the next pass
+	mv	t0, s6
+	mv	s6, s7
+	mv	s7, t0
+	addi	s4, s4, -1
+	bnez	s4, pass
+
+	mv	a0, s3
+	li	a7, 93
+	ecall
+
+	.data
+	.align 1
+coeffs:	# a symmetric low-pass, gain about 1.6 so the output saturates
+	.half 410, 1020, 1870, 2890, 3900, 4760, 5320, 5520
+	.half 5520, 5320, 4760, 3900, 2890, 1870, 1020, 410
@@ -0,0 +1,83 @@
+# hash.s - Murmur3-style hashing and word-at-a-time byte scanning over a
+# 16 KiB buffer of random bytes, eight passes with a different seed each,
+# written for Zba/Zbb/Zbs: rotates, shift-and-add, orc.b and cpop to count
+# the non-zero bytes of each word, maxu and bexti. Exits with a checksum
+# of the hashes and counts.
+# expect: 0x8645eb48
+
+	.equ LEN, 16384
+	.equ PASSES, 8
+	.equ BUF, 0x4000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+
+	# Random bytes in 0..63 from an LCG, so about one in 64 is zero
+	li	s0, 17
+	li	s1, 1103515245
+	li	s2, 12345
+	li	t0, BUF
+	li	t1, LEN
+1:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srli	a0, s0, 26
+	sb	a0, 0(t0)
+	addi	t0, t0, 1
+	addi	t1, t1, -1
+	bnez	t1, 1b
+
+	li	s3, 0xcc9e2d51		# c1
+	li	s4, 0x1b873593		# c2
+	li	s5, 0xe6546b64
+	li	s6, BUF
+	li	s7, 0			# checksum
+	li	s8, 0			# non-zero byte bits
+	li	s9, 0			# words whose low byte has bit 5 set
+	li	s10, 0			# largest word
+	li	s11, PASSES
+pass:
+	mv	a0, s11			# h = seed
+	li	t1, 0			# word index
+	li	t2, LEN / 4
+2:	sh2add	t0, t1, s6
+	lw	a1, 0(t0)
+	orc.b	a2, a1
+	cpop	a2, a2
+	add	s8, s8, a2
+	bexti	a3, a1, 5
+	add	s9, s9, a3
+	maxu	s10, s10, a1
+	mul	a1, a1, s3
+	rori	a1, a1, 17
+	mul	a1, a1, s4
+	xor	a0, a0, a1
+	rori	a0, a0, 19
+	sh2add	a0, a0, a0
+	add	a0, a0, s5
+	addi	t1, t1, 1
+	bltu	t1, t2, 2b
+
+	# fmix32
+	srli	a1, a0, 16
+	xor	a0, a0, a1
+	li	a1, 0x85ebca6b
+	mul	a0, a0, a1
+	srli	a1, a0, 13
+	xor	a0, a0, a1
+	li	a1, 0xc2b2ae35
+	mul	a0, a0, a1
+	srli	a1, a0, 16
+	xor	a0, a0, a1
+	rev8	a0, a0
+	xnor	s7, s7, a0
+	rol	s7, s7, s11
+	addi	s11, s11, -1
+	bnez	s11, pass
+
+	xor	a0, s7, s8
+	xor	a0, a0, s9
+	add	a0, a0, s10
+	li	a7, 93
+	ecall
@@ -0,0 +1,100 @@
+# list.s - pointer chasing: 2048 list nodes linked in a shuffled order,
+# so consecutive nodes are far apart, walked 32 times. Every visit loads
+# the next pointer and bumps the node's value. Exits with a checksum of
+# the values seen, in order.
+# expect: 0xc7535ec0
+
+	.equ N, 2048
+	.equ LAPS, 32
+	.equ NODES, 0x4000		# N nodes of { next, value }
+	.equ PERM, 0x8000		# N words, the visiting order
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+	li	s1, 1103515245
+	li	s2, 12345
+
+	# perm[i] = i
+	li	t0, PERM
+	li	t1, 0
+	li	t2, N
+1:	sw	t1, 0(t0)
+	addi	t0, t0, 4
+	addi	t1, t1, 1
+	blt	t1, t2, 1b
+
+	# Fisher-Yates shuffle with an LCG
+	li	s0, 7
+	li	s3, PERM
+	li	t1, N - 1
+2:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srli	t2, s0, 8
+	addi	t3, t1, 1
+	remu	t2, t2, t3		# j in [0, i]
+	slli	t4, t1, 2
+	add	t4, t4, s3
+	slli	t5, t2, 2
+	add	t5, t5, s3
+	lw	a0, 0(t4)
+	lw	a1, 0(t5)
+	sw	a1, 0(t4)
+	sw	a0, 0(t5)
+	addi	t1, t1, -1
+	bnez	t1, 2b
+
+	# Link node perm[i] to node perm[i + 1]; value = 3 * index + 1
+	li	s4, NODES
+	li	t0, PERM
+	li	t1, N - 1
+3:	lw	a0, 0(t0)
+	lw	a1, 4(t0)
+	slli	a2, a0, 3
+	add	a2, a2, s4
+	slli	a3, a1, 3
+	add	a3, a3, s4
+	sw	a3, 0(a2)
+	slli	a4, a0, 1
+	add	a4, a4, a0
+	addi	a4, a4, 1
+	sw	a4, 4(a2)
+	addi	t0, t0, 4
+	addi	t1, t1, -1
+	bnez	t1, 3b
+	# The last node ends the list
+	lw	a0, 0(t0)
+	slli	a2, a0, 3
+	add	a2, a2, s4
+	sw	zero, 0(a2)
+	slli	a4, a0, 1
+	add	a4, a4, a0
+	addi	a4, a4, 1
+	sw	a4, 4(a2)
+
+	# Walk: sum = sum * 31 + value, value += 1
+	li	t0, PERM
+	lw	a0, 0(t0)
+	slli	s5, a0, 3
+	add	s5, s5, s4		# head
+	li	s6, 0			# sum
+	li	s7, 0			# nodes visited
+	li	s8, LAPS
+	li	s9, 31
+lap:
+	mv	t0, s5
+4:	lw	t1, 4(t0)
+	mul	s6, s6, s9
+	add	s6, s6, t1
+	addi	t1, t1, 1
+	sw	t1, 4(t0)
+	addi	s7, s7, 1
+	lw	t0, 0(t0)
+	bnez	t0, 4b
+	addi	s8, s8, -1
+	bnez	s8, lap
+
+	xor	a0, s6, s7
+	li	a7, 93
+	ecall
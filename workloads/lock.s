@@ -0,0 +1,65 @@
+# lock.s - atomics: 100000 rounds of a test-and-set spinlock (amoswap
+# with acquire/release ordering) around a plain counter, an LR/SC
+# increment loop, and amoadd/amoxor/amomax statistics updates. Exits with
+# a checksum of the shared words.
+# expect: 0x680bafe3
+
+	.equ ROUNDS, 100000
+	.equ SHARED, 0x4000
+	.equ LOCK, 0			# offsets into SHARED
+	.equ COUNT, 4
+	.equ LLSC, 8
+	.equ SUM, 12
+	.equ MIX, 16
+	.equ MAX, 20
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+	li	s0, SHARED
+	addi	s1, s0, LLSC
+	addi	s2, s0, SUM
+	addi	s3, s0, MIX
+	addi	s4, s0, MAX
+	li	s5, ROUNDS
+	li	s6, 1103515245
+	li	s7, 1			# LCG state
+round:
+	# Spinlock around a non-atomic increment
+	li	t0, 1
+1:	amoswap.w.aq t1, t0, (s0)
+	bnez	t1, 1b
+	lw	t2, COUNT(s0)
+	addi	t2, t2, 1
+	sw	t2, COUNT(s0)
+	amoswap.w.rl zero, zero, (s0)
+
+	# LR/SC increment
+2:	lr.w	t3, (s1)
+	addi	t3, t3, 3
+	sc.w	t4, t3, (s1)
+	bnez	t4, 2b
+
+	# Statistics
+	mul	s7, s7, s6
+	addi	s7, s7, 1
+	srli	t5, s7, 20
+	amoadd.w zero, t5, (s2)
+	amoxor.w zero, s7, (s3)
+	amomax.w zero, s7, (s4)
+
+	addi	s5, s5, -1
+	bnez	s5, round
+
+	lw	a0, COUNT(s0)
+	lw	t0, LLSC(s0)
+	add	a0, a0, t0
+	lw	t0, SUM(s0)
+	xor	a0, a0, t0
+	lw	t0, MIX(s0)
+	add	a0, a0, t0
+	lw	t0, MAX(s0)
+	xor	a0, a0, t0
+	li	a7, 93
+	ecall
@@ -0,0 +1,79 @@
+# matmul.s - 24x24 integer matrix multiply, C = A * B, with row-major
+# operands and the inner loop striding down B's columns. Eight rounds,
+# each with a fresh A. Exits with a checksum of every element of C.
+# expect: 0xd75a601b
+
+	.equ N, 24
+	.equ ROUNDS, 8
+	.equ MAT_A, 0x4000		# N * N words each
+	.equ MAT_B, 0x5000
+	.equ MAT_C, 0x6000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+	li	s0, 5			# LCG state
+	li	s1, 1103515245
+	li	s2, 12345
+	li	s3, 0			# checksum
+
+	# B, and A in every round, hold small signed values
+	li	a0, MAT_B
+	call	fill
+	li	s4, ROUNDS
+round:
+	li	a0, MAT_A
+	call	fill
+
+	li	s5, MAT_A		# row i of A
+	li	s6, MAT_C		# C[i][0]
+	li	s7, N
+row:
+	li	s8, MAT_B		# column j of B
+	li	s9, N
+col:
+	mv	t0, s5
+	mv	t1, s8
+	li	t2, N
+	li	a0, 0
+1:	lw	a1, 0(t0)
+	lw	a2, 0(t1)
+	mul	a1, a1, a2
+	add	a0, a0, a1
+	addi	t0, t0, 4
+	addi	t1, t1, 4 * N
+	addi	t2, t2, -1
+	bnez	t2, 1b
+	sw	a0, 0(s6)
+	# checksum = rotl(checksum, 7) + c
+	slli	a1, s3, 7
+	srli	a2, s3, 25
+	or	s3, a1, a2
+	add	s3, s3, a0
+	addi	s6, s6, 4
+	addi	s8, s8, 4
+	addi	s9, s9, -1
+	bnez	s9, col
+	addi	s5, s5, 4 * N
+	addi	s7, s7, -1
+	bnez	s7, row
+
+	addi	s4, s4, -1
+	bnez	s4, round
+
+	mv	a0, s3
+	li	a7, 93
+	ecall
+
+# Fill the N x N matrix at a0 with values in [-128, 127]
+fill:
+	li	t0, N * N
+2:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srai	t1, s0, 24
+	sw	t1, 0(a0)
+	addi	a0, a0, 4
+	addi	t0, t0, -1
+	bnez	t0, 2b
+	ret
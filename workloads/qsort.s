@@ -0,0 +1,93 @@
+# qsort.s - recursive quicksort (Lomuto partition) of 2048 random signed
+# words, four rounds with different data. Exits with a position-weighted
+# sum of each sorted array, spoiled if any array is out of order.
+# expect: 0xcd2a8102
+
+	.equ N, 2048
+	.equ ROUNDS, 4
+	.equ ARR, 0x4000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+	li	s0, 3			# LCG state
+	li	s1, 1103515245
+	li	s2, 12345
+	li	s3, 0			# checksum
+	li	s4, ROUNDS
+round:
+	li	t0, ARR
+	li	t1, N
+1:	mul	s0, s0, s1
+	add	s0, s0, s2
+	sw	s0, 0(t0)
+	addi	t0, t0, 4
+	addi	t1, t1, -1
+	bnez	t1, 1b
+
+	li	a0, ARR
+	li	a1, ARR + 4 * (N - 1)
+	call	qsort
+
+	# checksum += a[i] * (i + 1); a[i] < a[i - 1] spoils it
+	li	t0, ARR
+	li	t1, 1
+	li	t2, N
+	lw	t3, 0(t0)
+2:	lw	t4, 0(t0)
+	bge	t4, t3, 3f
+	li	t5, 0x5bad5bad
+	xor	s3, s3, t5
+3:	mul	t5, t4, t1
+	add	s3, s3, t5
+	mv	t3, t4
+	addi	t0, t0, 4
+	addi	t1, t1, 1
+	ble	t1, t2, 2b
+
+	addi	s4, s4, -1
+	bnez	s4, round
+
+	mv	a0, s3
+	li	a7, 93
+	ecall
+
+# Sort the words from a0 to a1 inclusive
+qsort:
+	bgeu	a0, a1, 9f
+	addi	sp, sp, -16
+	sw	ra, 12(sp)
+	sw	s0, 8(sp)
+	sw	s1, 4(sp)
+	sw	s2, 0(sp)
+	mv	s0, a0
+	mv	s1, a1
+	lw	t0, 0(s1)		# pivot
+	mv	t1, s0			# next slot for a smaller element
+	mv	t2, s0
+4:	bgeu	t2, s1, 6f
+	lw	t3, 0(t2)
+	bge	t3, t0, 5f
+	lw	t4, 0(t1)
+	sw	t3, 0(t1)
+	sw	t4, 0(t2)
+	addi	t1, t1, 4
+5:	addi	t2, t2, 4
+	j	4b
+6:	lw	t4, 0(t1)		# pivot into place
+	sw	t0, 0(t1)
+	sw	t4, 0(s1)
+	mv	s2, t1
+	mv	a0, s0
+	addi	a1, s2, -4
+	call	qsort
+	addi	a0, s2, 4
+	mv	a1, s1
+	call	qsort
+	lw	ra, 12(sp)
+	lw	s0, 8(sp)
+	lw	s1, 4(sp)
+	lw	s2, 0(sp)
+	addi	sp, sp, 16
+9:	ret
@@ -0,0 +1,144 @@
+# string.s - C string and memory kernels: 256 random strings over a small
+# alphabet (so comparisons run deep) go through strlen, an unaligned
+# byte-wise memcpy and strcmp against their neighbour, over a buffer that
+# a word-wise memset clears first. Sixteen passes. Exits with a checksum
+# of the lengths, the comparison results and the final buffer contents.
+# expect: 0xe7fb25d8
+
+	.equ NSTR, 256
+	.equ PASSES, 16
+	.equ STRS, 0x4000		# packed NUL-terminated strings
+	.equ DST, 0x9000		# 4 KiB
+	.equ PTRS, 0xa000		# NSTR string pointers
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+	li	s0, 13			# LCG state
+	li	s1, 1103515245
+	li	s2, 12345
+
+	# Strings of 1 to 48 letters from "abcd"
+	li	t0, STRS
+	li	t1, PTRS
+	li	t2, NSTR
+1:	sw	t0, 0(t1)
+	addi	t1, t1, 4
+	mul	s0, s0, s1
+	add	s0, s0, s2
+	srli	t3, s0, 24
+	li	t4, 48
+	remu	t3, t3, t4
+	addi	t3, t3, 1
+2:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srli	t4, s0, 16
+	andi	t4, t4, 3
+	addi	t4, t4, 'a'
+	sb	t4, 0(t0)
+	addi	t0, t0, 1
+	addi	t3, t3, -1
+	bnez	t3, 2b
+	sb	zero, 0(t0)
+	addi	t0, t0, 1
+	addi	t2, t2, -1
+	bnez	t2, 1b
+
+	li	s3, 0			# checksum
+	li	s4, 0			# pass
+pass:
+	li	a0, DST
+	addi	a1, s4, 1
+	li	a2, 4096
+	call	memset
+
+	li	s5, 0			# string index
+str:
+	slli	t0, s5, 2
+	li	t1, PTRS
+	add	s6, t0, t1		# &ptrs[i]
+	lw	a0, 0(s6)
+	call	strlen
+	mv	s7, a0
+	# memcpy(DST + (i * 13 & 0x7ff), s, n + 1)
+	li	t0, 13
+	mul	a0, s5, t0
+	andi	a0, a0, 0x7ff
+	li	t0, DST
+	add	a0, a0, t0
+	lw	a1, 0(s6)
+	addi	a2, s7, 1
+	call	memcpy
+	beqz	s5, 3f
+	lw	a0, 0(s6)
+	lw	a1, -4(s6)
+	call	strcmp
+	xor	s7, s7, a0
+3:	# checksum = rotl(checksum, 3) ^ n ^ cmp
+	slli	t0, s3, 3
+	srli	t1, s3, 29
+	or	s3, t0, t1
+	xor	s3, s3, s7
+	addi	s5, s5, 1
+	li	t0, NSTR
+	blt	s5, t0, str
+
+	# Fold in the buffer
+	li	t0, DST
+	li	t1, DST + 4096
+4:	lw	t2, 0(t0)
+	add	s3, s3, t2
+	addi	t0, t0, 4
+	bltu	t0, t1, 4b
+
+	addi	s4, s4, 1
+	li	t0, PASSES
+	blt	s4, t0, pass
+
+	mv	a0, s3
+	li	a7, 93
+	ecall
+
+# memset(a0, a1, a2): word stores, a0 and a2 word-aligned
+memset:
+	andi	a1, a1, 0xff
+	li	t0, 0x01010101
+	mul	a1, a1, t0
+	add	a2, a2, a0
+5:	sw	a1, 0(a0)
+	addi	a0, a0, 4
+	bltu	a0, a2, 5b
+	ret
+
+# memcpy(a0, a1, a2): byte copy, any alignment
+memcpy:
+	beqz	a2, 7f
+6:	lbu	t0, 0(a1)
+	sb	t0, 0(a0)
+	addi	a0, a0, 1
+	addi	a1, a1, 1
+	addi	a2, a2, -1
+	bnez	a2, 6b
+7:	ret
+
+# strlen(a0)
+strlen:
+	mv	t0, a0
+8:	lbu	t1, 0(t0)
+	addi	t0, t0, 1
+	bnez	t1, 8b
+	sub	a0, t0, a0
+	addi	a0, a0, -1
+	ret
+
+# strcmp(a0, a1): difference of the first differing bytes
+strcmp:
+9:	lbu	t0, 0(a0)
+	lbu	t1, 0(a1)
+	bne	t0, t1, 10f
+	addi	a0, a0, 1
+	addi	a1, a1, 1
+	bnez	t0, 9b
+10:	sub	a0, t0, t1
+	ret
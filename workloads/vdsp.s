@@ -0,0 +1,95 @@
+# vdsp.s - the FIR filter of dsp.s written for Zve32x: 16 taps over 1024
+# samples of noise for 16 passes, strip-mined over the outputs at e32 with
+# LMUL 4, a vmacc.vx per tap and vmin/vmax for the saturation. Samples are
+# words rather than halfwords (there is no widening multiply), so the
+# checksum of every output sample is the one dsp.s computes.
+# expect: 0xf46e2694
+
+	.equ NSAMP, 1024
+	.equ NTAPS, 16
+	.equ PASSES, 16
+	.equ BUF_A, 0x8000		# NSAMP words each
+	.equ BUF_B, 0x9000
+
+	.text
+	.globl _start
+_start:
+	li	sp, 0x10000
+
+	# Fill the first buffer with 16-bit noise from an LCG
+	li	t0, BUF_A
+	li	t1, NSAMP
+	li	s0, 1
+	li	s1, 1103515245
+	li	s2, 12345
+1:	mul	s0, s0, s1
+	add	s0, s0, s2
+	srai	t2, s0, 16
+	sw	t2, 0(t0)
+	addi	t0, t0, 4
+	addi	t1, t1, -1
+	bnez	t1, 1b
+
+	li	s3, 0			# checksum
+	li	s4, PASSES
+	li	s6, BUF_A		# input
+	li	s7, BUF_B		# output
+	li	s8, 32767
+	li	s9, -32768
+pass:
+	# y[n..n+vl) = sat16(sum(h[k] * x[n-k..n-k+vl)) >> 15), n >= NTAPS - 1
+	li	s5, NTAPS - 1
+fir:
+	li	t0, NSAMP
+	sub	t0, t0, s5
+	vsetvli	t1, t0, e32, m4, ta, ma
+	vmv.v.i	v8, 0
+	slli	t2, s5, 2
+	add	t2, t2, s6		# &x[n]
+	la	t3, coeffs
+	li	t4, NTAPS
+tap:
+	lw	a1, 0(t3)
+	vle32.v	v4, (t2)
+	vmacc.vx v8, a1, v4
+	addi	t2, t2, -4
+	addi	t3, t3, 4
+	addi	t4, t4, -1
+	bnez	t4, tap
+	vsra.vi	v8, v8, 15
+	vmin.vx	v8, v8, s8
+	vmax.vx	v8, v8, s9
+	slli	t2, s5, 2
+	add	t2, t2, s7
+	vse32.v	v8, (t2)
+	add	s5, s5, t1
+	li	t0, NSAMP
+	blt	s5, t0, fir
+
+	# checksum = rotl(checksum, 5) ^ y, in sample order
+	li	t0, (NTAPS - 1) * 4
+	add	t0, t0, s7
+	li	t1, NSAMP * 4
+	add	t1, t1, s7
+2:	lw	a0, 0(t0)
+	rori	s3, s3, 27
+	xor	s3, s3, a0
+	addi	t0, t0, 4
+	bltu	t0, t1, 2b
+
+	# The output feeds the next pass
+	mv	t0, s6
+	mv	s6, s7
+	mv	s7, t0
+	addi	s4, s4, -1
+	bnez	s4, pass
+
+	mv	a0, s3
+	li	a7, 93
+	ecall
+
+	.data
+	.align 2
+coeffs:	# a symmetric low-pass, gain about 1.6 so the output saturates
+	.word 410, 1020, 1870, 2890, 3900, 4760, 5320, 5520
+	.word 5520, 5320, 4760, 3900, 2890, 1870, 1020, 410